@@ -73,3 +73,34 @@ String *String_alloc(size_t length) {
 	p->length = length;
 	return p;
 }
+
+/* Objects that live as long as the program and never move, such as string
+ * literals. They come from malloc'd chunks outside the collected heap, which
+ * the collectors neither mark, move nor free. Each thread fills its own chunk.
+ */
+static const size_t IMMORTAL_CHUNK_SIZE = 64 * 1024;
+static __thread void *immortal_next = NULL;
+static __thread void *immortal_end = NULL;
+
+static heap_object *immortal_alloc(object_metadata *metadata, size_t size) {
+	size = align_to_word_boundary(size);
+	if ( immortal_next==NULL || immortal_next + size > immortal_end ) {
+		size_t n = size > IMMORTAL_CHUNK_SIZE ? size : IMMORTAL_CHUNK_SIZE;
+		immortal_next = calloc(1, n);
+		immortal_end = immortal_next + n;
+	}
+	heap_object *p = immortal_next;
+	immortal_next += size;
+	p->metadata = metadata;
+	p->size = (uint32_t)size;
+#if defined(MARK_AND_COMPACT) || defined(SCAVENGER)
+	p->forwarded = p;	// in case anything asks where it went
+#endif
+	return p;
+}
+
+String *String_alloc_immortal(size_t length) {
+	String *p = (String *)immortal_alloc(&String_metadata, sizeof(String) + (length+1) * sizeof(char));
+	p->length = length;
+	return p;
+}
@@ -73,12 +73,24 @@ static inline size_t request2size(size_t n) {
 	return align_to_word_boundary(size_with_header(n));
 }
 
-/* Initialize a heap with a certain size for use with the garbage collector */
+/* A heap and its roots. All the functions below work on the calling thread's
+ * current heap, which the first of them used on a thread creates, so threads
+ * that allocate from different heaps share no collector state.
+ */
+typedef struct gc_heap Heap;
+
+/* Initialize the current heap with a certain size for use with the garbage collector */
 extern void gc_init(int size);
 
-/* Announce you are done with the heap managed by the garbage collector */
+/* Announce you are done with the current heap managed by the garbage collector */
 extern void gc_shutdown();
 
+/* Create a heap without making it current; e.g., one per VM */
+extern Heap *gc_heap_new(int size);
+extern void gc_heap_free(Heap *h);
+extern Heap *gc_get_heap();
+extern void gc_set_heap(Heap *h);
+
 /* Perform a mark_and_compact garbage collection, moving all live objects
  * to the start of the heap.
  */
@@ -41,17 +41,24 @@ static bool DEBUG = false;
 
 static const int MAX_ROOTS = 100000; // obviously this is ok only for the educational purpose of this code
 
-/* Track every pointer into the heap; includes globals, args, and locals */
-static heap_object **_roots[MAX_ROOTS];
+/* Everything about one heap. Each thread allocates from its own current heap
+ * so threads with different heaps share nothing here.
+ */
+struct gc_heap {
+	/* Track every pointer into the heap; includes globals, args, and locals */
+	heap_object **roots[MAX_ROOTS];
+
+	/* index of next free space in roots for a root */
+	int num_roots;
 
-/* index of next free space in _roots for a root */
-static int num_roots = 0;
+	size_t heap_size;
+	void *heap;
+	void *end_of_heap;
+	void *next_free;
+	void *next_free_forwarding; // next_free used during forwarding address computation
+};
 
-static size_t heap_size;
-static void *heap;
-static void *end_of_heap;
-static void *next_free;
-static void *next_free_forwarding; // next_free used during forwarding address computation
+static __thread Heap *current;
 
 
 // --------------------------------- G C  I n i t  &  R o o t  M g m t ---------------------------------
@@ -60,33 +67,61 @@ void gc_debug(bool debug) { DEBUG = debug; }
 
 /* Initialize a heap with a certain size for use with the garbage collector */
 void gc_init(int size) {
-	if (heap != NULL ) { gc_shutdown(); }
-    heap_size = (size_t)size;
-    heap = morecore((size_t)size);
-    end_of_heap = heap + size - 1;
-    next_free = heap;
-    num_roots = 0;
+	if ( current==NULL ) current = calloc(1, sizeof(Heap));
+	else if (current->heap != NULL ) { gc_shutdown(); }
+    current->heap_size = (size_t)size;
+    current->heap = morecore((size_t)size);
+    current->end_of_heap = current->heap + size - 1;
+    current->next_free = current->heap;
+    current->num_roots = 0;
 }
 
 /* Announce you are done with the heap managed by the garbage collector */
 void gc_shutdown() {
-	dropcore(heap, heap_size);
+	if ( current==NULL ) return;
+	dropcore(current->heap, current->heap_size);
+}
+
+Heap *gc_heap_new(int size) {
+	Heap *saved = current;
+	current = NULL;
+	gc_init(size);
+	Heap *h = current;
+	current = saved;
+	return h;
+}
+
+void gc_heap_free(Heap *h) {
+	dropcore(h->heap, h->heap_size);
+	if ( h==current ) current = NULL;
+	free(h);
+}
+
+Heap *gc_get_heap() { return current; }
+
+void gc_set_heap(Heap *h) { current = h; }
+
+// the calling thread's heap record; the first use on a thread creates one
+static inline Heap *this_heap() {
+	if ( current==NULL ) current = calloc(1, sizeof(Heap));
+	return current;
 }
 
 void gc_add_root(void **p)
 {
-	if ( num_roots<MAX_ROOTS ) {
-		_roots[num_roots++] = (heap_object **) p;
+	Heap *h = this_heap();
+	if ( h->num_roots<MAX_ROOTS ) {
+		h->roots[h->num_roots++] = (heap_object **) p;
 	}
 }
 
 int gc_num_roots() {
-	return num_roots;
+	return this_heap()->num_roots;
 }
 
 void gc_set_num_roots(int roots)
 {
-	num_roots = roots;
+	this_heap()->num_roots = roots;
 }
 
 // --------------------------------- A l l o c a t i o n ---------------------------------
@@ -95,7 +130,7 @@ void gc_set_num_roots(int roots)
  * The object is zeroed out and the header is initialized.
  */
 heap_object *gc_alloc(object_metadata *metadata, size_t size) {
-	if (heap == NULL ) { gc_init(DEFAULT_MAX_HEAP_SIZE); }
+	if (this_heap()->heap == NULL ) { gc_init(DEFAULT_MAX_HEAP_SIZE); }
 	size = align_to_word_boundary(size);
 	heap_object *p = gc_raw_alloc(size);
 
@@ -112,15 +147,16 @@ heap_object *gc_alloc(object_metadata *metadata, size_t size) {
  *  Size must include any header size and must be word-aligned.
  */
 static void *gc_raw_alloc(size_t size) {
-	if (next_free + size > end_of_heap) {
+	Heap *h = this_heap();
+	if (h->next_free + size > h->end_of_heap) {
 		gc(); // try to collect
-		if (next_free + size > end_of_heap) { // try again
+		if (h->next_free + size > h->end_of_heap) { // try again
 			return NULL;                      // oh well, no room. puke
 		}
 	}
 
-	void *p = next_free; // bump-ptr-allocation
-	next_free += size;
+	void *p = h->next_free; // bump-ptr-allocation
+	h->next_free += size;
 	return p;
 }
 
@@ -128,8 +164,9 @@ static void *gc_raw_alloc(size_t size) {
 // --------------------------------- C o l l e c t i o n ---------------------------------
 
 static inline void realloc_object(heap_object *p) {
-	void *q = next_free_forwarding; // bump-ptr-allocation
-	next_free_forwarding += p->size;
+	Heap *h = current;
+	void *q = h->next_free_forwarding; // bump-ptr-allocation
+	h->next_free_forwarding += p->size;
 	p->forwarded = q; // p now knows where it will end up after compacting
 	if (DEBUG) if ( p->forwarded!=p ) printf("forward %p to %s@%p (0x%x bytes)\n", p, p->metadata->name, p->forwarded, p->size);
 }
@@ -154,8 +191,9 @@ static inline void move_live_objects_to_forwarding_addr(heap_object *p) {
 }
 
 bool ptr_is_in_heap(heap_object *p) {
-	return  p >= (heap_object *) heap &&
-			p <= (heap_object *) end_of_heap &&
+	return  current!=NULL &&
+			p >= (heap_object *) current->heap &&
+			p <= (heap_object *) current->end_of_heap &&
 			p->magic == MAGIC_NUMBER;
 }
 
@@ -180,6 +218,7 @@ static inline void unmark_object(heap_object *p) { p->marked = false; }
  *    we overwrite objects and could kill a forwarding address in a live object.
  */
 void gc() {
+	Heap *h = this_heap();
     if (DEBUG) printf("GC\n");
 
 	gc_mark();
@@ -188,7 +227,7 @@ void gc() {
 	// oops actually must move objects from low to high ptr addresses.
 	// reallocate all live objects starting from start_of_heap
 	if (DEBUG) printf("FORWARD\n");
-	next_free_forwarding = heap;
+	h->next_free_forwarding = h->heap;
 	foreach_live(realloc_object);  		// for each marked (live) object, record forwarding address
 
 	// make sure all roots point at new object addresses
@@ -203,29 +242,32 @@ void gc() {
 	foreach_object(move_live_objects_to_forwarding_addr); // also visits the dead to wack p->magic
 
 	// reset highwater mark *after* we've moved everything around; foreach_object() uses next_free
-	next_free = next_free_forwarding;	// next object to be allocated would occur here
+	h->next_free = h->next_free_forwarding;	// next object to be allocated would occur here
 
 	if (DEBUG) printf("DONE GC\n");
 }
 
-/* Alter roots to point at new location of live objects (compacted) */
+/* Alter roots to point at new location of live objects (compacted);
+ * objects outside the heap, such as immortal string literals, stay put.
+ */
 static void update_roots() {
+	Heap *h = current;
 	if (DEBUG) printf("UPDATE ROOTS\n");
-	for (int i = 0; i < num_roots; i++) {
-		heap_object *p = *_roots[i];
-		if ( p!=NULL ) {
+	for (int i = 0; i < h->num_roots; i++) {
+		heap_object *p = *h->roots[i];
+		if ( p!=NULL && ptr_is_in_heap(p) ) {
 			if (DEBUG) {
 				if (p->forwarded != p) {
 					printf("move root[%d]=%p -> %s@%p (0x%x bytes) to %p\n",
 					       i,
-					       _roots[i],
+					       h->roots[i],
 					       p->metadata->name,
 					       p,
 					       p->size,
 					       p->forwarded);
 				}
 			}
-			*_roots[i] = p->forwarded;	// update root to point at new address
+			*h->roots[i] = p->forwarded;	// update root to point at new address
 		}
 	}
 }
@@ -238,7 +280,7 @@ static void update_ptr_fields(heap_object *p) {
 		void *ptr_to_ptr_field = ((void *) p) + offset_of_ptr_field;
 		heap_object **ptr_to_obj_ptr_field = (heap_object **) ptr_to_ptr_field;
 		heap_object *target_obj = *ptr_to_obj_ptr_field;
-		if (target_obj != NULL) {
+		if (target_obj != NULL && ptr_is_in_heap(target_obj)) {
 			if (DEBUG) {
 				if ( target_obj->forwarded!=target_obj ) {
 					printf("    update ptr (offset %d) from %p to %p\n",
@@ -258,16 +300,17 @@ static void update_ptr_fields(heap_object *p) {
    reachable p.
  */
 void gc_mark() {
+	Heap *h = this_heap();
 	if (DEBUG) printf("MARK\n");
-    for (int i = 0; i < num_roots; i++) {
-        heap_object *p = *_roots[i];
+    for (int i = 0; i < h->num_roots; i++) {
+        heap_object *p = *h->roots[i];
         if ( p != NULL ) {
             if ( ptr_is_in_heap(p) ) {
-	            if (DEBUG) printf("root[%d]=%p -> %s@%p (0x%x bytes)\n", i, _roots[i], p->metadata->name, p, p->size);
+	            if (DEBUG) printf("root[%d]=%p -> %s@%p (0x%x bytes)\n", i, h->roots[i], p->metadata->name, p, p->size);
 				mark_object(p);
             }
 	        else if ( DEBUG ) {
-	            if (DEBUG) printf("root[%d]=%p -> %p INVALID\n", i, _roots[i], p);
+	            if (DEBUG) printf("root[%d]=%p -> %p INVALID\n", i, h->roots[i], p);
             }
         }
     }
@@ -279,12 +322,13 @@ void gc_unmark() {
 }
 
 int gc_num_live_objects() {
+	Heap *h = this_heap();
 //	gc_unmark();
 	gc_mark();
 
 	int n = 0;
-	void *p = heap;
-	while (p >= heap && p < next_free) { // for each marked (live) object, record forwarding address
+	void *p = h->heap;
+	while (p >= h->heap && p < h->next_free) { // for each marked (live) object, record forwarding address
 		if (((heap_object *)p)->marked) {
 			n++;
 		}
@@ -310,7 +354,7 @@ static void gc_chase_ptr_fields(const heap_object *p) {// check for tracked heap
 		void *ptr_to_ptr_field = ((void *)p) + offset_of_ptr_field;
 		heap_object **ptr_to_obj_ptr_field = (heap_object **) ptr_to_ptr_field;
 		heap_object *target_obj = *ptr_to_obj_ptr_field;
-		if (target_obj != NULL) {
+		if (target_obj != NULL && ptr_is_in_heap(target_obj)) {
 			mark_object(target_obj);
 		}
 	}
@@ -323,26 +367,28 @@ static void gc_chase_ptr_fields(const heap_object *p) {// check for tracked heap
  * does not do liveness trace.
  */
 Heap_Info get_heap_info() {
-	void *p = heap;
+	Heap *h = this_heap();
+	void *p = h->heap;
 	int busy = 0;
 	int live = gc_num_live_objects();
 	int computed_busy_size = 0;
-	int busy_size = (uint32_t)(next_free - heap);
-	int free_size = (uint32_t)(end_of_heap - next_free + 1);
-	while (p >= heap && p < next_free ) { // stay inbounds, walking heap
+	int busy_size = (uint32_t)(h->next_free - h->heap);
+	int free_size = (uint32_t)(h->end_of_heap - h->next_free + 1);
+	while (p >= h->heap && p < h->next_free ) { // stay inbounds, walking heap
 		// track
 		busy++;
 		computed_busy_size += ((heap_object *)p)->size;
 		p = p + ((heap_object *)p)->size;
 	}
-	return (Heap_Info){heap, end_of_heap, next_free, (uint32_t)heap_size,
+	return (Heap_Info){h->heap, h->end_of_heap, h->next_free, (uint32_t)h->heap_size,
 	                   busy, live, computed_busy_size, 0, busy_size, free_size };
 }
 
 /* Apply function action to each marked (live) object in the heap; assumes live are marked */
 void foreach_live(void (*action)(heap_object *)) {
-	void *p = heap;
-	while (p >= heap && p < next_free) { // for each marked (live) object
+	Heap *h = this_heap();
+	void *p = h->heap;
+	while (p >= h->heap && p < h->next_free) { // for each marked (live) object
 		heap_object *_p = (heap_object *)p;
 		size_t size = _p->size;
 		if (DEBUG) {
@@ -356,8 +402,9 @@ void foreach_live(void (*action)(heap_object *)) {
 }
 
 void foreach_object(void (*action)(heap_object *)) {
-	void *p = heap;
-	while (p >= heap && p < next_free) { // for each object in the heap currently allocated
+	Heap *h = this_heap();
+	void *p = h->heap;
+	while (p >= h->heap && p < h->next_free) { // for each object in the heap currently allocated
 		size_t size = ((heap_object *)p)->size;
 		action(p);
 		p = p + size;
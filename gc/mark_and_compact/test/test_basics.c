@@ -192,6 +192,53 @@ void gc_compacts_vectors() {
 	assert_equal(gc_num_live_objects(), 0);
 }
 
+void gc_leaves_immortal_strings_alone() {
+	gc_begin_func();
+	STRING(lit);
+	STRING(s);
+	lit = String_immortal("hello");
+	PVector_alloc(10); // garbage, so s has to slide down
+	s = String_new("world");
+	String *old_s = s;
+	assert_equal(gc_num_live_objects(), 1); // the literal isn't in the heap
+
+	gc();
+	assert_equal(gc_num_live_objects(), 1);
+	assert_addr_not_equal(s, old_s);
+	assert_str_equal(s->str, "world");
+	assert_str_equal(lit->str, "hello");
+	assert_equal(lit->length, 5);
+	assert_false(ptr_is_in_heap((heap_object *)lit));
+
+	gc_end_func();
+}
+
+void heaps_are_independent() {
+	gc_begin_func();
+	STRING(mine);
+	mine = String_new("mine");
+
+	Heap *saved = gc_get_heap();
+	Heap *other = gc_heap_new(HEAP_SIZE);
+	gc_set_heap(other);
+	assert_equal(gc_num_roots(), 0);
+	STRING(theirs);
+	theirs = String_new("theirs");
+	assert_true(ptr_is_in_heap((heap_object *)theirs));
+	assert_false(ptr_is_in_heap((heap_object *)mine));
+	gc();
+	assert_equal(gc_num_live_objects(), 1);
+	assert_str_equal(theirs->str, "theirs");
+
+	gc_set_heap(saved);
+	assert_false(ptr_is_in_heap((heap_object *)theirs));
+	assert_equal(gc_num_live_objects(), 1);
+	assert_str_equal(mine->str, "mine");
+	gc_heap_free(other);
+
+	gc_end_func();
+}
+
 int main(int argc, char *argv[]) {
 	cunit_setup = setup;
 	cunit_teardown = teardown;
@@ -208,6 +255,8 @@ int main(int argc, char *argv[]) {
 	test(gc_after_single_vector_one_root_then_kill_ptr);
 	test(gc_after_single_vector_two_roots);
 	test(gc_compacts_vectors);
+	test(gc_leaves_immortal_strings_alone);
+	test(heaps_are_independent);
 
 	return 0;
 }
\ No newline at end of file
@@ -44,50 +44,85 @@ static bool DEBUG = false;
 
 static const int MAX_ROOTS = 1000;
 
-static heap_object **_roots[MAX_ROOTS];
-static int num_roots = 0;
+/* Everything about one heap. Each thread allocates from its own current heap
+ * so threads with different heaps share nothing here.
+ */
+struct gc_heap {
+    heap_object **roots[MAX_ROOTS];
+    int num_roots;
 
-static size_t heap_size;
-static void *start_of_heap;
-static void *end_of_heap;
-static void *free_list;
-static void *alloc_bump_ptr;
+    size_t heap_size;
+    void *start_of_heap;
+    void *end_of_heap;
+    void *free_list;
+    void *alloc_bump_ptr;
+};
+
+static __thread Heap *current;
 
 
 void gc_debug(bool debug) { DEBUG = debug; }
 
 /* Initialize a heap with a certain size for use with the garbage collector */
 void gc_init(int size) {
-    if ( start_of_heap!=NULL ) { gc_shutdown(); }
-    heap_size = (size_t)size;
-    start_of_heap = morecore((size_t)size);
-    end_of_heap = start_of_heap + size - 1;
-    alloc_bump_ptr = start_of_heap;
-    free_list = NULL;
-    num_roots = 0;
+    if ( current==NULL ) current = calloc(1, sizeof(Heap));
+    else if ( current->start_of_heap!=NULL ) { gc_shutdown(); }
+    current->heap_size = (size_t)size;
+    current->start_of_heap = morecore((size_t)size);
+    current->end_of_heap = current->start_of_heap + size - 1;
+    current->alloc_bump_ptr = current->start_of_heap;
+    current->free_list = NULL;
+    current->num_roots = 0;
 }
 
 void gc_shutdown() {
-    dropcore(start_of_heap, heap_size);
+    if ( current==NULL ) return;
+    dropcore(current->start_of_heap, current->heap_size);
+}
+
+Heap *gc_heap_new(int size) {
+    Heap *saved = current;
+    current = NULL;
+    gc_init(size);
+    Heap *h = current;
+    current = saved;
+    return h;
+}
+
+void gc_heap_free(Heap *h) {
+    dropcore(h->start_of_heap, h->heap_size);
+    if ( h==current ) current = NULL;
+    free(h);
+}
+
+Heap *gc_get_heap() { return current; }
+
+void gc_set_heap(Heap *h) { current = h; }
+
+// the calling thread's heap record; the first use on a thread creates one
+static inline Heap *this_heap() {
+    if ( current==NULL ) current = calloc(1, sizeof(Heap));
+    return current;
 }
 
 void gc_add_root(void **p)
 {
-    _roots[num_roots++] = (heap_object **)p;
+    Heap *h = this_heap();
+    h->roots[h->num_roots++] = (heap_object **)p;
 }
 
 int gc_num_roots() {
-    return num_roots;
+    return this_heap()->num_roots;
 }
 
 void gc_set_num_roots(int roots)
 {
-    num_roots = roots;
+    this_heap()->num_roots = roots;
 }
 
 //Allocation
 heap_object *gc_alloc(object_metadata *metadata, size_t size) {
-    if ( start_of_heap==NULL ) { gc_init(DEFAULT_MAX_HEAP_SIZE); }
+    if ( this_heap()->start_of_heap==NULL ) { gc_init(DEFAULT_MAX_HEAP_SIZE); }
     size = align_to_word_boundary(size);
     heap_object *p = gc_raw_alloc(size);
 
@@ -98,7 +133,8 @@ heap_object *gc_alloc(object_metadata *metadata, size_t size) {
 }
 
 static void *gc_raw_alloc(size_t size) {
-    if (alloc_bump_ptr + size > end_of_heap) {
+    Heap *h = this_heap();
+    if (h->alloc_bump_ptr + size > h->end_of_heap) {
         void *object = gc_alloc_from_freelist(size);
         // TODO parrt: shouldn't this return object if not null?
         if (NULL == object) {
@@ -111,15 +147,16 @@ static void *gc_raw_alloc(size_t size) {
             return object;
         }
     }
-    void *p = alloc_bump_ptr;
-    alloc_bump_ptr += size;
+    void *p = h->alloc_bump_ptr;
+    h->alloc_bump_ptr += size;
     return p;
 }
 
 
 static void *gc_alloc_from_freelist(size_t size) {
+    Heap *h = current;
 
-    heap_object *p = free_list;
+    heap_object *p = h->free_list;
     heap_object *prev = NULL;
     while (p != NULL && size != p->size && p->size < size) {
         prev = p;
@@ -138,8 +175,8 @@ static void *gc_alloc_from_freelist(size_t size) {
         nextchunk = q;
     }
     p->size = size;
-    if (p == free_list) {
-        free_list = nextchunk;
+    if (p == h->free_list) {
+        h->free_list = nextchunk;
     }
     else {
         prev->next = nextchunk;
@@ -149,11 +186,13 @@ static void *gc_alloc_from_freelist(size_t size) {
 
 
 bool ptr_is_in_heap(heap_object *p) {
-    return  p >= (heap_object *) start_of_heap &&
-            p <= (heap_object *) end_of_heap;
+    return  current!=NULL &&
+            p >= (heap_object *) current->start_of_heap &&
+            p <= (heap_object *) current->end_of_heap;
 }
 
 void gc() {
+    this_heap();
     if(DEBUG) printf("begin_mark\n");
     mark();
     if(DEBUG) printf("begin_sweep\n");
@@ -161,16 +200,17 @@ void gc() {
 }
 
 static void mark() {
-    for (int i = 0; i < num_roots; i++) {
-        if (DEBUG) printf("root[%d]=%p\n", i, _roots[i]);
-        heap_object *p = *_roots[i];
+    Heap *h = current;
+    for (int i = 0; i < h->num_roots; i++) {
+        if (DEBUG) printf("root[%d]=%p\n", i, h->roots[i]);
+        heap_object *p = *h->roots[i];
         if (p != NULL) {
             if (ptr_is_in_heap(p)) {
                 mark_object(p);
             }
         }
         else if ( DEBUG ) {
-            if (DEBUG) printf("root[%d]=%p -> %p INVALID\n", i, _roots[i], p);
+            if (DEBUG) printf("root[%d]=%p -> %p INVALID\n", i, h->roots[i], p);
         }
     }
 }
@@ -191,17 +231,18 @@ static void gc_chase_ptr_fields(const heap_object *p) {
         void *ptr_to_ptr_field = ((void *)p) + offset_of_ptr_field;
         heap_object **ptr_to_obj_ptr_field = (heap_object **) ptr_to_ptr_field;
         heap_object *target_obj = *ptr_to_obj_ptr_field;
-        if (target_obj != NULL) {
+        if (target_obj != NULL && ptr_is_in_heap(target_obj)) {
             mark_object(target_obj);
         }
     }
 }
 
 int gc_num_live_objects() {
+    Heap *h = this_heap();
     mark();
     int n = 0;
-    void *p = start_of_heap;
-    while (p >= start_of_heap && p < alloc_bump_ptr) {
+    void *p = h->start_of_heap;
+    while (p >= h->start_of_heap && p < h->alloc_bump_ptr) {
         if (((heap_object *)p)->marked) {
             n++;
         }
@@ -215,8 +256,9 @@ int gc_num_live_objects() {
 static void unmark_object(heap_object *p) { p->marked = false; }
 
 static void sweep() {
-    void *p = start_of_heap;
-    while (p >= start_of_heap && p < alloc_bump_ptr) {
+    Heap *h = current;
+    void *p = h->start_of_heap;
+    while (p >= h->start_of_heap && p < h->alloc_bump_ptr) {
         heap_object * o = ((heap_object *)p);
         if (o->marked) {
             unmark_object(o);
@@ -230,10 +272,11 @@ static void sweep() {
 }
 
 static void free_object(heap_object *p) {
+    Heap *h = current;
     // todo: parrt says shouldn't we be wiping free list each time? This is insanely slow O(n^2)
     if (!already_in_freelist(p)){
-        p->next = free_list;
-        free_list = p;
+        p->next = h->free_list;
+        h->free_list = p;
         if (DEBUG) {
             printf("sweep object@%p\n", p);
         }
@@ -241,7 +284,7 @@ static void free_object(heap_object *p) {
 }
 
 static bool already_in_freelist(heap_object *p) {
-    heap_object * ptr = free_list;
+    heap_object * ptr = current->free_list;
     while (ptr != NULL) {
         if (p == ptr) {
             return true;
@@ -252,13 +295,14 @@ static bool already_in_freelist(heap_object *p) {
 }
 
 Heap_Info get_heap_info() {
-    void *p = start_of_heap;
+    Heap *h = this_heap();
+    void *p = h->start_of_heap;
     int busy = 0;
     int live = gc_num_live_objects();
     int computed_busy_size = 0; //size of chunks was allocated
     int computed_free_size = 0;
 
-    while ( p>=start_of_heap && p<alloc_bump_ptr ) { // stay inbounds, walking heap
+    while ( p>=h->start_of_heap && p<h->alloc_bump_ptr ) { // stay inbounds, walking heap
 
         if (already_in_freelist((heap_object *)p)) {
             computed_free_size += ((heap_object *)p)->size;
@@ -269,15 +313,16 @@ Heap_Info get_heap_info() {
         }
         p = p + ((heap_object *)p)->size;
     }
-    computed_free_size += (uint32_t)(end_of_heap - alloc_bump_ptr + 1);
+    computed_free_size += (uint32_t)(h->end_of_heap - h->alloc_bump_ptr + 1);
 
-    return (Heap_Info){ start_of_heap, end_of_heap, alloc_bump_ptr,(uint32_t)heap_size,
+    return (Heap_Info){ h->start_of_heap, h->end_of_heap, h->alloc_bump_ptr,(uint32_t)h->heap_size,
                         busy, live, computed_busy_size, computed_free_size,computed_busy_size,computed_free_size};
 }
 
 void foreach_object(void (*action)(heap_object *)) {
-    void *p = start_of_heap;
-    while (p >= start_of_heap && p < alloc_bump_ptr) { // for each object in the heap currently allocated
+    Heap *h = this_heap();
+    void *p = h->start_of_heap;
+    while (p >= h->start_of_heap && p < h->alloc_bump_ptr) { // for each object in the heap currently allocated
         size_t size = ((heap_object *)p)->size;
         action(p);
         p = p + size;
@@ -40,19 +40,26 @@ static bool DEBUG = false;
 
 static const int MAX_ROOTS = 100000;
 
-/* Track every pointer into the heap; includes globals, args, and locals */
-static heap_object **_roots[MAX_ROOTS];
+/* Everything about one pair of heaps. Each thread allocates from its own
+ * current heap so threads with different heaps share nothing here.
+ */
+struct gc_heap {
+	/* Track every pointer into the heap; includes globals, args, and locals */
+	heap_object **roots[MAX_ROOTS];
+
+	/* index of next free space in roots for a root */
+	int num_roots;
 
-/* index of next free space in _roots for a root */
-static int num_roots = 0;
+	size_t heap_size;
+	void *heap_0;  // the heap where alloc happens
+	void *end_of_heap_0;
+	void *next_free;
+	void *heap_1;  // the heap where live objects are copied to
+	void *end_of_heap_1;
+	void *next_free_forwarding; // next_free in heap_1
+};
 
-static size_t heap_size;
-static void *heap_0;  // the heap where alloc happens
-static void *end_of_heap_0;
-static void *next_free;
-static void *heap_1;  // the heap where live objects are copied to
-static void *end_of_heap_1;
-static void *next_free_forwarding; // next_free in heap_1
+static __thread Heap *current;
 
 
 // --------------------------------- G C  I n i t  &  R o o t  M g m t ---------------------------------
@@ -61,54 +68,84 @@ void gc_debug(bool debug) { DEBUG = debug; }
 
 /* Initialize two heaps with a certain size for use with the garbage collector */
 void gc_init(int size) {
-	if (heap_0 != NULL || heap_1 != NULL ) { gc_shutdown(); }
-    heap_size = (size_t)size;
-    heap_0 = morecore((size_t)size);	// init heap_0
-    end_of_heap_0 = heap_0 + size - 1;
-    next_free = heap_0;
-    num_roots = 0;
-
-	heap_size = (size_t)size;	//init heap_1
-	heap_1 = morecore((size_t)size);
-	end_of_heap_1 = heap_1 + size - 1;
-	next_free_forwarding = heap_1;
+	if ( current==NULL ) current = calloc(1, sizeof(Heap));
+	else if (current->heap_0 != NULL || current->heap_1 != NULL ) { gc_shutdown(); }
+    current->heap_size = (size_t)size;
+    current->heap_0 = morecore((size_t)size);	// init heap_0
+    current->end_of_heap_0 = current->heap_0 + size - 1;
+    current->next_free = current->heap_0;
+    current->num_roots = 0;
+
+	current->heap_size = (size_t)size;	//init heap_1
+	current->heap_1 = morecore((size_t)size);
+	current->end_of_heap_1 = current->heap_1 + size - 1;
+	current->next_free_forwarding = current->heap_1;
 }
 
 /* Announce you are done with the heaps managed by the garbage collector */
 void gc_shutdown() {
-	dropcore(heap_0, heap_size);
-	dropcore(heap_1, heap_size);
+	if ( current==NULL ) return;
+	dropcore(current->heap_0, current->heap_size);
+	dropcore(current->heap_1, current->heap_size);
+}
+
+Heap *gc_heap_new(int size) {
+	Heap *saved = current;
+	current = NULL;
+	gc_init(size);
+	Heap *h = current;
+	current = saved;
+	return h;
+}
+
+void gc_heap_free(Heap *h) {
+	dropcore(h->heap_0, h->heap_size);
+	dropcore(h->heap_1, h->heap_size);
+	if ( h==current ) current = NULL;
+	free(h);
+}
+
+Heap *gc_get_heap() { return current; }
+
+void gc_set_heap(Heap *h) { current = h; }
+
+// the calling thread's heaps; the first use on a thread creates them
+static inline Heap *this_heap() {
+	if ( current==NULL ) current = calloc(1, sizeof(Heap));
+	return current;
 }
 
 void gc_add_root(void **p)
 {
-	if ( num_roots<MAX_ROOTS ) {
-		_roots[num_roots++] = (heap_object **) p;
+	Heap *h = this_heap();
+	if ( h->num_roots<MAX_ROOTS ) {
+		h->roots[h->num_roots++] = (heap_object **) p;
 	}
 }
 
 int gc_num_roots() {
-	return num_roots;
+	return this_heap()->num_roots;
 }
 
 
 int gc_count_roots(){
+	Heap *h = this_heap();
 	int c = 0;
 	for (int i = 0 ; i < MAX_ROOTS; i++){
-		if (_roots[i] != NULL  && *_roots[i] != NULL)
+		if (h->roots[i] != NULL  && *h->roots[i] != NULL)
 			c++;
 	}
 	return c;
 }
 void gc_set_num_roots(int roots)
 {
-	num_roots = roots;
+	this_heap()->num_roots = roots;
 }
 
 // --------------------------------- A l l o c a t i o n ---------------------------------
 
 heap_object *gc_alloc(object_metadata *metadata, size_t size) {
-	if (heap_0 == NULL ) {
+	if (this_heap()->heap_0 == NULL ) {
 		gc_init(DEFAULT_MAX_HEAP_SIZE);  // init heap_0 and heap_1
 	}
 	size = align_to_word_boundary(size);
@@ -126,15 +163,16 @@ heap_object *gc_alloc(object_metadata *metadata, size_t size) {
  *  Size must include any header size and must be word-aligned.
  */
 static void *gc_raw_alloc(size_t size) {
-	if (next_free + size > end_of_heap_0) {
+	Heap *h = this_heap();
+	if (h->next_free + size > h->end_of_heap_0) {
 		gc(); // try to collect
-		if (next_free + size > end_of_heap_0) { // try again
+		if (h->next_free + size > h->end_of_heap_0) { // try again
 			return NULL;                      // oh well, no room. puke
 		}
 	}
 
-	void *p = next_free; // bump-ptr-allocation
-	next_free += size;
+	void *p = h->next_free; // bump-ptr-allocation
+	h->next_free += size;
 	return p;
 }
 
@@ -142,23 +180,26 @@ static void *gc_raw_alloc(size_t size) {
 // --------------------------------- F o r w a r d i n g ---------------------------------
 
 bool ptr_is_in_heap_0(heap_object *p) {
-	return  p >= (heap_object *) heap_0 &&
-			p <= (heap_object *) end_of_heap_0;
+	return  current!=NULL &&
+			p >= (heap_object *) current->heap_0 &&
+			p <= (heap_object *) current->end_of_heap_0;
 	//p->magic == MAGIC_NUMBER;
 }
 
 bool ptr_is_in_heap_1(heap_object *p) {
-	return  p >= (heap_object *) heap_1 &&
-			p <= (heap_object *) end_of_heap_1;
+	return  current!=NULL &&
+			p >= (heap_object *) current->heap_1 &&
+			p <= (heap_object *) current->end_of_heap_1;
 	//p->magic == MAGIC_NUMBER;
 }
 
 //calculate the new position in heap_1
 static inline void realloc_object(heap_object *p) {
+	Heap *h = current;
 	if (ptr_is_in_heap_1(p))   //already collected in heap_1
 		return;
-	void *q = next_free_forwarding; // bump-ptr-allocation
-	next_free_forwarding += p->size;
+	void *q = h->next_free_forwarding; // bump-ptr-allocation
+	h->next_free_forwarding += p->size;
 	p->forwarded = q; // p->forwarded records the new position in heap_1
 }
 
@@ -171,46 +212,49 @@ static inline void move_to_forwarding_addr(heap_object *p) {
 
 
 void gc() {
+	Heap *h = this_heap();
 	if (DEBUG) printf("GC-SCAVENGE\n");
 	gc_scavenge();
 
 	//after scavenging, reset the heaps to be ready for next round of gc
-	void *tmp_start = heap_1;  //swap heap_0 and heap_1 pointers
-	heap_1 = heap_0;
-	heap_0 = tmp_start;
-	void *tmp_end = end_of_heap_1;  //swap heap_0 and heap_1 pointers
-	end_of_heap_1 = end_of_heap_0;
-	end_of_heap_0 = tmp_end;
-	next_free = next_free_forwarding;  // next object to be allocated would occur here
-	next_free_forwarding = heap_1;  //ready for next round of gc
+	void *tmp_start = h->heap_1;  //swap heap_0 and heap_1 pointers
+	h->heap_1 = h->heap_0;
+	h->heap_0 = tmp_start;
+	void *tmp_end = h->end_of_heap_1;  //swap heap_0 and heap_1 pointers
+	h->end_of_heap_1 = h->end_of_heap_0;
+	h->end_of_heap_0 = tmp_end;
+	h->next_free = h->next_free_forwarding;  // next object to be allocated would occur here
+	h->next_free_forwarding = h->heap_1;  //ready for next round of gc
 
 	if (DEBUG) printf("DONE GC\n");
 }
 
 /* Alter the root to point at new location */
 static void update_root(heap_object *p, int i) {
+	Heap *h = current;
 	if (DEBUG) {
 		printf("UPDATE ROOT\n");
 		if (p->forwarded != p) {
 			printf("move root[%d]=%p -> %s@%p (0x%x bytes) to %p\n",
 				   i,
-				   *_roots[i],
+				   *h->roots[i],
 				   p->metadata->name,
 				   p,
 				   p->size,
 				   p->forwarded);
 		}
 	}
-	*_roots[i] = p->forwarded;	// update root to point at new address
+	*h->roots[i] = p->forwarded;	// update root to point at new address
 }
 
 // ---------------------------------Scavenge and Forward Live Objects to Heap_1 ---------------------------------
 void gc_scavenge() {
+	Heap *h = current;
 	if (DEBUG) printf("SCAVENGING...\n");
 	if (DEBUG) printf("heap_0 : %p\nend of heap_0 : %p\nheap_1 : %p\nend of heap_1 : %p\n",
-					  heap_0, end_of_heap_0, heap_1, end_of_heap_1);
-    for (int i = 0; i < num_roots; i++) {
-        heap_object *p = *_roots[i];
+					  h->heap_0, h->end_of_heap_0, h->heap_1, h->end_of_heap_1);
+    for (int i = 0; i < h->num_roots; i++) {
+        heap_object *p = *h->roots[i];
 		if (DEBUG) printf("roots[%d] = %p, p->forwarded = %p\n", i, p, p->forwarded );
 
 		if (p == NULL){
@@ -232,14 +276,14 @@ void gc_scavenge() {
 				continue;
 			}
 
-			if (DEBUG) printf("root[%d]=%p -> %s@%p (0x%x bytes)\n", i, *_roots[i], p->metadata->name, p, p->size);
+			if (DEBUG) printf("root[%d]=%p -> %s@%p (0x%x bytes)\n", i, *h->roots[i], p->metadata->name, p, p->size);
 			if (DEBUG) printf("Start of %s@%p, end of %s@%p, size: (0x%x bytes)\n", p->metadata->name, p,p->metadata->name,((void *)p)+p->size, p->size);
 
 			forward_object(p);	  //recursively forward all pointed field objects
 			update_root(p, i);
 		}
 		else  {
-			if (DEBUG) printf("root[%d]=%p -> %p INVALID\n", i, _roots[i], p);
+			if (DEBUG) printf("root[%d]=%p -> %p INVALID\n", i, h->roots[i], p);
 		}
     }
 }
@@ -261,7 +305,7 @@ static void forward_ptr_fields(const heap_object *p) {// check for tracked heap
 		void *ptr_to_ptr_field = ((void *)p) + offset_of_ptr_field;
 		heap_object **ptr_to_obj_ptr_field = (heap_object **) ptr_to_ptr_field;
 		heap_object *target_obj = *ptr_to_obj_ptr_field;
-		if (target_obj != NULL ) {
+		if (target_obj != NULL && ptr_is_in_heap_0(target_obj)) { // leave objects outside the heap alone
 			if (!ptr_is_in_heap_1(target_obj->forwarded))  //field object hasn't been forwarded
 				forward_object(target_obj);
 			*ptr_to_obj_ptr_field = target_obj->forwarded; //update ptr field
@@ -272,25 +316,27 @@ static void forward_ptr_fields(const heap_object *p) {// check for tracked heap
 // --------------------------------- S u p p o r t ---------------------------------
 
 Heap_Info get_heap_info() {
-	void *p = heap_0;
+	Heap *h = this_heap();
+	void *p = h->heap_0;
 	int busy = 0;
 	int live = gc_num_live_objects();
 	int computed_busy_size = 0;
-	int busy_size = (uint32_t)(next_free - heap_0);
-	int free_size = (uint32_t)(end_of_heap_0 - next_free + 1);
-	while (p >= heap_0 && p < next_free ) { // stay inbounds, walking heap
+	int busy_size = (uint32_t)(h->next_free - h->heap_0);
+	int free_size = (uint32_t)(h->end_of_heap_0 - h->next_free + 1);
+	while (p >= h->heap_0 && p < h->next_free ) { // stay inbounds, walking heap
 		// track
 		busy++;
 		computed_busy_size += ((heap_object *)p)->size;
 		p = p + ((heap_object *)p)->size;
 	}
-	return (Heap_Info){heap_0, end_of_heap_0, next_free, (uint32_t)heap_size,
+	return (Heap_Info){h->heap_0, h->end_of_heap_0, h->next_free, (uint32_t)h->heap_size,
 	                   busy, live, computed_busy_size, 0, busy_size, free_size };
 }
 
 void foreach_object(void (*action)(heap_object *)) {
-	void *p = heap_0;
-	while (p >= heap_0 && p < next_free) { // for each object in the heap currently allocated
+	Heap *h = this_heap();
+	void *p = h->heap_0;
+	while (p >= h->heap_0 && p < h->next_free) { // for each object in the heap currently allocated
 		size_t size = ((heap_object *)p)->size;
 		action(p);
 		p = p + size;
@@ -298,9 +344,10 @@ void foreach_object(void (*action)(heap_object *)) {
 }
 //this has to be called after gc()
 int gc_num_live_objects() {
+	Heap *h = this_heap();
 	int n = 0;
-	void *p = heap_0;
-	while (p >= heap_0 && p < next_free) { // for each marked (live) object, record forwarding address
+	void *p = h->heap_0;
+	while (p >= h->heap_0 && p < h->next_free) { // for each marked (live) object, record forwarding address
 		//if(ptr_is_in_heap_1(((heap_object *)p)->forwarded))
 		n++;
 		p = p + ((heap_object *)p)->size;
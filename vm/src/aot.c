@@ -0,0 +1,499 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dlfcn.h>
+#include <wich.h>
+#include "vm.h"
+#include "aot.h"
+#include "verifier.h"
+
+// the compiler, flags and include path of this build; see vm/CMakeLists.txt
+#ifndef AOT_CC
+#define AOT_CC		"cc"
+#endif
+#ifndef AOT_CFLAGS
+#define AOT_CFLAGS	"-std=c99 -DMARK_AND_COMPACT -I/usr/local/wich/include"
+#endif
+
+typedef void (*Native)(VM *vm, element *locals);
+
+// helpers every generated file starts with
+static const char *prelude =
+	"#include <stdio.h>\n"
+	"#include <stdlib.h>\n"
+	"#include <string.h>\n"
+	"#include <math.h>\n"
+	"#include <wich.h>\n"
+	"#include \"vm.h\"\n"
+	"#include \"output.h\"\n"
+	"\n"
+	"typedef void (*Native)(VM *vm, element *locals);\n"
+	"\n"
+	"// any other callee runs on whatever tier it lives on\n"
+	"static inline element *invoke(VM *vm, element *sp, Function_metadata *func)\n"
+	"{\n"
+	"\tvm->sp = (int)(sp - vm->stack);\n"
+	"\tvm_invoke(vm, func);\n"
+	"\treturn &vm->stack[vm->sp];\n"
+	"}\n"
+	"\n"
+	"// vm_call() then code, for a callee compiled into this file; returns the new top of stack\n"
+	"static inline element *call(VM *vm, element *sp, Function_metadata *func, Native code)\n"
+	"{\n"
+	"\tif ( vm->native_depth>=MAX_NATIVE_DEPTH ) return invoke(vm, sp, func); // interpreted from here on down\n"
+	"\telement *args = sp - func->nargs + 1;\n"
+	"\tint fp = (int)(args - vm->stack);\n"
+	"\tif ( vm->callsp+1>=MAX_CALL_STACK || fp + func->frame_size + func->max_stack>=MAX_OPND_STACK ) {\n"
+	"\t\tvm->sp = (int)(sp - vm->stack);\n"
+	"\t\tvm_invoke(vm, func); // reports the overflow\n"
+	"\t}\n"
+	"\tint caller_fp = vm->fp;\n"
+	"\tActivation_Record *r = &vm->call_stack[++vm->callsp];\n"
+	"\tr->func = func;\n"
+	"\tr->retaddr = vm->ip;\n"
+	"\tr->elided = 0;\n"
+	"\tr->fp = fp;\n"
+	"\tmemset(sp+1, 0, (func->frame_size - func->nargs) * sizeof(element));\n"
+	"\tvm->sp = fp + func->frame_size - 1;\n"
+	"\tvm->fp = fp;\n"
+	"\tvm->native_depth++;\n"
+	"\tcode(vm, args);\n"
+	"\tvm->native_depth--;\n"
+	"\tvm->callsp--;\n"
+	"\tvm->fp = caller_fp;\n"
+	"\t// the result, if any, replaces the args\n"
+	"\tif ( func->return_type==VOID_TYPE ) return args - 1;\n"
+	"\t*args = vm->stack[vm->sp];\n"
+	"\treturn args;\n"
+	"}\n"
+	"\n"
+	"static void zero_division_error()\n"
+	"{\n"
+	"\tfprintf(stderr, \"ZeroDivisionError: Divisor cann't be 0\\n\");\n"
+	"}\n";
+
+static uint32_t fnv(uint32_t h, const void *data, size_t n)
+{
+	for (size_t k = 0; k < n; k++) h = (h ^ ((const byte *)data)[k]) * 16777619u;
+	return h;
+}
+
+// identifies the program a shared object was compiled from
+static uint32_t fingerprint(VM *vm)
+{
+	uint32_t h = fnv(2166136261u, vm->code, (size_t)vm->code_size);
+	for (int i = 0; i < vm->num_functions; i++) {
+		Function_metadata *func = &vm->functions[i];
+		h = fnv(h, func->name, strlen(func->name) + 1);
+		h = fnv(h, &func->address, sizeof(func->address));
+	}
+	return h;
+}
+
+static int operand16(VM *vm, const Instr *I)
+{
+	return vm->code[I->offset+1] | (vm->code[I->offset+2] << 8);
+}
+
+/* Whether func can be translated: it has to pass the verifier, which gives
+ * the stack depth before each instruction, and root only locals, which stay
+ * on the VM stack, never a temporary.
+ */
+static bool compilable(VM *vm, Function_metadata *func, int *depths)
+{
+	if ( !vm_stack_depths(vm, func, depths) ) return false;
+	for (int j = func->entry; j < (int)func->end; j++) {
+		int opcode = vm->instrs[j].opcode;
+		if ( (opcode==SROOT || opcode==VROOT) && depths[j - func->entry]>0 ) return false;
+	}
+	return true;
+}
+
+static void write_fconst(double d, FILE *f)
+{
+	if ( isnan(d) ) fprintf(f, "NAN");
+	else if ( isinf(d) ) fprintf(f, d<0 ? "-INFINITY" : "INFINITY");
+	else fprintf(f, "%a", d);
+}
+
+// t[d-2].r = t[d-2].x op t[d-1].x
+static const char *binary(FILE *f, int d, const char *r, const char *x, const char *op)
+{
+	fprintf(f, "t[%d].%s = t[%d].%s %s t[%d].%s;", d-2, r, d-2, x, op, d-1, x);
+	return r;
+}
+
+// t[d-2].r = fn(t[d-2].x, t[d-1].y)
+static const char *call2(FILE *f, int d, const char *r, const char *fn, const char *x, const char *y)
+{
+	fprintf(f, "t[%d].%s = %s(t[%d].%s, t[%d].%s);", d-2, r, fn, d-2, x, d-1, y);
+	return r;
+}
+
+// t[d-2].vref = fn(t[d-2], t[d-1].y) for a vector kernel; y is vref for a vector operand
+static const char *vector2(FILE *f, int d, const char *fn, const char *y)
+{
+	fprintf(f, "t[%d].vref = vm_vector_ref(%s(vm_vector(t[%d].vref), ", d-2, fn, d-2);
+	if ( strcmp(y, "vref")==0 ) fprintf(f, "vm_vector(t[%d].vref)));", d-1);
+	else fprintf(f, "t[%d].%s));", d-1, y);
+	return "vref";
+}
+
+// t[d-1].r = fn(t[d-1].x)
+static const char *call1(FILE *f, int d, const char *r, const char *fn, const char *x)
+{
+	fprintf(f, "t[%d].%s = %s(t[%d].%s);", d-1, r, fn, d-1, x);
+	return r;
+}
+
+// t[d-1].r = op t[d-1].x
+static const char *unary(FILE *f, int d, const char *r, const char *op, const char *x)
+{
+	fprintf(f, "t[%d].%s = %st[%d].%s;", d-1, r, op, d-1, x);
+	return r;
+}
+
+/* Write I, which finds d values on the operand stack, as a C statement.
+ * Operand stack slot k is C variable t[k]; it goes out to the VM stack
+ * only for a call or at the end of the function. after is the depth
+ * before the next instruction. Local k is C variable l[k] too unless it is
+ * root, the one SROOT and VROOT hand to the GC, which has to stay in the
+ * activation record.
+ *
+ * Values move between the variables a field at a time where possible so
+ * that the C compiler can keep them in registers. fields[k] is the field
+ * last written to t[k] on the way here, or NULL if not known; returns the
+ * field written to the top of the stack.
+ */
+static const char *write_instr(VM *vm, Function_metadata *func, const Instr *I, int d, int after, int root,
+							   const char **fields, bool *compiled, FILE *f)
+{
+	Function_metadata *callee;
+	const char *local = I->a.i==root ? "locals" : "l";
+	int k;
+	switch ( I->opcode ) {
+		case IADD: return binary(f, d, "i", "i", "+");
+		case ISUB: return binary(f, d, "i", "i", "-");
+		case IMUL: return binary(f, d, "i", "i", "*");
+		case IDIV:
+			fprintf(f, "if ( t[%d].i==0 ) vm_division_by_zero(vm); ", d-1);
+			return binary(f, d, "i", "i", "/");
+		case FADD: return binary(f, d, "f", "f", "+");
+		case FSUB: return binary(f, d, "f", "f", "-");
+		case FMUL: return binary(f, d, "f", "f", "*");
+		case FDIV:
+			fprintf(f, "if ( t[%d].f==0 ) vm_division_by_zero(vm); ", d-1);
+			return binary(f, d, "f", "f", "/");
+		case VADD: return vector2(f, d, "Vector_add", "vref");
+		case VADDI: return vector2(f, d, "Vector_add_scalar", "i");
+		case VADDF: return vector2(f, d, "Vector_add_scalar", "f");
+		case VSUB: return vector2(f, d, "Vector_sub", "vref");
+		case VSUBI: return vector2(f, d, "Vector_sub_scalar", "i");
+		case VSUBF: return vector2(f, d, "Vector_sub_scalar", "f");
+		case VMUL: return vector2(f, d, "Vector_mul", "vref");
+		case VMULI: return vector2(f, d, "Vector_mul_scalar", "i");
+		case VMULF: return vector2(f, d, "Vector_mul_scalar", "f");
+		case VDIV: return vector2(f, d, "Vector_div", "vref");
+		case VDIVI:
+			fprintf(f, "if ( t[%d].i==0 ) zero_division_error(); else ", d-1);
+			return vector2(f, d, "Vector_div_scalar", "i");
+		case VDIVF:
+			fprintf(f, "if ( t[%d].f==0 ) zero_division_error(); else ", d-1);
+			return vector2(f, d, "Vector_div_scalar", "f");
+		case SADD: return call2(f, d, "s", "String_add", "s", "s");
+		case OR: return binary(f, d, "b", "b", "||");
+		case AND: return binary(f, d, "b", "b", "&&");
+		case INEG: return unary(f, d, "i", "-", "i");
+		case FNEG: return unary(f, d, "f", "-", "f");
+		case NOT: return unary(f, d, "b", "!", "b");
+		case I2F: return unary(f, d, "f", "", "i");
+		case F2I: return unary(f, d, "i", "(int)", "f");
+		case I2S: return call1(f, d, "s", "String_from_int", "i");
+		case F2S: return call1(f, d, "s", "String_from_float", "f");
+		case V2S:
+			fprintf(f, "t[%d].s = String_from_vector(vm_vector(t[%d].vref));", d-1, d-1);
+			return "s";
+		case IEQ: return binary(f, d, "b", "i", "==");
+		case INEQ: return binary(f, d, "b", "i", "!=");
+		case ILT: return binary(f, d, "b", "i", "<");
+		case ILE: return binary(f, d, "b", "i", "<=");
+		case IGT: return binary(f, d, "b", "i", ">");
+		case IGE: return binary(f, d, "b", "i", ">=");
+		case FEQ: return binary(f, d, "b", "f", "==");
+		case FNEQ: return binary(f, d, "b", "f", "!=");
+		case FLT: return binary(f, d, "b", "f", "<");
+		case FLE: return binary(f, d, "b", "f", "<=");
+		case FGT: return binary(f, d, "b", "f", ">");
+		case FGE: return binary(f, d, "b", "f", ">=");
+		case SEQ: return call2(f, d, "b", "String_eq", "s", "s");
+		case SNEQ: return call2(f, d, "b", "String_neq", "s", "s");
+		case SGT: return call2(f, d, "b", "String_gt", "s", "s");
+		case SGE: return call2(f, d, "b", "String_ge", "s", "s");
+		case SLT: return call2(f, d, "b", "String_lt", "s", "s");
+		case SLE: return call2(f, d, "b", "String_le", "s", "s");
+		// the interpreter passes the top vector first
+		case VEQ:
+			fprintf(f, "t[%d].b = Vector_eq(vm_vector(t[%d].vref), vm_vector(t[%d].vref));", d-2, d-1, d-2);
+			return "b";
+		case VNEQ:
+			fprintf(f, "t[%d].b = Vector_neq(vm_vector(t[%d].vref), vm_vector(t[%d].vref));", d-2, d-1, d-2);
+			return "b";
+		case BR:
+			fprintf(f, "goto L%d;", (int)(I->a.target - vm->instrs));
+			return NULL;
+		case BRF:
+			fprintf(f, "if ( !t[%d].b ) goto L%d;", d-1, (int)(I->a.target - vm->instrs));
+			return NULL;
+		case ICONST:
+			// 0 is also 0.0 and false; the code generator compares floats with ICONST 0
+			if ( I->a.i==0 ) {
+				fprintf(f, "t[%d].f = 0;", d);
+				return "f";
+			}
+			fprintf(f, "t[%d].i = %d;", d, I->a.i);
+			return "i";
+		case FCONST:
+			fprintf(f, "t[%d].f = ", d);
+			write_fconst(I->a.f, f);
+			fprintf(f, ";");
+			return "f";
+		case SCONST:
+			fprintf(f, "t[%d].s = vm->strings[%d];", d, operand16(vm, I)); // a.s once quickened
+			return "s";
+		case ILOAD:
+			fprintf(f, "t[%d].i = %s[%d].i;", d, local, I->a.i);
+			return "i";
+		case FLOAD:
+			fprintf(f, "t[%d].f = %s[%d].f;", d, local, I->a.i);
+			return "f";
+		case VLOAD:
+			fprintf(f, "t[%d].vref = %s[%d].vref;", d, local, I->a.i);
+			return "vref";
+		case SLOAD:
+			fprintf(f, "t[%d].s = %s[%d].s;", d, local, I->a.i);
+			return "s";
+		case STORE:
+			if ( fields[d-1]!=NULL ) fprintf(f, "%s[%d].%s = t[%d].%s;", local, I->a.i, fields[d-1], d-1, fields[d-1]);
+			else fprintf(f, "%s[%d] = t[%d];", local, I->a.i, d-1);
+			return NULL;
+		case VECTOR:
+			k = d - after; // the verifier knows the size
+			fprintf(f, "{ double *data = malloc(%d * sizeof(double));", k);
+			for (int j = 0; j < k; j++) fprintf(f, " data[%d] = t[%d].f;", j, d-1-k+j);
+			fprintf(f, " t[%d].vref = vm_vector_ref(Vector_new(data, %d)); }", d-1-k, k);
+			return "vref";
+		case VLOAD_INDEX:
+			fprintf(f, "t[%d].f = ith(vm_vector(t[%d].vref), t[%d].i - 1);", d-2, d-2, d-1);
+			return "f";
+		case STORE_INDEX:
+			fprintf(f, "set_ith(vm_vector(t[%d].vref), t[%d].i - 1, t[%d].f);", d-3, d-2, d-1);
+			return NULL;
+		case SLOAD_INDEX:
+			fprintf(f, "if ( t[%d].i-1 >= t[%d].s->length ) "
+					   "fprintf(stderr, \"StringIndexOutOfRange: %%d out of index : 1 to %%d\\n\", t[%d].i, (int)t[%d].s->length); "
+					   "else t[%d].s = String_from_char(t[%d].s->str[t[%d].i-1]);", d-1, d-2, d-1, d-2, d-2, d-2, d-1);
+			return "s";
+		case PUSH_DFLT_RETV: // push_default_value() without taking the address of t
+			switch ( func->return_type ) {
+				case INT_TYPE: fprintf(f, "t[%d].i = DEFAULT_INT_VALUE;", d); return "i";
+				case FLOAT_TYPE: fprintf(f, "t[%d].f = DEFAULT_FLOAT_VALUE;", d); return "f";
+				case BOOLEAN_TYPE: fprintf(f, "t[%d].b = DEFAULT_BOOLEAN_VALUE;", d); return "b";
+				case STRING_TYPE: fprintf(f, "t[%d].s = String_new(DEFAULT_STRING_VALUE);", d); return "s";
+				case VECTOR_TYPE: fprintf(f, "t[%d].vref = vm_vector_ref(PVector_init(0, 0));", d); return "vref";
+				default: fprintf(f, ";"); return NULL;
+			}
+		case CALL:
+			callee = I->a.func;
+			k = (int)(callee - vm->functions);
+			if ( I->super==TAIL_CALL && callee==func ) { // loop back to the top with the new args
+				if ( I[1].opcode==GC_END ) fprintf(f, "gc_set_num_roots(vm->call_stack[vm->callsp].save_gc_roots); ");
+				for (int j = 0; j < callee->nargs; j++) fprintf(f, "locals[%d] = t[%d]; ", j, d - callee->nargs + j);
+				fprintf(f, "memset(&locals[%d], 0, %d * sizeof(element)); ", callee->nargs, func->frame_size - callee->nargs);
+				fprintf(f, "vm->call_stack[vm->callsp].elided++; goto top;");
+				return NULL;
+			}
+			for (int j = d - callee->nargs; j < d; j++) fprintf(f, "stack[%d] = t[%d]; ", j, j);
+			if ( callee->return_type!=VOID_TYPE ) fprintf(f, "t[%d] = *", d - callee->nargs);
+			if ( compiled[k] ) fprintf(f, "call(vm, &stack[%d], &vm->functions[%d], f%d);", d-1, k, k);
+			else fprintf(f, "invoke(vm, &stack[%d], &vm->functions[%d]);", d-1, k);
+			return NULL;
+		case RET:
+		case HALT:
+			for (int j = 0; j < d; j++) fprintf(f, "stack[%d] = t[%d]; ", j, j);
+			fprintf(f, "vm->sp = (int)(&stack[%d] - vm->stack); return;", d-1);
+			return NULL;
+		case IPRINT: fprintf(f, "vm_print_int(vm, t[%d].i);", d-1); return NULL;
+		case FPRINT: fprintf(f, "vm_print_float(vm, t[%d].f);", d-1); return NULL;
+		case BPRINT: fprintf(f, "vm_print_int(vm, t[%d].b);", d-1); return NULL;
+		case SPRINT: fprintf(f, "vm_print_string(vm, t[%d].s);", d-1); return NULL;
+		case VPRINT: fprintf(f, "vm_print_vector(vm, vm_vector(t[%d].vref));", d-1); return NULL;
+		case VLEN:
+			fprintf(f, "t[%d].i = Vector_len(vm_vector(t[%d].vref));", d-1, d-1);
+			return "i";
+		case SLEN: return call1(f, d, "i", "String_len", "s");
+		case GC_START:
+			fprintf(f, "vm->call_stack[vm->callsp].save_gc_roots = gc_num_roots();");
+			return NULL;
+		case GC_END:
+			fprintf(f, "gc_set_num_roots(vm->call_stack[vm->callsp].save_gc_roots);");
+			return NULL;
+		case SROOT: fprintf(f, "gc_add_root((void **)&stack[-1].s);"); return NULL; // top of the locals
+		case VROOT: fprintf(f, "gc_add_root((void **)&stack[-1].vref);"); return NULL;
+		case COPY_VECTOR:
+			fprintf(f, "if ( t[%d].vref!=NULL ) t[%d].vref = vm_vector_ref(Vector_copy(t[%d].vref->vptr)); "
+					   "else fprintf(stderr, \"Vector reference cannot be found\\n\");", d-1, d-1, d-1);
+			return "vref";
+		default: fprintf(f, ";"); return NULL; // POP, NOP
+	}
+}
+
+static void write_function(VM *vm, int k, int *depths, bool *compiled, bool *targets, FILE *f)
+{
+	Function_metadata *func = &vm->functions[k];
+	int end = (int)func->end;
+	int root = -1;
+	for (int j = func->entry; j < end; j++) {
+		if ( vm->instrs[j].opcode==SROOT || vm->instrs[j].opcode==VROOT ) root = func->frame_size - 1;
+	}
+	int nslots = func->max_stack>0 ? func->max_stack : 1;
+	const char **fields = calloc((size_t)nslots, sizeof(char *));
+	fprintf(f, "\n// %s\nstatic void f%d(VM *vm, element *locals)\n{\n", func->name, k);
+	fprintf(f, "\telement t[%d];\n", nslots);
+	fprintf(f, "\telement l[%d];\n", func->frame_size>0 ? func->frame_size : 1);
+	fprintf(f, "top:\n"); // where tail calls to func itself go
+	fprintf(f, "\tmemcpy(l, locals, %d * sizeof(element));\n", func->frame_size);
+	fprintf(f, "\telement *stack = &locals[%d]; // the VM's operand stack for this frame\n", func->frame_size);
+	for (int j = func->entry; j < end; j++) {
+		if ( depths[j]<0 ) continue; // unreachable
+		if ( targets[j] ) {
+			fprintf(f, "L%d:\n", j);
+			memset(fields, 0, nslots * sizeof(char *)); // other paths join here
+		}
+		int after = j+1<end ? depths[j+1] : -1;
+		fprintf(f, "\t");
+		const char *field = write_instr(vm, func, &vm->instrs[j], depths[j], after, root, fields, compiled, f);
+		if ( after>0 ) fields[after-1] = field;
+		fprintf(f, "\n");
+	}
+	fprintf(f, "}\n");
+	free(fields);
+}
+
+bool aot_write_c(VM *vm, FILE *f)
+{
+	int n = vm->num_functions;
+	bool *compiled = calloc((size_t)n+1, sizeof(bool));
+	int *depths = malloc(((size_t)vm->num_instrs+1) * sizeof(int));
+	bool *targets = calloc((size_t)vm->num_instrs+1, sizeof(bool));
+	for (int k = 0; k < n; k++) {
+		Function_metadata *func = &vm->functions[k];
+		if ( func->entry<(addr32)vm->num_instrs ) compiled[k] = compilable(vm, func, &depths[func->entry]);
+	}
+	for (int j = 0; j < vm->num_instrs; j++) {
+		const Instr *I = &vm->instrs[j];
+		if ( I->opcode==BR || I->opcode==BRF ) targets[I->a.target - vm->instrs] = true;
+	}
+
+	fprintf(f, "/* Generated by aot_write_c() from a Wich program; do not edit. */\n%s", prelude);
+	fprintf(f, "\n");
+	for (int k = 0; k < n; k++) {
+		if ( compiled[k] ) fprintf(f, "static void f%d(VM *vm, element *locals);\n", k);
+	}
+	for (int k = 0; k < n; k++) {
+		if ( compiled[k] ) write_function(vm, k, depths, compiled, targets, f);
+	}
+
+	// what aot_load() looks up
+	fprintf(f, "\nconst unsigned int wich_aot_fingerprint = %uu;\n", fingerprint(vm));
+	fprintf(f, "const int wich_aot_vm_size = (int)sizeof(VM);\n");
+	fprintf(f, "const int wich_aot_num_functions = %d;\n", n);
+	fprintf(f, "const Native wich_aot_functions[] = {\n");
+	for (int k = 0; k < n; k++) {
+		if ( compiled[k] ) fprintf(f, "\tf%d,\n", k);
+		else fprintf(f, "\tNULL,\n");
+	}
+	fprintf(f, "\tNULL\n};\n");
+
+	free(compiled);
+	free(depths);
+	free(targets);
+	return !ferror(f);
+}
+
+bool aot_compile(VM *vm, char *sofile)
+{
+	char cfile[strlen(sofile) + 3];
+	char *dot = strrchr(sofile, '.');
+	int len = dot!=NULL && strchr(dot, '/')==NULL ? (int)(dot - sofile) : (int)strlen(sofile);
+	snprintf(cfile, sizeof(cfile), "%.*s.c", len, sofile);
+	FILE *f = fopen(cfile, "w");
+	if ( f==NULL ) {
+		fprintf(stderr, "can't write %s\n", cfile);
+		return false;
+	}
+	bool ok = aot_write_c(vm, f);
+	fclose(f);
+	if ( !ok ) return false;
+
+#ifdef __APPLE__
+	static const char *shared = "-shared -fPIC -undefined dynamic_lookup";
+#else
+	static const char *shared = "-shared -fPIC";
+#endif
+	size_t n = strlen(AOT_CC) + strlen(AOT_CFLAGS) + strlen(shared) + strlen(cfile) + strlen(sofile) + 100;
+	char *cmd = malloc(n);
+	snprintf(cmd, n, "%s %s -O2 -w %s -o '%s' '%s'", AOT_CC, AOT_CFLAGS, shared, sofile, cfile);
+	ok = system(cmd)==0;
+	if ( !ok ) fprintf(stderr, "failed: %s\n", cmd);
+	free(cmd);
+	return ok;
+}
+
+bool aot_load(VM *vm, char *sofile)
+{
+	char path[strlen(sofile) + 3];
+	snprintf(path, sizeof(path), "%s%s", strchr(sofile, '/')==NULL ? "./" : "", sofile); // not a library search
+	void *so = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if ( so==NULL ) {
+		fprintf(stderr, "can't load %s: %s\n", sofile, dlerror());
+		return false;
+	}
+	const unsigned int *fp = dlsym(so, "wich_aot_fingerprint");
+	const int *vm_size = dlsym(so, "wich_aot_vm_size");
+	const int *n = dlsym(so, "wich_aot_num_functions");
+	const Native *functions = dlsym(so, "wich_aot_functions");
+	if ( fp==NULL || vm_size==NULL || n==NULL || functions==NULL ||
+		 *fp!=fingerprint(vm) || *vm_size!=(int)sizeof(VM) || *n!=vm->num_functions ) {
+		fprintf(stderr, "%s wasn't compiled from this program for this VM\n", sofile);
+		dlclose(so);
+		return false;
+	}
+	for (int k = 0; k < vm->num_functions; k++) {
+		if ( functions[k]!=NULL ) vm->functions[k].native = functions[k];
+	}
+	return true; // the functions stay in use, so so stays open
+}
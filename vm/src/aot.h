@@ -0,0 +1,51 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef AOT_H_
+#define AOT_H_
+
+#include "vm.h"
+
+/* Ahead-of-time compilation through C. aot_write_c() translates every
+ * function of a loaded program into a C function with the signature of
+ * Function_metadata.native that calls wlib and the GC directly. Locals stay
+ * in the function's activation record on the VM stack, so GC_START, GC_END,
+ * SROOT and VROOT keep their meaning; operand stack temporaries become C
+ * variables that the C compiler can keep in registers. Calls between
+ * compiled functions are C calls.
+ *
+ * aot_compile() writes that C next to sofile and compiles it with the C
+ * compiler and flags this VM was built with. aot_load() dlopens the shared
+ * object and installs its functions as the natives of the program's
+ * functions; vm_exec() then runs main as native code. A shared object only
+ * loads into the program and VM build it was compiled for.
+ *
+ * A function that fails the verifier or roots a temporary stays on the
+ * interpreter. After a division by zero, the quotient's slot holds the
+ * dividend where the interpreter would have lost both operands.
+ */
+extern bool aot_write_c(VM *vm, FILE *f);
+extern bool aot_compile(VM *vm, char *sofile);
+extern bool aot_load(VM *vm, char *sofile);
+
+#endif
@@ -0,0 +1,57 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef DISPATCH_H_
+#define DISPATCH_H_
+
+// Interpreter loops use direct threading (GCC labels-as-values) unless asked
+// for the portable switch at build time with -DVM_SWITCH_DISPATCH. A loop keeps
+// its instruction pointer in a local named pc whose records carry a handler
+// field. Each handler ends with NEXT, which moves to the next instruction and
+// jumps straight to its handler, or DISPATCH, which jumps to the handler of
+// the instruction at pc.
+#if defined(__GNUC__) && !defined(VM_SWITCH_DISPATCH)
+#define VM_THREADED_DISPATCH
+#endif
+
+#ifdef VM_THREADED_DISPATCH
+#define CASE(op)	do_##op:
+#define DISPATCH	goto *pc->handler
+#define NEXT		goto *(++pc)->handler
+#else
+#define CASE(op)	case op:
+#define DISPATCH	continue
+#define NEXT		goto next
+#endif
+
+// At -O2 GCC's SLP vectorizer packs sp and fp into one vector register. That
+// swells the dispatch code all handlers share until GCC no longer copies it
+// back into each of them, leaving a loop with one indirect jump for all
+// instructions and branch prediction to match. Loop functions opt out.
+#if defined(VM_THREADED_DISPATCH) && !defined(__clang__)
+#define VM_LOOP_ATTRIBUTES	__attribute__((optimize("no-tree-slp-vectorize")))
+#else
+#define VM_LOOP_ATTRIBUTES
+#endif
+
+#endif
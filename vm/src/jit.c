@@ -0,0 +1,769 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <wich.h>
+#include "vm.h"
+#include "jit.h"
+#include "output.h"
+
+#if defined(__x86_64__)
+
+/* Machine code is generated with these registers holding VM state; all are
+ * callee-saved in the System V ABI so they survive calls into C:
+ *
+ *	rbx	VM *vm
+ *	r12	&vm->stack[sp], the top of the operand stack
+ *	r13	locals of the function's activation record
+ *
+ * vm->sp is only written back when the function returns; C helpers get the
+ * top of stack as an argument and return the new one.
+ */
+enum { RAX=0, RCX=1, RDX=2, RBX=3, RSP=4, RBP=5, RSI=6, RDI=7, R12=12, R13=13, R14=14 };
+enum { XMM0=0, XMM1=1, XMM2=2 };
+enum { CC_B=0x2, CC_AE=0x3, CC_E=0x4, CC_NE=0x5, CC_A=0x7, CC_P=0xA, CC_NP=0xB,
+	   CC_L=0xC, CC_GE=0xD, CC_LE=0xE, CC_G=0xF };
+
+#define VMREG	RBX
+#define TOP		R12
+#define LOCALS	R13
+
+static const int ES = (int)sizeof(element);
+
+typedef struct {
+	byte *code;
+	int n;
+	int max;
+} Asm;
+
+typedef struct {
+	int pos;	// where the rel32 goes
+	int target;	// instr index relative to start of function
+} Fixup;
+
+typedef element *(*Helper)(VM *vm, element *top, const void *arg);
+
+static void b1(Asm *a, int x)
+{
+	if ( a->n==a->max ) {
+		a->max *= 2;
+		a->code = realloc(a->code, (size_t)a->max);
+	}
+	a->code[a->n++] = (byte)x;
+}
+
+static void b4(Asm *a, int x)
+{
+	for (int k = 0; k < 4; k++) b1(a, (x >> (8*k)) & 0xff);
+}
+
+static void b8(Asm *a, uint64_t x)
+{
+	for (int k = 0; k < 8; k++) b1(a, (int)((x >> (8*k)) & 0xff));
+}
+
+static void rex(Asm *a, bool w, int reg, int rm)
+{
+	int r = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+	if ( r!=0x40 ) b1(a, r);
+}
+
+static void opcode(Asm *a, int op)
+{
+	if ( op>0xff ) b1(a, op >> 8); // two byte opcodes 0F xx
+	b1(a, op & 0xff);
+}
+
+// op reg, [base+disp]
+static void mem(Asm *a, int prefix, bool w, int op, int reg, int base, int disp)
+{
+	if ( prefix ) b1(a, prefix);
+	rex(a, w, reg, base);
+	opcode(a, op);
+	bool small = disp>=-128 && disp<=127;
+	b1(a, (small ? 0x40 : 0x80) | ((reg & 7) << 3) | (base & 7));
+	if ( (base & 7)==RSP ) b1(a, 0x24); // rsp and r12 need a SIB byte
+	if ( small ) b1(a, disp);
+	else b4(a, disp);
+}
+
+// op reg, rm
+static void reg2(Asm *a, int prefix, bool w, int op, int reg, int rm)
+{
+	if ( prefix ) b1(a, prefix);
+	rex(a, w, reg, rm);
+	opcode(a, op);
+	b1(a, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void mov_imm64(Asm *a, int r, uint64_t x)
+{
+	rex(a, true, 0, r);
+	b1(a, 0xB8 + (r & 7));
+	b8(a, x);
+}
+
+// add (ext=0) or sub (ext=5) an immediate to a 64 bit register
+static void alu_imm(Asm *a, int ext, int r, int x)
+{
+	rex(a, true, 0, r);
+	b1(a, 0x81);
+	b1(a, 0xC0 | (ext << 3) | (r & 7));
+	b4(a, x);
+}
+
+static void push(Asm *a, int r)
+{
+	if ( r & 8 ) b1(a, 0x41);
+	b1(a, 0x50 + (r & 7));
+}
+
+static void pop(Asm *a, int r)
+{
+	if ( r & 8 ) b1(a, 0x41);
+	b1(a, 0x58 + (r & 7));
+}
+
+// jmp or jcc with a rel32 to be patched; returns position of the rel32
+static int jump(Asm *a, int cc)
+{
+	if ( cc<0 ) b1(a, 0xE9);
+	else opcode(a, 0x0F80 | cc);
+	b4(a, 0);
+	return a->n - 4;
+}
+
+static void patch(Asm *a, int pos, int target)
+{
+	int rel = target - (pos + 4);
+	memcpy(&a->code[pos], &rel, 4);
+}
+
+static void setcc(Asm *a, int cc, int r)
+{
+	reg2(a, 0, false, 0x0F90 | cc, 0, r);
+}
+
+// copy n bytes from [src+sdisp] to [dst+ddisp] through rax
+static void copy(Asm *a, int dst, int ddisp, int src, int sdisp, int n)
+{
+	int k = 0;
+	for (; k+8 <= n; k += 8) {
+		mem(a, 0, true, 0x8B, RAX, src, sdisp + k);
+		mem(a, 0, true, 0x89, RAX, dst, ddisp + k);
+	}
+	for (; k+4 <= n; k += 4) {
+		mem(a, 0, false, 0x8B, RAX, src, sdisp + k);
+		mem(a, 0, false, 0x89, RAX, dst, ddisp + k);
+	}
+}
+
+// call fn(vm, top, arg) and continue with the top of stack it returns
+static void call_helper(Asm *a, Helper fn, const void *arg)
+{
+	reg2(a, 0, true, 0x89, VMREG, RDI);
+	reg2(a, 0, true, 0x89, TOP, RSI);
+	mov_imm64(a, RDX, (uint64_t)(uintptr_t)arg);
+	mov_imm64(a, RAX, (uint64_t)(uintptr_t)fn);
+	b1(a, 0xFF); b1(a, 0xD0); // call rax
+	reg2(a, 0, true, 0x89, RAX, TOP);
+}
+
+static void inline zero_division_error()
+{
+	fprintf(stderr, "ZeroDivisionError: Divisor cann't be 0\n");
+}
+
+/* Execute instruction I the same way the interpreter does, for instructions
+ * that aren't worth compiling inline.
+ */
+static element *jit_helper(VM *vm, element *top, const void *arg)
+{
+	const Instr *I = arg;
+	element *stack = vm->stack;
+	int sp = (int)(top - stack);
+	int i;
+	double f, g;
+	bool b;
+	String *c;
+	PVector_ptr vptr, r, l;
+	int x, y;
+
+	switch ( I->opcode ) {
+		case IDIV:
+			y = stack[sp--].i;
+			x = stack[sp--].i;
+			if ( y==0 ) vm_division_by_zero(vm);
+			stack[++sp].i = x / y;
+			break;
+		case FDIV:
+			f = stack[sp--].f;
+			g = stack[sp--].f;
+			if ( f==0 ) vm_division_by_zero(vm);
+			stack[++sp].f = g / f;
+			break;
+		case VADD:
+			r = vm_vector(stack[sp--].vref);
+			l = vm_vector(stack[sp].vref);
+			stack[sp].vref = vm_vector_ref(Vector_add(l, r));
+			break;
+		case VADDI:
+			i = stack[sp--].i;
+			vptr = vm_vector(stack[sp].vref);
+			stack[sp].vref = vm_vector_ref(Vector_add_scalar(vptr, i));
+			break;
+		case VADDF:
+			f = stack[sp--].f;
+			vptr = vm_vector(stack[sp].vref);
+			stack[sp].vref = vm_vector_ref(Vector_add_scalar(vptr, f));
+			break;
+		case VSUB:
+			r = vm_vector(stack[sp--].vref);
+			l = vm_vector(stack[sp].vref);
+			stack[sp].vref = vm_vector_ref(Vector_sub(l, r));
+			break;
+		case VSUBI:
+			i = stack[sp--].i;
+			vptr = vm_vector(stack[sp].vref);
+			stack[sp].vref = vm_vector_ref(Vector_sub_scalar(vptr, i));
+			break;
+		case VSUBF:
+			f = stack[sp--].f;
+			vptr = vm_vector(stack[sp].vref);
+			stack[sp].vref = vm_vector_ref(Vector_sub_scalar(vptr, f));
+			break;
+		case VMUL:
+			r = vm_vector(stack[sp--].vref);
+			l = vm_vector(stack[sp].vref);
+			stack[sp].vref = vm_vector_ref(Vector_mul(l, r));
+			break;
+		case VMULI:
+			i = stack[sp--].i;
+			vptr = vm_vector(stack[sp].vref);
+			stack[sp].vref = vm_vector_ref(Vector_mul_scalar(vptr, i));
+			break;
+		case VMULF:
+			f = stack[sp--].f;
+			vptr = vm_vector(stack[sp].vref);
+			stack[sp].vref = vm_vector_ref(Vector_mul_scalar(vptr, f));
+			break;
+		case VDIV:
+			r = vm_vector(stack[sp--].vref);
+			l = vm_vector(stack[sp].vref);
+			stack[sp].vref = vm_vector_ref(Vector_div(l, r));
+			break;
+		case VDIVI:
+			i = stack[sp--].i;
+			if ( i==0 ) {
+				zero_division_error();
+				break;
+			}
+			vptr = vm_vector(stack[sp].vref);
+			stack[sp].vref = vm_vector_ref(Vector_div_scalar(vptr, i));
+			break;
+		case VDIVF:
+			f = stack[sp--].f;
+			if ( f==0 ) {
+				zero_division_error();
+				break;
+			}
+			vptr = vm_vector(stack[sp].vref);
+			stack[sp].vref = vm_vector_ref(Vector_div_scalar(vptr, f));
+			break;
+		case SADD:
+			c = stack[sp--].s;
+			stack[sp].s = String_add(stack[sp].s, c);
+			break;
+		case I2S:
+			stack[sp].s = String_from_int(stack[sp].i);
+			break;
+		case F2S:
+			stack[sp].s = String_from_float(stack[sp].f);
+			break;
+		case V2S:
+			vptr = vm_vector(stack[sp].vref);
+			stack[sp].s = String_from_vector(vptr);
+			break;
+		case SEQ:
+			c = stack[sp--].s;
+			b = String_eq(stack[sp--].s, c);
+			stack[++sp].b = b;
+			break;
+		case SNEQ:
+			c = stack[sp--].s;
+			b = String_neq(stack[sp--].s, c);
+			stack[++sp].b = b;
+			break;
+		case SGT:
+			c = stack[sp--].s;
+			b = String_gt(stack[sp--].s, c);
+			stack[++sp].b = b;
+			break;
+		case SGE:
+			c = stack[sp--].s;
+			b = String_ge(stack[sp--].s, c);
+			stack[++sp].b = b;
+			break;
+		case SLT:
+			c = stack[sp--].s;
+			b = String_lt(stack[sp--].s, c);
+			stack[++sp].b = b;
+			break;
+		case SLE:
+			c = stack[sp--].s;
+			b = String_le(stack[sp--].s, c);
+			stack[++sp].b = b;
+			break;
+		case VEQ:
+			l = vm_vector(stack[sp--].vref);
+			r = vm_vector(stack[sp--].vref);
+			stack[++sp].b = Vector_eq(l, r);
+			break;
+		case VNEQ:
+			l = vm_vector(stack[sp--].vref);
+			r = vm_vector(stack[sp--].vref);
+			stack[++sp].b = Vector_neq(l, r);
+			break;
+		case VECTOR: {
+			i = stack[sp--].i;
+			double *data = (double *)malloc(i*sizeof(double));
+			for (int j = i-1; j >= 0; j--) { data[j] = stack[sp--].f; }
+			stack[++sp].vref = vm_vector_ref(Vector_new(data, i));
+			break;
+		}
+		case VLOAD_INDEX:
+			i = stack[sp--].i;
+			vptr = vm_vector(stack[sp--].vref);
+			stack[++sp].f = ith(vptr, i-1);
+			break;
+		case STORE_INDEX:
+			f = stack[sp--].f;
+			i = stack[sp--].i;
+			vptr = vm_vector(stack[sp--].vref);
+			set_ith(vptr, i-1, f);
+			break;
+		case SLOAD_INDEX: {
+			i = stack[sp--].i;
+			c = stack[sp--].s;
+			if ( i-1 >= c->length ) {
+				fprintf(stderr, "StringIndexOutOfRange: %d out of index : 1 to %d\n", i, (int)c->length);
+				break;
+			}
+			stack[++sp].s = String_from_char(c->str[i-1]);
+			break;
+		}
+		case PUSH_DFLT_RETV:
+			sp = push_default_value(vm->call_stack[vm->callsp].func->return_type, sp, stack);
+			break;
+		case IPRINT:
+			vm_print_int(vm, stack[sp--].i);
+			break;
+		case FPRINT:
+			vm_print_float(vm, stack[sp--].f);
+			break;
+		case BPRINT:
+			vm_print_int(vm, stack[sp--].b);
+			break;
+		case SPRINT:
+			vm_print_string(vm, stack[sp--].s);
+			break;
+		case VPRINT:
+			vm_print_vector(vm, vm_vector(stack[sp--].vref));
+			break;
+		case VLEN:
+			vptr = vm_vector(stack[sp--].vref);
+			stack[++sp].i = Vector_len(vptr);
+			break;
+		case SLEN:
+			c = stack[sp--].s;
+			stack[++sp].i = String_len(c);
+			break;
+		case GC_START:
+			vm->call_stack[vm->callsp].save_gc_roots = gc_num_roots();
+			break;
+		case GC_END:
+			gc_set_num_roots(vm->call_stack[vm->callsp].save_gc_roots);
+			break;
+		case SROOT:
+			gc_add_root((void **)&stack[sp].s);
+			break;
+		case VROOT:
+			gc_add_root((void **)&stack[sp].vref);
+			break;
+		case COPY_VECTOR:
+			if ( stack[sp].vref!=NULL ) {
+				stack[sp].vref = vm_vector_ref(Vector_copy(stack[sp].vref->vptr));
+			}
+			else {
+				fprintf(stderr, "Vector reference cannot be found\n");
+			}
+			break;
+		default:
+			break;
+	}
+	return &stack[sp];
+}
+
+// CALL: run func on whatever tier it lives on
+static element *jit_call(VM *vm, element *top, const void *arg)
+{
+	vm->sp = (int)(top - vm->stack);
+	vm_invoke(vm, (Function_metadata *)arg);
+	return &vm->stack[vm->sp];
+}
+
+// TAIL_CALL: leave the call to vm_call_compiled(), which reuses our frame
+static element *jit_tail_call(VM *vm, element *top, const void *arg)
+{
+	const Instr *I = arg;
+	vm->ip = (addr32)(I - vm->instrs) + 1; // vm_tail_call() looks for the GC_ENDs it skips here
+	vm->tail_call = I->a.func;
+	return top;
+}
+
+/* Find the instructions reachable from the function entry; fails if a
+ * branch leaves the function, control falls off its end or a CALL has
+ * no function.
+ */
+static bool reachable(VM *vm, int start, int n, bool *live)
+{
+	int *work = malloc((n+1) * sizeof(int));
+	int nwork = 0;
+	bool ok = true;
+	live[0] = true;
+	work[nwork++] = 0;
+	while ( ok && nwork>0 ) {
+		int i = work[--nwork];
+		Instr *I = &vm->instrs[start + i];
+		if ( I->opcode==CALL && I->a.func==NULL ) { ok = false; break; }
+		int succ[2] = {i+1, -1};
+		if ( I->opcode==BR || I->opcode==BRF ) succ[1] = (int)(I->a.target - vm->instrs) - start;
+		if ( I->opcode==BR || I->opcode==RET || I->opcode==HALT ) succ[0] = -1;
+		for (int s = 0; s < 2; s++) {
+			int j = succ[s];
+			if ( j==-1 ) continue;
+			if ( j<0 || j>=n ) { ok = false; break; }
+			if ( !live[j] ) {
+				live[j] = true;
+				work[nwork++] = j;
+			}
+		}
+	}
+	free(work);
+	return ok;
+}
+
+static void binary_int(Asm *a, int op)
+{
+	mem(a, 0, false, 0x8B, RAX, TOP, -ES);
+	mem(a, 0, false, op, RAX, TOP, 0);
+	mem(a, 0, false, 0x89, RAX, TOP, -ES);
+	alu_imm(a, 5, TOP, ES);
+}
+
+static void binary_float(Asm *a, int op)
+{
+	mem(a, 0xF2, false, 0x0F10, XMM0, TOP, -ES);
+	mem(a, 0xF2, false, op, XMM0, TOP, 0);
+	mem(a, 0xF2, false, 0x0F11, XMM0, TOP, -ES);
+	alu_imm(a, 5, TOP, ES);
+}
+
+static void compare_int(Asm *a, int cc)
+{
+	mem(a, 0, false, 0x8B, RAX, TOP, -ES);
+	mem(a, 0, false, 0x3B, RAX, TOP, 0);
+	setcc(a, cc, RAX);
+	mem(a, 0, false, 0x88, RAX, TOP, -ES);
+	alu_imm(a, 5, TOP, ES);
+}
+
+/* Compare the two floats on top with ucomisd, ordering them so that a
+ * comparison with NaN comes out false like it does in C.
+ */
+static void compare_float(Asm *a, BYTECODE op)
+{
+	bool swap = op==FLT || op==FLE; // f < g is g > f
+	mem(a, 0xF2, false, 0x0F10, XMM0, TOP, swap ? 0 : -ES);
+	mem(a, 0x66, false, 0x0F2E, XMM0, TOP, swap ? -ES : 0);
+	switch ( op ) {
+		case FLT: case FGT: setcc(a, CC_A, RAX); break;
+		case FLE: case FGE: setcc(a, CC_AE, RAX); break;
+		case FEQ:
+			setcc(a, CC_E, RAX);
+			setcc(a, CC_NP, RCX);
+			reg2(a, 0, false, 0x20, RCX, RAX); // and al, cl
+			break;
+		default: // FNEQ
+			setcc(a, CC_NE, RAX);
+			setcc(a, CC_P, RCX);
+			reg2(a, 0, false, 0x08, RCX, RAX); // or al, cl
+			break;
+	}
+	mem(a, 0, false, 0x88, RAX, TOP, -ES);
+	alu_imm(a, 5, TOP, ES);
+}
+
+static void compile(VM *vm, Asm *a, const Instr *I, Fixup *fixups, int *nfixups, int start, int *epilogue_jumps, int *nret)
+{
+	int j, k;
+	switch ( I->opcode ) {
+		case IADD: binary_int(a, 0x03); break;
+		case ISUB: binary_int(a, 0x2B); break;
+		case IMUL: binary_int(a, 0x0FAF); break;
+		case IDIV:
+			mem(a, 0, false, 0x8B, RCX, TOP, 0);
+			reg2(a, 0, false, 0x85, RCX, RCX);		// test ecx, ecx
+			j = jump(a, CC_E);
+			mem(a, 0, false, 0x8B, RAX, TOP, -ES);
+			b1(a, 0x99);							// cdq
+			reg2(a, 0, false, 0xF7, 7, RCX);		// idiv ecx
+			mem(a, 0, false, 0x89, RAX, TOP, -ES);
+			alu_imm(a, 5, TOP, ES);
+			k = jump(a, -1);
+			patch(a, j, a->n);
+			call_helper(a, jit_helper, I);			// stop on division by zero
+			patch(a, k, a->n);
+			break;
+		case FADD: binary_float(a, 0x0F58); break;
+		case FSUB: binary_float(a, 0x0F5C); break;
+		case FMUL: binary_float(a, 0x0F59); break;
+		case FDIV:
+			mem(a, 0xF2, false, 0x0F10, XMM1, TOP, 0);
+			reg2(a, 0x66, false, 0x0F57, XMM2, XMM2);	// xorpd xmm2, xmm2
+			reg2(a, 0x66, false, 0x0F2E, XMM1, XMM2);	// ucomisd xmm1, xmm2
+			j = jump(a, CC_P);							// NaN isn't 0
+			k = jump(a, CC_E);
+			patch(a, j, a->n);
+			binary_float(a, 0x0F5E);
+			j = jump(a, -1);
+			patch(a, k, a->n);
+			call_helper(a, jit_helper, I);
+			patch(a, j, a->n);
+			break;
+		case OR:
+		case AND:
+			mem(a, 0, false, 0x8A, RAX, TOP, -ES);
+			reg2(a, 0, false, 0x84, RAX, RAX);
+			setcc(a, CC_NE, RAX);
+			mem(a, 0, false, 0x8A, RCX, TOP, 0);
+			reg2(a, 0, false, 0x84, RCX, RCX);
+			setcc(a, CC_NE, RCX);
+			reg2(a, 0, false, I->opcode==OR ? 0x08 : 0x20, RCX, RAX);
+			mem(a, 0, false, 0x88, RAX, TOP, -ES);
+			alu_imm(a, 5, TOP, ES);
+			break;
+		case INEG:
+			mem(a, 0, false, 0xF7, 3, TOP, 0);			// neg dword [top]
+			break;
+		case FNEG:
+			mem(a, 0, true, 0x0FBA, 7, TOP, 0);			// btc qword [top], 63
+			b1(a, 63);
+			break;
+		case NOT:
+			mem(a, 0, false, 0x80, 7, TOP, 0);			// cmp byte [top], 0
+			b1(a, 0);
+			setcc(a, CC_E, RAX);
+			mem(a, 0, false, 0x88, RAX, TOP, 0);
+			break;
+		case I2F:
+			mem(a, 0xF2, false, 0x0F2A, XMM0, TOP, 0);	// cvtsi2sd xmm0, dword [top]
+			mem(a, 0xF2, false, 0x0F11, XMM0, TOP, 0);
+			break;
+		case F2I:
+			mem(a, 0xF2, false, 0x0F2C, RAX, TOP, 0);	// cvttsd2si eax, [top]
+			mem(a, 0, false, 0x89, RAX, TOP, 0);
+			break;
+		case IEQ:  compare_int(a, CC_E); break;
+		case INEQ: compare_int(a, CC_NE); break;
+		case ILT:  compare_int(a, CC_L); break;
+		case ILE:  compare_int(a, CC_LE); break;
+		case IGT:  compare_int(a, CC_G); break;
+		case IGE:  compare_int(a, CC_GE); break;
+		case FEQ: case FNEQ: case FLT: case FLE: case FGT: case FGE:
+			compare_float(a, (BYTECODE)I->opcode);
+			break;
+		case BR:
+			fixups[*nfixups].pos = jump(a, -1);
+			fixups[(*nfixups)++].target = (int)(I->a.target - vm->instrs) - start;
+			break;
+		case BRF:
+			mem(a, 0, false, 0x8A, RAX, TOP, 0);
+			alu_imm(a, 5, TOP, ES);
+			reg2(a, 0, false, 0x84, RAX, RAX);
+			fixups[*nfixups].pos = jump(a, CC_E);
+			fixups[(*nfixups)++].target = (int)(I->a.target - vm->instrs) - start;
+			break;
+		case ICONST:
+			mem(a, 0, true, 0xC7, 0, TOP, ES);			// mov qword [top+ES], imm32
+			b4(a, I->a.i);
+			alu_imm(a, 0, TOP, ES);
+			break;
+		case FCONST: {
+			uint64_t bits;
+			memcpy(&bits, &I->a.f, sizeof(bits));
+			mov_imm64(a, RAX, bits);
+			mem(a, 0, true, 0x89, RAX, TOP, ES);
+			alu_imm(a, 0, TOP, ES);
+			break;
+		}
+		case SCONST:
+			mov_imm64(a, RAX, (uint64_t)(uintptr_t)vm_sconst(vm, I));
+			mem(a, 0, true, 0x89, RAX, TOP, ES);
+			alu_imm(a, 0, TOP, ES);
+			break;
+		case ILOAD:
+			copy(a, TOP, ES, LOCALS, I->a.i * ES, sizeof(int));
+			alu_imm(a, 0, TOP, ES);
+			break;
+		case FLOAD:
+			copy(a, TOP, ES, LOCALS, I->a.i * ES, sizeof(double));
+			alu_imm(a, 0, TOP, ES);
+			break;
+		case SLOAD:
+			copy(a, TOP, ES, LOCALS, I->a.i * ES, sizeof(char *));
+			alu_imm(a, 0, TOP, ES);
+			break;
+		case VLOAD:
+			copy(a, TOP, ES, LOCALS, I->a.i * ES, sizeof(Vector_ref *));
+			alu_imm(a, 0, TOP, ES);
+			break;
+		case STORE:
+			copy(a, LOCALS, I->a.i * ES, TOP, 0, ES);
+			alu_imm(a, 5, TOP, ES);
+			break;
+		case POP:
+			alu_imm(a, 5, TOP, ES);
+			break;
+		case CALL:
+			if ( I->super==TAIL_CALL ) {
+				call_helper(a, jit_tail_call, I);
+				epilogue_jumps[(*nret)++] = jump(a, -1);
+			}
+			else call_helper(a, jit_call, I->a.func);
+			break;
+		case RET:
+		case HALT:
+			epilogue_jumps[(*nret)++] = jump(a, -1);
+			break;
+		case NOP:
+			break;
+		default:
+			call_helper(a, jit_helper, I);
+			break;
+	}
+}
+
+bool jit_compile(VM *vm, Function_metadata *func)
+{
+	if ( (ES & (ES-1))!=0 ) return false; // need a shift to turn top back into sp
+	int shift = 0;
+	while ( (1 << shift)<ES ) shift++;
+
+	int start = func->entry;
+	int end = (int)func->end;
+	int n = end - start;
+	if ( n<=0 ) return false;
+	bool *live = calloc((size_t)n, sizeof(bool));
+	if ( !reachable(vm, start, n, live) ) {
+		free(live);
+		return false;
+	}
+
+	Asm a = {malloc(1024), 0, 1024};
+	int *offsets = malloc(n * sizeof(int));
+	Fixup *fixups = malloc(n * sizeof(Fixup));
+	int *epilogue_jumps = malloc(n * sizeof(int));
+	int nfixups = 0, nret = 0;
+
+	// prologue: save callee-saved registers (5 pushes keep rsp 16-byte aligned)
+	push(&a, RBP);
+	reg2(&a, 0, true, 0x89, RSP, RBP);				// mov rbp, rsp
+	push(&a, RBX);
+	push(&a, R12);
+	push(&a, R13);
+	push(&a, R14);
+	reg2(&a, 0, true, 0x89, RDI, VMREG);
+	reg2(&a, 0, true, 0x89, RSI, LOCALS);
+	mem(&a, 0, true, 0x63, RAX, VMREG, (int)offsetof(VM, sp));	// movsxd rax, [vm->sp]
+	reg2(&a, 0, true, 0xC1, 4, RAX);								// shl rax, shift
+	b1(&a, shift);
+	mem(&a, 0, true, 0x8B, TOP, VMREG, (int)offsetof(VM, stack));	// mov r12, [vm->stack]
+	reg2(&a, 0, true, 0x01, RAX, TOP);								// add r12, rax
+
+	for (int i = 0; i < n; i++) {
+		offsets[i] = a.n;
+		if ( live[i] ) compile(vm, &a, &vm->instrs[start + i], fixups, &nfixups, start, epilogue_jumps, &nret);
+	}
+
+	// epilogue: write back sp and return
+	int epilogue = a.n;
+	reg2(&a, 0, true, 0x89, TOP, RAX);								// mov rax, r12
+	mem(&a, 0, true, 0x2B, RAX, VMREG, (int)offsetof(VM, stack));	// sub rax, [vm->stack]
+	reg2(&a, 0, true, 0xC1, 7, RAX);								// sar rax, shift
+	b1(&a, shift);
+	mem(&a, 0, false, 0x89, RAX, VMREG, (int)offsetof(VM, sp));
+	pop(&a, R14);
+	pop(&a, R13);
+	pop(&a, R12);
+	pop(&a, RBX);
+	pop(&a, RBP);
+	b1(&a, 0xC3);
+
+	for (int j = 0; j < nfixups; j++) patch(&a, fixups[j].pos, offsets[fixups[j].target]);
+	for (int j = 0; j < nret; j++) patch(&a, epilogue_jumps[j], epilogue);
+
+	bool ok = false;
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t size = ((size_t)a.n + page - 1) / page * page;
+	void *code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if ( code!=MAP_FAILED ) {
+		memcpy(code, a.code, (size_t)a.n);
+		if ( mprotect(code, size, PROT_READ | PROT_EXEC)==0 ) {
+			func->native = (void (*)(VM *, element *))code;
+			ok = true;
+		}
+		else munmap(code, size);
+	}
+
+	free(a.code);
+	free(offsets);
+	free(fixups);
+	free(epilogue_jumps);
+	free(live);
+	return ok;
+}
+
+#else
+
+bool jit_compile(VM *vm, Function_metadata *func)
+{
+	return false;
+}
+
+#endif
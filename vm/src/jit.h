@@ -0,0 +1,42 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef JIT_H_
+#define JIT_H_
+
+#include "vm.h"
+
+static const int JIT_THRESHOLD = 10; // default number of calls before a function is compiled
+
+/* Baseline template JIT for x86-64. Each instruction of a function becomes a
+ * fixed sequence of machine code that works on the VM's own operand stack
+ * and activation record, so GC roots and everything else that looks at
+ * vm->stack still works. Simple int, float and boolean instructions plus
+ * loads, stores and branches are compiled inline; the rest call back into C.
+ *
+ * Returns true and sets func->native if func could be compiled. On other
+ * architectures nothing is ever compiled.
+ */
+extern bool jit_compile(VM *vm, Function_metadata *func);
+
+#endif
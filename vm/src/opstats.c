@@ -0,0 +1,154 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <wich.h>
+#include "vm.h"
+#include "opstats.h"
+
+static const int NUM_OPCODES = SCONST_QUICK+1;
+
+// groups of opcodes whose cycles are worth comparing as a whole
+static const char *classes[] = {
+	[HALT] = "control", [NOP] = "control",
+	[IADD] = "int", [ISUB] = "int", [IMUL] = "int", [IDIV] = "int", [INEG] = "int",
+	[OR] = "int", [AND] = "int", [NOT] = "int",
+	[FADD] = "float", [FSUB] = "float", [FMUL] = "float", [FDIV] = "float", [FNEG] = "float",
+	[VADD] = "vector", [VADDI] = "vector", [VADDF] = "vector",
+	[VSUB] = "vector", [VSUBI] = "vector", [VSUBF] = "vector",
+	[VMUL] = "vector", [VMULI] = "vector", [VMULF] = "vector",
+	[VDIV] = "vector", [VDIVI] = "vector", [VDIVF] = "vector",
+	[VEQ] = "vector", [VNEQ] = "vector", [VECTOR] = "vector", [VLOAD_INDEX] = "vector",
+	[STORE_INDEX] = "vector", [VLEN] = "vector", [COPY_VECTOR] = "vector",
+	[SADD] = "string", [SEQ] = "string", [SNEQ] = "string", [SGT] = "string", [SGE] = "string",
+	[SLT] = "string", [SLE] = "string", [SLOAD_INDEX] = "string", [SLEN] = "string",
+	[I2F] = "convert", [F2I] = "convert", [I2S] = "convert", [F2S] = "convert", [V2S] = "convert",
+	[IEQ] = "compare", [INEQ] = "compare", [ILT] = "compare", [ILE] = "compare", [IGT] = "compare", [IGE] = "compare",
+	[FEQ] = "compare", [FNEQ] = "compare", [FLT] = "compare", [FLE] = "compare", [FGT] = "compare", [FGE] = "compare",
+	[BR] = "branch", [BRF] = "branch",
+	[ICONST] = "load/store", [FCONST] = "load/store", [SCONST] = "load/store",
+	[ILOAD] = "load/store", [FLOAD] = "load/store", [VLOAD] = "load/store", [SLOAD] = "load/store",
+	[STORE] = "load/store", [PUSH_DFLT_RETV] = "load/store", [POP] = "load/store",
+	[CALL] = "call", [RET] = "call", [TAIL_CALL] = "call",
+	[IPRINT] = "print", [FPRINT] = "print", [BPRINT] = "print", [SPRINT] = "print", [VPRINT] = "print",
+	[GC_START] = "gc", [GC_END] = "gc", [SROOT] = "gc", [VROOT] = "gc",
+};
+
+Opcode_stats *vm_stats_alloc()
+{
+	return calloc(1, sizeof(Opcode_stats));
+}
+
+// the counting loop runs unfused so only TAIL_CALL shows up past NUM_INSTRS
+static const char *opcode_name(int op)
+{
+	if ( op<NUM_INSTRS ) return vm_instructions[op].name;
+	return op==TAIL_CALL ? "TAIL_CALL" : NULL;
+}
+
+static int opcode_named(const char *name)
+{
+	for (int op = 0; op < NUM_OPCODES; op++) {
+		const char *s = opcode_name(op);
+		if ( s!=NULL && strcmp(s, name)==0 ) return op;
+	}
+	return -1;
+}
+
+static const char *opcode_class(int op)
+{
+	return op<(int)(sizeof(classes)/sizeof(classes[0])) && classes[op]!=NULL ? classes[op] : "other";
+}
+
+void vm_stats_write_csv(Opcode_stats *stats, FILE *f)
+{
+	fprintf(f, "kind,first,second,count,cycles\n");
+	fprintf(f, "runs,,,%" PRIu64 ",\n", stats->runs);
+	for (int op = 0; op < NUM_OPCODES; op++) {
+		if ( stats->count[op]==0 ) continue;
+		fprintf(f, "opcode,%s,,%" PRIu64 ",%" PRIu64 "\n",
+				opcode_name(op), stats->count[op], stats->cycles[op]);
+	}
+	for (int op = 0; op < NUM_OPCODES; op++) {
+		for (int next = 0; next < NUM_OPCODES; next++) {
+			if ( stats->pairs[op][next]==0 ) continue;
+			fprintf(f, "pair,%s,%s,%" PRIu64 ",\n", opcode_name(op), opcode_name(next), stats->pairs[op][next]);
+		}
+	}
+	fprintf(f, "branch,BRF,taken,%" PRIu64 ",\n", stats->brf_taken);
+	fprintf(f, "branch,BRF,not taken,%" PRIu64 ",\n", stats->brf_not_taken);
+	// each class once, in order of its first opcode
+	for (int op = 0; op < NUM_OPCODES; op++) {
+		const char *class = opcode_class(op);
+		bool seen = false;
+		for (int prev = 0; prev < op; prev++) {
+			if ( strcmp(opcode_class(prev), class)==0 ) seen = true;
+		}
+		if ( seen ) continue;
+		uint64_t count = 0, cycles = 0;
+		for (int k = op; k < NUM_OPCODES; k++) {
+			if ( strcmp(opcode_class(k), class)==0 ) {
+				count += stats->count[k];
+				cycles += stats->cycles[k];
+			}
+		}
+		if ( count>0 ) fprintf(f, "class,%s,,%" PRIu64 ",%" PRIu64 "\n", class, count, cycles);
+	}
+}
+
+bool vm_stats_merge_csv(Opcode_stats *stats, FILE *f)
+{
+	char line[200];
+	if ( fgets(line, sizeof(line), f)==NULL ) return true; // empty file; nothing counted yet
+	if ( strncmp(line, "kind,", 5)!=0 ) return false;
+	while ( fgets(line, sizeof(line), f)!=NULL ) {
+		char *field[5];
+		int n = 0;
+		char *p = line;
+		while ( n<5 ) {
+			field[n++] = p;
+			p = strpbrk(p, ",\n");
+			if ( p==NULL || *p=='\n' ) break;
+			*p++ = '\0';
+		}
+		if ( p!=NULL ) *p = '\0';
+		if ( n!=5 ) return false;
+		uint64_t count = strtoull(field[3], NULL, 10);
+		uint64_t cycles = strtoull(field[4], NULL, 10);
+		int first = opcode_named(field[1]);
+		int second = opcode_named(field[2]);
+		if ( strcmp(field[0], "runs")==0 ) stats->runs += count;
+		else if ( strcmp(field[0], "opcode")==0 && first>=0 ) {
+			stats->count[first] += count;
+			stats->cycles[first] += cycles;
+		}
+		else if ( strcmp(field[0], "pair")==0 && first>=0 && second>=0 ) stats->pairs[first][second] += count;
+		else if ( strcmp(field[0], "branch")==0 && strcmp(field[2], "taken")==0 ) stats->brf_taken += count;
+		else if ( strcmp(field[0], "branch")==0 && strcmp(field[2], "not taken")==0 ) stats->brf_not_taken += count;
+		else if ( strcmp(field[0], "class")!=0 ) return false;
+	}
+	return true;
+}
@@ -0,0 +1,99 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef OPSTATS_H_
+#define OPSTATS_H_
+
+#include <stdint.h>
+#include "vm.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define OPSTATS_CLOCK()	__rdtsc()
+#else
+#include <time.h>
+static inline uint64_t opstats_clock()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000000 + (uint64_t)t.tv_nsec;
+}
+#define OPSTATS_CLOCK()	opstats_clock()	// nanoseconds stand in for cycles
+#endif
+
+/* Dynamic instruction statistics. A VM built with -DVM_OPCODE_STATS gets an
+ * extra interpreter loop that, while vm->stats is set, runs every instruction
+ * unfused, like the trace does, and calls vm_stats_count() before each one.
+ * The other loops are compiled exactly as without the option.
+ *
+ * An instruction's cycles run from the time stamp counter read after it was
+ * counted to the one before the next instruction is, so they cover its handler
+ * and the dispatch that follows; good for comparing opcodes and classes of
+ * opcodes rather than as absolute numbers.
+ */
+typedef struct opcode_stats {
+	uint64_t runs;											// programs counted into these stats
+	uint64_t count[SCONST_QUICK+1];							// executions per opcode
+	uint64_t cycles[SCONST_QUICK+1];
+	uint64_t pairs[SCONST_QUICK+1][SCONST_QUICK+1];		// [opcode][opcode executed next]
+	uint64_t brf_taken;
+	uint64_t brf_not_taken;
+
+	int last_op;				// previous instruction, if last_pc!=NULL
+	const Instr *last_pc;
+	uint64_t last_time;
+} Opcode_stats;
+
+extern Opcode_stats *vm_stats_alloc();
+
+/* Add the counts in a CSV file written by vm_stats_write_csv() to stats so
+ * a corpus can be counted one program at a time. Returns false if f has a
+ * row that isn't understood.
+ */
+extern bool vm_stats_merge_csv(Opcode_stats *stats, FILE *f);
+
+/* Rows of kind,first,second,count,cycles for: runs; each opcode executed;
+ * each pair of opcodes executed one after the other; BRF taken and not taken;
+ * and totals per opcode class (ignored when merging).
+ */
+extern void vm_stats_write_csv(Opcode_stats *stats, FILE *f);
+
+static inline void vm_stats_count(Opcode_stats *stats, const Instr *pc)
+{
+	uint64_t now = OPSTATS_CLOCK();
+	int op = pc->super==TAIL_CALL ? TAIL_CALL : pc->opcode;
+	if ( stats->last_pc!=NULL ) {
+		stats->cycles[stats->last_op] += now - stats->last_time;
+		stats->pairs[stats->last_op][op]++;
+		if ( stats->last_op==BRF ) {
+			if ( pc==stats->last_pc+1 ) stats->brf_not_taken++;
+			else stats->brf_taken++;
+		}
+	}
+	stats->count[op]++;
+	stats->last_op = op;
+	stats->last_pc = pc;
+	stats->last_time = OPSTATS_CLOCK();
+}
+
+#endif
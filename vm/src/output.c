@@ -0,0 +1,92 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wich.h>
+#include <format.h>
+#include "vm.h"
+#include "output.h"
+
+// make room for n more chars in vm->out
+static inline void reserve(VM *vm, int n)
+{
+	if ( vm->out_len + n > OUTPUT_BUFFER_SIZE ) vm_flush(vm);
+}
+
+static void write_line(VM *vm, const char *s, size_t n)
+{
+	if ( n>=(size_t)OUTPUT_BUFFER_SIZE ) {
+		vm_flush(vm);
+		fwrite(s, 1, n, stdout);
+		n = 0;
+	}
+	reserve(vm, (int)n + 1);
+	memcpy(&vm->out[vm->out_len], s, n);
+	vm->out_len += (int)n;
+	vm->out[vm->out_len++] = '\n';
+}
+
+void vm_print_int(VM *vm, int i)
+{
+	reserve(vm, FORMAT_INT_SIZE);
+	vm->out_len += format_int(&vm->out[vm->out_len], i);
+	vm->out[vm->out_len++] = '\n'; // where format_int() put the NUL
+}
+
+void vm_print_float(VM *vm, double f)
+{
+	reserve(vm, FORMAT_FLOAT_SIZE);
+	vm->out_len += format_fixed(&vm->out[vm->out_len], f, 2);
+	vm->out[vm->out_len++] = '\n';
+}
+
+void vm_print_string(VM *vm, String *s)
+{
+	if ( s==NULL ) {
+		print_string(s); // reports the error
+		return;
+	}
+	write_line(vm, s->str, s->length);
+}
+
+void vm_print_vector(VM *vm, PVector_ptr v)
+{
+	if ( v.vector==NULL ) {
+		reserve(vm, 2);
+		vm->out[vm->out_len++] = '[';
+		vm->out[vm->out_len++] = ']'; // and no newline, as print_vector() does it
+		return;
+	}
+	size_t n;
+	char *s = format_vector(v, &n);
+	write_line(vm, s, n);
+	free(s);
+}
+
+void vm_flush(VM *vm)
+{
+	fwrite(vm->out, 1, (size_t)vm->out_len, stdout);
+	vm->out_len = 0;
+}
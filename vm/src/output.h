@@ -0,0 +1,42 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+
+#include "vm.h"
+
+/* A VM's stdout. IPRINT, FPRINT, BPRINT, SPRINT and VPRINT format their
+ * values straight into vm->out, on every execution tier, and vm_flush()
+ * hands what has piled up to stdout with one fwrite. vm_exec() flushes when
+ * the program halts and the print functions flush when vm->out is full.
+ * Messages on stderr are not held back, so they can come out ahead of
+ * output printed before them.
+ */
+extern void vm_print_int(VM *vm, int i);
+extern void vm_print_float(VM *vm, double f);
+extern void vm_print_string(VM *vm, String *s);
+extern void vm_print_vector(VM *vm, PVector_ptr v);
+extern void vm_flush(VM *vm);
+
+#endif
@@ -0,0 +1,237 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <wich.h>
+#include "vm.h"
+#include "profiler.h"
+
+static const int MAX_PROFILE_DEPTH = 64;			// innermost frames kept per sample
+static const int PROFILE_BUFFER_SIZE = 4*1024*1024;	// ints; about a million samples of shallow stacks
+static const int MAX_HOT_INSTRS = 20;				// instructions listed by the summary
+
+/* Samples are packed into one int buffer allocated before the timer starts
+ * since the signal handler must not call malloc. Each is recorded as
+ *
+ *	depth ip func_0 .. func_depth-1
+ *
+ * where the funcs are indexes into vm->functions, outermost first, or -1 for
+ * a frame whose function wasn't set yet when the signal came in.
+ */
+static VM *volatile profiled;
+static int *samples;
+static volatile int samples_size;	// ints of samples in use
+static volatile int num_samples;
+static volatile int dropped;		// samples lost to a full buffer
+static struct sigaction saved_action;
+
+static int *sort_key;				// for qsort comparators that rank by count
+
+static void sample(int sig)
+{
+	VM *vm = profiled;
+	if ( vm==NULL || vm->callsp<0 ) return;
+	int depth = vm->callsp+1;
+	if ( depth>MAX_PROFILE_DEPTH ) depth = MAX_PROFILE_DEPTH;
+	if ( samples_size+2+depth>PROFILE_BUFFER_SIZE ) {
+		dropped++;
+		return;
+	}
+	int *s = &samples[samples_size];
+	const Instr *pc = vm->profile_pc;
+	s[0] = depth;
+	s[1] = pc!=NULL ? (int)(pc - vm->instrs) : -1;
+	int bottom = vm->callsp - depth + 1;
+	for (int k = 0; k < depth; k++) {
+		Function_metadata *func = vm->call_stack[bottom+k].func;
+		s[2+k] = func!=NULL ? (int)(func - vm->functions) : -1;
+	}
+	samples_size += 2+depth;
+	num_samples++;
+}
+
+bool vm_profile_start(VM *vm, int hz)
+{
+	if ( profiled!=NULL || hz<=0 ) return false;
+	if ( samples==NULL ) samples = malloc(PROFILE_BUFFER_SIZE * sizeof(int));
+	if ( samples==NULL ) return false;
+	samples_size = 0;
+	num_samples = 0;
+	dropped = 0;
+	vm->profile_pc = NULL;
+	vm->profiling = true;
+	profiled = vm;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = sample;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGPROF, &action, &saved_action);
+
+	long usec = 1000000 / hz;
+	if ( usec==0 ) usec = 1;
+	struct itimerval timer = {{0, usec}, {0, usec}};
+	setitimer(ITIMER_PROF, &timer, NULL);
+	return true;
+}
+
+void vm_profile_stop(VM *vm)
+{
+	if ( profiled!=vm ) return;
+	struct itimerval off = {{0, 0}, {0, 0}};
+	setitimer(ITIMER_PROF, &off, NULL);
+	sigaction(SIGPROF, &saved_action, NULL);
+	profiled = NULL;
+	vm->profiling = false;
+	vm->profile_pc = NULL;
+}
+
+int vm_profile_samples() { return num_samples; }
+
+static char *function_name(VM *vm, int f)
+{
+	return f>=0 ? vm->functions[f].name : "[unknown]";
+}
+
+// offsets into samples of each sample in the order they were taken
+static int *sample_offsets()
+{
+	int *offsets = malloc((num_samples+1) * sizeof(int));
+	int p = 0;
+	for (int n = 0; n < num_samples; n++) {
+		offsets[n] = p;
+		p += 2+samples[p];
+	}
+	return offsets;
+}
+
+static int compare_stacks(const void *a, const void *b)
+{
+	const int *x = &samples[*(const int *)a];
+	const int *y = &samples[*(const int *)b];
+	int n = x[0]<y[0] ? x[0] : y[0];
+	for (int k = 0; k < n; k++) {
+		if ( x[2+k]!=y[2+k] ) return x[2+k]<y[2+k] ? -1 : 1;
+	}
+	return x[0] - y[0];
+}
+
+// highest count first, then lowest index so output is stable
+static int compare_counts(const void *a, const void *b)
+{
+	int i = *(const int *)a, j = *(const int *)b;
+	if ( sort_key[i]!=sort_key[j] ) return sort_key[j] - sort_key[i];
+	return i - j;
+}
+
+void vm_profile_write_folded(VM *vm, FILE *f)
+{
+	int *offsets = sample_offsets();
+	qsort(offsets, (size_t)num_samples, sizeof(int), compare_stacks);
+	for (int i = 0; i < num_samples; ) {
+		int j = i+1;
+		while ( j<num_samples && compare_stacks(&offsets[i], &offsets[j])==0 ) j++;
+		const int *s = &samples[offsets[i]];
+		for (int k = 0; k < s[0]; k++) {
+			fprintf(f, "%s%s", k>0 ? ";" : "", function_name(vm, s[2+k]));
+		}
+		fprintf(f, " %d\n", j-i);
+		i = j;
+	}
+	free(offsets);
+}
+
+void vm_profile_write_summary(VM *vm, FILE *f)
+{
+	int nf = vm->num_functions;
+	int *self = calloc((size_t)nf+1, sizeof(int));	// slot nf counts [unknown]
+	int *total = calloc((size_t)nf+1, sizeof(int));
+	int *counted = malloc(((size_t)nf+1) * sizeof(int)); // sample that last added to total; recursion counts once
+	int *end = malloc(((size_t)nf+1) * sizeof(int));
+	int *hits = calloc((size_t)vm->num_instrs+1, sizeof(int));
+	int *order = malloc(((size_t)vm->num_instrs+nf+1) * sizeof(int));
+	for (int k = 0; k < nf; k++) end[k] = (int)vm->functions[k].end;
+	for (int k = 0; k <= nf; k++) counted[k] = -1;
+
+	int elsewhere = 0; // leaf running as native code or on the register tier
+	int p = 0;
+	for (int n = 0; n < num_samples; n++) {
+		int depth = samples[p], ip = samples[p+1];
+		int *funcs = &samples[p+2];
+		for (int k = 0; k < depth; k++) {
+			int slot = funcs[k]>=0 ? funcs[k] : nf;
+			if ( counted[slot]!=n ) {
+				total[slot]++;
+				counted[slot] = n;
+			}
+		}
+		int leaf = funcs[depth-1];
+		self[leaf>=0 ? leaf : nf]++;
+		// the interpreter may be executing a caller of a compiled leaf
+		if ( leaf>=0 && ip>=(int)vm->functions[leaf].entry && ip<end[leaf] ) hits[ip]++;
+		else elsewhere++;
+		p += 2+depth;
+	}
+
+	double percent = num_samples>0 ? 100.0 / num_samples : 0.0;
+	fprintf(f, "%d samples", num_samples);
+	if ( dropped>0 ) fprintf(f, " (%d dropped)", dropped);
+	fprintf(f, "\n%7s %7s  %s\n", "self", "total", "function");
+	int m = 0;
+	for (int k = 0; k <= nf; k++) if ( total[k]>0 ) order[m++] = k;
+	sort_key = self;
+	qsort(order, (size_t)m, sizeof(int), compare_counts);
+	for (int k = 0; k < m; k++) {
+		int slot = order[k];
+		fprintf(f, "%6.1f%% %6.1f%%  %s\n", self[slot]*percent, total[slot]*percent,
+				function_name(vm, slot<nf ? slot : -1));
+	}
+
+	fprintf(f, "hottest instructions:\n");
+	m = 0;
+	for (int k = 0; k < vm->num_instrs; k++) if ( hits[k]>0 ) order[m++] = k;
+	sort_key = hits;
+	qsort(order, (size_t)m, sizeof(int), compare_counts);
+	for (int k = 0; k < m && k < MAX_HOT_INSTRS; k++) {
+		Instr *I = &vm->instrs[order[k]];
+		int func = -1;
+		for (int g = 0; g < nf; g++) {
+			if ( order[k]>=(int)vm->functions[g].entry && order[k]<end[g] ) func = g;
+		}
+		fprintf(f, "%6.1f%%  %-16s %04d: %s\n", hits[order[k]]*percent, function_name(vm, func),
+				I->offset, vm_instructions[I->opcode].name);
+	}
+	if ( elsewhere>0 ) fprintf(f, "%6.1f%%  not interpreted\n", elsewhere*percent);
+
+	free(self);
+	free(total);
+	free(counted);
+	free(end);
+	free(hits);
+	free(order);
+}
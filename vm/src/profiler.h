@@ -0,0 +1,53 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include "vm.h"
+
+static const int PROFILE_HZ = 1000;	// default samples per second of CPU time
+
+/* Sampling profiler. While it is on, a SIGPROF timer interrupts the program
+ * hz times per second of CPU time and the handler copies the functions on
+ * vm->call_stack plus the instruction the interpreter is executing into a
+ * buffer allocated up front. vm_exec() interprets with a loop that publishes
+ * its pc only while vm->profiling is set, so a VM that isn't being profiled
+ * runs exactly the code it always did.
+ *
+ * The ip of a sample is -1 if the innermost function was running as native
+ * code or on the register tier. Only one VM at a time can be profiled.
+ */
+extern bool vm_profile_start(VM *vm, int hz);
+extern void vm_profile_stop(VM *vm);
+extern int vm_profile_samples();
+
+/* One line per distinct call stack, outermost function first, followed by
+ * the number of samples: the folded format flamegraph.pl reads.
+ */
+extern void vm_profile_write_folded(VM *vm, FILE *f);
+
+/* Self and total samples per function and the hottest instructions. */
+extern void vm_profile_write_summary(VM *vm, FILE *f);
+
+#endif
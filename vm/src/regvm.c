@@ -0,0 +1,808 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <wich.h>
+#include "vm.h"
+#include "dispatch.h"
+#include "regvm.h"
+#include "output.h"
+
+static char *reg_opcode_names[] = {
+	"MOV", "ICONST", "FCONST",
+	"IADD", "ISUB", "IMUL", "IDIV", "IADDK",
+	"FADD", "FSUB", "FMUL", "FDIV",
+	"OR", "AND",
+	"INEG", "FNEG", "NOT", "I2F", "F2I",
+	"IEQ", "INEQ", "ILT", "ILE", "IGT", "IGE",
+	"FEQ", "FNEQ", "FLT", "FLE", "FGT", "FGE",
+	"BR", "BRF",
+	"IEQ_BRF", "INEQ_BRF", "ILT_BRF", "ILE_BRF", "IGT_BRF", "IGE_BRF",
+	"IEQK_BRF", "INEQK_BRF", "ILTK_BRF", "ILEK_BRF", "IGTK_BRF", "IGEK_BRF",
+	"FEQ_BRF", "FNEQ_BRF", "FLT_BRF", "FLE_BRF", "FGT_BRF", "FGE_BRF",
+	"CALL", "TAIL_CALL", "RET", "RETV",
+	"IPRINT", "FPRINT", "BPRINT"
+};
+
+typedef enum { OPND_REG, OPND_INT, OPND_FLOAT } Operand_kind;
+
+// What the translator knows about an operand stack slot: either the value
+// is in a register (a local or the slot's own home register) or it's a
+// constant that hasn't been loaded anywhere yet.
+typedef struct {
+	Operand_kind kind;
+	int reg;
+	int i;
+	double f;
+} Operand;
+
+typedef struct {
+	VM *vm;
+	Function_metadata *func;
+	int start, end;		// func's instrs are vm->instrs[start..end-1]
+	int nlocals;		// args + locals
+	int *depth;			// operand stack depth before each instr or -1 if unreachable
+	bool *leader;		// branch target
+	int *label;			// index of first register instr for each instr
+	Operand *stack;
+	int sp;				// number of operands on stack
+	RInstr *code;
+	int *targets;		// instr index each emitted branch goes to, -1 if not a branch
+	int n;
+	int max;
+	int last_result;	// index of emitted instr computing the top operand into its home or -1
+} Translator;
+
+static element reg_exec(VM *vm, RFunction *rf, element *r, int size);
+static element reg_call(VM *vm, RFunction *rf, element *args);
+
+static bool value_type(int type)
+{
+	return type==INT_TYPE || type==FLOAT_TYPE || type==BOOLEAN_TYPE;
+}
+
+/* Compute the operand stack depth before each reachable instruction of the
+ * function and check that every instruction is one we can translate. Returns
+ * false if the function has to stay on the stack interpreter.
+ */
+static bool reg_analyze(Translator *t, int *maxdepth)
+{
+	VM *vm = t->vm;
+	int n = t->end - t->start;
+	int *work = malloc((n+1) * sizeof(int));
+	int nwork = 0;
+	bool ok = true;
+
+	*maxdepth = 0;
+	t->depth[0] = 0;
+	work[nwork++] = 0;
+	while ( ok && nwork>0 ) {
+		int i = work[--nwork];
+		Instr *I = &vm->instrs[t->start + i];
+		int d = t->depth[i];
+		int pops = 0, pushes = 0;
+		bool falls_through = true;
+		int target = -1;
+		switch ( I->opcode ) {
+			case IADD: case ISUB: case IMUL: case IDIV:
+			case FADD: case FSUB: case FMUL: case FDIV:
+			case OR: case AND:
+			case IEQ: case INEQ: case ILT: case ILE: case IGT: case IGE:
+			case FEQ: case FNEQ: case FLT: case FLE: case FGT: case FGE:
+				pops = 2; pushes = 1;
+				break;
+			case INEG: case FNEG: case NOT: case I2F: case F2I:
+				pops = 1; pushes = 1;
+				break;
+			case ICONST: case FCONST:
+				pushes = 1;
+				break;
+			case ILOAD: case FLOAD:
+				if ( I->a.i<0 || I->a.i>=t->nlocals ) ok = false;
+				pushes = 1;
+				break;
+			case STORE:
+				if ( I->a.i<0 || I->a.i>=t->nlocals ) ok = false;
+				pops = 1;
+				break;
+			case POP: case IPRINT: case FPRINT: case BPRINT:
+				pops = 1;
+				break;
+			case PUSH_DFLT_RETV:
+				if ( t->func->return_type!=VOID_TYPE ) pushes = 1;
+				break;
+			case CALL:
+				if ( I->a.func<vm->functions || I->a.func>=&vm->functions[vm->num_functions] ) ok = false;
+				else {
+					pops = I->a.func->nargs;
+					if ( I->a.func->return_type!=VOID_TYPE ) pushes = 1;
+					if ( I->a.func->return_type!=VOID_TYPE && !value_type(I->a.func->return_type) ) ok = false;
+				}
+				break;
+			case RET:
+				pops = t->func->return_type!=VOID_TYPE ? 1 : 0;
+				if ( d!=pops ) ok = false; // anything else left on the stack would leak into the caller
+				falls_through = false;
+				break;
+			case HALT:
+				if ( strcmp(t->func->name, "main")!=0 ) ok = false;
+				falls_through = false;
+				break;
+			case BR:
+				falls_through = false;
+				// fall through
+			case BRF:
+				if ( I->opcode==BRF ) pops = 1;
+				target = (int)(I->a.target - vm->instrs) - t->start;
+				if ( target<0 || target>=n ) ok = false;
+				break;
+			case NOP: case GC_START: case GC_END:
+				break;
+			default:
+				ok = false;
+				break;
+		}
+		if ( !ok ) break;
+		if ( d-pops<0 ) { ok = false; break; }
+		d = d - pops + pushes;
+		if ( d>*maxdepth ) *maxdepth = d;
+
+		int succ[2] = {falls_through ? i+1 : -1, target};
+		for (int s = 0; s < 2; s++) {
+			int j = succ[s];
+			if ( j<0 ) continue;
+			if ( j>=n ) { ok = false; break; } // falls off the end of the function
+			if ( s==1 ) t->leader[j] = true;
+			if ( t->depth[j]<0 ) {
+				t->depth[j] = d;
+				work[nwork++] = j;
+			}
+			else if ( t->depth[j]!=d ) { ok = false; break; }
+		}
+	}
+	free(work);
+	return ok;
+}
+
+static int home(Translator *t, int d) { return t->nlocals + d; }
+
+static RInstr *emit(Translator *t, REG_OPCODE op, int a, int b, int c)
+{
+	if ( t->n==t->max ) {
+		t->max *= 2;
+		t->code = realloc(t->code, t->max * sizeof(RInstr));
+		t->targets = realloc(t->targets, t->max * sizeof(int));
+	}
+	RInstr *R = &t->code[t->n];
+	memset(R, 0, sizeof(RInstr));
+	R->opcode = (short)op;
+	R->a = (short)a;
+	R->b = (short)b;
+	R->c = (short)c;
+	t->targets[t->n] = -1;
+	t->n++;
+	t->last_result = -1;
+	return R;
+}
+
+static void emit_branch(Translator *t, REG_OPCODE op, int b, int c, int target)
+{
+	emit(t, op, 0, b, c);
+	t->targets[t->n-1] = target;
+}
+
+// load constant e into register reg
+static void emit_load(Translator *t, int reg, Operand e)
+{
+	if ( e.kind==OPND_INT ) emit(t, R_ICONST, reg, 0, 0)->k = e.i;
+	else if ( e.kind==OPND_FLOAT ) emit(t, R_FCONST, reg, 0, 0)->x.f = e.f;
+	else if ( e.reg!=reg ) emit(t, R_MOV, reg, e.reg, 0);
+}
+
+// make sure the operand at depth d is in its home register
+static void materialize(Translator *t, int d)
+{
+	Operand *e = &t->stack[d];
+	if ( e->kind==OPND_REG && e->reg==home(t, d) ) return;
+	emit_load(t, home(t, d), *e);
+	e->kind = OPND_REG;
+	e->reg = home(t, d);
+}
+
+// put all operands in their home registers as expected at branch targets and calls
+static void flush(Translator *t)
+{
+	for (int d = 0; d < t->sp; d++) materialize(t, d);
+}
+
+// register holding the operand at depth d, loading it into its home if it's a constant
+static int reg(Translator *t, int d)
+{
+	if ( t->stack[d].kind!=OPND_REG ) materialize(t, d);
+	return t->stack[d].reg;
+}
+
+static void push_reg(Translator *t, int r)
+{
+	Operand e = {OPND_REG, r, 0, 0.0};
+	t->stack[t->sp++] = e;
+}
+
+static void push_int(Translator *t, int i)
+{
+	Operand e = {OPND_INT, 0, i, 0.0};
+	t->stack[t->sp++] = e;
+}
+
+static void push_float(Translator *t, double f)
+{
+	Operand e = {OPND_FLOAT, 0, 0, f};
+	t->stack[t->sp++] = e;
+}
+
+// emit r[home] = r[b] op r[c] for the two operands on top and push the result
+static void binary(Translator *t, REG_OPCODE op)
+{
+	int d = t->sp - 2;
+	int b = reg(t, d);
+	int c = reg(t, d+1);
+	t->sp -= 2;
+	emit(t, op, home(t, d), b, c);
+	push_reg(t, home(t, d));
+	t->last_result = t->n - 1;
+}
+
+static void unary(Translator *t, REG_OPCODE op)
+{
+	int d = t->sp - 1;
+	int b = reg(t, d);
+	t->sp--;
+	emit(t, op, home(t, d), b, 0);
+	push_reg(t, home(t, d));
+	t->last_result = t->n - 1;
+}
+
+static REG_OPCODE swap_compare(REG_OPCODE op)
+{
+	switch ( op ) {
+		case R_ILT_BRF : return R_IGT_BRF;
+		case R_ILE_BRF : return R_IGE_BRF;
+		case R_IGT_BRF : return R_ILT_BRF;
+		case R_IGE_BRF : return R_ILE_BRF;
+		default : return op;
+	}
+}
+
+/* Translate a compare followed by BRF into one compare-and-branch. Integer
+ * comparisons against a constant use the immediate form.
+ */
+static void compare_branch(Translator *t, REG_OPCODE op, bool is_int, int target)
+{
+	int d = t->sp - 2;
+	t->sp -= 2;
+	flush(t); // rest of the stack goes home before branching
+	t->sp += 2;
+	int x = d, y = d+1;
+	if ( is_int && t->stack[x].kind==OPND_INT && t->stack[y].kind!=OPND_INT ) {
+		op = swap_compare(op);
+		x = d+1; y = d;
+	}
+	if ( is_int && t->stack[y].kind==OPND_INT ) {
+		emit_branch(t, (REG_OPCODE)(op - R_IEQ_BRF + R_IEQK_BRF), reg(t, x), 0, target);
+		t->code[t->n-1].k = t->stack[y].i;
+	}
+	else {
+		int b = reg(t, x);
+		int c = reg(t, y);
+		emit_branch(t, op, b, c, target);
+	}
+	t->sp -= 2;
+}
+
+static void store(Translator *t, int local)
+{
+	int d = t->sp - 1;
+	// operands still referring to the old value of local need their own copy
+	for (int j = 0; j < d; j++) {
+		if ( t->stack[j].kind==OPND_REG && t->stack[j].reg==local ) materialize(t, j);
+	}
+	Operand e = t->stack[d];
+	if ( e.kind==OPND_REG && e.reg==home(t, d) && t->last_result==t->n-1 ) {
+		t->code[t->n-1].a = (short)local; // compute directly into local
+		t->last_result = -1;
+	}
+	else {
+		emit_load(t, local, e);
+	}
+	t->sp--;
+}
+
+static REG_OPCODE reg_opcode(BYTECODE op)
+{
+	switch ( op ) {
+		case IADD : return R_IADD;
+		case ISUB : return R_ISUB;
+		case IMUL : return R_IMUL;
+		case IDIV : return R_IDIV;
+		case FADD : return R_FADD;
+		case FSUB : return R_FSUB;
+		case FMUL : return R_FMUL;
+		case FDIV : return R_FDIV;
+		case OR   : return R_OR;
+		case AND  : return R_AND;
+		case INEG : return R_INEG;
+		case FNEG : return R_FNEG;
+		case NOT  : return R_NOT;
+		case I2F  : return R_I2F;
+		case F2I  : return R_F2I;
+		case IEQ  : return R_IEQ;
+		case INEQ : return R_INEQ;
+		case ILT  : return R_ILT;
+		case ILE  : return R_ILE;
+		case IGT  : return R_IGT;
+		case IGE  : return R_IGE;
+		case FEQ  : return R_FEQ;
+		case FNEQ : return R_FNEQ;
+		case FLT  : return R_FLT;
+		case FLE  : return R_FLE;
+		case FGT  : return R_FGT;
+		case FGE  : return R_FGE;
+		default   : return R_MOV;
+	}
+}
+
+static void translate(Translator *t)
+{
+	VM *vm = t->vm;
+	int n = t->end - t->start;
+	bool live = true; // can the previous instruction fall through to this one?
+
+	for (int i = 0; i < n; i++) {
+		if ( t->depth[i]<0 ) { live = false; continue; }
+		if ( t->leader[i] ) {
+			if ( live ) flush(t);
+			t->sp = t->depth[i];
+			for (int d = 0; d < t->sp; d++) {
+				t->stack[d].kind = OPND_REG;
+				t->stack[d].reg = home(t, d);
+			}
+			t->last_result = -1;
+		}
+		t->label[i] = t->n;
+		live = true;
+
+		Instr *I = &vm->instrs[t->start + i];
+		Instr *next = i+1 < n && t->depth[i+1]>=0 && !t->leader[i+1] ? I + 1 : NULL;
+		Operand *top = t->sp>0 ? &t->stack[t->sp-1] : NULL;
+		switch ( I->opcode ) {
+			case IADD:
+				if ( top->kind==OPND_INT ) {
+					int k = top->i;
+					t->sp--;
+					unary(t, R_IADDK);
+					t->code[t->n-1].k = k;
+				}
+				else binary(t, R_IADD);
+				break;
+			case ISUB:
+				if ( top->kind==OPND_INT && top->i!=INT_MIN ) {
+					int k = -top->i;
+					t->sp--;
+					unary(t, R_IADDK);
+					t->code[t->n-1].k = k;
+				}
+				else binary(t, R_ISUB);
+				break;
+			case IEQ: case INEQ: case ILT: case ILE: case IGT: case IGE:
+				if ( next!=NULL && next->opcode==BRF ) {
+					compare_branch(t, (REG_OPCODE)(R_IEQ_BRF + I->opcode - IEQ), true,
+								   (int)(next->a.target - vm->instrs) - t->start);
+					t->label[++i] = t->n;
+				}
+				else binary(t, reg_opcode((BYTECODE)I->opcode));
+				break;
+			case FEQ: case FNEQ: case FLT: case FLE: case FGT: case FGE:
+				if ( next!=NULL && next->opcode==BRF ) {
+					compare_branch(t, (REG_OPCODE)(R_FEQ_BRF + I->opcode - FEQ), false,
+								   (int)(next->a.target - vm->instrs) - t->start);
+					t->label[++i] = t->n;
+				}
+				else binary(t, reg_opcode((BYTECODE)I->opcode));
+				break;
+			case IMUL: case IDIV: case FADD: case FSUB: case FMUL: case FDIV: case OR: case AND:
+				binary(t, reg_opcode((BYTECODE)I->opcode));
+				break;
+			case I2F:
+				if ( top->kind==OPND_INT ) {
+					top->kind = OPND_FLOAT;
+					top->f = top->i;
+				}
+				else unary(t, R_I2F);
+				break;
+			case F2I:
+				if ( top->kind==OPND_FLOAT ) {
+					top->kind = OPND_INT;
+					top->i = (int)top->f;
+				}
+				else unary(t, R_F2I);
+				break;
+			case INEG:
+				if ( top->kind==OPND_INT ) top->i = -top->i;
+				else unary(t, R_INEG);
+				break;
+			case FNEG:
+				if ( top->kind==OPND_FLOAT ) top->f = -top->f;
+				else unary(t, R_FNEG);
+				break;
+			case NOT:
+				unary(t, R_NOT);
+				break;
+			case ICONST:
+				push_int(t, I->a.i);
+				break;
+			case FCONST:
+				push_float(t, I->a.f);
+				break;
+			case ILOAD:
+			case FLOAD:
+				push_reg(t, I->a.i);
+				break;
+			case STORE:
+				store(t, I->a.i);
+				break;
+			case POP:
+				t->sp--;
+				break;
+			case PUSH_DFLT_RETV:
+				if ( t->func->return_type==INT_TYPE ) push_int(t, DEFAULT_INT_VALUE);
+				else if ( t->func->return_type==FLOAT_TYPE ) push_float(t, DEFAULT_FLOAT_VALUE);
+				else if ( t->func->return_type==BOOLEAN_TYPE ) push_int(t, DEFAULT_BOOLEAN_VALUE);
+				break;
+			case BR:
+				flush(t);
+				emit_branch(t, R_BR, 0, 0, (int)(I->a.target - vm->instrs) - t->start);
+				live = false;
+				break;
+			case BRF: {
+				int b = reg(t, t->sp-1);
+				t->sp--;
+				flush(t);
+				emit_branch(t, R_BRF, b, 0, (int)(I->a.target - vm->instrs) - t->start);
+				break;
+			}
+			case CALL: {
+				Function_metadata *func = I->a.func;
+				flush(t);
+				int base = t->sp - func->nargs;
+				emit(t, I->super==TAIL_CALL ? R_TAIL_CALL : R_CALL, home(t, base), 0, 0)->x.func = func;
+				t->sp = base;
+				if ( func->return_type!=VOID_TYPE ) push_reg(t, home(t, base));
+				break;
+			}
+			case RET:
+				if ( t->func->return_type!=VOID_TYPE ) {
+					emit(t, R_RET, 0, reg(t, t->sp-1), 0);
+					t->sp--;
+				}
+				else emit(t, R_RETV, 0, 0, 0);
+				live = false;
+				break;
+			case HALT:
+				emit(t, R_RETV, 0, 0, 0);
+				live = false;
+				break;
+			case IPRINT:
+			case FPRINT:
+			case BPRINT:
+				emit(t, I->opcode==IPRINT ? R_IPRINT : I->opcode==FPRINT ? R_FPRINT : R_BPRINT,
+					 0, reg(t, t->sp-1), 0);
+				t->sp--;
+				break;
+			default: // NOP, GC_START, GC_END; registers aren't GC roots
+				break;
+		}
+	}
+}
+
+/* Translate func to register form or return NULL if it uses anything the
+ * register tier doesn't support.
+ */
+RFunction *reg_translate_function(VM *vm, Function_metadata *func)
+{
+	int start = func->entry;
+	int end = (int)func->end;
+	if ( start>=end ) return NULL;
+
+	Translator t;
+	memset(&t, 0, sizeof(Translator));
+	int n = end - start;
+	t.vm = vm;
+	t.func = func;
+	t.start = start;
+	t.end = end;
+	t.nlocals = func->nargs + func->nlocals;
+	t.depth = malloc(n * sizeof(int));
+	t.leader = calloc((size_t)n, sizeof(bool));
+	t.label = malloc(n * sizeof(int));
+	for (int i = 0; i < n; i++) t.depth[i] = -1;
+
+	RFunction *rf = NULL;
+	int maxdepth;
+	if ( value_type(func->return_type) || func->return_type==VOID_TYPE ) {
+		if ( func->nargs>=0 && func->nlocals>=0 && reg_analyze(&t, &maxdepth) && t.nlocals+maxdepth<SHRT_MAX ) {
+			t.stack = malloc((maxdepth+1) * sizeof(Operand));
+			t.max = n;
+			t.code = malloc(t.max * sizeof(RInstr));
+			t.targets = malloc(t.max * sizeof(int));
+			t.last_result = -1;
+			translate(&t);
+
+			rf = calloc(1, sizeof(RFunction));
+			rf->func = func;
+			rf->nregs = t.nlocals + maxdepth + 1; // a void CALL with no args names the slot just above the stack
+			rf->ninstrs = t.n;
+			rf->code = t.code;
+			for (int j = 0; j < t.n; j++) {
+				if ( t.targets[j]>=0 ) rf->code[j].x.target = &rf->code[t.label[t.targets[j]]];
+			}
+			free(t.stack);
+			free(t.targets);
+		}
+	}
+	free(t.depth);
+	free(t.leader);
+	free(t.label);
+	return rf;
+}
+
+/* Translate every function that the register tier can run and hook it into
+ * the function table; returns how many were translated.
+ */
+int reg_translate(VM *vm)
+{
+	int n = 0;
+	for (int i = 0; i < vm->num_functions; i++) {
+		Function_metadata *func = &vm->functions[i];
+		func->regcode = reg_translate_function(vm, func);
+		if ( func->regcode!=NULL ) n++;
+	}
+	return n;
+}
+
+/* Called by the stack interpreter to run a translated function; pops the
+ * args off the operand stack and pushes the result if any.
+ */
+void vm_regcall(VM *vm, Function_metadata *func)
+{
+	element *args = &vm->stack[vm->sp - func->nargs + 1];
+	vm->sp -= func->nargs;
+	element result = reg_call(vm, func->regcode, args);
+	if ( func->return_type!=VOID_TYPE ) vm->stack[++vm->sp] = result;
+}
+
+/* Run rf in registers of its own on the C stack; callers keep the nesting
+ * within MAX_NATIVE_DEPTH.
+ */
+static element reg_call(VM *vm, RFunction *rf, element *args)
+{
+	Function_metadata *func = rf->func;
+	element r[rf->nregs];
+	memcpy(r, args, func->nargs * sizeof(element));
+	memset(&r[func->nargs], 0, (rf->nregs - func->nargs) * sizeof(element));
+	if ( vm->callsp+1>=MAX_CALL_STACK ) {
+		vm_flush(vm);
+		fprintf(stderr, "stack overflow calling %s\n", func->name);
+		exit(1);
+	}
+	Activation_Record *frame = &vm->call_stack[++vm->callsp];
+	frame->func = func; // keep call stack complete for anybody looking at it
+	frame->fp = -1;     // args and locals are in registers
+	frame->elided = 0;
+	vm->native_depth++;
+	element result = reg_exec(vm, rf, r, rf->nregs);
+	vm->native_depth--;
+	vm->callsp--;
+	return result;
+}
+
+// r has room for size registers
+static element reg_exec(VM *vm, RFunction *rf, element *r, int size)
+{
+	Function_metadata *func;
+	Activation_Record *frame;
+	element result;
+	register const RInstr *pc;
+
+enter:
+	pc = rf->code;
+
+#ifdef VM_THREADED_DISPATCH
+	static const void *const dispatch[] = {
+		[R_MOV] = &&do_R_MOV, [R_ICONST] = &&do_R_ICONST, [R_FCONST] = &&do_R_FCONST,
+		[R_IADD] = &&do_R_IADD, [R_ISUB] = &&do_R_ISUB, [R_IMUL] = &&do_R_IMUL, [R_IDIV] = &&do_R_IDIV,
+		[R_IADDK] = &&do_R_IADDK,
+		[R_FADD] = &&do_R_FADD, [R_FSUB] = &&do_R_FSUB, [R_FMUL] = &&do_R_FMUL, [R_FDIV] = &&do_R_FDIV,
+		[R_OR] = &&do_R_OR, [R_AND] = &&do_R_AND,
+		[R_INEG] = &&do_R_INEG, [R_FNEG] = &&do_R_FNEG, [R_NOT] = &&do_R_NOT, [R_I2F] = &&do_R_I2F, [R_F2I] = &&do_R_F2I,
+		[R_IEQ] = &&do_R_IEQ, [R_INEQ] = &&do_R_INEQ, [R_ILT] = &&do_R_ILT, [R_ILE] = &&do_R_ILE,
+		[R_IGT] = &&do_R_IGT, [R_IGE] = &&do_R_IGE,
+		[R_FEQ] = &&do_R_FEQ, [R_FNEQ] = &&do_R_FNEQ, [R_FLT] = &&do_R_FLT, [R_FLE] = &&do_R_FLE,
+		[R_FGT] = &&do_R_FGT, [R_FGE] = &&do_R_FGE,
+		[R_BR] = &&do_R_BR, [R_BRF] = &&do_R_BRF,
+		[R_IEQ_BRF] = &&do_R_IEQ_BRF, [R_INEQ_BRF] = &&do_R_INEQ_BRF, [R_ILT_BRF] = &&do_R_ILT_BRF,
+		[R_ILE_BRF] = &&do_R_ILE_BRF, [R_IGT_BRF] = &&do_R_IGT_BRF, [R_IGE_BRF] = &&do_R_IGE_BRF,
+		[R_IEQK_BRF] = &&do_R_IEQK_BRF, [R_INEQK_BRF] = &&do_R_INEQK_BRF, [R_ILTK_BRF] = &&do_R_ILTK_BRF,
+		[R_ILEK_BRF] = &&do_R_ILEK_BRF, [R_IGTK_BRF] = &&do_R_IGTK_BRF, [R_IGEK_BRF] = &&do_R_IGEK_BRF,
+		[R_FEQ_BRF] = &&do_R_FEQ_BRF, [R_FNEQ_BRF] = &&do_R_FNEQ_BRF, [R_FLT_BRF] = &&do_R_FLT_BRF,
+		[R_FLE_BRF] = &&do_R_FLE_BRF, [R_FGT_BRF] = &&do_R_FGT_BRF, [R_FGE_BRF] = &&do_R_FGE_BRF,
+		[R_CALL] = &&do_R_CALL, [R_TAIL_CALL] = &&do_R_TAIL_CALL, [R_RET] = &&do_R_RET, [R_RETV] = &&do_R_RETV,
+		[R_IPRINT] = &&do_R_IPRINT, [R_FPRINT] = &&do_R_FPRINT, [R_BPRINT] = &&do_R_BPRINT
+	};
+	if ( !rf->threaded ) {
+		for (int j = 0; j < rf->ninstrs; j++) rf->code[j].handler = dispatch[rf->code[j].opcode];
+		rf->threaded = true;
+	}
+
+	DISPATCH;
+#else
+	for (;;) {
+		switch (pc->opcode) {
+#endif
+			CASE(R_MOV)		r[pc->a] = r[pc->b];						NEXT;
+			CASE(R_ICONST)	r[pc->a] = (element){.i = pc->k};			NEXT;
+			CASE(R_FCONST)	r[pc->a].f = pc->x.f;						NEXT;
+			CASE(R_IADD)	r[pc->a].i = r[pc->b].i + r[pc->c].i;		NEXT;
+			CASE(R_ISUB)	r[pc->a].i = r[pc->b].i - r[pc->c].i;		NEXT;
+			CASE(R_IMUL)	r[pc->a].i = r[pc->b].i * r[pc->c].i;		NEXT;
+			CASE(R_IDIV)
+				if ( r[pc->c].i==0 ) vm_division_by_zero(vm);
+				r[pc->a].i = r[pc->b].i / r[pc->c].i;
+				NEXT;
+			CASE(R_IADDK)	r[pc->a].i = r[pc->b].i + pc->k;			NEXT;
+			CASE(R_FADD)	r[pc->a].f = r[pc->b].f + r[pc->c].f;		NEXT;
+			CASE(R_FSUB)	r[pc->a].f = r[pc->b].f - r[pc->c].f;		NEXT;
+			CASE(R_FMUL)	r[pc->a].f = r[pc->b].f * r[pc->c].f;		NEXT;
+			CASE(R_FDIV)
+				if ( r[pc->c].f==0 ) vm_division_by_zero(vm);
+				r[pc->a].f = r[pc->b].f / r[pc->c].f;
+				NEXT;
+			CASE(R_OR)		r[pc->a].b = r[pc->b].b || r[pc->c].b;		NEXT;
+			CASE(R_AND)		r[pc->a].b = r[pc->b].b && r[pc->c].b;		NEXT;
+			CASE(R_INEG)	r[pc->a].i = -r[pc->b].i;					NEXT;
+			CASE(R_FNEG)	r[pc->a].f = -r[pc->b].f;					NEXT;
+			CASE(R_NOT)		r[pc->a].b = !r[pc->b].b;					NEXT;
+			CASE(R_I2F)		r[pc->a].f = r[pc->b].i;					NEXT;
+			CASE(R_F2I)		r[pc->a].i = (int)r[pc->b].f;				NEXT;
+			CASE(R_IEQ)		r[pc->a].b = r[pc->b].i == r[pc->c].i;		NEXT;
+			CASE(R_INEQ)	r[pc->a].b = r[pc->b].i != r[pc->c].i;		NEXT;
+			CASE(R_ILT)		r[pc->a].b = r[pc->b].i <  r[pc->c].i;		NEXT;
+			CASE(R_ILE)		r[pc->a].b = r[pc->b].i <= r[pc->c].i;		NEXT;
+			CASE(R_IGT)		r[pc->a].b = r[pc->b].i >  r[pc->c].i;		NEXT;
+			CASE(R_IGE)		r[pc->a].b = r[pc->b].i >= r[pc->c].i;		NEXT;
+			CASE(R_FEQ)		r[pc->a].b = r[pc->b].f == r[pc->c].f;		NEXT;
+			CASE(R_FNEQ)	r[pc->a].b = r[pc->b].f != r[pc->c].f;		NEXT;
+			CASE(R_FLT)		r[pc->a].b = r[pc->b].f <  r[pc->c].f;		NEXT;
+			CASE(R_FLE)		r[pc->a].b = r[pc->b].f <= r[pc->c].f;		NEXT;
+			CASE(R_FGT)		r[pc->a].b = r[pc->b].f >  r[pc->c].f;		NEXT;
+			CASE(R_FGE)		r[pc->a].b = r[pc->b].f >= r[pc->c].f;		NEXT;
+			CASE(R_BR)
+				pc = pc->x.target;
+				DISPATCH;
+			CASE(R_BRF)
+				if ( !r[pc->b].b ) { pc = pc->x.target; DISPATCH; }
+				NEXT;
+			CASE(R_IEQ_BRF)		pc = r[pc->b].i == r[pc->c].i ? pc + 1 : pc->x.target;	DISPATCH;
+			CASE(R_INEQ_BRF)	pc = r[pc->b].i != r[pc->c].i ? pc + 1 : pc->x.target;	DISPATCH;
+			CASE(R_ILT_BRF)		pc = r[pc->b].i <  r[pc->c].i ? pc + 1 : pc->x.target;	DISPATCH;
+			CASE(R_ILE_BRF)		pc = r[pc->b].i <= r[pc->c].i ? pc + 1 : pc->x.target;	DISPATCH;
+			CASE(R_IGT_BRF)		pc = r[pc->b].i >  r[pc->c].i ? pc + 1 : pc->x.target;	DISPATCH;
+			CASE(R_IGE_BRF)		pc = r[pc->b].i >= r[pc->c].i ? pc + 1 : pc->x.target;	DISPATCH;
+			CASE(R_IEQK_BRF)	pc = r[pc->b].i == pc->k ? pc + 1 : pc->x.target;		DISPATCH;
+			CASE(R_INEQK_BRF)	pc = r[pc->b].i != pc->k ? pc + 1 : pc->x.target;		DISPATCH;
+			CASE(R_ILTK_BRF)	pc = r[pc->b].i <  pc->k ? pc + 1 : pc->x.target;		DISPATCH;
+			CASE(R_ILEK_BRF)	pc = r[pc->b].i <= pc->k ? pc + 1 : pc->x.target;		DISPATCH;
+			CASE(R_IGTK_BRF)	pc = r[pc->b].i >  pc->k ? pc + 1 : pc->x.target;		DISPATCH;
+			CASE(R_IGEK_BRF)	pc = r[pc->b].i >= pc->k ? pc + 1 : pc->x.target;		DISPATCH;
+			CASE(R_FEQ_BRF)		pc = r[pc->b].f == r[pc->c].f ? pc + 1 : pc->x.target;	DISPATCH;
+			CASE(R_FNEQ_BRF)	pc = r[pc->b].f != r[pc->c].f ? pc + 1 : pc->x.target;	DISPATCH;
+			CASE(R_FLT_BRF)		pc = r[pc->b].f <  r[pc->c].f ? pc + 1 : pc->x.target;	DISPATCH;
+			CASE(R_FLE_BRF)		pc = r[pc->b].f <= r[pc->c].f ? pc + 1 : pc->x.target;	DISPATCH;
+			CASE(R_FGT_BRF)		pc = r[pc->b].f >  r[pc->c].f ? pc + 1 : pc->x.target;	DISPATCH;
+			CASE(R_FGE_BRF)		pc = r[pc->b].f >= r[pc->c].f ? pc + 1 : pc->x.target;	DISPATCH;
+			CASE(R_TAIL_CALL)
+				func = pc->x.func;
+				if ( func->regcode!=NULL && func->regcode->nregs<=size ) {
+					memmove(r, &r[pc->a], func->nargs * sizeof(element));
+					memset(&r[func->nargs], 0, (func->regcode->nregs - func->nargs) * sizeof(element));
+					frame = &vm->call_stack[vm->callsp];
+					frame->func = func;
+					frame->elided++;
+					rf = func->regcode;
+					goto enter;
+				}
+				// not enough registers; call it and let the R_RET that follows return the result
+			CASE(R_CALL)
+				func = pc->x.func;
+				if ( func->regcode!=NULL && vm->native_depth<MAX_NATIVE_DEPTH ) {
+					r[pc->a] = reg_call(vm, func->regcode, &r[pc->a]);
+				}
+				else {
+					for (int j = 0; j < func->nargs; j++) vm->stack[++vm->sp] = r[pc->a + j];
+					vm_invoke(vm, func);
+					if ( func->return_type!=VOID_TYPE ) r[pc->a] = vm->stack[vm->sp--];
+				}
+				NEXT;
+			CASE(R_RET)
+				return r[pc->b];
+			CASE(R_RETV)
+				result.i = 0;
+				return result;
+			CASE(R_IPRINT)	vm_print_int(vm, r[pc->b].i);				NEXT;
+			CASE(R_FPRINT)	vm_print_float(vm, r[pc->b].f);				NEXT;
+			CASE(R_BPRINT)	vm_print_int(vm, r[pc->b].b);				NEXT;
+#ifndef VM_THREADED_DISPATCH
+			default:
+				vm_flush(vm);
+				fprintf(stderr, "invalid register opcode: %d\n", pc->opcode);
+				exit(1);
+		}
+next:
+		pc++;
+	}
+#endif
+}
+
+void reg_print(RFunction *rf)
+{
+	printf("%s: %d registers\n", rf->func->name, rf->nregs);
+	for (int j = 0; j < rf->ninstrs; j++) {
+		RInstr *R = &rf->code[j];
+		printf("%04d:  %-12s", j, reg_opcode_names[R->opcode]);
+		switch ( R->opcode ) {
+			case R_ICONST: printf("r%d, %d", R->a, R->k); break;
+			case R_FCONST: printf("r%d, %g", R->a, R->x.f); break;
+			case R_IADDK: printf("r%d, r%d, %d", R->a, R->b, R->k); break;
+			case R_BR: printf("%ld", (long)(R->x.target - rf->code)); break;
+			case R_BRF: printf("r%d, %ld", R->b, (long)(R->x.target - rf->code)); break;
+			case R_CALL: case R_TAIL_CALL: printf("r%d, %s", R->a, R->x.func->name); break;
+			case R_RET: case R_IPRINT: case R_FPRINT: case R_BPRINT: printf("r%d", R->b); break;
+			case R_RETV: break;
+			case R_MOV: case R_INEG: case R_FNEG: case R_NOT: case R_I2F: case R_F2I:
+				printf("r%d, r%d", R->a, R->b);
+				break;
+			default:
+				if ( R->opcode>=R_IEQK_BRF && R->opcode<=R_IGEK_BRF ) {
+					printf("r%d, %d, %ld", R->b, R->k, (long)(R->x.target - rf->code));
+				}
+				else if ( R->opcode>=R_IEQ_BRF ) {
+					printf("r%d, r%d, %ld", R->b, R->c, (long)(R->x.target - rf->code));
+				}
+				else printf("r%d, r%d, r%d", R->a, R->b, R->c);
+				break;
+		}
+		printf("\n");
+	}
+}
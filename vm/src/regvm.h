@@ -0,0 +1,94 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef REGVM_H_
+#define REGVM_H_
+
+#include "vm.h"
+
+/* Register tier. reg_translate() rewrites the stack bytecode of each function
+ * it can handle into three-address form where locals and operand stack slots
+ * are virtual registers: registers 0..nargs+nlocals-1 hold the args and
+ * locals and the operand stack slot at depth d lives in register
+ * nargs+nlocals+d. Loads and constants don't move anything; they just name
+ * the register or value an operation reads, so ILOAD ILOAD IADD STORE
+ * becomes one IADD.
+ *
+ * Only functions restricted to int, float and boolean values are translated
+ * because registers are not GC roots. Everything else stays on the stack
+ * interpreter and the two tiers call each other freely.
+ */
+typedef enum {
+	R_MOV,			// r[a] = r[b]
+	R_ICONST,		// r[a].i = k
+	R_FCONST,		// r[a].f = f
+
+	R_IADD, R_ISUB, R_IMUL, R_IDIV,		// r[a] = r[b] op r[c]
+	R_IADDK,							// r[a] = r[b] + k
+	R_FADD, R_FSUB, R_FMUL, R_FDIV,
+	R_OR, R_AND,
+	R_INEG, R_FNEG, R_NOT, R_I2F, R_F2I,	// r[a] = op r[b]
+
+	R_IEQ, R_INEQ, R_ILT, R_ILE, R_IGT, R_IGE,
+	R_FEQ, R_FNEQ, R_FLT, R_FLE, R_FGT, R_FGE,
+
+	R_BR,			// goto target
+	R_BRF,			// if !r[b] goto target
+	R_IEQ_BRF, R_INEQ_BRF, R_ILT_BRF, R_ILE_BRF, R_IGT_BRF, R_IGE_BRF,			// if !(r[b] op r[c]) goto target
+	R_IEQK_BRF, R_INEQK_BRF, R_ILTK_BRF, R_ILEK_BRF, R_IGTK_BRF, R_IGEK_BRF,	// if !(r[b] op k) goto target
+	R_FEQ_BRF, R_FNEQ_BRF, R_FLT_BRF, R_FLE_BRF, R_FGT_BRF, R_FGE_BRF,
+
+	R_CALL,			// r[a] = func(r[a], r[a+1], ...)
+	R_TAIL_CALL,	// R_CALL whose result is returned right away; reuses the registers
+	R_RET,			// return r[b]
+	R_RETV,			// return nothing
+
+	R_IPRINT, R_FPRINT, R_BPRINT	// print r[b]
+} REG_OPCODE;
+
+typedef struct rinstr {
+	const void *handler;	// address of interpreter code that executes this instr
+	short opcode;
+	short a, b, c;			// register operands; a is the destination
+	int k;					// int immediate
+	union {
+		double f;				// float immediate
+		struct rinstr *target;	// branch target
+		Function_metadata *func;// CALL target
+	} x;
+} RInstr;
+
+typedef struct rfunction {
+	Function_metadata *func;
+	int nregs;				// args + locals + max operand stack depth
+	int ninstrs;
+	bool threaded;			// handlers filled in
+	RInstr *code;
+} RFunction;
+
+extern int reg_translate(VM *vm);
+extern RFunction *reg_translate_function(VM *vm, Function_metadata *func);
+extern void vm_regcall(VM *vm, Function_metadata *func);
+extern void reg_print(RFunction *rf);
+
+#endif
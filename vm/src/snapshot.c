@@ -0,0 +1,242 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <wich.h>
+#include "vm.h"
+#include "snapshot.h"
+#include "output.h"
+
+static const char SNAPSHOT_MAGIC[8] = "WICHIMG";
+static const uint32_t SNAPSHOT_VERSION = 2;
+
+/* An image is laid out as
+ *
+ *	header instrs[num_instrs+1] functions[num_functions] code[code_size+1] strings
+ *
+ * with each section starting at the offset recorded in the header. strings
+ * holds the constant pool followed by the function names, each as a length
+ * and NUL-terminated chars padded to a multiple of 4 bytes.
+ */
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t instr_size;	// sizeof(Instr) and the number of opcodes of the build
+	uint32_t num_opcodes;	// that wrote the image
+	int32_t code_size;
+	int32_t num_instrs;
+	int32_t num_functions;
+	int32_t num_strings;
+	int32_t verified;
+	int32_t quickened;
+	uint32_t functions;		// section offsets from the start of the image
+	uint32_t code;
+	uint32_t strings;
+} Snapshot_header;
+
+typedef struct {
+	int32_t return_type;
+	int32_t address;
+	int32_t entry;
+	int32_t end;
+	int32_t nargs;
+	int32_t nlocals;
+	int32_t frame_size;
+	int32_t max_stack;
+	int32_t calls;
+} Snapshot_function;
+
+static size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+static int operand16(VM *vm, const Instr *I)
+{
+	return vm->code[I->offset+1] | (vm->code[I->offset+2] << 8);
+}
+
+static void write_string(const char *s, size_t len, FILE *f)
+{
+	static const char zeros[4] = {0};
+	uint32_t n = (uint32_t)len;
+	fwrite(&n, sizeof(n), 1, f);
+	fwrite(s, 1, len, f);
+	fwrite(zeros, 1, 4 - len % 4, f); // NUL and padding
+}
+
+bool vm_snapshot_write(VM *vm, FILE *f)
+{
+	Snapshot_header h = {
+		.version = SNAPSHOT_VERSION,
+		.instr_size = sizeof(Instr),
+		.num_opcodes = SCONST_QUICK+1,
+		.code_size = vm->code_size,
+		.num_instrs = vm->num_instrs,
+		.num_functions = vm->num_functions,
+		.num_strings = vm->num_strings,
+		.verified = vm->verified,
+		.quickened = vm->quickened
+	};
+	memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+	size_t instrs = align8(sizeof(Snapshot_header));
+	h.functions = (uint32_t)(instrs + (vm->num_instrs+1) * sizeof(Instr));
+	h.code = (uint32_t)(h.functions + vm->num_functions * sizeof(Snapshot_function));
+	h.strings = (uint32_t)align8(h.code + vm->code_size + 1);
+
+	static const char zeros[8] = {0};
+	fwrite(&h, sizeof(h), 1, f);
+	fwrite(zeros, 1, instrs - sizeof(h), f);
+	for (int i = 0; i <= vm->num_instrs; i++) {
+		Instr I = vm->instrs[i];
+		I.handler = NULL; // vm_run fills these in for the loop that runs
+		switch ( I.opcode ) {
+			case BR:
+			case BRF:
+				I.a.i = (int)(I.a.target - vm->instrs);
+				break;
+			case CALL:
+				I.a.i = I.a.func!=NULL ? (int)(I.a.func - vm->functions) : -1;
+				// whether the callee stays interpreted depends on the options of the run
+				if ( I.super==CALL_QUICK ) I.super = CALL;
+				break;
+			case SCONST:
+				I.a.i = operand16(vm, &I);
+				break;
+		}
+		fwrite(&I, sizeof(I), 1, f);
+	}
+	for (int i = 0; i < vm->num_functions; i++) {
+		Function_metadata *func = &vm->functions[i];
+		Snapshot_function sf = {
+			func->return_type, func->address, func->entry, func->end, func->nargs, func->nlocals,
+			func->frame_size, func->max_stack, func->calls
+		};
+		fwrite(&sf, sizeof(sf), 1, f);
+	}
+	fwrite(vm->code, 1, (size_t)vm->code_size + 1, f);
+	fwrite(zeros, 1, h.strings - (h.code + vm->code_size + 1), f);
+	for (int i = 0; i < vm->num_strings; i++) {
+		write_string(vm->strings[i]->str, vm->strings[i]->length, f);
+	}
+	for (int i = 0; i < vm->num_functions; i++) {
+		write_string(vm->functions[i].name, strlen(vm->functions[i].name), f);
+	}
+	return !ferror(f);
+}
+
+bool vm_is_snapshot(char *filename)
+{
+	char magic[sizeof(SNAPSHOT_MAGIC)] = "";
+	FILE *f = fopen(filename, "r");
+	if ( f==NULL ) return false;
+	size_t n = fread(magic, 1, sizeof(magic), f);
+	fclose(f);
+	return n==sizeof(magic) && memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic))==0;
+}
+
+VM *vm_snapshot_load(char *filename)
+{
+	int fd = open(filename, O_RDONLY);
+	if ( fd<0 ) {
+		fprintf(stderr, "can't open %s\n", filename);
+		return NULL;
+	}
+	struct stat st;
+	fstat(fd, &st);
+	// private and writable: relocation and quickening dirty only the pages they touch
+	void *image = st.st_size>=(off_t)sizeof(Snapshot_header) ?
+		mmap(NULL, (size_t)st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	close(fd);
+	if ( image==MAP_FAILED ) {
+		fprintf(stderr, "can't map %s\n", filename);
+		return NULL;
+	}
+	Snapshot_header *h = image;
+	if ( memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic))!=0 || h->version!=SNAPSHOT_VERSION ||
+		 h->instr_size!=sizeof(Instr) || h->num_opcodes!=SCONST_QUICK+1 ||
+		 h->num_functions>MAX_FUNCTIONS || h->strings>(size_t)st.st_size ) {
+		fprintf(stderr, "%s isn't an image this VM wrote\n", filename);
+		munmap(image, (size_t)st.st_size);
+		return NULL;
+	}
+
+	VM *vm = vm_alloc();
+	vm->image = image;
+	vm->image_size = (size_t)st.st_size;
+	vm_init_runtime(vm);
+	vm->code = (byte *)image + h->code;
+	vm->code_size = h->code_size;
+	vm->instrs = (Instr *)((byte *)image + align8(sizeof(Snapshot_header)));
+	vm->num_instrs = h->num_instrs;
+	vm->verified = h->verified;
+	vm->quickened = h->quickened;
+
+	byte *s = (byte *)image + h->strings;
+	for (int i = 0; i < h->num_strings; i++) {
+		uint32_t len = *(uint32_t *)s;
+		def_string(vm, (char *)s + sizeof(len));
+		s += sizeof(len) + len + 4 - len % 4;
+	}
+	Snapshot_function *sf = (Snapshot_function *)((byte *)image + h->functions);
+	for (int i = 0; i < h->num_functions; i++) {
+		uint32_t len = *(uint32_t *)s;
+		def_function(vm, (char *)s + sizeof(len), sf[i].return_type, (addr32)sf[i].address, sf[i].nargs, sf[i].nlocals);
+		Function_metadata *func = &vm->functions[i];
+		func->entry = (addr32)sf[i].entry;
+		func->end = (addr32)sf[i].end;
+		func->frame_size = sf[i].frame_size;
+		func->max_stack = sf[i].max_stack;
+		func->calls = sf[i].calls;
+		s += sizeof(len) + len + 4 - len % 4;
+	}
+
+	for (int i = 0; i <= vm->num_instrs; i++) {
+		Instr *I = &vm->instrs[i];
+		switch ( I->opcode ) {
+			case BR:
+			case BRF:
+				I->a.target = &vm->instrs[I->a.i];
+				break;
+			case CALL:
+				I->a.func = I->a.i>=0 && I->a.i<vm->num_functions ? &vm->functions[I->a.i] : NULL;
+				break;
+			case SCONST:
+				if ( I->super==SCONST_QUICK ) I->a.s = vm->strings[I->a.i];
+				break;
+		}
+	}
+	return vm;
+}
+
+void vm_snapshot_init(VM *vm, Function_metadata *func)
+{
+	gc_set_heap(vm->heap);
+	vm_invoke(vm, func);
+	vm_flush(vm);
+	while ( vm->sp>=0 ) vm_drop(vm, &vm->stack[vm->sp--]); // a result nobody wants
+	gc();
+}
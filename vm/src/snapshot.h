@@ -0,0 +1,48 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+#include "vm.h"
+
+/* Snapshot images. An image holds a VM as vm_load() leaves it, or as an
+ * init function leaves it once it has run: decoded and quickened
+ * instructions, function table, string pool and code. Pointers between
+ * them are stored as indexes. vm_snapshot_load() maps the image, turns
+ * the indexes back into pointers in place and is ready to vm_exec().
+ * Nothing is parsed, decoded, fused or verified again.
+ *
+ * Images hold the VM's own structs so they only load into the build
+ * that wrote them; vm_snapshot_load() rejects any other.
+ */
+extern bool vm_snapshot_write(VM *vm, FILE *f);
+extern bool vm_is_snapshot(char *filename);
+extern VM *vm_snapshot_load(char *filename);
+
+/* Run func, which takes no arguments, so that an image written afterwards
+ * starts with the instructions it executed already quickened.
+ */
+extern void vm_snapshot_init(VM *vm, Function_metadata *func);
+
+#endif
@@ -0,0 +1,763 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <wich.h>
+#include "vm.h"
+#include "dispatch.h"
+#include "superblock.h"
+#include "output.h"
+
+static char *sb_opcode_names[] = {
+	"MOV", "ICONST", "FCONST",
+	"IADD", "ISUB", "IMUL", "IDIV", "IADDK",
+	"FADD", "FSUB", "FMUL", "FDIV",
+	"OR", "AND",
+	"INEG", "FNEG", "NOT", "I2F", "F2I",
+	"IEQ", "INEQ", "ILT", "ILE", "IGT", "IGE",
+	"FEQ", "FNEQ", "FLT", "FLE", "FGT", "FGE",
+	"GUARD_T", "GUARD_F",
+	"IEQ_GUARD", "INEQ_GUARD", "ILT_GUARD", "ILE_GUARD", "IGT_GUARD", "IGE_GUARD",
+	"IEQK_GUARD", "INEQK_GUARD", "ILTK_GUARD", "ILEK_GUARD", "IGTK_GUARD", "IGEK_GUARD",
+	"VLOAD_INDEX", "STORE_INDEX", "VLEN",
+	"IPRINT", "FPRINT", "BPRINT",
+	"LOOP"
+};
+
+// how the iteration being recorded uses each local
+typedef enum { LOCAL_UNUSED, LOCAL_VALUE, LOCAL_VECTOR } Local_use;
+
+typedef struct {
+	VM *vm;
+	Function_metadata *func;
+	int frame_size;
+	SB_Operand *stack;
+	int sp;				// number of operands on stack
+	int maxdepth;
+	SInstr *code;
+	int *exit_of;		// index into exits of each emitted instr's exit or -1
+	int n;
+	int max;
+	SB_Exit *exits;
+	int nexits;
+	int maxexits;
+	Local_use *use;
+	bool *stored;
+	int last_result;	// index of emitted instr computing the top operand into its home or -1
+} Recorder;
+
+static void inline zero_division_error()
+{
+	fprintf(stderr, "ZeroDivisionError: Divisor cann't be 0\n");
+}
+
+static int home(Recorder *t, int d) { return t->frame_size + d; }
+
+static SInstr *emit(Recorder *t, SB_OPCODE op, int a, int b, int c)
+{
+	if ( t->n==t->max ) {
+		t->max *= 2;
+		t->code = realloc(t->code, t->max * sizeof(SInstr));
+		t->exit_of = realloc(t->exit_of, t->max * sizeof(int));
+	}
+	SInstr *S = &t->code[t->n];
+	memset(S, 0, sizeof(SInstr));
+	S->opcode = (short)op;
+	S->a = (short)a;
+	S->b = (short)b;
+	S->c = (short)c;
+	t->exit_of[t->n] = -1;
+	t->n++;
+	t->last_result = -1;
+	return S;
+}
+
+/* Make the last instruction emitted leave for resume, with the bottom depth
+ * operands of the current stack pushed for the interpreter.
+ */
+static void side_exit(Recorder *t, const Instr *resume, int depth)
+{
+	if ( t->nexits==t->maxexits ) {
+		t->maxexits *= 2;
+		t->exits = realloc(t->exits, t->maxexits * sizeof(SB_Exit));
+	}
+	SB_Exit *e = &t->exits[t->nexits];
+	e->resume = resume;
+	e->nopnds = depth;
+	e->opnds = malloc((depth+1) * sizeof(SB_Operand));
+	memcpy(e->opnds, t->stack, depth * sizeof(SB_Operand));
+	t->exit_of[t->n-1] = t->nexits++;
+}
+
+// load constant e into register reg
+static void emit_load(Recorder *t, int reg, SB_Operand e)
+{
+	if ( e.kind==SB_INT ) emit(t, S_ICONST, reg, 0, 0)->k = e.value.i;
+	else if ( e.kind==SB_FLOAT ) emit(t, S_FCONST, reg, 0, 0)->x.f = e.value.f;
+	else if ( e.reg!=reg ) emit(t, S_MOV, reg, e.reg, 0);
+}
+
+// register holding the value operand at depth d, loading it into its home if it's a constant
+static int reg(Recorder *t, int d)
+{
+	SB_Operand *e = &t->stack[d];
+	if ( e->kind!=SB_REG ) {
+		emit_load(t, home(t, d), *e);
+		e->kind = SB_REG;
+		e->reg = home(t, d);
+	}
+	return e->reg;
+}
+
+static void push(Recorder *t, SB_Operand_kind kind, int r, element value)
+{
+	t->stack[t->sp++] = (SB_Operand){kind, r, value};
+	if ( t->sp>t->maxdepth ) t->maxdepth = t->sp;
+}
+
+static void push_reg(Recorder *t, int r) { push(t, SB_REG, r, (element){.i = 0}); }
+
+// emit r[home] = r[b] op r[c] for the two operands on top and push the result
+static void binary(Recorder *t, SB_OPCODE op)
+{
+	int d = t->sp - 2;
+	int b = reg(t, d);
+	int c = reg(t, d+1);
+	t->sp -= 2;
+	emit(t, op, home(t, d), b, c);
+	push_reg(t, home(t, d));
+	t->last_result = t->n - 1;
+}
+
+static void unary(Recorder *t, SB_OPCODE op)
+{
+	int d = t->sp - 1;
+	int b = reg(t, d);
+	t->sp--;
+	emit(t, op, home(t, d), b, 0);
+	push_reg(t, home(t, d));
+	t->last_result = t->n - 1;
+}
+
+static void store(Recorder *t, int local)
+{
+	int d = t->sp - 1;
+	// operands still referring to the old value of local need their own copy
+	for (int j = 0; j < d; j++) {
+		if ( t->stack[j].kind==SB_REG && t->stack[j].reg==local ) {
+			emit(t, S_MOV, home(t, j), local, 0);
+			t->stack[j].reg = home(t, j);
+		}
+	}
+	SB_Operand e = t->stack[d];
+	if ( e.kind==SB_REG && e.reg==home(t, d) && t->last_result==t->n-1 ) {
+		t->code[t->n-1].a = (short)local; // compute directly into local
+		t->last_result = -1;
+	}
+	else {
+		emit_load(t, local, e);
+	}
+	t->sp--;
+}
+
+static SB_OPCODE negate_compare(SB_OPCODE op)
+{
+	switch ( op ) {
+		case S_IEQ : return S_INEQ;
+		case S_INEQ : return S_IEQ;
+		case S_ILT : return S_IGE;
+		case S_ILE : return S_IGT;
+		case S_IGT : return S_ILE;
+		default : return S_ILT; // S_IGE
+	}
+}
+
+static SB_OPCODE swap_compare(SB_OPCODE op)
+{
+	switch ( op ) {
+		case S_ILT : return S_IGT;
+		case S_ILE : return S_IGE;
+		case S_IGT : return S_ILT;
+		case S_IGE : return S_ILE;
+		default : return op;
+	}
+}
+
+/* Guard that the int comparison op of the two operands on top comes out
+ * holds, or doesn't if taken, and leave for resume if not. Comparisons
+ * against a constant use the immediate form.
+ */
+static void guard_compare(Recorder *t, SB_OPCODE op, bool taken, const Instr *resume)
+{
+	if ( taken ) op = negate_compare(op);
+	int x = t->sp - 2, y = t->sp - 1;
+	if ( t->stack[x].kind==SB_INT && t->stack[y].kind!=SB_INT ) {
+		op = swap_compare(op);
+		x = t->sp - 1; y = t->sp - 2;
+	}
+	if ( t->stack[y].kind==SB_INT ) {
+		int k = t->stack[y].value.i;
+		emit(t, (SB_OPCODE)(op - S_IEQ + S_IEQK_GUARD), 0, reg(t, x), 0)->k = k;
+	}
+	else {
+		int b = reg(t, x);
+		int c = reg(t, y);
+		emit(t, (SB_OPCODE)(op - S_IEQ + S_IEQ_GUARD), 0, b, c);
+	}
+	t->sp -= 2;
+	side_exit(t, resume, t->sp);
+}
+
+static bool use_local(Recorder *t, int local, Local_use use)
+{
+	if ( local<0 || local>=t->frame_size ) return false;
+	if ( t->use[local]!=LOCAL_UNUSED && t->use[local]!=use ) return false;
+	t->use[local] = use;
+	return true;
+}
+
+// the top n operands are ints, floats or booleans rather than vectors
+static bool values(Recorder *t, int n)
+{
+	for (int d = t->sp - n; d < t->sp; d++) {
+		if ( d<0 || t->stack[d].kind==SB_LOCAL ) return false;
+	}
+	return true;
+}
+
+static SB_OPCODE sb_opcode(BYTECODE op)
+{
+	switch ( op ) {
+		case IADD : return S_IADD;
+		case ISUB : return S_ISUB;
+		case IMUL : return S_IMUL;
+		case IDIV : return S_IDIV;
+		case FADD : return S_FADD;
+		case FSUB : return S_FSUB;
+		case FMUL : return S_FMUL;
+		case FDIV : return S_FDIV;
+		case OR   : return S_OR;
+		case AND  : return S_AND;
+		case INEG : return S_INEG;
+		case FNEG : return S_FNEG;
+		case NOT  : return S_NOT;
+		case I2F  : return S_I2F;
+		case F2I  : return S_F2I;
+		case IEQ  : return S_IEQ;
+		case INEQ : return S_INEQ;
+		case ILT  : return S_ILT;
+		case ILE  : return S_ILE;
+		case IGT  : return S_IGT;
+		case IGE  : return S_IGE;
+		case FEQ  : return S_FEQ;
+		case FNEQ : return S_FNEQ;
+		case FLT  : return S_FLT;
+		case FLE  : return S_FLE;
+		case FGT  : return S_FGT;
+		case FGE  : return S_FGE;
+		default   : return S_MOV;
+	}
+}
+
+// what instruction op leaves on the stack interpreter for operands x and y (or just x)
+static element eval(BYTECODE op, element x, element y)
+{
+	element e = x;
+	switch ( op ) {
+		case IADD : e.i = x.i + y.i; break;
+		case ISUB : e.i = x.i - y.i; break;
+		case IMUL : e.i = x.i * y.i; break;
+		case IDIV : e.i = x.i / y.i; break;
+		case FADD : e.f = x.f + y.f; break;
+		case FSUB : e.f = x.f - y.f; break;
+		case FMUL : e.f = x.f * y.f; break;
+		case FDIV : e.f = x.f / y.f; break;
+		case OR   : e.b = x.b || y.b; break;
+		case AND  : e.b = x.b && y.b; break;
+		case INEG : e.i = -x.i; break;
+		case FNEG : e.f = -x.f; break;
+		case NOT  : e.b = !x.b; break;
+		case I2F  : e.f = x.i; break;
+		case F2I  : e.i = (int)x.f; break;
+		case IEQ  : e.b = x.i == y.i; break;
+		case INEQ : e.b = x.i != y.i; break;
+		case ILT  : e.b = x.i <  y.i; break;
+		case ILE  : e.b = x.i <= y.i; break;
+		case IGT  : e.b = x.i >  y.i; break;
+		case IGE  : e.b = x.i >= y.i; break;
+		case FEQ  : e.b = x.f == y.f; break;
+		case FNEQ : e.b = x.f != y.f; break;
+		case FLT  : e.b = x.f <  y.f; break;
+		case FLE  : e.b = x.f <= y.f; break;
+		case FGT  : e.b = x.f >  y.f; break;
+		case FGE  : e.b = x.f >= y.f; break;
+		default   : break;
+	}
+	return e;
+}
+
+/* Interpret instructions from the loop header at vm->ip, translating each
+ * before or after running it, until the iteration branches back to the
+ * header. Returns false, with nothing of the instruction it stopped at run,
+ * if the iteration does anything the superblock can't. Either way vm->ip and
+ * vm->sp say where the interpreter goes on.
+ */
+static bool record(Recorder *t, const Instr *header)
+{
+	VM *vm = t->vm;
+	element *stack = vm->stack;
+	element *locals = &stack[vm->fp];
+	const Instr *start = &vm->instrs[t->func->entry];
+	const Instr *end = &vm->instrs[t->func->end];
+	const Instr *pc = header;
+	int sp = vm->sp;
+	bool closed = false;
+	element x;
+
+	for (int recorded = 0; !closed && recorded < MAX_SUPERBLOCK_BYTECODES; recorded++) {
+		const Instr *I = pc;
+		const Instr *next = pc + 1;
+		BYTECODE op = (BYTECODE)I->opcode;
+		switch ( op ) {
+			case IADD: case ISUB: case IMUL: case FADD: case FSUB: case FMUL: case OR: case AND:
+				if ( !values(t, 2) ) goto stop;
+				stack[sp-1] = eval(op, stack[sp-1], stack[sp]);
+				sp--;
+				if ( (op==IADD || op==ISUB) && t->stack[t->sp-1].kind==SB_INT && t->stack[t->sp-1].value.i!=INT_MIN ) {
+					int k = t->stack[--t->sp].value.i;
+					unary(t, S_IADDK);
+					t->code[t->n-1].k = op==IADD ? k : -k;
+				}
+				else binary(t, sb_opcode(op));
+				break;
+			case IDIV: case FDIV: {
+				if ( !values(t, 2) ) goto stop;
+				if ( op==IDIV ? stack[sp].i==0 : stack[sp].f==0 ) goto stop; // the interpreter reports it
+				stack[sp-1] = eval(op, stack[sp-1], stack[sp]);
+				sp--;
+				int d = t->sp - 2;
+				int b = reg(t, d);
+				int c = reg(t, d+1);
+				emit(t, sb_opcode(op), home(t, d), b, c);
+				side_exit(t, I, t->sp); // a zero divisor goes back to the interpreter with both operands
+				t->sp -= 2;
+				push_reg(t, home(t, d));
+				t->last_result = t->n - 1;
+				break;
+			}
+			case IEQ: case INEQ: case ILT: case ILE: case IGT: case IGE:
+			case FEQ: case FNEQ: case FLT: case FLE: case FGT: case FGE:
+				if ( !values(t, 2) ) goto stop;
+				stack[sp-1] = eval(op, stack[sp-1], stack[sp]);
+				sp--;
+				if ( next->opcode==BRF && op<=IGE ) {
+					bool taken = !stack[sp--].b;
+					guard_compare(t, sb_opcode(op), taken, taken ? next + 1 : next->a.target);
+					next = taken ? next->a.target : next + 1;
+				}
+				else binary(t, sb_opcode(op));
+				break;
+			case INEG: case FNEG: case NOT: case I2F: case F2I: {
+				if ( !values(t, 1) ) goto stop;
+				stack[sp] = eval(op, stack[sp], stack[sp]);
+				SB_Operand *top = &t->stack[t->sp-1];
+				if ( op==I2F && top->kind==SB_INT ) *top = (SB_Operand){SB_FLOAT, 0, {.f = top->value.i}};
+				else if ( op==F2I && top->kind==SB_FLOAT ) *top = (SB_Operand){SB_INT, 0, {.i = (int)top->value.f}};
+				else if ( op==INEG && top->kind==SB_INT ) top->value.i = -top->value.i;
+				else if ( op==FNEG && top->kind==SB_FLOAT ) top->value.f = -top->value.f;
+				else unary(t, sb_opcode(op));
+				break;
+			}
+			case ICONST:
+				stack[++sp] = (element){.i = I->a.i};
+				push(t, SB_INT, 0, stack[sp]);
+				break;
+			case FCONST:
+				stack[++sp].f = I->a.f;
+				push(t, SB_FLOAT, 0, stack[sp]);
+				break;
+			case ILOAD: case FLOAD:
+				if ( !use_local(t, I->a.i, LOCAL_VALUE) ) goto stop;
+				stack[++sp] = locals[I->a.i];
+				push_reg(t, I->a.i);
+				break;
+			case VLOAD:
+				if ( !use_local(t, I->a.i, LOCAL_VECTOR) ) goto stop;
+				stack[++sp] = locals[I->a.i];
+				push(t, SB_LOCAL, I->a.i, stack[sp]);
+				break;
+			case STORE:
+				if ( !values(t, 1) || !use_local(t, I->a.i, LOCAL_VALUE) ) goto stop;
+				locals[I->a.i] = stack[sp--];
+				t->stored[I->a.i] = true;
+				store(t, I->a.i);
+				break;
+			case VLOAD_INDEX: {
+				if ( !values(t, 1) || t->sp<2 || t->stack[t->sp-2].kind!=SB_LOCAL ) goto stop;
+				int i = stack[sp--].i;
+				stack[sp].f = ith(vm_vector(stack[sp].vref), i-1);
+				int d = t->sp - 2;
+				int b = reg(t, d+1);
+				int v = t->stack[d].reg;
+				t->sp -= 2;
+				emit(t, S_VLOAD_INDEX, home(t, d), b, v);
+				push_reg(t, home(t, d));
+				t->last_result = t->n - 1;
+				break;
+			}
+			case STORE_INDEX: {
+				if ( !values(t, 2) || t->sp<3 || t->stack[t->sp-3].kind!=SB_LOCAL ) goto stop;
+				set_ith(vm_vector(stack[sp-2].vref), stack[sp-1].i-1, stack[sp].f);
+				sp -= 3;
+				int b = reg(t, t->sp-2);
+				int c = reg(t, t->sp-1);
+				emit(t, S_STORE_INDEX, t->stack[t->sp-3].reg, b, c);
+				t->sp -= 3;
+				break;
+			}
+			case VLEN: {
+				if ( t->sp<1 || t->stack[t->sp-1].kind!=SB_LOCAL ) goto stop;
+				stack[sp] = (element){.i = Vector_len(vm_vector(stack[sp].vref))};
+				int d = t->sp - 1;
+				int v = t->stack[d].reg;
+				t->sp--;
+				emit(t, S_VLEN, home(t, d), 0, v);
+				push_reg(t, home(t, d));
+				t->last_result = t->n - 1;
+				break;
+			}
+			case POP:
+				if ( t->sp<1 ) goto stop;
+				sp--;
+				t->sp--;
+				break;
+			case IPRINT: case FPRINT: case BPRINT:
+				if ( !values(t, 1) ) goto stop;
+				x = stack[sp--];
+				if ( op==IPRINT ) vm_print_int(vm, x.i);
+				else if ( op==FPRINT ) vm_print_float(vm, x.f);
+				else vm_print_int(vm, x.b);
+				emit(t, op==IPRINT ? S_IPRINT : op==FPRINT ? S_FPRINT : S_BPRINT, 0, reg(t, t->sp-1), 0);
+				t->sp--;
+				break;
+			case NOP:
+				break;
+			case BR:
+				next = I->a.target;
+				break;
+			case BRF: {
+				if ( !values(t, 1) ) goto stop;
+				bool taken = !stack[sp--].b;
+				int b = reg(t, t->sp-1);
+				t->sp--;
+				emit(t, taken ? S_GUARD_F : S_GUARD_T, 0, b, 0);
+				side_exit(t, taken ? I + 1 : I->a.target, t->sp);
+				if ( taken ) next = I->a.target;
+				break;
+			}
+			default:
+				goto stop;
+		}
+		pc = next;
+		if ( pc==header && t->sp==0 ) {
+			emit(t, S_LOOP, 0, 0, 0);
+			closed = true;
+		}
+		else if ( pc<=I || pc<start || pc>=end ) break; // an inner loop or somewhere odd
+	}
+stop:
+	vm->sp = sp;
+	vm->ip = (addr32)(pc - vm->instrs);
+	return closed;
+}
+
+/* Record the iteration of the loop whose header is at vm->ip, running it,
+ * and return its superblock or NULL if it can't have one. The operand stack
+ * of the function must be empty at the header.
+ */
+Superblock *sb_record(VM *vm)
+{
+	if ( vm->callsp<0 ) return NULL;
+	Activation_Record *frame = &vm->call_stack[vm->callsp];
+	Function_metadata *func = frame->func;
+	if ( frame->fp!=vm->fp || vm->sp!=vm->fp + func->frame_size - 1 ) return NULL;
+	if ( func->frame_size>=MAX_SUPERBLOCK_REGS ) return NULL;
+
+	Recorder t;
+	memset(&t, 0, sizeof(Recorder));
+	t.vm = vm;
+	t.func = func;
+	t.frame_size = func->frame_size;
+	t.stack = malloc((func->max_stack + 1) * sizeof(SB_Operand));
+	t.max = 16;
+	t.code = malloc(t.max * sizeof(SInstr));
+	t.exit_of = malloc(t.max * sizeof(int));
+	t.maxexits = 4;
+	t.exits = malloc(t.maxexits * sizeof(SB_Exit));
+	t.use = calloc((size_t)func->frame_size, sizeof(Local_use));
+	t.stored = calloc((size_t)func->frame_size, sizeof(bool));
+	t.last_result = -1;
+
+	const Instr *header = &vm->instrs[vm->ip];
+	Superblock *sb = NULL;
+	if ( record(&t, header) && t.frame_size + t.maxdepth + 1<=MAX_SUPERBLOCK_REGS ) {
+		sb = calloc(1, sizeof(Superblock));
+		sb->func = func;
+		sb->header = header;
+		sb->nregs = t.frame_size + t.maxdepth + 1;
+		sb->ninstrs = t.n;
+		sb->code = t.code;
+		sb->nexits = t.nexits;
+		sb->exits = t.exits;
+		for (int j = 0; j < t.n; j++) {
+			if ( t.exit_of[j]>=0 ) sb->code[j].x.exit = &sb->exits[t.exit_of[j]];
+		}
+		sb->loads = malloc(t.frame_size * sizeof(short));
+		sb->stores = malloc(t.frame_size * sizeof(short));
+		for (int k = 0; k < t.frame_size; k++) {
+			if ( t.use[k]==LOCAL_VALUE ) sb->loads[sb->nloads++] = (short)k;
+			if ( t.stored[k] ) sb->stores[sb->nstores++] = (short)k;
+		}
+	}
+	else {
+		for (int j = 0; j < t.nexits; j++) free(t.exits[j].opnds);
+		free(t.exits);
+		free(t.code);
+	}
+	free(t.exit_of);
+	free(t.stack);
+	free(t.use);
+	free(t.stored);
+	return sb;
+}
+
+/* Called by the stack interpreter each time it branches back to the loop
+ * header at vm->ip. Runs the loop's superblock if it has one or records it
+ * if it has become hot; leaves vm->ip and vm->sp where the interpreter is
+ * to go on.
+ */
+void sb_loop(VM *vm)
+{
+	Hot_loops *h = vm->hot_loops;
+	if ( h==NULL ) {
+		h = vm->hot_loops = calloc(1, sizeof(Hot_loops));
+		h->counts = calloc((size_t)vm->num_instrs+1, sizeof(int));
+		h->blocks = calloc((size_t)vm->num_instrs+1, sizeof(Superblock *));
+	}
+	addr32 header = vm->ip;
+	Superblock *sb = h->blocks[header];
+	if ( sb==NULL ) {
+		if ( h->counts[header]<0 || h->counts[header]++<vm->hot_loop_threshold ) return;
+		sb = sb_record(vm);
+		if ( sb==NULL ) {
+			h->counts[header] = -1;
+			return;
+		}
+		h->blocks[header] = sb;
+		h->compiled++;
+		// sb_record() ran the iteration and is back at the header
+	}
+	if ( vm->sp==vm->fp + sb->func->frame_size - 1 ) sb_exec(vm, sb);
+}
+
+void sb_exec(VM *vm, Superblock *sb)
+{
+	element r[sb->nregs];
+	element *locals = &vm->stack[vm->fp];
+	const SB_Exit *out;
+
+	for (int j = 0; j < sb->nloads; j++) r[sb->loads[j]] = locals[sb->loads[j]];
+	register const SInstr *pc = sb->code;
+
+#ifdef VM_THREADED_DISPATCH
+	static const void *const dispatch[] = {
+		[S_MOV] = &&do_S_MOV, [S_ICONST] = &&do_S_ICONST, [S_FCONST] = &&do_S_FCONST,
+		[S_IADD] = &&do_S_IADD, [S_ISUB] = &&do_S_ISUB, [S_IMUL] = &&do_S_IMUL, [S_IDIV] = &&do_S_IDIV,
+		[S_IADDK] = &&do_S_IADDK,
+		[S_FADD] = &&do_S_FADD, [S_FSUB] = &&do_S_FSUB, [S_FMUL] = &&do_S_FMUL, [S_FDIV] = &&do_S_FDIV,
+		[S_OR] = &&do_S_OR, [S_AND] = &&do_S_AND,
+		[S_INEG] = &&do_S_INEG, [S_FNEG] = &&do_S_FNEG, [S_NOT] = &&do_S_NOT, [S_I2F] = &&do_S_I2F, [S_F2I] = &&do_S_F2I,
+		[S_IEQ] = &&do_S_IEQ, [S_INEQ] = &&do_S_INEQ, [S_ILT] = &&do_S_ILT, [S_ILE] = &&do_S_ILE,
+		[S_IGT] = &&do_S_IGT, [S_IGE] = &&do_S_IGE,
+		[S_FEQ] = &&do_S_FEQ, [S_FNEQ] = &&do_S_FNEQ, [S_FLT] = &&do_S_FLT, [S_FLE] = &&do_S_FLE,
+		[S_FGT] = &&do_S_FGT, [S_FGE] = &&do_S_FGE,
+		[S_GUARD_T] = &&do_S_GUARD_T, [S_GUARD_F] = &&do_S_GUARD_F,
+		[S_IEQ_GUARD] = &&do_S_IEQ_GUARD, [S_INEQ_GUARD] = &&do_S_INEQ_GUARD, [S_ILT_GUARD] = &&do_S_ILT_GUARD,
+		[S_ILE_GUARD] = &&do_S_ILE_GUARD, [S_IGT_GUARD] = &&do_S_IGT_GUARD, [S_IGE_GUARD] = &&do_S_IGE_GUARD,
+		[S_IEQK_GUARD] = &&do_S_IEQK_GUARD, [S_INEQK_GUARD] = &&do_S_INEQK_GUARD, [S_ILTK_GUARD] = &&do_S_ILTK_GUARD,
+		[S_ILEK_GUARD] = &&do_S_ILEK_GUARD, [S_IGTK_GUARD] = &&do_S_IGTK_GUARD, [S_IGEK_GUARD] = &&do_S_IGEK_GUARD,
+		[S_VLOAD_INDEX] = &&do_S_VLOAD_INDEX, [S_STORE_INDEX] = &&do_S_STORE_INDEX, [S_VLEN] = &&do_S_VLEN,
+		[S_IPRINT] = &&do_S_IPRINT, [S_FPRINT] = &&do_S_FPRINT, [S_BPRINT] = &&do_S_BPRINT,
+		[S_LOOP] = &&do_S_LOOP
+	};
+	if ( !sb->threaded ) {
+		for (int j = 0; j < sb->ninstrs; j++) sb->code[j].handler = dispatch[sb->code[j].opcode];
+		sb->threaded = true;
+	}
+
+	DISPATCH;
+#else
+	for (;;) {
+		switch (pc->opcode) {
+#endif
+			CASE(S_MOV)		r[pc->a] = r[pc->b];						NEXT;
+			CASE(S_ICONST)	r[pc->a] = (element){.i = pc->k};			NEXT;
+			CASE(S_FCONST)	r[pc->a].f = pc->x.f;						NEXT;
+			CASE(S_IADD)	r[pc->a].i = r[pc->b].i + r[pc->c].i;		NEXT;
+			CASE(S_ISUB)	r[pc->a].i = r[pc->b].i - r[pc->c].i;		NEXT;
+			CASE(S_IMUL)	r[pc->a].i = r[pc->b].i * r[pc->c].i;		NEXT;
+			CASE(S_IDIV)
+				if ( r[pc->c].i==0 ) goto side_exit;
+				r[pc->a].i = r[pc->b].i / r[pc->c].i;
+				NEXT;
+			CASE(S_IADDK)	r[pc->a].i = r[pc->b].i + pc->k;			NEXT;
+			CASE(S_FADD)	r[pc->a].f = r[pc->b].f + r[pc->c].f;		NEXT;
+			CASE(S_FSUB)	r[pc->a].f = r[pc->b].f - r[pc->c].f;		NEXT;
+			CASE(S_FMUL)	r[pc->a].f = r[pc->b].f * r[pc->c].f;		NEXT;
+			CASE(S_FDIV)
+				if ( r[pc->c].f==0 ) goto side_exit;
+				r[pc->a].f = r[pc->b].f / r[pc->c].f;
+				NEXT;
+			CASE(S_OR)		r[pc->a].b = r[pc->b].b || r[pc->c].b;		NEXT;
+			CASE(S_AND)		r[pc->a].b = r[pc->b].b && r[pc->c].b;		NEXT;
+			CASE(S_INEG)	r[pc->a].i = -r[pc->b].i;					NEXT;
+			CASE(S_FNEG)	r[pc->a].f = -r[pc->b].f;					NEXT;
+			CASE(S_NOT)		r[pc->a].b = !r[pc->b].b;					NEXT;
+			CASE(S_I2F)		r[pc->a].f = r[pc->b].i;					NEXT;
+			CASE(S_F2I)		r[pc->a].i = (int)r[pc->b].f;				NEXT;
+			CASE(S_IEQ)		r[pc->a].b = r[pc->b].i == r[pc->c].i;		NEXT;
+			CASE(S_INEQ)	r[pc->a].b = r[pc->b].i != r[pc->c].i;		NEXT;
+			CASE(S_ILT)		r[pc->a].b = r[pc->b].i <  r[pc->c].i;		NEXT;
+			CASE(S_ILE)		r[pc->a].b = r[pc->b].i <= r[pc->c].i;		NEXT;
+			CASE(S_IGT)		r[pc->a].b = r[pc->b].i >  r[pc->c].i;		NEXT;
+			CASE(S_IGE)		r[pc->a].b = r[pc->b].i >= r[pc->c].i;		NEXT;
+			CASE(S_FEQ)		r[pc->a].b = r[pc->b].f == r[pc->c].f;		NEXT;
+			CASE(S_FNEQ)	r[pc->a].b = r[pc->b].f != r[pc->c].f;		NEXT;
+			CASE(S_FLT)		r[pc->a].b = r[pc->b].f <  r[pc->c].f;		NEXT;
+			CASE(S_FLE)		r[pc->a].b = r[pc->b].f <= r[pc->c].f;		NEXT;
+			CASE(S_FGT)		r[pc->a].b = r[pc->b].f >  r[pc->c].f;		NEXT;
+			CASE(S_FGE)		r[pc->a].b = r[pc->b].f >= r[pc->c].f;		NEXT;
+			CASE(S_GUARD_T)			if ( !r[pc->b].b ) goto side_exit;					NEXT;
+			CASE(S_GUARD_F)			if ( r[pc->b].b ) goto side_exit;					NEXT;
+			CASE(S_IEQ_GUARD)		if ( !(r[pc->b].i == r[pc->c].i) ) goto side_exit;	NEXT;
+			CASE(S_INEQ_GUARD)		if ( !(r[pc->b].i != r[pc->c].i) ) goto side_exit;	NEXT;
+			CASE(S_ILT_GUARD)		if ( !(r[pc->b].i <  r[pc->c].i) ) goto side_exit;	NEXT;
+			CASE(S_ILE_GUARD)		if ( !(r[pc->b].i <= r[pc->c].i) ) goto side_exit;	NEXT;
+			CASE(S_IGT_GUARD)		if ( !(r[pc->b].i >  r[pc->c].i) ) goto side_exit;	NEXT;
+			CASE(S_IGE_GUARD)		if ( !(r[pc->b].i >= r[pc->c].i) ) goto side_exit;	NEXT;
+			CASE(S_IEQK_GUARD)		if ( !(r[pc->b].i == pc->k) ) goto side_exit;		NEXT;
+			CASE(S_INEQK_GUARD)		if ( !(r[pc->b].i != pc->k) ) goto side_exit;		NEXT;
+			CASE(S_ILTK_GUARD)		if ( !(r[pc->b].i <  pc->k) ) goto side_exit;		NEXT;
+			CASE(S_ILEK_GUARD)		if ( !(r[pc->b].i <= pc->k) ) goto side_exit;		NEXT;
+			CASE(S_IGTK_GUARD)		if ( !(r[pc->b].i >  pc->k) ) goto side_exit;		NEXT;
+			CASE(S_IGEK_GUARD)		if ( !(r[pc->b].i >= pc->k) ) goto side_exit;		NEXT;
+			CASE(S_VLOAD_INDEX)
+				r[pc->a].f = ith(vm_vector(locals[pc->c].vref), r[pc->b].i-1);
+				NEXT;
+			CASE(S_STORE_INDEX)
+				set_ith(vm_vector(locals[pc->a].vref), r[pc->b].i-1, r[pc->c].f);
+				NEXT;
+			CASE(S_VLEN)	r[pc->a] = (element){.i = Vector_len(vm_vector(locals[pc->c].vref))};	NEXT;
+			CASE(S_IPRINT)	vm_print_int(vm, r[pc->b].i);				NEXT;
+			CASE(S_FPRINT)	vm_print_float(vm, r[pc->b].f);				NEXT;
+			CASE(S_BPRINT)	vm_print_int(vm, r[pc->b].b);				NEXT;
+			CASE(S_LOOP)
+				pc = sb->code;
+				DISPATCH;
+#ifndef VM_THREADED_DISPATCH
+			default:
+				vm_flush(vm);
+				fprintf(stderr, "invalid superblock opcode: %d\n", pc->opcode);
+				exit(1);
+		}
+next:
+		pc++;
+	}
+#endif
+side_exit:
+	out = pc->x.exit;
+	for (int j = 0; j < sb->nstores; j++) locals[sb->stores[j]] = r[sb->stores[j]];
+	int sp = vm->sp;
+	for (int j = 0; j < out->nopnds; j++) {
+		const SB_Operand *e = &out->opnds[j];
+		vm->stack[++sp] = e->kind==SB_REG ? r[e->reg] : e->kind==SB_LOCAL ? locals[e->reg] : e->value;
+	}
+	vm->sp = sp;
+	vm->ip = (addr32)(out->resume - vm->instrs);
+	vm->hot_loops->side_exits++;
+}
+
+void sb_free(VM *vm)
+{
+	Hot_loops *h = vm->hot_loops;
+	if ( h==NULL ) return;
+	for (int i = 0; i <= vm->num_instrs; i++) {
+		Superblock *sb = h->blocks[i];
+		if ( sb==NULL ) continue;
+		for (int j = 0; j < sb->nexits; j++) free(sb->exits[j].opnds);
+		free(sb->exits);
+		free(sb->code);
+		free(sb->loads);
+		free(sb->stores);
+		free(sb);
+	}
+	free(h->blocks);
+	free(h->counts);
+	free(h);
+	vm->hot_loops = NULL;
+}
+
+void sb_print(Superblock *sb)
+{
+	printf("%s loop at %d: %d registers\n", sb->func->name, sb->header->offset, sb->nregs);
+	for (int j = 0; j < sb->ninstrs; j++) {
+		SInstr *S = &sb->code[j];
+		printf("%04d:  %-12s", j, sb_opcode_names[S->opcode]);
+		switch ( S->opcode ) {
+			case S_ICONST: printf("r%d, %d", S->a, S->k); break;
+			case S_FCONST: printf("r%d, %g", S->a, S->x.f); break;
+			case S_IADDK: printf("r%d, r%d, %d", S->a, S->b, S->k); break;
+			case S_GUARD_T: case S_GUARD_F: case S_IPRINT: case S_FPRINT: case S_BPRINT: printf("r%d", S->b); break;
+			case S_VLOAD_INDEX: printf("r%d, l%d[r%d]", S->a, S->c, S->b); break;
+			case S_STORE_INDEX: printf("l%d[r%d], r%d", S->a, S->b, S->c); break;
+			case S_VLEN: printf("r%d, l%d", S->a, S->c); break;
+			case S_LOOP: break;
+			case S_MOV: case S_INEG: case S_FNEG: case S_NOT: case S_I2F: case S_F2I:
+				printf("r%d, r%d", S->a, S->b);
+				break;
+			default:
+				if ( S->opcode>=S_IEQK_GUARD && S->opcode<=S_IGEK_GUARD ) printf("r%d, %d", S->b, S->k);
+				else if ( S->opcode>=S_IEQ_GUARD ) printf("r%d, r%d", S->b, S->c);
+				else printf("r%d, r%d, r%d", S->a, S->b, S->c);
+				break;
+		}
+		bool exits = (S->opcode>=S_GUARD_T && S->opcode<=S_IGEK_GUARD) || S->opcode==S_IDIV || S->opcode==S_FDIV;
+		if ( exits ) {
+			printf("  -> %d", S->x.exit->resume->offset);
+		}
+		printf("\n");
+	}
+}
@@ -0,0 +1,139 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef SUPERBLOCK_H_
+#define SUPERBLOCK_H_
+
+#include "vm.h"
+
+static const int HOT_LOOP_THRESHOLD = 50;		// default backward branches to a loop header before it's recorded
+static const int MAX_SUPERBLOCK_BYTECODES = 256;// longest loop iteration that's recorded
+static const int MAX_SUPERBLOCK_REGS = 256;		// frame plus operand stack of the loop's function
+
+/* Superblock tier for hot loops. The loop behind wrun -b
+ * counts backward branches per loop header. When a loop gets hot,
+ * sb_record() interprets one iteration itself, from the header back to it,
+ * and translates the path it took into straight-line register code:
+ *
+ *	- each BRF becomes a guard that the branch goes the same way again
+ *	- loads and constants only name the register or value an operation
+ *	  reads, so operand stack pushes and pops disappear as in regvm.c
+ *	- int, float and boolean locals live in registers 0..frame_size-1 for
+ *	  as long as the superblock runs; vector locals stay in the frame and
+ *	  are indexed there
+ *
+ * sb_exec() runs that code around and around. A guard that fails, or a
+ * division by zero, is a side exit: the locals the superblock stored go back
+ * to the frame, the operands the bytecode has on its stack at that point are
+ * pushed and the stack interpreter carries on at the instruction the
+ * bytecode would have gone to. Iterations that leave the function, call,
+ * allocate or use strings are never recorded, and neither are loops whose
+ * header has operands on the stack; a superblock is only entered with the
+ * stack as it was when it was recorded, which unverified code needn't keep.
+ */
+typedef enum {
+	S_MOV,			// r[a] = r[b]
+	S_ICONST,		// r[a].i = k
+	S_FCONST,		// r[a].f = f
+
+	S_IADD, S_ISUB, S_IMUL, S_IDIV,		// r[a] = r[b] op r[c]; IDIV and FDIV exit on a zero divisor
+	S_IADDK,							// r[a] = r[b] + k
+	S_FADD, S_FSUB, S_FMUL, S_FDIV,
+	S_OR, S_AND,
+	S_INEG, S_FNEG, S_NOT, S_I2F, S_F2I,	// r[a] = op r[b]
+
+	S_IEQ, S_INEQ, S_ILT, S_ILE, S_IGT, S_IGE,
+	S_FEQ, S_FNEQ, S_FLT, S_FLE, S_FGT, S_FGE,
+
+	S_GUARD_T,		// exit unless r[b]
+	S_GUARD_F,		// exit if r[b]
+	S_IEQ_GUARD, S_INEQ_GUARD, S_ILT_GUARD, S_ILE_GUARD, S_IGT_GUARD, S_IGE_GUARD,			// exit unless r[b] op r[c]
+	S_IEQK_GUARD, S_INEQK_GUARD, S_ILTK_GUARD, S_ILEK_GUARD, S_IGTK_GUARD, S_IGEK_GUARD,	// exit unless r[b] op k
+
+	S_VLOAD_INDEX,	// r[a].f = element r[b].i of vector local c
+	S_STORE_INDEX,	// element r[b].i of vector local a = r[c].f
+	S_VLEN,			// r[a].i = length of vector local c
+
+	S_IPRINT, S_FPRINT, S_BPRINT,	// print r[b]
+
+	S_LOOP			// back to the first instruction
+} SB_OPCODE;
+
+// An operand stack slot as the translator sees it: in a register, a
+// constant not loaded anywhere yet or a vector local read in the frame.
+typedef enum { SB_REG, SB_INT, SB_FLOAT, SB_LOCAL } SB_Operand_kind;
+
+typedef struct {
+	SB_Operand_kind kind;
+	int reg;			// register or local index
+	element value;		// SB_INT or SB_FLOAT constant
+} SB_Operand;
+
+// where the stack interpreter takes over when a guard fails
+typedef struct sb_exit {
+	const Instr *resume;	// instruction to continue at
+	int nopnds;				// operands to push first, bottom of stack first
+	SB_Operand *opnds;
+} SB_Exit;
+
+typedef struct sinstr {
+	const void *handler;	// address of superblock loop code that executes this instr
+	short opcode;
+	short a, b, c;			// register operands; a is the destination
+	int k;					// int immediate
+	union {
+		double f;			// float immediate
+		SB_Exit *exit;		// where a guard, IDIV or FDIV leaves
+	} x;
+} SInstr;
+
+typedef struct superblock {
+	Function_metadata *func;
+	const Instr *header;	// first instruction of the loop
+	int nregs;				// frame + operand stack depth of the iteration
+	int ninstrs;
+	SInstr *code;
+	int nexits;
+	SB_Exit *exits;
+	int nloads;				// locals copied into registers on entry
+	short *loads;
+	int nstores;			// locals copied back to the frame on exit
+	short *stores;
+	bool threaded;			// handlers filled in
+} Superblock;
+
+// per loop header state of a VM's superblock tier
+typedef struct hot_loops {
+	int *counts;			// backward branches taken to each instr; -1 once recording gave up
+	Superblock **blocks;	// superblock whose header is each instr or NULL
+	int compiled;			// superblocks made so far
+	long side_exits;		// times a superblock handed control back to the interpreter
+} Hot_loops;
+
+extern void sb_loop(VM *vm);
+extern Superblock *sb_record(VM *vm);
+extern void sb_exec(VM *vm, Superblock *sb);
+extern void sb_free(VM *vm);
+extern void sb_print(Superblock *sb);
+
+#endif
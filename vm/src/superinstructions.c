@@ -0,0 +1,88 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wich.h>
+#include "vm.h"
+#include "superinstructions.h"
+
+/* Fused sequences picked from opcode pair/triple counts over the sample
+ * programs (see wsuper). Longest patterns come first because vm_fuse()
+ * takes the first match at each instruction.
+ */
+VM_SUPERINSTRUCTION vm_superinstructions[] = {
+		{"ILOAD_ILOAD_ILT_BRF",     ILOAD_ILOAD_ILT_BRF,     4, {ILOAD, ILOAD, ILT, BRF}},
+		{"ILOAD_ILOAD_ILE_BRF",     ILOAD_ILOAD_ILE_BRF,     4, {ILOAD, ILOAD, ILE, BRF}},
+		{"ILOAD_ILOAD_IGT_BRF",     ILOAD_ILOAD_IGT_BRF,     4, {ILOAD, ILOAD, IGT, BRF}},
+		{"ILOAD_ILOAD_IGE_BRF",     ILOAD_ILOAD_IGE_BRF,     4, {ILOAD, ILOAD, IGE, BRF}},
+		{"ILOAD_ICONST_IADD_STORE", ILOAD_ICONST_IADD_STORE, 4, {ILOAD, ICONST, IADD, STORE}},
+
+		{"ILOAD_ICONST_IADD",       ILOAD_ICONST_IADD,       3, {ILOAD, ICONST, IADD}},
+		{"ILOAD_ICONST_ISUB",       ILOAD_ICONST_ISUB,       3, {ILOAD, ICONST, ISUB}},
+		{"ILOAD_ICONST_IEQ",        ILOAD_ICONST_IEQ,        3, {ILOAD, ICONST, IEQ}},
+		{"ILOAD_ILOAD_IADD",        ILOAD_ILOAD_IADD,        3, {ILOAD, ILOAD, IADD}},
+		{"ILOAD_ILOAD_ISUB",        ILOAD_ILOAD_ISUB,        3, {ILOAD, ILOAD, ISUB}},
+
+		{"IEQ_BRF",                 IEQ_BRF,                 2, {IEQ, BRF}},
+		{"INEQ_BRF",                INEQ_BRF,                2, {INEQ, BRF}},
+		{"ILT_BRF",                 ILT_BRF,                 2, {ILT, BRF}},
+		{"ILE_BRF",                 ILE_BRF,                 2, {ILE, BRF}},
+		{"IGT_BRF",                 IGT_BRF,                 2, {IGT, BRF}},
+		{"IGE_BRF",                 IGE_BRF,                 2, {IGE, BRF}},
+		{"FLT_BRF",                 FLT_BRF,                 2, {FLT, BRF}},
+		{"FGT_BRF",                 FGT_BRF,                 2, {FGT, BRF}},
+		{"ICONST_I2F",              ICONST_I2F,              2, {ICONST, I2F}},
+		{"STORE_ILOAD",             STORE_ILOAD,             2, {STORE, ILOAD}},
+};
+
+const int NUM_SUPERINSTRS = sizeof(vm_superinstructions)/sizeof(vm_superinstructions[0]);
+
+/* Return the first superinstruction whose pattern matches the decoded
+ * instructions starting at index i or NULL if none.
+ */
+VM_SUPERINSTRUCTION *vm_superinstr_at(VM *vm, int i)
+{
+	for (int s = 0; s < NUM_SUPERINSTRS; s++) {
+		VM_SUPERINSTRUCTION *S = &vm_superinstructions[s];
+		if ( i + S->length > vm->num_instrs ) continue; // never fuse the trailing HALT
+		int j = 0;
+		while ( j < S->length && vm->instrs[i+j].opcode == S->pattern[j] ) j++;
+		if ( j == S->length ) return S;
+	}
+	return NULL;
+}
+
+/* Mark the start of every matching sequence in vm->instrs with its
+ * superinstruction. Every instruction is considered as a start, even those
+ * inside an earlier match, so that a branch into the middle of a fused
+ * sequence lands on a fused sequence too when possible.
+ */
+void vm_fuse(VM *vm)
+{
+	for (int i = 0; i < vm->num_instrs; i++) {
+		VM_SUPERINSTRUCTION *S = vm_superinstr_at(vm, i);
+		if ( S!=NULL ) vm->instrs[i].super = (byte)S->opcode;
+	}
+}
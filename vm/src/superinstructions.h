@@ -0,0 +1,48 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef SUPERINSTRUCTIONS_H_
+#define SUPERINSTRUCTIONS_H_
+
+#include "vm.h"
+
+static const int MAX_SUPER_LENGTH = 4;
+
+/* A superinstruction executes the instructions of pattern in one dispatch.
+ * It replaces only the handler of the first instruction in a sequence; the
+ * other records stay intact so branches into the middle still work.
+ */
+typedef struct {
+	char *name;
+	BYTECODE opcode;
+	int length;
+	BYTECODE pattern[MAX_SUPER_LENGTH];
+} VM_SUPERINSTRUCTION;
+
+extern VM_SUPERINSTRUCTION vm_superinstructions[];
+extern const int NUM_SUPERINSTRS;
+
+extern void vm_fuse(VM *vm);
+extern VM_SUPERINSTRUCTION *vm_superinstr_at(VM *vm, int i);
+
+#endif
@@ -0,0 +1,91 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symtab.h"
+
+static const int MIN_SYMTAB_SIZE = 16;
+
+static uint32_t hash(const char *s)
+{
+	uint32_t h = 2166136261u; // FNV-1a
+	for (; *s; s++) h = (h ^ (unsigned char)*s) * 16777619u;
+	return h;
+}
+
+static Symbol *lookup(const Symtab *t, const char *name)
+{
+	for (uint32_t i = hash(name);; i++) {
+		Symbol *s = &t->slots[i & (t->size-1)];
+		if ( s->name==NULL || strcmp(s->name, name)==0 ) return s;
+	}
+}
+
+/* Make room for n symbols before the table has to grow. */
+void symtab_init(Symtab *t, int n)
+{
+	int size = MIN_SYMTAB_SIZE;
+	while ( size<2*n ) size *= 2;
+	t->slots = calloc((size_t)size, sizeof(Symbol));
+	t->size = size;
+	t->count = 0;
+}
+
+void symtab_free(Symtab *t)
+{
+	free(t->slots);
+	t->slots = NULL;
+	t->size = t->count = 0;
+}
+
+/* The value of name or -1 if it isn't there. */
+int symtab_get(const Symtab *t, const char *name)
+{
+	if ( t->size==0 ) return -1;
+	Symbol *s = lookup(t, name);
+	return s->name!=NULL ? s->value : -1;
+}
+
+/* Add name unless it's there already; return whether it was added. Tables
+ * are kept at most half full so that probes stay short.
+ */
+bool symtab_put(Symtab *t, const char *name, int value)
+{
+	if ( 2*(t->count+1)>t->size ) {
+		Symtab bigger;
+		symtab_init(&bigger, t->count+1);
+		for (int i = 0; i < t->size; i++) {
+			if ( t->slots[i].name!=NULL ) *lookup(&bigger, t->slots[i].name) = t->slots[i];
+		}
+		bigger.count = t->count;
+		free(t->slots);
+		*t = bigger;
+	}
+	Symbol *s = lookup(t, name);
+	if ( s->name!=NULL ) return false;
+	*s = (Symbol){name, value};
+	t->count++;
+	return true;
+}
@@ -0,0 +1,49 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef SYMTAB_H_
+#define SYMTAB_H_
+
+#include <stdbool.h>
+
+/* Map names to small ints, e.g. function names to indexes into
+ * vm->functions, with an open addressing hash table. The table doesn't
+ * copy names; they must live as long as it does.
+ */
+typedef struct {
+	const char *name;	// NULL if the slot is free
+	int value;
+} Symbol;
+
+typedef struct symtab {
+	Symbol *slots;
+	int size;			// 0 or a power of two
+	int count;
+} Symtab;
+
+extern void symtab_init(Symtab *t, int n);
+extern void symtab_free(Symtab *t);
+extern int symtab_get(const Symtab *t, const char *name);
+extern bool symtab_put(Symtab *t, const char *name, int value);
+
+#endif
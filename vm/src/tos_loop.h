@@ -0,0 +1,722 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* The interpreter loop again, for verified code, with the top of the operand
+ * stack cached in a local, tos, that the C compiler can keep in a register.
+ * vm.c includes this file once to define vm_run_tos().
+ *
+ * stack[sp] is tos's home slot; every slot below it is in memory but
+ * stack[sp] itself may be out of date. So a push stores tos to stack[sp]
+ * before sp moves up and a pop reloads tos from the slot it uncovers, while
+ * an add only reads the second operand: one memory access instead of three.
+ * With nothing on the operand stack, tos is the last local and agrees with
+ * memory, so loads and stores of locals can go straight to the frame.
+ *
+ * Anything that looks at the operand stack in memory or may allocate, which
+ * can move objects under the GC roots in the frame, runs between SPILL and
+ * FILL: calls, returns, vector and string opcodes and the like. That keeps
+ * the loop small; only the int, float and boolean opcodes, loads and stores
+ * and the superinstructions made of them work on tos directly.
+ *
+ * No include guard on purpose.
+ */
+
+#define SPILL	stack[sp] = tos
+#define FILL	tos = stack[sp]
+#define PUSH	stack[sp++] = tos	// then set tos to the new top
+
+// Int and boolean results replace all of tos, like ICONST, rather than just
+// their field; merging them into the old bits costs instructions.
+
+static VM_LOOP_ATTRIBUTES void vm_run_tos(VM *vm)
+{
+	int i = 0;
+	bool b1;
+	double f;
+	String *c;
+	PVector_ptr vptr,r,l;
+	int x, y;
+	Activation_Record *frame;
+	Function_metadata *func;
+	element *locals;
+
+	register const Instr *pc = &vm->instrs[vm->ip];
+	register int sp = vm->sp;
+	register int fp = vm->fp;
+	element *stack = vm->stack;
+	register element tos = stack[sp]; // stack[-1] exists for main's empty stack
+
+#ifdef VM_THREADED_DISPATCH
+	static const void *const dispatch[] = {
+		[HALT] = &&do_HALT,
+		[IADD] = &&do_IADD, [ISUB] = &&do_ISUB, [IMUL] = &&do_IMUL, [IDIV] = &&do_IDIV,
+		[FADD] = &&do_FADD, [FSUB] = &&do_FSUB, [FMUL] = &&do_FMUL, [FDIV] = &&do_FDIV,
+		[VADD] = &&do_VADD, [VADDI] = &&do_VADDI, [VADDF] = &&do_VADDF,
+		[VSUB] = &&do_VSUB, [VSUBI] = &&do_VSUBI, [VSUBF] = &&do_VSUBF,
+		[VMUL] = &&do_VMUL, [VMULI] = &&do_VMULI, [VMULF] = &&do_VMULF,
+		[VDIV] = &&do_VDIV, [VDIVI] = &&do_VDIVI, [VDIVF] = &&do_VDIVF,
+		[SADD] = &&do_SADD,
+		[OR] = &&do_OR, [AND] = &&do_AND, [INEG] = &&do_INEG, [FNEG] = &&do_FNEG, [NOT] = &&do_NOT,
+		[I2F] = &&do_I2F, [F2I] = &&do_F2I, [I2S] = &&do_I2S, [F2S] = &&do_F2S, [V2S] = &&do_V2S,
+		[IEQ] = &&do_IEQ, [INEQ] = &&do_INEQ, [ILT] = &&do_ILT, [ILE] = &&do_ILE, [IGT] = &&do_IGT, [IGE] = &&do_IGE,
+		[FEQ] = &&do_FEQ, [FNEQ] = &&do_FNEQ, [FLT] = &&do_FLT, [FLE] = &&do_FLE, [FGT] = &&do_FGT, [FGE] = &&do_FGE,
+		[SEQ] = &&do_SEQ, [SNEQ] = &&do_SNEQ, [SGT] = &&do_SGT, [SGE] = &&do_SGE, [SLT] = &&do_SLT, [SLE] = &&do_SLE,
+		[VEQ] = &&do_VEQ, [VNEQ] = &&do_VNEQ,
+		[BR] = &&do_BR, [BRF] = &&do_BRF,
+		[ICONST] = &&do_ICONST, [FCONST] = &&do_FCONST, [SCONST] = &&do_SCONST,
+		[ILOAD] = &&do_ILOAD, [FLOAD] = &&do_FLOAD, [VLOAD] = &&do_VLOAD, [SLOAD] = &&do_SLOAD, [STORE] = &&do_STORE,
+		[VECTOR] = &&do_VECTOR, [VLOAD_INDEX] = &&do_VLOAD_INDEX, [STORE_INDEX] = &&do_STORE_INDEX,
+		[SLOAD_INDEX] = &&do_SLOAD_INDEX, [PUSH_DFLT_RETV] = &&do_PUSH_DFLT_RETV, [POP] = &&do_POP,
+		[CALL] = &&do_CALL, [RET] = &&do_RET,
+		[IPRINT] = &&do_IPRINT, [FPRINT] = &&do_FPRINT, [BPRINT] = &&do_BPRINT, [SPRINT] = &&do_SPRINT, [VPRINT] = &&do_VPRINT,
+		[NOP] = &&do_NOP, [VLEN] = &&do_VLEN, [SLEN] = &&do_SLEN,
+		[GC_START] = &&do_GC_START, [GC_END] = &&do_GC_END, [SROOT] = &&do_SROOT, [VROOT] = &&do_VROOT,
+		[COPY_VECTOR] = &&do_COPY_VECTOR,
+
+		[ICONST_I2F] = &&do_ICONST_I2F,
+		[ILOAD_ICONST_IADD] = &&do_ILOAD_ICONST_IADD, [ILOAD_ICONST_ISUB] = &&do_ILOAD_ICONST_ISUB,
+		[ILOAD_ICONST_IEQ] = &&do_ILOAD_ICONST_IEQ,
+		[ILOAD_ILOAD_IADD] = &&do_ILOAD_ILOAD_IADD, [ILOAD_ILOAD_ISUB] = &&do_ILOAD_ILOAD_ISUB,
+		[ILOAD_ILOAD_ILT_BRF] = &&do_ILOAD_ILOAD_ILT_BRF, [ILOAD_ILOAD_ILE_BRF] = &&do_ILOAD_ILOAD_ILE_BRF,
+		[ILOAD_ILOAD_IGT_BRF] = &&do_ILOAD_ILOAD_IGT_BRF, [ILOAD_ILOAD_IGE_BRF] = &&do_ILOAD_ILOAD_IGE_BRF,
+		[ILOAD_ICONST_IADD_STORE] = &&do_ILOAD_ICONST_IADD_STORE,
+		[IEQ_BRF] = &&do_IEQ_BRF, [INEQ_BRF] = &&do_INEQ_BRF, [ILT_BRF] = &&do_ILT_BRF, [ILE_BRF] = &&do_ILE_BRF,
+		[IGT_BRF] = &&do_IGT_BRF, [IGE_BRF] = &&do_IGE_BRF, [FLT_BRF] = &&do_FLT_BRF, [FGT_BRF] = &&do_FGT_BRF,
+		[STORE_ILOAD] = &&do_STORE_ILOAD,
+		[TAIL_CALL] = &&do_TAIL_CALL,
+		[CALL_QUICK] = &&do_CALL_QUICK, [SCONST_QUICK] = &&do_SCONST_QUICK
+	};
+	// as in vm_loop.h, the handlers belong to the loop that ran last
+	if ( vm->instrs[vm->num_instrs].handler!=dispatch[HALT] ) {
+		for (int k = 0; k <= vm->num_instrs; k++) vm->instrs[k].handler = dispatch[vm->instrs[k].super];
+	}
+
+	DISPATCH;
+#else
+	for (;;) {
+		int opcode = pc->super;
+		switch (opcode) {
+#endif
+			CASE(IADD)
+				y = tos.i;
+				tos = (element){.i = stack[--sp].i + y};
+				NEXT;
+			CASE(ISUB)
+				y = tos.i;
+				tos = (element){.i = stack[--sp].i - y};
+				NEXT;
+			CASE(IMUL)
+				y = tos.i;
+				tos = (element){.i = stack[--sp].i * y};
+				NEXT;
+			CASE(IDIV)
+				y = tos.i;
+				x = stack[--sp].i;
+				if ( y==0 ) vm_division_by_zero(vm);
+				tos = (element){.i = x / y};
+				NEXT;
+			CASE(FADD)
+				f = tos.f;
+				tos.f = stack[--sp].f + f;
+				NEXT;
+			CASE(FSUB)
+				f = tos.f;
+				tos.f = stack[--sp].f - f;
+				NEXT;
+			CASE(FMUL)
+				f = tos.f;
+				tos.f = stack[--sp].f * f;
+				NEXT;
+			CASE(FDIV)
+				f = tos.f;
+				if ( f==0 ) vm_division_by_zero(vm);
+				tos.f = stack[--sp].f / f;
+				NEXT;
+			CASE(VADD)
+				SPILL;
+				sp--;
+				vm_vector_op(vm, &stack[sp], &stack[sp+1], VEXPR_ADD);
+				FILL;
+				NEXT;
+			CASE(VADDI)
+				i = tos.i;
+				sp--;
+				vm_vector_scalar_op(vm, &stack[sp], VEXPR_ADD_SCALAR, i);
+				FILL;
+				NEXT;
+			CASE(VADDF)
+				f = tos.f;
+				sp--;
+				vm_vector_scalar_op(vm, &stack[sp], VEXPR_ADD_SCALAR, f);
+				FILL;
+				NEXT;
+			CASE(VSUB)
+				SPILL;
+				sp--;
+				vm_vector_op(vm, &stack[sp], &stack[sp+1], VEXPR_SUB);
+				FILL;
+				NEXT;
+			CASE(VSUBI)
+				i = tos.i;
+				sp--;
+				vm_vector_scalar_op(vm, &stack[sp], VEXPR_SUB_SCALAR, i);
+				FILL;
+				NEXT;
+			CASE(VSUBF)
+				f = tos.f;
+				sp--;
+				vm_vector_scalar_op(vm, &stack[sp], VEXPR_SUB_SCALAR, f);
+				FILL;
+				NEXT;
+			CASE(VMUL)
+				SPILL;
+				sp--;
+				vm_vector_op(vm, &stack[sp], &stack[sp+1], VEXPR_MUL);
+				FILL;
+				NEXT;
+			CASE(VMULI)
+				i = tos.i;
+				sp--;
+				vm_vector_scalar_op(vm, &stack[sp], VEXPR_MUL_SCALAR, i);
+				FILL;
+				NEXT;
+			CASE(VMULF)
+				f = tos.f;
+				sp--;
+				vm_vector_scalar_op(vm, &stack[sp], VEXPR_MUL_SCALAR, f);
+				FILL;
+				NEXT;
+			CASE(VDIV)
+				SPILL;
+				sp--;
+				vm_vector_op(vm, &stack[sp], &stack[sp+1], VEXPR_DIV);
+				FILL;
+				NEXT;
+			CASE(VDIVI)
+				i = tos.i;
+				sp--;
+				if ( i==0 ) zero_division_error();
+				else vm_vector_scalar_op(vm, &stack[sp], VEXPR_DIV_SCALAR, i);
+				FILL;
+				NEXT;
+			CASE(VDIVF)
+				f = tos.f;
+				sp--;
+				if ( f==0 ) zero_division_error();
+				else vm_vector_scalar_op(vm, &stack[sp], VEXPR_DIV_SCALAR, f);
+				FILL;
+				NEXT;
+			CASE(SADD)
+				c = tos.s;
+				tos.s = String_add(stack[--sp].s, c);
+				NEXT;
+			CASE(OR)
+				tos = (element){.b = stack[--sp].b || tos.b};
+				NEXT;
+			CASE(AND)
+				tos = (element){.b = stack[--sp].b && tos.b};
+				NEXT;
+			CASE(INEG)
+				tos = (element){.i = -tos.i};
+				NEXT;
+			CASE(FNEG)
+				tos.f = -tos.f;
+				NEXT;
+			CASE(NOT)
+				tos = (element){.b = !tos.b};
+				NEXT;
+			CASE(I2F)
+				tos.f = tos.i;
+				NEXT;
+			CASE(I2S)
+				tos.s = String_from_int(tos.i);
+				NEXT;
+			CASE(F2I)
+				tos = (element){.i = (int)tos.f};
+				NEXT;
+			CASE(F2S)
+				tos.s = String_from_float(tos.f);
+				NEXT;
+			CASE(V2S)
+				SPILL;
+				vm_force(vm, &stack[sp]);
+				vptr = vm_vector(stack[sp].vref);
+				stack[sp].s = String_from_vector(vptr);
+				FILL;
+				NEXT;
+			CASE(IEQ)
+				y = tos.i;
+				tos = (element){.b = stack[--sp].i == y};
+				NEXT;
+			CASE(INEQ)
+				y = tos.i;
+				tos = (element){.b = stack[--sp].i != y};
+				NEXT;
+			CASE(ILT)
+				y = tos.i;
+				tos = (element){.b = stack[--sp].i < y};
+				NEXT;
+			CASE(ILE)
+				y = tos.i;
+				tos = (element){.b = stack[--sp].i <= y};
+				NEXT;
+			CASE(IGT)
+				y = tos.i;
+				tos = (element){.b = stack[--sp].i > y};
+				NEXT;
+			CASE(IGE)
+				y = tos.i;
+				tos = (element){.b = stack[--sp].i >= y};
+				NEXT;
+			CASE(FEQ)
+				f = tos.f;
+				tos = (element){.b = stack[--sp].f == f};
+				NEXT;
+			CASE(FNEQ)
+				f = tos.f;
+				tos = (element){.b = stack[--sp].f != f};
+				NEXT;
+			CASE(FLT)
+				f = tos.f;
+				tos = (element){.b = stack[--sp].f < f};
+				NEXT;
+			CASE(FLE)
+				f = tos.f;
+				tos = (element){.b = stack[--sp].f <= f};
+				NEXT;
+			CASE(FGT)
+				f = tos.f;
+				tos = (element){.b = stack[--sp].f > f};
+				NEXT;
+			CASE(FGE)
+				f = tos.f;
+				tos = (element){.b = stack[--sp].f >= f};
+				NEXT;
+			CASE(SEQ)
+				c = tos.s;
+				sp--;
+				tos = (element){.b = String_eq(stack[sp].s, c)};
+				NEXT;
+			CASE(SNEQ)
+				c = tos.s;
+				sp--;
+				tos = (element){.b = String_neq(stack[sp].s, c)};
+				NEXT;
+			CASE(SGT)
+				c = tos.s;
+				sp--;
+				tos = (element){.b = String_gt(stack[sp].s, c)};
+				NEXT;
+			CASE(SGE)
+				c = tos.s;
+				sp--;
+				tos = (element){.b = String_ge(stack[sp].s, c)};
+				NEXT;
+			CASE(SLT)
+				c = tos.s;
+				sp--;
+				tos = (element){.b = String_lt(stack[sp].s, c)};
+				NEXT;
+			CASE(SLE)
+				c = tos.s;
+				sp--;
+				tos = (element){.b = String_le(stack[sp].s, c)};
+				NEXT;
+			CASE(VEQ)
+				SPILL;
+				vm_force_n(vm, &stack[sp-1], 2);
+				l = vm_vector(stack[sp--].vref);
+				r = vm_vector(stack[sp].vref);
+				tos = (element){.b = Vector_eq(l,r)};
+				NEXT;
+			CASE(VNEQ)
+				SPILL;
+				vm_force_n(vm, &stack[sp-1], 2);
+				l = vm_vector(stack[sp--].vref);
+				r = vm_vector(stack[sp].vref);
+				tos = (element){.b = Vector_neq(l,r)};
+				NEXT;
+			CASE(BR)
+				pc = pc->a.target;
+				DISPATCH;
+			CASE(BRF)
+				b1 = tos.b;
+				tos = stack[--sp];
+				if ( !b1 ) {
+					pc = pc->a.target;
+					DISPATCH;
+				}
+				NEXT;
+			CASE(ICONST)
+				PUSH;
+				tos = (element){.i = pc->a.i}; // whole slot so ICONST 0 also reads as 0.0
+				NEXT;
+			CASE(FCONST)
+				PUSH;
+				tos.f = pc->a.f;
+				NEXT;
+			CASE(SCONST)
+				PUSH;
+				tos.s = vm->strings[pc->a.i];
+				((Instr *)pc)->a.s = tos.s;
+				QUICKEN(SCONST_QUICK);
+				NEXT;
+			CASE(SCONST_QUICK)
+				PUSH;
+				tos.s = pc->a.s;
+				NEXT;
+			CASE(ILOAD)
+				PUSH;
+				tos = (element){.i = stack[fp + pc->a.i].i};
+				NEXT;
+			CASE(FLOAD)
+				PUSH;
+				tos.f = stack[fp + pc->a.i].f;
+				NEXT;
+			CASE(VLOAD)
+				PUSH;
+				tos.vref = stack[fp + pc->a.i].vref;
+				NEXT;
+			CASE(SLOAD)
+				PUSH;
+				tos.s = stack[fp + pc->a.i].s;
+				NEXT;
+			CASE(STORE)
+				if ( vm->num_lazy>0 ) {
+					SPILL;
+					vm_force(vm, &stack[sp]);
+					FILL;
+				}
+				stack[fp + pc->a.i] = tos; // untyped store; it'll just copy all bits
+				tos = stack[--sp];
+				NEXT;
+			CASE(VECTOR) {
+				SPILL;
+				i = stack[sp--].i;
+				double *data = (double*)malloc(i*sizeof(double));
+				for (int j = i-1; j >= 0;j--) { data[j] = stack[sp--].f; }
+				vptr = Vector_new(data,i);
+				stack[++sp].vref = vm_vector_ref(vptr);
+				FILL;
+				NEXT;
+			}
+			CASE(VLOAD_INDEX)
+				SPILL;
+				vm_force(vm, &stack[sp-1]);
+				i = stack[sp--].i;
+				vptr = vm_vector(stack[sp].vref);
+				tos.f = ith(vptr, i-1);
+				NEXT;
+			CASE(STORE_INDEX)
+				SPILL;
+				vm_force(vm, &stack[sp-2]);
+				f = stack[sp--].f;
+				i = stack[sp--].i;
+				vptr = vm_vector(stack[sp--].vref);
+				set_ith(vptr, i-1, f);
+				FILL;
+				NEXT;
+			CASE(SLOAD_INDEX)
+				i = tos.i;
+				c = stack[--sp].s;
+				if (i-1 >= c->length)
+				{
+					fprintf(stderr, "StringIndexOutOfRange: %d out of index : 1 to %d\n",i,(int)c->length);
+					tos = stack[--sp];
+					NEXT;
+				}
+				stack[sp].s = String_from_char(c->str[i-1]);
+				FILL;
+				NEXT;
+			CASE(PUSH_DFLT_RETV)
+				SPILL;
+				i = vm->call_stack[vm->callsp].func->return_type;
+				sp = push_default_value(i, sp, stack);
+				FILL;
+				NEXT;
+			CASE(POP)
+				if ( vm->num_lazy>0 ) {
+					SPILL;
+					vm_drop(vm, &stack[sp]);
+				}
+				tos = stack[--sp];
+				NEXT;
+			CASE(CALL)
+				func = pc->a.func;
+				// a callee that isn't compiled now never will be without the JIT
+				if ( !vm->jit && func->native==NULL && func->regcode==NULL ) QUICKEN(CALL_QUICK);
+				pc++; // return to instruction following CALL
+				SPILL;
+				vm_force_n(vm, &stack[sp - func->nargs + 1], func->nargs);
+				WRITE_BACK_REGISTERS(vm);
+				if ( !vm_call_compiled(vm, func) ) vm_call(vm, func);
+				LOAD_REGISTERS(vm);
+				FILL;
+				DISPATCH;
+			CASE(CALL_QUICK)
+				func = pc->a.func;
+				SPILL;
+				vm_force_n(vm, &stack[sp - func->nargs + 1], func->nargs);
+				if ( vm->callsp+1>=MAX_CALL_STACK || sp + func->frame_size + func->max_stack>=MAX_OPND_STACK ) {
+					pc++;
+					WRITE_BACK_REGISTERS(vm);
+					vm_call(vm, func); // reports the overflow
+				}
+				// vm_call() without leaving the loop
+				frame = &vm->call_stack[++vm->callsp];
+				frame->func = func;
+				frame->retaddr = (addr32)(pc + 1 - vm->instrs);
+				frame->elided = 0;
+				frame->fp = fp = sp - func->nargs + 1;
+				memset(&stack[sp+1], 0, (func->frame_size - func->nargs) * sizeof(element));
+				sp = fp + func->frame_size - 1;
+				FILL;
+				pc = &vm->instrs[func->entry];
+				DISPATCH;
+			CASE(TAIL_CALL)
+				func = pc->a.func;
+				SPILL;
+				vm_force_n(vm, &stack[sp - func->nargs + 1], func->nargs);
+				pc++;
+				WRITE_BACK_REGISTERS(vm);
+				if ( !vm_call_compiled(vm, func) ) vm_tail_call(vm, func);
+				LOAD_REGISTERS(vm);
+				FILL;
+				DISPATCH;
+			CASE(RET)
+				frame = &vm->call_stack[vm->callsp--];
+				pc = &vm->instrs[frame->retaddr];
+				// the result, if any, replaces the args; it stays in tos
+				if ( frame->func->return_type!=VOID_TYPE ) {
+					if ( vm->num_lazy>0 ) {
+						SPILL;
+						vm_force(vm, &stack[sp]);
+						FILL;
+					}
+					sp = frame->fp;
+				}
+				else {
+					sp = frame->fp - 1;
+					FILL;
+				}
+				fp = vm->callsp>=0 ? vm->call_stack[vm->callsp].fp : -1;
+				DISPATCH;
+			CASE(IPRINT)
+				vm_print_int(vm, tos.i);
+				tos = stack[--sp];
+				NEXT;
+			CASE(FPRINT)
+				vm_print_float(vm, tos.f);
+				tos = stack[--sp];
+				NEXT;
+			CASE(BPRINT)
+				vm_print_int(vm, tos.b);
+				tos = stack[--sp];
+				NEXT;
+			CASE(SPRINT)
+				vm_print_string(vm, tos.s);
+				tos = stack[--sp];
+				NEXT;
+			CASE(VPRINT)
+				SPILL;
+				vm_force(vm, &stack[sp]);
+				vm_print_vector(vm, vm_vector(stack[sp--].vref));
+				FILL;
+				NEXT;
+			CASE(VLEN)
+				SPILL;
+				vm_force(vm, &stack[sp]);
+				tos = (element){.i = Vector_len(vm_vector(stack[sp].vref))};
+				NEXT;
+			CASE(SLEN)
+				tos = (element){.i = String_len(tos.s)};
+				NEXT;
+			CASE(GC_START)
+				vm->call_stack[vm->callsp].save_gc_roots = gc_num_roots();
+				NEXT;
+			CASE(GC_END)
+				gc_set_num_roots(vm->call_stack[vm->callsp].save_gc_roots);
+				NEXT;
+			CASE(SROOT)
+				SPILL;
+				gc_add_root((void **)&stack[sp].s);
+				NEXT;
+			CASE(VROOT)
+				SPILL;
+				vm_force(vm, &stack[sp]);
+				gc_add_root((void **)&stack[sp].vref);
+				FILL;
+				NEXT;
+			CASE(COPY_VECTOR)
+				SPILL;
+				vm_force(vm, &stack[sp]);
+				if (stack[sp].vref != NULL) {
+					stack[sp].vref = vm_vector_ref(Vector_copy(stack[sp].vref->vptr));
+				}
+				else {
+					fprintf(stderr, "Vector reference cannot be found\n");
+				}
+				FILL;
+				NEXT;
+			CASE(NOP) NEXT;
+			CASE(HALT)
+				SPILL;
+				goto halt;
+
+			// superinstructions; operands are found in the records of the
+			// instructions they replace: pc[0], pc[1], ...
+			CASE(ICONST_I2F)
+				PUSH;
+				tos.f = pc->a.i;
+				pc += 2;
+				DISPATCH;
+			CASE(ILOAD_ICONST_IADD)
+				PUSH;
+				locals = &stack[fp];
+				tos = (element){.i = locals[pc[0].a.i].i + pc[1].a.i};
+				pc += 3;
+				DISPATCH;
+			CASE(ILOAD_ICONST_ISUB)
+				PUSH;
+				locals = &stack[fp];
+				tos = (element){.i = locals[pc[0].a.i].i - pc[1].a.i};
+				pc += 3;
+				DISPATCH;
+			CASE(ILOAD_ICONST_IEQ)
+				PUSH;
+				locals = &stack[fp];
+				tos = (element){.b = locals[pc[0].a.i].i == pc[1].a.i};
+				pc += 3;
+				DISPATCH;
+			CASE(ILOAD_ILOAD_IADD)
+				PUSH;
+				locals = &stack[fp];
+				tos = (element){.i = locals[pc[0].a.i].i + locals[pc[1].a.i].i};
+				pc += 3;
+				DISPATCH;
+			CASE(ILOAD_ILOAD_ISUB)
+				PUSH;
+				locals = &stack[fp];
+				tos = (element){.i = locals[pc[0].a.i].i - locals[pc[1].a.i].i};
+				pc += 3;
+				DISPATCH;
+			CASE(ILOAD_ILOAD_ILT_BRF)
+				locals = &stack[fp];
+				pc = locals[pc[0].a.i].i < locals[pc[1].a.i].i ? pc + 4 : pc[3].a.target;
+				DISPATCH;
+			CASE(ILOAD_ILOAD_ILE_BRF)
+				locals = &stack[fp];
+				pc = locals[pc[0].a.i].i <= locals[pc[1].a.i].i ? pc + 4 : pc[3].a.target;
+				DISPATCH;
+			CASE(ILOAD_ILOAD_IGT_BRF)
+				locals = &stack[fp];
+				pc = locals[pc[0].a.i].i > locals[pc[1].a.i].i ? pc + 4 : pc[3].a.target;
+				DISPATCH;
+			CASE(ILOAD_ILOAD_IGE_BRF)
+				locals = &stack[fp];
+				pc = locals[pc[0].a.i].i >= locals[pc[1].a.i].i ? pc + 4 : pc[3].a.target;
+				DISPATCH;
+			CASE(ILOAD_ICONST_IADD_STORE)
+				locals = &stack[fp];
+				x = locals[pc[0].a.i].i + pc[1].a.i;
+				locals[pc[3].a.i].i = x;
+				if ( fp + pc[3].a.i==sp ) tos = (element){.i = x}; // nothing on the operand stack; tos is this local
+				pc += 4;
+				DISPATCH;
+			CASE(IEQ_BRF)
+				y = tos.i;
+				x = stack[--sp].i;
+				tos = stack[--sp];
+				pc = x == y ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(INEQ_BRF)
+				y = tos.i;
+				x = stack[--sp].i;
+				tos = stack[--sp];
+				pc = x != y ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(ILT_BRF)
+				y = tos.i;
+				x = stack[--sp].i;
+				tos = stack[--sp];
+				pc = x < y ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(ILE_BRF)
+				y = tos.i;
+				x = stack[--sp].i;
+				tos = stack[--sp];
+				pc = x <= y ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(IGT_BRF)
+				y = tos.i;
+				x = stack[--sp].i;
+				tos = stack[--sp];
+				pc = x > y ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(IGE_BRF)
+				y = tos.i;
+				x = stack[--sp].i;
+				tos = stack[--sp];
+				pc = x >= y ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(FLT_BRF)
+				f = tos.f;
+				b1 = stack[--sp].f < f;
+				tos = stack[--sp];
+				pc = b1 ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(FGT_BRF)
+				f = tos.f;
+				b1 = stack[--sp].f > f;
+				tos = stack[--sp];
+				pc = b1 ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(STORE_ILOAD)
+				if ( vm->num_lazy>0 ) {
+					SPILL;
+					vm_force(vm, &stack[sp]);
+					FILL;
+				}
+				locals = &stack[fp];
+				locals[pc[0].a.i] = tos;
+				tos = (element){.i = locals[pc[1].a.i].i};
+				pc += 2;
+				DISPATCH;
+#ifndef VM_THREADED_DISPATCH
+			default:
+				vm_flush(vm);
+				fprintf(stderr, "invalid opcode: %d at ip=%d\n", opcode, pc->offset);
+				exit(1);
+		}
+next:
+		pc++;
+	}
+#endif
+halt:
+	WRITE_BACK_REGISTERS(vm);
+}
+
+#undef SPILL
+#undef FILL
+#undef PUSH
@@ -0,0 +1,309 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <wich.h>
+#include "vm.h"
+#include "verifier.h"
+
+static const int ANY_TYPE = -1; // type not known statically; e.g., args
+
+// what the verifier knows about a value on the operand stack
+typedef struct {
+	int type;
+	bool known;		// int constant with known value? VECTOR needs its size
+	int value;
+} Value;
+
+// abstract machine state before an instruction
+typedef struct {
+	int depth;		// -1 until instruction is found reachable
+	Value *stack;
+	int *locals;
+} State;
+
+/* Operand types popped (bottom to top) and pushed by each instruction that
+ * has a fixed signature: i int, f float, b boolean, s string, v vector,
+ * a anything.
+ */
+static const char *signatures[] = {
+	[HALT] = ">",
+	[IADD] = "ii>i", [ISUB] = "ii>i", [IMUL] = "ii>i", [IDIV] = "ii>i",
+	[FADD] = "ff>f", [FSUB] = "ff>f", [FMUL] = "ff>f", [FDIV] = "ff>f",
+	[VADD] = "vv>v", [VADDI] = "vi>v", [VADDF] = "vf>v",
+	[VSUB] = "vv>v", [VSUBI] = "vi>v", [VSUBF] = "vf>v",
+	[VMUL] = "vv>v", [VMULI] = "vi>v", [VMULF] = "vf>v",
+	[VDIV] = "vv>v", [VDIVI] = "vi>v", [VDIVF] = "vf>v",
+	[SADD] = "ss>s",
+	[OR] = "bb>b", [AND] = "bb>b", [INEG] = "i>i", [FNEG] = "f>f", [NOT] = "b>b",
+	[I2F] = "i>f", [F2I] = "f>i", [I2S] = "i>s", [F2S] = "f>s", [V2S] = "v>s",
+	[IEQ] = "ii>b", [INEQ] = "ii>b", [ILT] = "ii>b", [ILE] = "ii>b", [IGT] = "ii>b", [IGE] = "ii>b",
+	[FEQ] = "ff>b", [FNEQ] = "ff>b", [FLT] = "ff>b", [FLE] = "ff>b", [FGT] = "ff>b", [FGE] = "ff>b",
+	[SEQ] = "ss>b", [SNEQ] = "ss>b", [SGT] = "ss>b", [SGE] = "ss>b", [SLT] = "ss>b", [SLE] = "ss>b",
+	[VEQ] = "vv>b", [VNEQ] = "vv>b",
+	[BR] = ">", [BRF] = "b>",
+	[ICONST] = ">i", [FCONST] = ">f", [SCONST] = ">s",
+	[VLOAD_INDEX] = "vi>f", [STORE_INDEX] = "vif>", [SLOAD_INDEX] = "si>s",
+	[POP] = "a>",
+	[IPRINT] = "i>", [FPRINT] = "f>", [BPRINT] = "b>", [SPRINT] = "s>", [VPRINT] = "v>",
+	[NOP] = ">", [VLEN] = "v>i", [SLEN] = "s>i",
+	[GC_START] = ">", [GC_END] = ">", [SROOT] = ">", [VROOT] = ">",
+	[COPY_VECTOR] = "v>v",
+};
+
+static int type_of(char c)
+{
+	switch ( c ) {
+		case 'i' : return INT_TYPE;
+		case 'f' : return FLOAT_TYPE;
+		case 'b' : return BOOLEAN_TYPE;
+		case 's' : return STRING_TYPE;
+		case 'v' : return VECTOR_TYPE;
+		default  : return ANY_TYPE;
+	}
+}
+
+static bool compatible(int found, int expected)
+{
+	if ( found==expected || found==ANY_TYPE || expected==ANY_TYPE ) return true;
+	// the code generator uses ICONST 0/1 for booleans and ILOAD to load them
+	return (found==INT_TYPE && expected==BOOLEAN_TYPE) || (found==BOOLEAN_TYPE && expected==INT_TYPE);
+}
+
+static bool verify_error(bool report, Function_metadata *func, const Instr *I, char *fmt, ...)
+{
+	if ( report ) {
+		va_list args;
+		va_start(args, fmt);
+		fprintf(stderr, "verify error in %s at %04d %s: ", func->name, I->offset, vm_instructions[I->opcode].name);
+		vfprintf(stderr, fmt, args);
+		fprintf(stderr, "\n");
+		va_end(args);
+	}
+	return false;
+}
+
+// merge state s into the state of instruction j; returns true if that changed it
+static bool merge(State *states, int j, int depth, Value *stack, int *locals, int nlocals)
+{
+	State *t = &states[j];
+	if ( t->depth<0 ) {
+		t->depth = depth;
+		t->stack = malloc((depth+1) * sizeof(Value));
+		memcpy(t->stack, stack, depth * sizeof(Value));
+		t->locals = malloc((nlocals+1) * sizeof(int));
+		memcpy(t->locals, locals, nlocals * sizeof(int));
+		return true;
+	}
+	bool changed = false;
+	for (int d = 0; d < depth; d++) {
+		Value *v = &t->stack[d];
+		if ( v->type!=stack[d].type && v->type!=ANY_TYPE ) { v->type = ANY_TYPE; changed = true; }
+		if ( v->known && (!stack[d].known || v->value!=stack[d].value) ) { v->known = false; changed = true; }
+	}
+	for (int k = 0; k < nlocals; k++) {
+		if ( t->locals[k]!=locals[k] && t->locals[k]!=ANY_TYPE ) { t->locals[k] = ANY_TYPE; changed = true; }
+	}
+	return changed;
+}
+
+// verify func; with depths, also record the stack depth before each instruction
+static bool verify(VM *vm, Function_metadata *func, bool report, int *depths)
+{
+	int start = func->entry;
+	int end = (int)func->end;
+	int n = end - start;
+	int nlocals = func->nargs + func->nlocals;
+	if ( n<=0 || func->nargs<0 || func->nlocals<0 ) {
+		if ( report ) fprintf(stderr, "verify error in %s: bad address, args or locals\n", func->name);
+		return false;
+	}
+
+	State *states = calloc((size_t)n, sizeof(State));
+	for (int i = 0; i < n; i++) states[i].depth = -1;
+	int *work = malloc(n * sizeof(int));
+	bool *queued = calloc((size_t)n, sizeof(bool));
+	int nwork = 0;
+	Value *stack = malloc((n+1) * sizeof(Value)); // joins must agree on depth so no path gets deeper
+	int *locals = malloc((nlocals+1) * sizeof(int));
+	int max_stack = 0;
+	bool ok = true;
+
+	for (int k = 0; k < nlocals; k++) locals[k] = ANY_TYPE;
+	merge(states, 0, 0, stack, locals, nlocals);
+	work[nwork++] = 0;
+	queued[0] = true;
+
+	while ( ok && nwork>0 ) {
+		int i = work[--nwork];
+		queued[i] = false;
+		const Instr *I = &vm->instrs[start + i];
+		int sp = states[i].depth;
+		memcpy(stack, states[i].stack, sp * sizeof(Value));
+		memcpy(locals, states[i].locals, nlocals * sizeof(int));
+
+		int succ[2] = {i+1, -1};
+		const char *sig = I->opcode < (int)(sizeof(signatures)/sizeof(signatures[0])) ? signatures[I->opcode] : NULL;
+		Value push = {VOID_TYPE, false, 0};
+
+		switch ( I->opcode ) {
+			case ILOAD: case FLOAD: case VLOAD: case SLOAD: {
+				int type = I->opcode==ILOAD ? INT_TYPE : I->opcode==FLOAD ? FLOAT_TYPE :
+						   I->opcode==VLOAD ? VECTOR_TYPE : STRING_TYPE;
+				if ( I->a.i<0 || I->a.i>=nlocals ) { ok = verify_error(report, func, I, "local %d out of range", I->a.i); break; }
+				if ( !compatible(locals[I->a.i], type) ) { ok = verify_error(report, func, I, "local %d has wrong type", I->a.i); break; }
+				push.type = type;
+				break;
+			}
+			case STORE:
+				if ( I->a.i<0 || I->a.i>=nlocals ) { ok = verify_error(report, func, I, "local %d out of range", I->a.i); break; }
+				if ( sp<1 ) { ok = verify_error(report, func, I, "stack underflow"); break; }
+				locals[I->a.i] = stack[--sp].type;
+				break;
+			case SCONST:
+				if ( I->super!=SCONST_QUICK && (I->a.i<0 || I->a.i>=vm->num_strings) ) { ok = verify_error(report, func, I, "string %d out of range", I->a.i); break; }
+				push.type = STRING_TYPE;
+				break;
+			case VECTOR: {
+				if ( sp<1 || !stack[sp-1].known ) { ok = verify_error(report, func, I, "size not a constant"); break; }
+				int size = stack[--sp].value;
+				if ( size<0 || size>sp ) { ok = verify_error(report, func, I, "stack underflow"); break; }
+				for (int k = 0; k < size; k++) {
+					if ( !compatible(stack[--sp].type, FLOAT_TYPE) ) { ok = verify_error(report, func, I, "element not float"); break; }
+				}
+				push.type = VECTOR_TYPE;
+				break;
+			}
+			case PUSH_DFLT_RETV:
+				push.type = func->return_type;
+				break;
+			case CALL: {
+				Function_metadata *callee = I->a.func;
+				if ( callee<vm->functions || callee>=&vm->functions[vm->num_functions] ) {
+					ok = verify_error(report, func, I, "no such function");
+					break;
+				}
+				if ( sp<callee->nargs ) { ok = verify_error(report, func, I, "stack underflow"); break; }
+				sp -= callee->nargs;
+				push.type = callee->return_type;
+				break;
+			}
+			case RET: {
+				int expected = func->return_type==VOID_TYPE ? 0 : 1;
+				if ( sp!=expected ) { ok = verify_error(report, func, I, "stack depth %d at return", sp); break; }
+				if ( expected==1 && !compatible(stack[0].type, func->return_type) ) {
+					ok = verify_error(report, func, I, "wrong return type");
+				}
+				succ[0] = -1;
+				break;
+			}
+			case HALT:
+				succ[0] = -1;
+				break;
+			default:
+				if ( sig==NULL ) { ok = verify_error(report, func, I, "invalid opcode"); break; }
+				const char *gt = strchr(sig, '>');
+				int npops = (int)(gt - sig);
+				if ( sp<npops ) { ok = verify_error(report, func, I, "stack underflow"); break; }
+				for (int k = npops-1; k >= 0; k--) {
+					Value *v = &stack[--sp];
+					// int 0 has the same bits as 0.0; code generator compares floats with ICONST 0
+					bool zero = v->known && v->value==0 && type_of(sig[k])==FLOAT_TYPE;
+					if ( !zero && !compatible(v->type, type_of(sig[k])) ) {
+						ok = verify_error(report, func, I, "operand %d has wrong type", k+1);
+						break;
+					}
+				}
+				if ( gt[1]!='\0' ) push.type = type_of(gt[1]);
+				if ( I->opcode==ICONST ) {
+					push.known = true;
+					push.value = I->a.i;
+				}
+				break;
+		}
+		if ( !ok ) break;
+		if ( push.type!=VOID_TYPE ) {
+			if ( sp>=n ) { ok = verify_error(report, func, I, "stack overflow"); break; }
+			stack[sp++] = push;
+		}
+		if ( sp>max_stack ) max_stack = sp;
+
+		if ( I->opcode==BR || I->opcode==BRF ) {
+			int target = (int)(I->a.target - vm->instrs) - start;
+			if ( target<0 || target>=n ) { ok = verify_error(report, func, I, "branch out of function"); break; }
+			succ[1] = target;
+			if ( I->opcode==BR ) succ[0] = -1;
+		}
+		for (int s = 0; s < 2 && ok; s++) {
+			int j = succ[s];
+			if ( j<0 ) continue;
+			if ( j>=n ) { ok = verify_error(report, func, I, "falls off end of function"); break; }
+			if ( states[j].depth>=0 && states[j].depth!=sp ) {
+				ok = verify_error(report, func, &vm->instrs[start + j], "stack depth %d and %d on different paths", states[j].depth, sp);
+				break;
+			}
+			if ( merge(states, j, sp, stack, locals, nlocals) && !queued[j] ) {
+				work[nwork++] = j;
+				queued[j] = true;
+			}
+		}
+	}
+
+	if ( ok ) func->max_stack = max_stack;
+	if ( ok && depths!=NULL ) {
+		for (int i = 0; i < n; i++) depths[i] = states[i].depth;
+	}
+	for (int i = 0; i < n; i++) {
+		free(states[i].stack);
+		free(states[i].locals);
+	}
+	free(states);
+	free(work);
+	free(queued);
+	free(stack);
+	free(locals);
+	return ok;
+}
+
+bool vm_verify_function(VM *vm, Function_metadata *func, bool report)
+{
+	return verify(vm, func, report, NULL);
+}
+
+bool vm_stack_depths(VM *vm, Function_metadata *func, int *depths)
+{
+	return verify(vm, func, false, depths);
+}
+
+/* Verify all functions; true only if every one of them passes. */
+bool vm_verify(VM *vm, bool report)
+{
+	bool ok = true;
+	for (int i = 0; i < vm->num_functions; i++) {
+		if ( !vm_verify_function(vm, &vm->functions[i], report) ) ok = false;
+	}
+	return ok;
+}
@@ -0,0 +1,46 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef VERIFIER_H_
+#define VERIFIER_H_
+
+#include "vm.h"
+
+/* Load-time bytecode verifier. Abstract interpretation over each function
+ * proves that the operand stack never underflows, that its depth is the same
+ * along every path into an instruction, that operand types match the typed
+ * opcodes, and that local, string, function and branch operands are in range.
+ * Only instructions reachable from the function entry are checked.
+ *
+ * vm_verify_function() also records the function's max operand stack depth.
+ * With report, the first problem found is described on stderr.
+ *
+ * vm_stack_depths() verifies func quietly and, if it passes, fills in the
+ * operand stack depth before each of its instructions, relative to the
+ * entry, or -1 for one that is unreachable.
+ */
+extern bool vm_verify(VM *vm, bool report);
+extern bool vm_verify_function(VM *vm, Function_metadata *func, bool report);
+extern bool vm_stack_depths(VM *vm, Function_metadata *func, int *depths);
+
+#endif
@@ -27,7 +27,16 @@ SOFTWARE.
 #include <wich.h>
 #include "vm.h"
 
+#include <morecore.h>
 #include "wloader.h"
+#include "dispatch.h"
+#include "superinstructions.h"
+#include "regvm.h"
+#include "jit.h"
+#include "superblock.h"
+#include "verifier.h"
+#include "opstats.h"
+#include "output.h"
 
 VM_INSTRUCTION vm_instructions[] = {
 		{"HALT", HALT, 0},
@@ -127,12 +136,18 @@ VM_INSTRUCTION vm_instructions[] = {
 
 static void vm_print_instr(VM *vm, addr32 ip);
 static void vm_print_stack(VM *vm);
+static void vm_trace(VM *vm, addr32 ip);
 static inline int int32(const byte *data, addr32 ip);
 static inline int int16(const byte *data, addr32 ip);
 static inline double double64(const byte *data, addr32 ip);
 static void vm_call(VM *vm, Function_metadata *func);
-static void vm_print_stack_value(word p);
-int push_default_value(int index, int sp,  element *stack);
+static void vm_tail_call(VM *vm, Function_metadata *func);
+static void vm_enter(VM *vm, Activation_Record *r);
+static void vm_mark_tail_calls(VM *vm);
+static void vm_run(VM *vm, bool trace);
+static bool vm_call_compiled(VM *vm, Function_metadata *func);
+static void vm_decode(VM *vm);
+static void vm_print_stack_value(VM *vm, element e);
 
 VM * vm_alloc()
 {
@@ -142,23 +157,203 @@ VM * vm_alloc()
 
 void vm_init(VM *vm, byte *code, int code_size)
 {
-	// we are linking in mark-and-compact collector so allocations all occur outside of the VM
+	// keep a private copy of the code with a trailing HALT so the dispatch loop
+	// never has to check ip against code_size
+	byte *copy = calloc((size_t)code_size+1, sizeof(byte));
+	memcpy(copy, code, (size_t)code_size);
+	copy[code_size] = HALT;
+	vm_init_code(vm, copy, code_size);
+}
+
+/* Like vm_init() but code, which must have a HALT at code[code_size], is
+ * used where it lies; e.g., in a mapped object file.
+ */
+void vm_init_code(VM *vm, byte *code, int code_size)
+{
+	vm_init_runtime(vm);
 	vm->code = code;
 	vm->code_size = code_size;
+	vm_decode(vm);
+	vm->verified = vm_verify(vm, false);
+}
+
+/* Set up what a VM needs to run besides its code: heap, stacks and registers. */
+void vm_init_runtime(VM *vm)
+{
+	// we are linking in mark-and-compact collector so allocations all occur outside of the VM,
+	// in a heap of the VM's own so that VMs on different threads share nothing
+	vm->heap = gc_heap_new(DEFAULT_MAX_HEAP_SIZE);
+	gc_set_heap(vm->heap);
+	// a pending expression may be all that points at its leaves; root every slot of the pool
+	// once, at the bottom of the root stack where no GC_END pops them. Free slots hold NULL
+	for (int k = 0; k < MAX_LAZY_VECTORS; k++) {
+		for (int j = 0; j < MAX_VECTOR_EXPR_OPS; j++) {
+			gc_add_root((void **)&vm->lazy_vectors[k].ops[j].leaf.vector);
+		}
+	}
+	// reserve address space for the stacks; the OS supplies pages as they're touched
+	// plus stack[-1], which vm_run_tos() caches while main's stack is empty
+	vm->stack = (element *)morecore((MAX_OPND_STACK + 1) * sizeof(element)) + 1;
+	vm->call_stack = morecore(MAX_CALL_STACK * sizeof(Activation_Record));
 	vm->sp = -1; // grow upwards, stack[sp] is top of stack and valid
 	vm->fp = -1; // frame pointer is invalid initially
 	vm->callsp = -1;
+	for (int k = 0; k < MAX_LAZY_VECTORS; k++) vm->free_lazy[k] = k;
+	vm->out = malloc(OUTPUT_BUFFER_SIZE);
+}
+
+static bool in_image(VM *vm, void *p)
+{
+	return (uintptr_t)p - (uintptr_t)vm->image < vm->image_size;
+}
+
+/* Release what vm_init(), vm_load() or vm_snapshot_load() set up, including
+ * the VM's heap, and vm itself. Compiled code and the constant pool, which is
+ * immortal, stay.
+ */
+void vm_free(VM *vm)
+{
+	vm_flush(vm);
+	free(vm->out);
+	gc_heap_free(vm->heap);
+	dropcore(vm->stack - 1, (MAX_OPND_STACK + 1) * sizeof(element));
+	dropcore(vm->call_stack, MAX_CALL_STACK * sizeof(Activation_Record));
+	if ( !in_image(vm, vm->instrs) ) free(vm->instrs);
+	if ( !in_image(vm, vm->code) ) free(vm->code);
+	dropcore(vm->image, vm->image_size);
+	sb_free(vm);
+	for (int i = 0; i < vm->num_functions; i++) free(vm->functions[i].name);
+	free(vm->functions);
+	symtab_free(&vm->function_index);
+	free(vm->strings);
+	free(vm);
+}
+
+/* Translate vm->code into vm->instrs, one record per instruction plus the
+ * trailing HALT. Operands are extracted, branch offsets become absolute
+ * targets and CALL operands become function pointers, or NULL for a function
+ * that isn't there. Handlers are filled in by vm_exec once it knows which
+ * dispatch table to use.
+ */
+static void vm_decode(VM *vm)
+{
+	const byte *code = vm->code;
+	int *index = malloc(((size_t)vm->code_size+1) * sizeof(int)); // code address -> instr index
+	for (int ip = 0; ip <= vm->code_size; ip++) index[ip] = -1;
+
+	int n = 0;
+	for (int ip = 0; ip <= vm->code_size; ip += 1 + vm_instructions[code[ip]].opnd_size) {
+		index[ip] = n++;
+	}
+	vm->num_instrs = n - 1; // don't count trailing HALT
+	vm->instrs = calloc((size_t)n, sizeof(Instr));
+
+	for (int ip = 0; ip <= vm->code_size; ip += 1 + vm_instructions[code[ip]].opnd_size) {
+		Instr *I = &vm->instrs[index[ip]];
+		I->opcode = code[ip];
+		I->super = code[ip];
+		I->offset = (addr32)ip;
+		switch (I->opcode) {
+			case BR:
+			case BRF: {
+				int target = ip + int16(code, ip + 1);
+				if ( target<0 || target>vm->code_size || index[target]<0 ) {
+					target = vm->code_size; // not an instruction; stop at trailing HALT if ever taken
+				}
+				I->a.target = &vm->instrs[index[target]];
+				break;
+			}
+			case CALL: {
+				int k = int16(code, ip + 1);
+				I->a.func = k>=0 && k<vm->num_functions ? &vm->functions[k] : NULL; // the verifier rejects NULL
+				break;
+			}
+			case ICONST:
+				I->a.i = int32(code, ip + 1);
+				break;
+			case FCONST:
+				I->a.f = double64(code, ip + 1);
+				break;
+			default:
+				if ( vm_instructions[I->opcode].opnd_size==2 ) {
+					I->a.i = int16(code, ip + 1);
+				}
+				break;
+		}
+	}
+
+	for (int i = 0; i < vm->num_functions; i++) {
+		Function_metadata *f = &vm->functions[i];
+		f->entry = f->address <= vm->code_size && index[f->address] >= 0 ? (addr32)index[f->address] : (addr32)vm->num_instrs;
+	}
+
+	// a function ends where the next one in the code starts; next[j] is the
+	// first entry at or after instruction j
+	int *next = index;
+	for (int j = 0; j <= vm->num_instrs; j++) next[j] = vm->num_instrs;
+	for (int i = 0; i < vm->num_functions; i++) next[vm->functions[i].entry] = vm->functions[i].entry;
+	for (int j = vm->num_instrs-1; j >= 0; j--) {
+		if ( next[j]==vm->num_instrs ) next[j] = next[j+1];
+	}
+
+	for (int i = 0; i < vm->num_functions; i++) {
+		Function_metadata *f = &vm->functions[i];
+		f->end = f->entry<(addr32)vm->num_instrs ? (addr32)next[f->entry+1] : (addr32)vm->num_instrs;
+		int end = f->end;
+		f->frame_size = f->nargs + f->nlocals;
+		for (int j = f->entry; j < end; j++) {
+			const Instr *I = &vm->instrs[j];
+			bool local = I->opcode==ILOAD || I->opcode==FLOAD || I->opcode==VLOAD || I->opcode==SLOAD || I->opcode==STORE;
+			if ( local && I->a.i>=f->frame_size ) f->frame_size = I->a.i + 1;
+		}
+		f->max_stack = end - (int)f->entry; // no instruction pushes more than one value; verifier refines
+	}
+	free(index);
+
+	vm_fuse(vm);
+	vm_mark_tail_calls(vm);
 }
 
+/* Mark CALL f; GC_END...; RET sequences as TAIL_CALL so that f reuses the
+ * caller's frame. Like a superinstruction, this only changes the handler
+ * of the CALL; the GC_ENDs and RET stay for anybody jumping to them.
+ */
+static void vm_mark_tail_calls(VM *vm)
+{
+	for (int i = 0; i < vm->num_functions; i++) {
+		Function_metadata *caller = &vm->functions[i];
+		int end = (int)caller->end;
+		for (int j = caller->entry; j < end; j++) {
+			Instr *I = &vm->instrs[j];
+			if ( I->opcode!=CALL || I->super!=CALL ) continue;
+			int k = j + 1;
+			while ( k<end && vm->instrs[k].opcode==GC_END ) k++;
+			if ( k==end || vm->instrs[k].opcode!=RET ) continue;
+			if ( I->a.func<vm->functions || I->a.func>=&vm->functions[vm->num_functions] ) continue;
+			// the callee's result, or lack of one, must be what the caller returns
+			if ( (I->a.func->return_type==VOID_TYPE)!=(caller->return_type==VOID_TYPE) ) continue;
+			I->super = TAIL_CALL;
+		}
+	}
+}
+
+/* Add a function to vm->functions, which grows as needed, and return its
+ * index. The first function of a name is the one vm_function() finds.
+ */
 int def_function(VM *vm, char *name, int return_type, addr32 address, int nargs, int nlocals)
 {
 	if ( vm->num_functions>=MAX_FUNCTIONS ) {
 		fprintf(stderr, "Exceeded max functions %d\n", MAX_FUNCTIONS);
 		return -1;
 	}
+	if ( vm->num_functions==vm->max_functions ) {
+		vm->max_functions = vm->max_functions>0 ? 2*vm->max_functions : 16;
+		vm->functions = realloc(vm->functions, (size_t)vm->max_functions * sizeof(Function_metadata));
+	}
 	int i = vm->num_functions++;
 	Function_metadata *f = &vm->functions[i];
-	f->name = strdup(name);
+	*f = (Function_metadata){.name = strdup(name)};
+	symtab_put(&vm->function_index, f->name, i);
 	f->return_type = return_type;
 	f->address = address;
 	f->nargs = nargs;
@@ -166,8 +361,29 @@ int def_function(VM *vm, char *name, int return_type, addr32 address, int nargs,
 	return i;
 }
 
-#define WRITE_BACK_REGISTERS(vm) vm->ip = ip; vm->sp = sp; vm->fp = fp;
-#define LOAD_REGISTERS(vm) ip = vm->ip; sp = vm->sp; fp = vm->fp;
+/* Add an immortal copy of s to the constant pool and return its index. */
+int def_string(VM *vm, char *s)
+{
+	if ( vm->num_strings>=MAX_STRINGS ) {
+		fprintf(stderr, "Exceeded max strings %d\n", MAX_STRINGS);
+		return -1;
+	}
+	if ( vm->num_strings==vm->max_strings ) {
+		vm->max_strings = vm->max_strings>0 ? 2*vm->max_strings : 16;
+		vm->strings = realloc(vm->strings, (size_t)vm->max_strings * sizeof(String *));
+	}
+	vm->strings[vm->num_strings] = String_immortal(s);
+	return vm->num_strings++;
+}
+
+/* Index into vm->functions of the function called name or -1. */
+int vm_function_index(VM *vm, char *name)
+{
+	return symtab_get(&vm->function_index, name);
+}
+
+#define WRITE_BACK_REGISTERS(vm) vm->ip = (addr32)(pc - vm->instrs); vm->sp = sp; vm->fp = fp;
+#define LOAD_REGISTERS(vm) pc = &vm->instrs[vm->ip]; sp = vm->sp; fp = vm->fp;
 
 static void inline validate_stack_address(int a)
 {
@@ -176,11 +392,28 @@ static void inline validate_stack_address(int a)
 	}
 }
 
+static void no_such_function(VM *vm, const Instr *pc)
+{
+	vm_flush(vm);
+	fprintf(stderr, "no such function called at ip=%d\n", pc->offset);
+	exit(1);
+}
+
 static void inline zero_division_error()
 {
 	fprintf(stderr, "ZeroDivisionError: Divisor cann't be 0\n");
 }
 
+/* IDIV and FDIV have no value to leave for a zero divisor, and going on a
+ * slot short would run into the caller's frame, so every tier stops here.
+ */
+void vm_division_by_zero(VM *vm)
+{
+	vm_flush(vm);
+	zero_division_error();
+	exit(1);
+}
+
 static void gc_check()
 {
 	gc();
@@ -188,531 +421,319 @@ static void gc_check()
 	if ( info.live!=0 ) fprintf(stderr, "%d objects remain after collection\n", info.live);
 }
 
-void vm_exec(VM *vm, bool trace)
+static PVector_ptr (*const vector_kernels[])(PVector_ptr, PVector_ptr) = {
+	[VEXPR_ADD] = Vector_add, [VEXPR_SUB] = Vector_sub, [VEXPR_MUL] = Vector_mul, [VEXPR_DIV] = Vector_div
+};
+
+static PVector_ptr (*const scalar_kernels[])(PVector_ptr, double) = {
+	[VEXPR_ADD_SCALAR] = Vector_add_scalar, [VEXPR_SUB_SCALAR] = Vector_sub_scalar,
+	[VEXPR_MUL_SCALAR] = Vector_mul_scalar, [VEXPR_DIV_SCALAR] = Vector_div_scalar
+};
+
+static Vector_expr *lazy_alloc(VM *vm, PVector_ptr v)
 {
-	int a = 0;
-	int i = 0;
-	bool b1, b2;
-	double f,g;
-	char* c;
-	PVector_ptr vptr,r,l;
-	int x, y;
-	Activation_Record *frame;
+	if ( vm->num_lazy==MAX_LAZY_VECTORS ) return NULL;
+	Vector_expr *e = &vm->lazy_vectors[vm->free_lazy[MAX_LAZY_VECTORS - ++vm->num_lazy]];
+	Vector_expr_init(e, v);
+	return e;
+}
 
-	Function_metadata *const main = vm_function(vm, "main");
-	vm_call(vm, main);
-
-	// Define VM registers (C compiler probably ignores 'register' nowadays
-	// but it's good documentation in this case. Keep as locals for
-	// convenience but write them back to the vm object after each decode/execute.
-	register addr32 ip = vm->ip;
-	register int sp = vm->sp;
-	register int fp = vm->fp;
-	const byte *code = vm->code;
-	element *stack = vm->stack;
-
-	int opcode = code[ip];
-
-	while (opcode != HALT && ip < vm->code_size ) {
-		if (trace) vm_print_instr(vm, ip);
-		ip++;
-		switch (opcode) {
-			case IADD:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].i = x + y;
-				break;
-			case ISUB:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].i = x - y;
-				break;
-			case IMUL:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].i = x * y;
-				break;
-			case IDIV:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp--].i;
-				if (y ==0 ) {
-					zero_division_error();
-					break;
-				}
-				stack[++sp].i = x / y;
-				break;
-			case FADD:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				g = stack[sp].f;
-				stack[sp].f = g + f;
-				break;
-			case FSUB:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				g = stack[sp].f;
-				stack[sp].f = g - f;
-				break;
-			case FMUL:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				g = stack[sp].f;
-				stack[sp].f = g * f;
-				break;
-			case FDIV:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				g = stack[sp--].f;
-				if (f == 0) {
-					zero_division_error();
-					break;
-				}
-				stack[++sp].f = g / f;
-				break;
-            case VADD:
-				validate_stack_address(sp-1);
-				r = stack[sp--].vptr;
-				l = stack[sp].vptr;
-				vptr = Vector_add(l,r);
-				stack[sp].vptr = vptr;
-                break;
-			case VADDI:
-				validate_stack_address(sp-1);
-				i = stack[sp--].i;
-				vptr = stack[sp].vptr;
-				vptr = Vector_add(vptr,Vector_from_int(i,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-			case VADDF:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				vptr = stack[sp].vptr;
-				vptr = Vector_add(vptr,Vector_from_float(f,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-            case VSUB:
-				validate_stack_address(sp-1);
-				r = stack[sp--].vptr;
-				l = stack[sp].vptr;
-				vptr = Vector_sub(l,r);
-				stack[sp].vptr = vptr;
-                break;
-			case VSUBI:
-				validate_stack_address(sp-1);
-				i = stack[sp--].i;
-				vptr = stack[sp].vptr;
-				vptr = Vector_sub(vptr,Vector_from_int(i,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-			case VSUBF:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				vptr = stack[sp].vptr;
-				vptr = Vector_sub(vptr,Vector_from_float(f,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-            case VMUL:
-				validate_stack_address(sp-1);
-				r = stack[sp--].vptr;
-				l = stack[sp].vptr;
-				vptr = Vector_mul(l,r);
-				stack[sp].vptr = vptr;
-                break;
-			case VMULI:
-				validate_stack_address(sp-1);
-				i = stack[sp--].i;
-				vptr = stack[sp].vptr;
-				vptr = Vector_mul(vptr,Vector_from_int(i,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-			case VMULF:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				vptr = stack[sp].vptr;
-				vptr = Vector_mul(vptr,Vector_from_float(f,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-            case VDIV:
-                validate_stack_address(sp-1);
-				r = stack[sp--].vptr;
-				l = stack[sp].vptr;
-                vptr = Vector_div(l,r);
-                stack[sp].vptr = vptr;
-                break;
-			case VDIVI:
-				validate_stack_address(sp-1);
-				i = stack[sp--].i;
-				if (i == 0) {
-					zero_division_error();
-					break;
-				}
-				vptr = stack[sp].vptr;
-				vptr = Vector_div(vptr,Vector_from_int(i,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-			case VDIVF:
-				validate_stack_address(sp-1);
-				f = stack[sp--].f;
-				if (f == 0) {
-					zero_division_error();
-					break;
-				}
-				vptr = stack[sp].vptr;
-				vptr = Vector_div(vptr,Vector_from_float(f,vptr.vector->length));
-				stack[sp].vptr = vptr;
-				break;
-            case SADD:
-				validate_stack_address(sp-1);
-				char * right = stack[sp--].s;
-				stack[sp].s = String_add(String_new(stack[sp].s),String_new(right))->str;
-                break;
-			case OR :
-				validate_stack_address(sp-1);
-				b2 = stack[sp--].b;
-				b1 = stack[sp].b;
-				stack[sp].b = b1 || b2;
-				break;
-			case AND :
-				validate_stack_address(sp-1);
-				b2 = stack[sp--].b;
-				b1 = stack[sp].b;
-				stack[sp].b = b1 && b2;
-				break;
-			case INEG:
-				validate_stack_address(sp);
-				stack[sp].i = -stack[sp].i;
-				break;
-			case FNEG:
-				validate_stack_address(sp);
-				stack[sp].f = -stack[sp].f;
-				break;
-			case NOT:
-				validate_stack_address(sp);
-				stack[sp].b = !stack[sp].b;
-				break;
-			case I2F:
-				validate_stack_address(sp);
-				stack[sp].f = stack[sp].i;
-				break;
-			case I2S:
-				validate_stack_address(sp);
-				stack[sp].s = String_from_int(stack[sp].i)->str;
-				break;
-			case F2I:
-				validate_stack_address(sp);
-				stack[sp].i = (int)stack[sp].f;
-				break;
-            case F2S:
-				validate_stack_address(sp);
-				stack[sp].s = String_from_float(stack[sp].f)->str;
-                break;
-            case V2S:
-				validate_stack_address(sp);
-				vptr = stack[sp].vptr;
-				stack[sp].s = String_from_vector(vptr)->str;
-                break;
-			case IEQ:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].b = x == y;
-				break;
-			case INEQ:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].b = x != y;
-				break;
-			case ILT:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].b = x < y;
-				break;
-			case ILE:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].b = x <= y;
-				break;
-			case IGT:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].b = x > y;
-				break;
-			case IGE:
-				validate_stack_address(sp-1);
-				y = stack[sp--].i;
-				x = stack[sp].i;
-				stack[sp].b = x >= y;
-				break;
-			case FEQ:
-				validate_stack_address(sp-1);
-				g = stack[sp--].f;
-				f = stack[sp].f;
-				stack[sp].b = f == g;
-				break;
-			case FNEQ:
-				validate_stack_address(sp-1);
-				g = stack[sp--].f;
-				f = stack[sp].f;
-				stack[sp].b = f != g;
-				break;
-			case FLT:
-				validate_stack_address(sp-1);
-				g = stack[sp--].f;
-				f = stack[sp].f;
-				stack[sp].b = f < g;
-				break;
-			case FLE:
-				validate_stack_address(sp-1);
-				g = stack[sp--].f;
-				f = stack[sp].f;
-				stack[sp].b = f <= g;
-				break;
-			case FGT:
-				validate_stack_address(sp-1);
-				g = stack[sp--].f;
-				f = stack[sp].f;
-				stack[sp].b = f > g;
-				break;
-			case FGE:
-				validate_stack_address(sp-1);
-				g = stack[sp--].f;
-				f = stack[sp].f;
-				stack[sp].b = f >= g;
-				break;
-            case SEQ:
-				validate_stack_address(sp-1);
-				c = stack[sp--].s;
-				b1 = String_eq(String_new(stack[sp--].s),String_new(c));
-				stack[++sp].b = b1;
-                break;
-            case SNEQ:
-				validate_stack_address(sp-1);
-				c = stack[sp--].s;
-				b1 = String_neq(String_new(stack[sp--].s),String_new(c));
-				stack[++sp].b = b1;
-                break;
-            case SGT:
-				validate_stack_address(sp-1);
-				c = stack[sp--].s;
-				b1 = String_gt(String_new(stack[sp--].s),String_new(c));
-				stack[++sp].b = b1;
-                break;
-            case SGE:
-				validate_stack_address(sp-1);
-				c = stack[sp--].s;
-				b1 = String_ge(String_new(stack[sp--].s),String_new(c));
-				stack[++sp].b = b1;
-                break;
-            case SLT:
-				validate_stack_address(sp-1);
-				c = stack[sp--].s;
-				b1 = String_lt(String_new(stack[sp--].s),String_new(c));
-				stack[++sp].b = b1;
-                break;
-            case SLE:
-				validate_stack_address(sp-1);
-				c = stack[sp--].s;
-				b1 = String_le(String_new(stack[sp--].s),String_new(c));
-				stack[++sp].b = b1;
-                break;
-			case VEQ:
-				validate_stack_address(sp-1);
-				l = stack[sp--].vptr;
-				r = stack[sp--].vptr;
-				b1 = Vector_eq(l,r);
-				stack[++sp].b = b1;
-				break;
-			case VNEQ:
-				validate_stack_address(sp-1);
-				l = stack[sp--].vptr;
-				r = stack[sp--].vptr;
-				b1 = Vector_neq(l,r);
-				stack[++sp].b = b1;
-				break;
-			case BR:
-				ip += int16(code,ip) - 1;
-				break;
-			case BRF:
-				validate_stack_address(sp);
-				if ( !stack[sp--].b ) {
-					int offset = int16(code,ip);
-					ip += offset - 1;
-				}
-				else {
-					ip += 2;
-				}
-				break;
-			case ICONST:
-				stack[++sp].i = int32(code,ip);
-				ip += 4;
-				break;
-			case FCONST:
-				stack[++sp].f = double64(code, ip);
-				ip += 8;
-				break;
-			case SCONST :
-				i = int16(code,ip);
-				ip += 2;
-				stack[++sp].s = vm->strings[i];
-				break;
-			case ILOAD:
-				i = int16(code,ip);
-				ip += 2;
-				stack[++sp].i = vm->call_stack[vm->callsp].locals[i].i;
-				break;
-			case FLOAD:
-				i = int16(code,ip);
-				ip += 2;
-				stack[++sp].f = vm->call_stack[vm->callsp].locals[i].f;
-				break;
-            case VLOAD:
-                i = int16(code,ip);
-                ip += 2;
-                stack[++sp].vptr = vm->call_stack[vm->callsp].locals[i].vptr;
-                break;
-            case SLOAD:
-                i = int16(code,ip);
-                ip += 2;
-                stack[++sp].s = vm->call_stack[vm->callsp].locals[i].s;
-				break;
-			case STORE:
-				i = int16(code,ip);
-				ip += 2;
-				vm->call_stack[vm->callsp].locals[i] = stack[sp--]; // untyped store; it'll just copy all bits
-				break;
-			case VECTOR:
-				i = stack[sp--].i;
-				validate_stack_address(sp-i+1);
-				double *data = (double*)malloc(i*sizeof(double));
-				for (int j = i-1; j >= 0;j--) { data[j] = stack[sp--].f; }
-				vptr = Vector_new(data,i);
-				stack[++sp].vptr = vptr;
-				break;
-			case VLOAD_INDEX:
-				i = stack[sp--].i;
-				vptr = stack[sp--].vptr;
-				vm->stack[++sp].f = ith(vptr, i-1);
-				break;
-			case STORE_INDEX:
-				f = stack[sp--].f;
-				i = stack[sp--].i;
-				vptr = stack[sp--].vptr;
-				set_ith(vptr, i-1, f);
-				break;
-			case SLOAD_INDEX:
-				i = stack[sp--].i;
-				char * str = stack[sp--].s;
-				if (i-1 >= strlen(str))
-				{
-					fprintf(stderr, "StringIndexOutOfRange: %d out of index : 1 to %d\n",i,(int)strlen(stack[sp].s));
-					break;
-				}
-				c = String_from_char(str[i-1])->str;
-				stack[++sp].s = c;
-				break;
-			case PUSH_DFLT_RETV:
-				i = *&vm->call_stack[vm->callsp].func->return_type;
-				sp = push_default_value(i, sp, stack);
-				break;
-			case POP:
-				sp--;
-				break;
-			case CALL:
-				a = int16(code,ip); // load index of function from code memory
-				WRITE_BACK_REGISTERS(vm); // (ip has been updated)
-				vm_call(vm, &vm->functions[a]);
-				LOAD_REGISTERS(vm);
-				break;
-			case RET:
-				frame = &vm->call_stack[vm->callsp--];
-				ip = frame->retaddr;
-				break;
-			case IPRINT:
-				validate_stack_address(sp);
-				printf("%d\n", stack[sp--].i);
-				break;
-			case FPRINT:
-				validate_stack_address(sp);
-				printf("%1.2f\n", stack[sp--].f);
-				break;
-			case BPRINT:
-				validate_stack_address(sp);
-				printf("%d\n", stack[sp--].b);
-				break;
-			case SPRINT:
-				validate_stack_address(sp);
-				printf("%s\n", stack[sp--].s);
-				break;
-			case VPRINT:
-				validate_stack_address(sp);
-				print_vector(stack[sp--].vptr);
-				break;
-			case VLEN:
-				vptr = stack[sp--].vptr;
-				i = Vector_len(vptr);
-				stack[++sp].i = i;
-				break;
-			case SLEN:
-				c = stack[sp--].s;
-				i = String_len(String_new(c));
-				stack[++sp].i = i;
-				break;
-			case GC_START:
-				vm->call_stack[vm->callsp].save_gc_roots = gc_num_roots();
-				break;
-			case GC_END:
-				gc_set_num_roots(vm->call_stack[vm->callsp].save_gc_roots);
-				break;
-			case SROOT:
-				gc_add_root((void **)&stack[sp].s);
-				break;
-			case VROOT:
-				gc_add_root((void **)&stack[sp].vptr);
-				break;
-			case COPY_VECTOR:
-				if (stack[sp].vptr.vector != NULL) {
-					stack[sp].vptr = Vector_copy(stack[sp].vptr);
-				}
-				else {
-					fprintf(stderr, "Vector reference cannot be found\n");
+static void lazy_free(VM *vm, Vector_expr *e)
+{
+	for (int k = 0; k < e->n; k++) e->ops[k].leaf = NIL_VECTOR; // don't keep dead leaves alive
+	vm->free_lazy[MAX_LAZY_VECTORS - vm->num_lazy--] = (int)(e - vm->lazy_vectors);
+}
+
+static inline Vector_ref *lazy_ptr(Vector_expr *e)
+{
+	return (Vector_ref *)e;
+}
+
+/* l = l op r without touching the elements; the expression is computed when
+ * consumed. Null vectors, mismatched lengths, expressions too big to extend and
+ * a full pool all go to the eager kernels, which also report the errors.
+ */
+void vm_vector_op(VM *vm, element *l, element *r, VEXPR_OP op)
+{
+	bool lazy_l = vm_is_lazy(vm, l->vref), lazy_r = vm_is_lazy(vm, r->vref);
+	if ( (lazy_l || l->vref!=NULL) && (lazy_r || r->vref!=NULL) ) {
+		Vector_expr leaf, *re = (Vector_expr *)r->vref;
+		if ( !lazy_r ) {
+			Vector_expr_init(&leaf, r->vref->vptr);
+			re = &leaf;
+		}
+		Vector_expr *le = lazy_l ? (Vector_expr *)l->vref : lazy_alloc(vm, l->vref->vptr);
+		if ( le!=NULL ) {
+			if ( Vector_expr_binary(le, re, op) ) {
+				if ( lazy_r ) {
+					lazy_free(vm, re);
+					r->vref = NULL; // no stale pointers into the pool
 				}
-				break;
-			case NOP : break;
-			default:
-				printf("invalid opcode: %d at ip=%d\n", opcode, (ip - 1));
-				exit(1);
+				l->vref = lazy_ptr(le);
+				return;
+			}
+			if ( !lazy_l ) lazy_free(vm, le);
 		}
-		WRITE_BACK_REGISTERS(vm);
-		if (trace) vm_print_stack(vm);
-		opcode = code[ip];
 	}
-	if (trace) vm_print_instr(vm, ip);
-	if (trace) vm_print_stack(vm);
+	vm_force(vm, l);
+	vm_force(vm, r);
+	l->vref = vm_vector_ref(vector_kernels[op](vm_vector(l->vref), vm_vector(r->vref)));
+}
+
+void vm_vector_scalar_op(VM *vm, element *v, VEXPR_OP op, double s)
+{
+	Vector_expr *e = NULL;
+	if ( vm_is_lazy(vm, v->vref) ) e = (Vector_expr *)v->vref;
+	else if ( v->vref!=NULL ) e = lazy_alloc(vm, v->vref->vptr);
+	if ( e!=NULL && Vector_expr_scalar(e, op, s) ) {
+		v->vref = lazy_ptr(e);
+		return;
+	}
+	vm_force(vm, v);
+	v->vref = vm_vector_ref(scalar_kernels[op](vm_vector(v->vref), s));
+}
+
+Vector_ref *vm_materialize(VM *vm, Vector_ref *v)
+{
+	Vector_expr *e = (Vector_expr *)v;
+	PVector_ptr result = Vector_expr_eval(e);
+	lazy_free(vm, e);
+	return vm_vector_ref(result);
+}
+
+// a value nobody will look at; forget any expression it holds
+void vm_drop(VM *vm, element *e)
+{
+	if ( vm_is_lazy(vm, e->vref) ) {
+		lazy_free(vm, (Vector_expr *)e->vref);
+		e->vref = NULL;
+	}
+}
+
+object_metadata Vector_ref_metadata = {
+		"Vector_ref",
+		1,
+		{__offsetof(Vector_ref,vptr.vector)}
+};
+
+/* Box v for a stack slot; NULL for the null vector. The new handle may start
+ * a collection, which must not lose v while nothing else points at it.
+ */
+Vector_ref *vm_vector_ref(PVector_ptr v)
+{
+	if ( v.vector==NULL ) return NULL;
+	gc_begin_func();
+	gc_add_root((void **)&v.vector);
+	Vector_ref *r = (Vector_ref *)gc_alloc(&Vector_ref_metadata, sizeof(Vector_ref));
+	r->vptr = v;
+	gc_end_func();
+	return r;
+}
+
+void vm_exec(VM *vm, bool trace)
+{
+	Function_metadata *const main = vm_function(vm, "main");
+	gc_set_heap(vm->heap);
+	// main is only ever called once so don't wait for it to get hot
+	if ( vm->jit && !trace ) jit_compile(vm, main);
+	vm->traced = false;
+	if ( trace || !vm_call_compiled(vm, main) ) {
+		vm_call(vm, main);
+		vm_run(vm, trace);
+	}
+	vm_flush(vm);
+	if ( vm->traced ) vm_print_stack(vm);
 
 	gc_check();
 }
 
+/* Run func to completion on the stack interpreter on behalf of another
+ * execution tier. The caller pushes the args onto the operand stack and
+ * finds the result, if any, on top of it afterwards.
+ */
+void vm_invoke(VM *vm, Function_metadata *func)
+{
+	if ( vm_call_compiled(vm, func) ) return;
+	addr32 ip = vm->ip;
+	int fp = vm->fp;
+	vm->ip = (addr32)vm->num_instrs; // func's RET lands on the trailing HALT
+	vm_call(vm, func);
+	vm_run(vm, false);
+	vm->ip = ip;
+	vm->fp = fp;
+}
+
+// The interpreter loop is instantiated with stack checks for code
+// that didn't pass the verifier and without them for code that did.
+// Neither has any trace hooks; tracing has a loop of its own.
+#define VM_RUN				vm_run_checked
+#define VALIDATE_STACK(a)	validate_stack_address(a)
+#include "vm_loop.h"
+#undef VM_RUN
+#undef VALIDATE_STACK
+
+#define VM_RUN				vm_run_unchecked
+#define VALIDATE_STACK(a)
+#include "vm_loop.h"
+#undef VM_RUN
+#undef VALIDATE_STACK
+
+// A third copy runs only while the sampling profiler is on so that the other
+// two never pay for telling it where they are.
+#define VM_RUN				vm_run_profiled
+#define VALIDATE_STACK(a)	validate_stack_address(a)
+#define VM_PROFILED
+#include "vm_loop.h"
+#undef VM_RUN
+#undef VALIDATE_STACK
+#undef VM_PROFILED
+
+// The diagnostic loop behind vm_exec(vm, true)
+#define VM_RUN				vm_run_traced
+#define VALIDATE_STACK(a)	validate_stack_address(a)
+#define VM_TRACED
+#include "vm_loop.h"
+#undef VM_RUN
+#undef VALIDATE_STACK
+#undef VM_TRACED
+
+#ifdef VM_OPCODE_STATS
+// Counting takes the trace's path through the loop, which runs the
+// instructions unfused and never hands calls to the other tiers.
+#define VM_RUN				vm_run_counted
+#define VALIDATE_STACK(a)	validate_stack_address(a)
+#define VM_TRACED
+#define VM_COUNTED
+#include "vm_loop.h"
+#undef VM_RUN
+#undef VALIDATE_STACK
+#undef VM_TRACED
+#undef VM_COUNTED
+#endif
+
+// Verified code can also run on a loop that caches the top of the stack
+#include "tos_loop.h"
+
+// Any code can run on a loop that hands loops to superblock.c once they're hot
+#define VM_RUN				vm_run_hot
+#define VALIDATE_STACK(a)	validate_stack_address(a)
+#define VM_SUPERBLOCKS
+#include "vm_loop.h"
+#undef VM_RUN
+#undef VALIDATE_STACK
+#undef VM_SUPERBLOCKS
+
+/* Execute instructions starting at vm->ip until a HALT with the loop for
+ * how vm is to run.
+ */
+static void vm_run(VM *vm, bool trace)
+{
+	if ( trace ) vm_run_traced(vm);
+#ifdef VM_OPCODE_STATS
+	else if ( vm->stats!=NULL ) vm_run_counted(vm);
+#endif
+	else if ( vm->profiling ) vm_run_profiled(vm);
+	else if ( vm->superblocks ) vm_run_hot(vm);
+	else if ( vm->verified && vm->cache_tos ) vm_run_tos(vm);
+	else if ( vm->verified ) vm_run_unchecked(vm);
+	else vm_run_checked(vm);
+}
+
+/* If func has been JIT compiled or translated for the register tier, run it
+ * there to completion and return true. Args come from the operand stack and
+ * the result, if any, is pushed. Counts calls to decide when func is hot
+ * enough to compile.
+ *
+ * Compiled code calls back in through vm_invoke(), so every such call nests
+ * on the C stack; past MAX_NATIVE_DEPTH of them we return false and the
+ * interpreter runs the rest of the recursion on its own stacks. Compiled code
+ * doesn't make tail calls itself but sets vm->tail_call and returns, so that
+ * the callee reuses the frame here like vm_tail_call() does in the loop.
+ */
+static bool vm_call_compiled(VM *vm, Function_metadata *func)
+{
+	if ( vm->native_depth>=MAX_NATIVE_DEPTH ) return false;
+	if ( vm->jit && func->native==NULL && func->calls++==vm->jit_threshold ) jit_compile(vm, func);
+	if ( func->native!=NULL ) {
+		addr32 ip = vm->ip;
+		int fp = vm->fp;
+		vm->ip = (addr32)vm->num_instrs; // an interpreted tail callee returns to the trailing HALT
+		vm_call(vm, func);
+		vm->native_depth++;
+		func->native(vm, &vm->stack[vm->fp]);
+		while ( vm->tail_call!=NULL ) {
+			func = vm->tail_call;
+			vm->tail_call = NULL;
+			if ( vm->jit && func->native==NULL && func->calls++==vm->jit_threshold ) jit_compile(vm, func);
+			vm_tail_call(vm, func);
+			if ( func->native==NULL ) break;
+			func->native(vm, &vm->stack[vm->fp]);
+		}
+		if ( func->native!=NULL ) {
+			// the result, if any, replaces the args
+			if ( func->return_type!=VOID_TYPE ) {
+				vm->stack[vm->fp] = vm->stack[vm->sp];
+				vm->sp = vm->fp;
+			}
+			else vm->sp = vm->fp - 1;
+			vm->callsp--;
+		}
+		else vm_run(vm, false); // its RET pops the frame
+		vm->native_depth--;
+		vm->fp = fp;
+		vm->ip = ip;
+		return true;
+	}
+	if ( func->regcode!=NULL ) {
+		vm_regcall(vm, func);
+		return true;
+	}
+	return false;
+}
+
+static void stack_overflow(VM *vm, Function_metadata *func)
+{
+	vm_flush(vm);
+	fprintf(stderr, "stack overflow calling %s\n", func->name);
+	exit(1);
+}
+
 void vm_call(VM *vm, Function_metadata *func)
 {
+	if ( vm->callsp+1>=MAX_CALL_STACK ) stack_overflow(vm, func);
 	Activation_Record *r = &vm->call_stack[++vm->callsp];
 	r->func = func;
-	r->retaddr = vm->ip + 2; // save return address (assume ip is 1st byte of operand)
-	// copy args to frame activation record
-	for (int i = func->nargs-1; i>=0 ; --i) {
-		r->locals[i] = vm->stack[vm->sp--];
-	}
-	for (int i = 0; i<func->nlocals; i++) {
-		r->locals[func->nargs+i].i = 0; // init locals
-	}
-	vm->ip = func->address; // jump!
+	r->retaddr = vm->ip; // save return address (assume ip is instr following CALL)
+	r->elided = 0;
+	// args stay where the caller pushed them and the locals go right above
+	r->fp = vm->sp - func->nargs + 1;
+	vm_enter(vm, r);
+}
+
+/* Call func in place of the current function, which has nothing left to do
+ * but return func's result: func's args move down to the base of the
+ * current frame and func returns straight to our caller.
+ */
+static void vm_tail_call(VM *vm, Function_metadata *func)
+{
+	Activation_Record *r = &vm->call_stack[vm->callsp];
+	if ( vm->instrs[vm->ip].opcode==GC_END ) gc_set_num_roots(r->save_gc_roots); // the GC_ENDs we skip
+	memmove(&vm->stack[r->fp], &vm->stack[vm->sp - func->nargs + 1], func->nargs * sizeof(element));
+	vm->sp = r->fp + func->nargs - 1;
+	r->func = func;
+	r->elided++;
+	vm_enter(vm, r);
+}
+
+// zero the locals of frame r above its args and jump to the function
+static void vm_enter(VM *vm, Activation_Record *r)
+{
+	Function_metadata *func = r->func;
+	if ( r->fp + func->frame_size + func->max_stack>=MAX_OPND_STACK ) stack_overflow(vm, func);
+	memset(&vm->stack[vm->sp+1], 0, (func->frame_size - func->nargs) * sizeof(element)); // init locals
+	vm->sp = r->fp + func->frame_size - 1;
+	vm->fp = r->fp;
+	vm->ip = func->entry; // jump!
 }
 
 int push_default_value(int i, int sp, element *stack) {
@@ -727,10 +748,10 @@ int push_default_value(int i, int sp, element *stack) {
 			stack[++sp].b = DEFAULT_BOOLEAN_VALUE;
 			break;
 		case STRING_TYPE:
-			stack[++sp].s = DEFAULT_STRING_VALUE;
+			stack[++sp].s = String_new(DEFAULT_STRING_VALUE);
 			break;
 		case VECTOR_TYPE:
-			stack[++sp].vptr = PVector_init(0, 0);
+			stack[++sp].vref = vm_vector_ref(PVector_init(0, 0));
 			break;
 		default:
 			break;
@@ -777,28 +798,74 @@ static void vm_print_instr(VM *vm, addr32 ip)
 	}
 }
 
+/* Called before executing the instruction at code address ip; dumps the stack as left by
+ * the previous instruction, if that was traced, and then the instruction itself if
+ * vm->trace selects it.
+ */
+static void vm_trace(VM *vm, addr32 ip)
+{
+	if ( vm->traced ) vm_print_stack(vm);
+	Trace_options *t = &vm->trace;
+	Function_metadata *func = vm->callsp>=0 ? vm->call_stack[vm->callsp].func : NULL;
+	vm->traced = ip>=t->from && (t->to==0 || ip<t->to) &&
+				 (t->function==NULL || (func!=NULL && strcmp(func->name, t->function)==0));
+	if ( vm->traced ) vm_print_instr(vm, ip);
+}
+
 static void vm_print_stack(VM *vm) {
 	// stack grows upwards; stack[sp] is top of stack
 	fprintf(stderr, "calls=[");
 	for (int i = 0; i <= vm->callsp; i++) {
 		Activation_Record *frame = &vm->call_stack[i];
 		Function_metadata *func = frame->func;
+		if ( frame->elided>0 ) fprintf(stderr, " (%d elided)", frame->elided);
 		fprintf(stderr, " %s=[", func->name);
-		for (int j = 0; j < func->nlocals+func->nargs; ++j) {
-			vm_print_stack_value((word)frame->locals[j].i);
+		for (int j = 0; frame->fp>=0 && j < func->nlocals+func->nargs; ++j) {
+			vm_print_stack_value(vm, vm->stack[frame->fp + j]);
 		}
 		fprintf(stderr, " ]");
 	}
 	fprintf(stderr, " ]  ");
 	fprintf(stderr, "opnds=[");
+	int k = 0; // first frame that doesn't end below stack[i]
 	for (int i = 0; i <= vm->sp; i++) {
-		int p = vm->stack[i].i;
-		vm_print_stack_value((word)p);
+		Activation_Record *frame;
+		while ( k<=vm->callsp && ((frame = &vm->call_stack[k])->fp<0 || frame->fp + frame->func->frame_size<=i) ) k++;
+		if ( k<=vm->callsp && i>=vm->call_stack[k].fp ) continue; // args and locals aren't operands
+		vm_print_stack_value(vm, vm->stack[i]);
 	}
 	fprintf(stderr, " ] fp=%d sp=%d\n", vm->fp, vm->sp);
 }
 
-void vm_print_stack_value(word p) {
+// a heap object or string literal the VM created; not just any bits that happen to point into the heap
+static bool vm_is_object(VM *vm, void *p)
+{
+	for (int i = 0; i < vm->num_strings; i++) {
+		if ( p==vm->strings[i] ) return true;
+	}
+	return ((uintptr_t)p & ALIGN_MASK)==0 && ptr_is_in_heap(p) && ((heap_object *)p)->magic==MAGIC_NUMBER;
+}
+
+static void vm_print_stack_value(VM *vm, element e) {
+	if ( vm->trace.heap ) { // show strings and vectors rather than their addresses
+		if ( vm_is_object(vm, e.s) && e.s->metadata.metadata==&String_metadata ) {
+			fprintf(stderr, " \"%s\"", e.s->str);
+			return;
+		}
+		if ( vm_is_lazy(vm, e.vref) ) {
+			fprintf(stderr, " <vector expression>");
+			return;
+		}
+		if ( vm_is_object(vm, e.vref) && e.vref->metadata.metadata==&Vector_ref_metadata ) {
+			fprintf(stderr, " [");
+			for (int i = 0; i < (int)e.vref->vptr.vector->length; i++) {
+				fprintf(stderr, i>0 ? ", %1.2f" : "%1.2f", ith(e.vref->vptr, i));
+			}
+			fprintf(stderr, "]");
+			return;
+		}
+	}
+	word p = (word)e.i;
 	if ( ((long)p) >= 0 ) {
 		fprintf(stderr, " %lu", (long)p);
 	}
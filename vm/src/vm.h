@@ -29,10 +29,16 @@ SOFTWARE.
 #ifndef VM_H_
 #define VM_H_
 
-static const int MAX_FUNCTIONS	= 1000;
-static const int MAX_LOCALS		= 10;	// max locals/args in activation record
-static const int MAX_CALL_STACK = 1000;
-static const int MAX_OPND_STACK = 1000;
+#include <vector_expr.h>
+#include "symtab.h"
+
+static const int MAX_FUNCTIONS	= 32768;	// CALL operands are signed 16 bits
+static const int MAX_STRINGS	= 32768;	// and so are SCONST operands
+static const int MAX_CALL_STACK = 1000000;	// reserved address space; pages are used on demand
+static const int MAX_OPND_STACK = 4000000;	// args, locals and operands of all frames
+static const int MAX_NATIVE_DEPTH = 2000;	// compiled calls nested on the C stack; deeper ones are interpreted
+static const int MAX_LAZY_VECTORS = 32;		// deferred vector expressions alive at once
+static const int OUTPUT_BUFFER_SIZE = 1 << 16;	// bytes of stdout a VM holds back; see output.h
 static const int NUM_INSTRS		= 83;
 static const int    DEFAULT_INT_VALUE = 0;
 static const float  DEFAULT_FLOAT_VALUE = 0.0;
@@ -45,10 +51,15 @@ typedef void *ptr;
 typedef unsigned int addr32;
 typedef unsigned int word32;
 
+// function address in an object file for a function that another module
+// defines; vm_link() resolves it by name
+static const addr32 EXTERN_FUNCTION = 0xFFFFFFFF;
+
 // predefined type numbers; needed by VM and any compilers that target the VM.
 // for example, to define the metadata for a global variable of type int, we need to specify
 // the type somehow. We use this INT_TYPE value in olava object files.
 
+static const int VOID_TYPE = 0;
 static const int INT_TYPE = 1;
 static const int FLOAT_TYPE	= 2;
 static const int BOOLEAN_TYPE = 3;
@@ -153,7 +164,36 @@ typedef enum {
 	SROOT,
 	VROOT,
 
-	COPY_VECTOR
+	COPY_VECTOR,
+
+	// superinstructions; these never appear in object files. vm_init
+	// substitutes them for common sequences of the instructions above.
+	ICONST_I2F,
+	ILOAD_ICONST_IADD,
+	ILOAD_ICONST_ISUB,
+	ILOAD_ICONST_IEQ,
+	ILOAD_ILOAD_IADD,
+	ILOAD_ILOAD_ISUB,
+	ILOAD_ILOAD_ILT_BRF,
+	ILOAD_ILOAD_ILE_BRF,
+	ILOAD_ILOAD_IGT_BRF,
+	ILOAD_ILOAD_IGE_BRF,
+	ILOAD_ICONST_IADD_STORE,
+	IEQ_BRF,
+	INEQ_BRF,
+	ILT_BRF,
+	ILE_BRF,
+	IGT_BRF,
+	IGE_BRF,
+	FLT_BRF,
+	FGT_BRF,
+	STORE_ILOAD,
+
+	TAIL_CALL,      // CALL whose result is returned right away; reuses the caller's frame
+
+	// quick forms the interpreter rewrites instructions into once they've run
+	CALL_QUICK,     // callee stays on the stack interpreter; push its frame inline
+	SCONST_QUICK    // string pointer is in the instruction
 } BYTECODE;
 
 typedef struct {
@@ -162,32 +202,78 @@ typedef struct {
     int opnd_size; // size in bytes
 } VM_INSTRUCTION;
 
+/* One version of a persistent vector, boxed in the heap so that a stack slot
+ * holding a vector is a single pointer the GC can root and move. Never
+ * changed once made; copies of a slot share it.
+ */
+typedef struct {
+	heap_object metadata;
+	PVector_ptr vptr;
+} Vector_ref;
+
+extern object_metadata Vector_ref_metadata;
+
 typedef union {
 	int i;
 	double f;
 	bool b;
-	char *s;
-	PVector_ptr vptr;
+	String *s;
+	Vector_ref *vref;	// NULL, a Vector_ref or a deferred expression in lazy_vectors
 	char ba[sizeof(double)];
 } element;
 
+struct vm;
+
 // to call a func, we use index into table of Function descriptors
 typedef struct function {
 	char *name;
 	int return_type;
 	addr32 address; // index into code array
+	addr32 entry;   // index into decoded instrs array
+	addr32 end;     // index just past the last decoded instr; entry of the next function or trailing HALT
 	int nargs;
 	int nlocals;
+	struct rfunction *regcode; // register tier translation or NULL if run by the stack interpreter
+	int frame_size;             // args + locals; covers every local index the code uses
+	int max_stack;              // max operand stack depth; exact if verified else a bound
+	void (*native)(struct vm *vm, element *locals); // JIT compiled code or NULL
+	int calls;                  // times called while not compiled
 } Function_metadata;
 
+// vm_init decodes the byte code once into an array of these so that the
+// interpreter never has to pick operands out of the byte stream at run time.
+typedef struct instr {
+	const void *handler;            // address of interpreter code that executes this instr
+	byte opcode;
+	byte super;                     // superinstruction starting here or just opcode if none
+	addr32 offset;                  // address of this instruction in the original code array
+	union {
+		int i;                      // ICONST value or index of a string, local, etc...
+		double f;                   // FCONST value
+		struct instr *target;       // BR/BRF absolute branch target
+		Function_metadata *func;    // CALL target
+		String *s;                  // SCONST_QUICK string
+	} a;
+} Instr;
+
+// The args stay on the operand stack where the caller pushed them and the
+// locals follow, so a frame is just an index into vm->stack.
 typedef struct activation_record {
 	Function_metadata *func;
-	addr32 retaddr;
+	addr32 retaddr;                 // index into decoded instrs array
 	int save_gc_roots;
-	element locals[MAX_LOCALS]; // args + locals go here per func def
+	int fp;                         // index into vm->stack of first arg or -1 if not on the stack
+	int elided;                     // frames this one replaced via tail calls
 } Activation_Record;
 
+// what vm_exec(vm, true) prints; everything unless narrowed down
 typedef struct {
+	char *function;		// only instructions executed by this function, or any if NULL
+	int from, to;		// only instructions at code addresses from..to-1; to==0 means no limit
+	bool heap;			// print the strings and vectors on the stack, not their addresses
+} Trace_options;
+
+typedef struct vm {
 	// registers
 	addr32 ip;        	// instruction pointer register
     int sp;             // stack pointer register
@@ -196,20 +282,104 @@ typedef struct {
 
 	byte *code;   		// byte-addressable code memory.
 	int code_size;
-	element stack[MAX_OPND_STACK]; 	// operand stack, grows upwards; word addressable
-	Activation_Record call_stack[MAX_CALL_STACK];
+	Instr *instrs;		// pre-decoded code; ip indexes into this
+	int num_instrs;
+	element *stack; 	// operand stack, grows upwards; word addressable
+	Activation_Record *call_stack;
+	Heap *heap;			// strings and vectors this VM creates; current while it runs
 
 	int num_strings;
 	int num_functions;
-	char **strings;
+	int max_strings;	// room in strings and functions before they have to grow
+	int max_functions;
+	String **strings;	// constant pool; immortal, so SCONST can push them as is
+
+	Function_metadata *functions; // array of function defs
+	Symtab function_index;	// function name -> index into functions
+
+	bool verified;		// all functions passed vm_verify; run without stack checks
+	bool cache_tos;		// run verified code on the loop that keeps the top of stack in a register
+	int quickened;		// instructions rewritten into their quick forms so far
+
+	bool jit;			// compile functions to machine code once they get hot
+	int jit_threshold;	// number of calls after which a function is hot
+	int native_depth;	// calls into compiled or register tier code running on the C stack
+	Function_metadata *tail_call; // what compiled code left vm_call_compiled() to call in its place
+
+	bool superblocks;	// interpret with the loop that turns hot loops into superblocks
+	int hot_loop_threshold;	// times a loop branches back before its iteration is recorded
+	struct hot_loops *hot_loops;	// counts and superblocks per loop header; see superblock.h
+
+	Trace_options trace;
+	bool traced;		// the instruction last traced still waits for a dump of the stack it leaves
+
+	bool profiling;		// interpret with the loop that publishes profile_pc
+	const Instr *volatile profile_pc; // instruction being interpreted; read by the SIGPROF handler
+
+	struct opcode_stats *stats;	// count instructions here if built with VM_OPCODE_STATS
+
+	void *image;		// mapped snapshot or object file that code etc. point into, if any
+	size_t image_size;
+
+	char *out;			// printed but not yet written to stdout
+	int out_len;
 
-	Function_metadata functions[MAX_FUNCTIONS]; // array of function defs
+	// Vector arithmetic in the interpreter builds expressions here instead of
+	// allocating a vector per operator. An element whose vref points into
+	// lazy_vectors is such an expression; anything that needs the elements
+	// computes it first with vm_force().
+	Vector_expr lazy_vectors[MAX_LAZY_VECTORS];
+	int free_lazy[MAX_LAZY_VECTORS];	// indexes of unused lazy_vectors
+	int num_lazy;						// lazy_vectors in use
 } VM;
 
 extern VM *vm_alloc();
 extern void vm_init(VM *vm, byte *code, int code_size);
+extern void vm_init_code(VM *vm, byte *code, int code_size);
+extern void vm_init_runtime(VM *vm);
+extern void vm_free(VM *vm);
 extern void vm_exec(VM *vm, bool trace);
+extern void vm_invoke(VM *vm, Function_metadata *func);
+extern void vm_division_by_zero(VM *vm);
+extern int push_default_value(int index, int sp, element *stack);
 extern int def_function(VM *vm, char *name, int return_type, addr32 address, int nargs, int nlocals);
+extern int def_string(VM *vm, char *s);
+extern int vm_function_index(VM *vm, char *name);
 extern VM_INSTRUCTION vm_instructions[];
+extern void vm_vector_op(VM *vm, element *l, element *r, VEXPR_OP op);
+extern void vm_vector_scalar_op(VM *vm, element *v, VEXPR_OP op, double s);
+extern Vector_ref *vm_materialize(VM *vm, Vector_ref *v);
+extern void vm_drop(VM *vm, element *e);
+extern Vector_ref *vm_vector_ref(PVector_ptr v);
+
+// the vector a slot refers to; NULL reads as the null vector
+static inline PVector_ptr vm_vector(Vector_ref *v)
+{
+	return v!=NULL ? v->vptr : (PVector_ptr){0, NULL};
+}
+
+static inline bool vm_is_lazy(VM *vm, Vector_ref *v)
+{
+	return (uintptr_t)v - (uintptr_t)vm->lazy_vectors < sizeof(vm->lazy_vectors);
+}
+
+// compute a deferred vector expression in place so the slot holds a real vector
+static inline void vm_force(VM *vm, element *e)
+{
+	if ( vm->num_lazy>0 && vm_is_lazy(vm, e->vref) ) e->vref = vm_materialize(vm, e->vref);
+}
+
+static inline void vm_force_n(VM *vm, element *e, int n)
+{
+	if ( vm->num_lazy>0 ) {
+		for (int k = 0; k < n; k++) vm_force(vm, &e[k]);
+	}
+}
+
+// the string pushed by SCONST instruction I, quickened or not
+static inline String *vm_sconst(VM *vm, const Instr *I)
+{
+	return I->super==SCONST_QUICK ? I->a.s : vm->strings[I->a.i];
+}
 
 #endif
@@ -0,0 +1,786 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* The interpreter loop: executes instructions starting at vm->ip until a
+ * HALT. vm.c includes this file once per variant with
+ *
+ *	VM_RUN				name of the function to define
+ *	VALIDATE_STACK(a)	check that stack address a is in range, or nothing
+ *						for code the verifier has already proven safe
+ *	VM_PROFILED			optional; if defined, store pc in vm->profile_pc
+ *						before every instruction for the sampling profiler
+ *	VM_TRACED			optional; if defined, this is the diagnostic loop:
+ *						each instruction passes through vm_trace() and runs
+ *						unfused, unquickened and never on the other tiers.
+ *						Loops without it have no trace hooks at all
+ *	VM_COUNTED			optional; with VM_TRACED, count instructions into
+ *						vm->stats instead of printing them
+ *	VM_SUPERBLOCKS		optional; if defined, every backward BR goes through
+ *						sb_loop(), which runs the loop as a superblock once
+ *						it's hot
+ *
+ * No include guard on purpose.
+ */
+
+// rewrite the instruction at pc into quick form op; only when not tracing,
+// since trace mode dispatches on the unfused opcode anyway
+#ifdef VM_THREADED_DISPATCH
+#define QUICKEN(op)	{ ((Instr *)pc)->super = (op); ((Instr *)pc)->handler = dispatch[op]; vm->quickened++; }
+#else
+#define QUICKEN(op)	{ ((Instr *)pc)->super = (op); vm->quickened++; }
+#endif
+
+// the profiled loop stores pc on its way to every handler
+#if defined(VM_PROFILED) && defined(VM_THREADED_DISPATCH)
+#undef DISPATCH
+#undef NEXT
+#define DISPATCH	goto *(vm->profile_pc = pc)->handler
+#define NEXT		goto *(vm->profile_pc = ++pc)->handler
+#endif
+
+static VM_LOOP_ATTRIBUTES void VM_RUN(VM *vm)
+{
+#ifdef VM_TRACED
+	const bool trace = true;
+#else
+	const bool trace = false;
+#endif
+	int i = 0;
+	bool b1, b2;
+	double f,g;
+	String *c;
+	PVector_ptr vptr,r,l;
+	int x, y;
+	Activation_Record *frame;
+	Function_metadata *func;
+	element *locals;
+
+	// Define VM registers (C compiler probably ignores 'register' nowadays
+	// but it's good documentation in this case. Keep as locals for
+	// convenience and only write them back to the vm object when somebody
+	// outside of this loop needs to see them (calls, tracing, halting).
+	register const Instr *pc = &vm->instrs[vm->ip];
+	register int sp = vm->sp;
+	register int fp = vm->fp;
+	element *stack = vm->stack;
+
+#ifdef VM_THREADED_DISPATCH
+	static const void *const dispatch[] = {
+		[HALT] = &&do_HALT,
+		[IADD] = &&do_IADD, [ISUB] = &&do_ISUB, [IMUL] = &&do_IMUL, [IDIV] = &&do_IDIV,
+		[FADD] = &&do_FADD, [FSUB] = &&do_FSUB, [FMUL] = &&do_FMUL, [FDIV] = &&do_FDIV,
+		[VADD] = &&do_VADD, [VADDI] = &&do_VADDI, [VADDF] = &&do_VADDF,
+		[VSUB] = &&do_VSUB, [VSUBI] = &&do_VSUBI, [VSUBF] = &&do_VSUBF,
+		[VMUL] = &&do_VMUL, [VMULI] = &&do_VMULI, [VMULF] = &&do_VMULF,
+		[VDIV] = &&do_VDIV, [VDIVI] = &&do_VDIVI, [VDIVF] = &&do_VDIVF,
+		[SADD] = &&do_SADD,
+		[OR] = &&do_OR, [AND] = &&do_AND, [INEG] = &&do_INEG, [FNEG] = &&do_FNEG, [NOT] = &&do_NOT,
+		[I2F] = &&do_I2F, [F2I] = &&do_F2I, [I2S] = &&do_I2S, [F2S] = &&do_F2S, [V2S] = &&do_V2S,
+		[IEQ] = &&do_IEQ, [INEQ] = &&do_INEQ, [ILT] = &&do_ILT, [ILE] = &&do_ILE, [IGT] = &&do_IGT, [IGE] = &&do_IGE,
+		[FEQ] = &&do_FEQ, [FNEQ] = &&do_FNEQ, [FLT] = &&do_FLT, [FLE] = &&do_FLE, [FGT] = &&do_FGT, [FGE] = &&do_FGE,
+		[SEQ] = &&do_SEQ, [SNEQ] = &&do_SNEQ, [SGT] = &&do_SGT, [SGE] = &&do_SGE, [SLT] = &&do_SLT, [SLE] = &&do_SLE,
+		[VEQ] = &&do_VEQ, [VNEQ] = &&do_VNEQ,
+		[BR] = &&do_BR, [BRF] = &&do_BRF,
+		[ICONST] = &&do_ICONST, [FCONST] = &&do_FCONST, [SCONST] = &&do_SCONST,
+		[ILOAD] = &&do_ILOAD, [FLOAD] = &&do_FLOAD, [VLOAD] = &&do_VLOAD, [SLOAD] = &&do_SLOAD, [STORE] = &&do_STORE,
+		[VECTOR] = &&do_VECTOR, [VLOAD_INDEX] = &&do_VLOAD_INDEX, [STORE_INDEX] = &&do_STORE_INDEX,
+		[SLOAD_INDEX] = &&do_SLOAD_INDEX, [PUSH_DFLT_RETV] = &&do_PUSH_DFLT_RETV, [POP] = &&do_POP,
+		[CALL] = &&do_CALL, [RET] = &&do_RET,
+		[IPRINT] = &&do_IPRINT, [FPRINT] = &&do_FPRINT, [BPRINT] = &&do_BPRINT, [SPRINT] = &&do_SPRINT, [VPRINT] = &&do_VPRINT,
+		[NOP] = &&do_NOP, [VLEN] = &&do_VLEN, [SLEN] = &&do_SLEN,
+		[GC_START] = &&do_GC_START, [GC_END] = &&do_GC_END, [SROOT] = &&do_SROOT, [VROOT] = &&do_VROOT,
+		[COPY_VECTOR] = &&do_COPY_VECTOR,
+
+		[ICONST_I2F] = &&do_ICONST_I2F,
+		[ILOAD_ICONST_IADD] = &&do_ILOAD_ICONST_IADD, [ILOAD_ICONST_ISUB] = &&do_ILOAD_ICONST_ISUB,
+		[ILOAD_ICONST_IEQ] = &&do_ILOAD_ICONST_IEQ,
+		[ILOAD_ILOAD_IADD] = &&do_ILOAD_ILOAD_IADD, [ILOAD_ILOAD_ISUB] = &&do_ILOAD_ILOAD_ISUB,
+		[ILOAD_ILOAD_ILT_BRF] = &&do_ILOAD_ILOAD_ILT_BRF, [ILOAD_ILOAD_ILE_BRF] = &&do_ILOAD_ILOAD_ILE_BRF,
+		[ILOAD_ILOAD_IGT_BRF] = &&do_ILOAD_ILOAD_IGT_BRF, [ILOAD_ILOAD_IGE_BRF] = &&do_ILOAD_ILOAD_IGE_BRF,
+		[ILOAD_ICONST_IADD_STORE] = &&do_ILOAD_ICONST_IADD_STORE,
+		[IEQ_BRF] = &&do_IEQ_BRF, [INEQ_BRF] = &&do_INEQ_BRF, [ILT_BRF] = &&do_ILT_BRF, [ILE_BRF] = &&do_ILE_BRF,
+		[IGT_BRF] = &&do_IGT_BRF, [IGE_BRF] = &&do_IGE_BRF, [FLT_BRF] = &&do_FLT_BRF, [FGT_BRF] = &&do_FGT_BRF,
+		[STORE_ILOAD] = &&do_STORE_ILOAD,
+		[TAIL_CALL] = &&do_TAIL_CALL,
+		[CALL_QUICK] = &&do_CALL_QUICK, [SCONST_QUICK] = &&do_SCONST_QUICK
+	};
+	// The handlers belong to the loop that ran last; the trailing HALT tells us
+	// whether they're already this loop's (nested runs via vm_invoke).
+#ifdef VM_TRACED
+	// every instruction detours through do_trace before reaching the
+	// handler of its unfused opcode
+	if ( vm->instrs[vm->num_instrs].handler!=&&do_trace ) {
+		for (int k = 0; k <= vm->num_instrs; k++) vm->instrs[k].handler = &&do_trace;
+	}
+#else
+	if ( vm->instrs[vm->num_instrs].handler!=dispatch[HALT] ) {
+		for (int k = 0; k <= vm->num_instrs; k++) vm->instrs[k].handler = dispatch[vm->instrs[k].super];
+	}
+#endif
+
+	DISPATCH;
+#ifdef VM_TRACED
+do_trace:
+#ifdef VM_COUNTED
+	vm_stats_count(vm->stats, pc);
+#else
+	WRITE_BACK_REGISTERS(vm);
+	vm_trace(vm, pc->offset);
+#endif
+	goto *dispatch[pc->super==TAIL_CALL ? TAIL_CALL : pc->opcode]; // trace shows elided frames too
+#endif
+#else
+	for (;;) {
+		int opcode = pc->super;
+#ifdef VM_PROFILED
+		vm->profile_pc = pc;
+#endif
+#ifdef VM_TRACED
+#ifdef VM_COUNTED
+		vm_stats_count(vm->stats, pc);
+#else
+		WRITE_BACK_REGISTERS(vm);
+		vm_trace(vm, pc->offset);
+#endif
+		opcode = pc->super==TAIL_CALL ? TAIL_CALL : pc->opcode;
+#endif
+		switch (opcode) {
+#endif
+			CASE(IADD)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp].i;
+				stack[sp].i = x + y;
+				NEXT;
+			CASE(ISUB)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp].i;
+				stack[sp].i = x - y;
+				NEXT;
+			CASE(IMUL)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp].i;
+				stack[sp].i = x * y;
+				NEXT;
+			CASE(IDIV)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp--].i;
+				if (y ==0 ) vm_division_by_zero(vm);
+				stack[++sp].i = x / y;
+				NEXT;
+			CASE(FADD)
+				VALIDATE_STACK(sp-1);
+				f = stack[sp--].f;
+				g = stack[sp].f;
+				stack[sp].f = g + f;
+				NEXT;
+			CASE(FSUB)
+				VALIDATE_STACK(sp-1);
+				f = stack[sp--].f;
+				g = stack[sp].f;
+				stack[sp].f = g - f;
+				NEXT;
+			CASE(FMUL)
+				VALIDATE_STACK(sp-1);
+				f = stack[sp--].f;
+				g = stack[sp].f;
+				stack[sp].f = g * f;
+				NEXT;
+			CASE(FDIV)
+				VALIDATE_STACK(sp-1);
+				f = stack[sp--].f;
+				g = stack[sp--].f;
+				if (f == 0) vm_division_by_zero(vm);
+				stack[++sp].f = g / f;
+				NEXT;
+            CASE(VADD)
+				VALIDATE_STACK(sp-1);
+				sp--;
+				vm_vector_op(vm, &stack[sp], &stack[sp+1], VEXPR_ADD);
+                NEXT;
+			CASE(VADDI)
+				VALIDATE_STACK(sp-1);
+				i = stack[sp--].i;
+				vm_vector_scalar_op(vm, &stack[sp], VEXPR_ADD_SCALAR, i);
+				NEXT;
+			CASE(VADDF)
+				VALIDATE_STACK(sp-1);
+				f = stack[sp--].f;
+				vm_vector_scalar_op(vm, &stack[sp], VEXPR_ADD_SCALAR, f);
+				NEXT;
+            CASE(VSUB)
+				VALIDATE_STACK(sp-1);
+				sp--;
+				vm_vector_op(vm, &stack[sp], &stack[sp+1], VEXPR_SUB);
+                NEXT;
+			CASE(VSUBI)
+				VALIDATE_STACK(sp-1);
+				i = stack[sp--].i;
+				vm_vector_scalar_op(vm, &stack[sp], VEXPR_SUB_SCALAR, i);
+				NEXT;
+			CASE(VSUBF)
+				VALIDATE_STACK(sp-1);
+				f = stack[sp--].f;
+				vm_vector_scalar_op(vm, &stack[sp], VEXPR_SUB_SCALAR, f);
+				NEXT;
+            CASE(VMUL)
+				VALIDATE_STACK(sp-1);
+				sp--;
+				vm_vector_op(vm, &stack[sp], &stack[sp+1], VEXPR_MUL);
+                NEXT;
+			CASE(VMULI)
+				VALIDATE_STACK(sp-1);
+				i = stack[sp--].i;
+				vm_vector_scalar_op(vm, &stack[sp], VEXPR_MUL_SCALAR, i);
+				NEXT;
+			CASE(VMULF)
+				VALIDATE_STACK(sp-1);
+				f = stack[sp--].f;
+				vm_vector_scalar_op(vm, &stack[sp], VEXPR_MUL_SCALAR, f);
+				NEXT;
+            CASE(VDIV)
+                VALIDATE_STACK(sp-1);
+				sp--;
+				vm_vector_op(vm, &stack[sp], &stack[sp+1], VEXPR_DIV);
+                NEXT;
+			CASE(VDIVI)
+				VALIDATE_STACK(sp-1);
+				i = stack[sp--].i;
+				if (i == 0) {
+					zero_division_error();
+					NEXT;
+				}
+				vm_vector_scalar_op(vm, &stack[sp], VEXPR_DIV_SCALAR, i);
+				NEXT;
+			CASE(VDIVF)
+				VALIDATE_STACK(sp-1);
+				f = stack[sp--].f;
+				if (f == 0) {
+					zero_division_error();
+					NEXT;
+				}
+				vm_vector_scalar_op(vm, &stack[sp], VEXPR_DIV_SCALAR, f);
+				NEXT;
+            CASE(SADD)
+				VALIDATE_STACK(sp-1);
+				c = stack[sp--].s;
+				stack[sp].s = String_add(stack[sp].s, c);
+                NEXT;
+			CASE(OR)
+				VALIDATE_STACK(sp-1);
+				b2 = stack[sp--].b;
+				b1 = stack[sp].b;
+				stack[sp].b = b1 || b2;
+				NEXT;
+			CASE(AND)
+				VALIDATE_STACK(sp-1);
+				b2 = stack[sp--].b;
+				b1 = stack[sp].b;
+				stack[sp].b = b1 && b2;
+				NEXT;
+			CASE(INEG)
+				VALIDATE_STACK(sp);
+				stack[sp].i = -stack[sp].i;
+				NEXT;
+			CASE(FNEG)
+				VALIDATE_STACK(sp);
+				stack[sp].f = -stack[sp].f;
+				NEXT;
+			CASE(NOT)
+				VALIDATE_STACK(sp);
+				stack[sp].b = !stack[sp].b;
+				NEXT;
+			CASE(I2F)
+				VALIDATE_STACK(sp);
+				stack[sp].f = stack[sp].i;
+				NEXT;
+			CASE(I2S)
+				VALIDATE_STACK(sp);
+				stack[sp].s = String_from_int(stack[sp].i);
+				NEXT;
+			CASE(F2I)
+				VALIDATE_STACK(sp);
+				stack[sp].i = (int)stack[sp].f;
+				NEXT;
+            CASE(F2S)
+				VALIDATE_STACK(sp);
+				stack[sp].s = String_from_float(stack[sp].f);
+                NEXT;
+            CASE(V2S)
+				VALIDATE_STACK(sp);
+				vm_force(vm, &stack[sp]);
+				vptr = vm_vector(stack[sp].vref);
+				stack[sp].s = String_from_vector(vptr);
+                NEXT;
+			CASE(IEQ)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp].i;
+				stack[sp].b = x == y;
+				NEXT;
+			CASE(INEQ)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp].i;
+				stack[sp].b = x != y;
+				NEXT;
+			CASE(ILT)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp].i;
+				stack[sp].b = x < y;
+				NEXT;
+			CASE(ILE)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp].i;
+				stack[sp].b = x <= y;
+				NEXT;
+			CASE(IGT)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp].i;
+				stack[sp].b = x > y;
+				NEXT;
+			CASE(IGE)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp].i;
+				stack[sp].b = x >= y;
+				NEXT;
+			CASE(FEQ)
+				VALIDATE_STACK(sp-1);
+				g = stack[sp--].f;
+				f = stack[sp].f;
+				stack[sp].b = f == g;
+				NEXT;
+			CASE(FNEQ)
+				VALIDATE_STACK(sp-1);
+				g = stack[sp--].f;
+				f = stack[sp].f;
+				stack[sp].b = f != g;
+				NEXT;
+			CASE(FLT)
+				VALIDATE_STACK(sp-1);
+				g = stack[sp--].f;
+				f = stack[sp].f;
+				stack[sp].b = f < g;
+				NEXT;
+			CASE(FLE)
+				VALIDATE_STACK(sp-1);
+				g = stack[sp--].f;
+				f = stack[sp].f;
+				stack[sp].b = f <= g;
+				NEXT;
+			CASE(FGT)
+				VALIDATE_STACK(sp-1);
+				g = stack[sp--].f;
+				f = stack[sp].f;
+				stack[sp].b = f > g;
+				NEXT;
+			CASE(FGE)
+				VALIDATE_STACK(sp-1);
+				g = stack[sp--].f;
+				f = stack[sp].f;
+				stack[sp].b = f >= g;
+				NEXT;
+            CASE(SEQ)
+				VALIDATE_STACK(sp-1);
+				c = stack[sp--].s;
+				b1 = String_eq(stack[sp--].s, c);
+				stack[++sp].b = b1;
+                NEXT;
+            CASE(SNEQ)
+				VALIDATE_STACK(sp-1);
+				c = stack[sp--].s;
+				b1 = String_neq(stack[sp--].s, c);
+				stack[++sp].b = b1;
+                NEXT;
+            CASE(SGT)
+				VALIDATE_STACK(sp-1);
+				c = stack[sp--].s;
+				b1 = String_gt(stack[sp--].s, c);
+				stack[++sp].b = b1;
+                NEXT;
+            CASE(SGE)
+				VALIDATE_STACK(sp-1);
+				c = stack[sp--].s;
+				b1 = String_ge(stack[sp--].s, c);
+				stack[++sp].b = b1;
+                NEXT;
+            CASE(SLT)
+				VALIDATE_STACK(sp-1);
+				c = stack[sp--].s;
+				b1 = String_lt(stack[sp--].s, c);
+				stack[++sp].b = b1;
+                NEXT;
+            CASE(SLE)
+				VALIDATE_STACK(sp-1);
+				c = stack[sp--].s;
+				b1 = String_le(stack[sp--].s, c);
+				stack[++sp].b = b1;
+                NEXT;
+			CASE(VEQ)
+				VALIDATE_STACK(sp-1);
+				vm_force_n(vm, &stack[sp-1], 2);
+				l = vm_vector(stack[sp--].vref);
+				r = vm_vector(stack[sp--].vref);
+				b1 = Vector_eq(l,r);
+				stack[++sp].b = b1;
+				NEXT;
+			CASE(VNEQ)
+				VALIDATE_STACK(sp-1);
+				vm_force_n(vm, &stack[sp-1], 2);
+				l = vm_vector(stack[sp--].vref);
+				r = vm_vector(stack[sp--].vref);
+				b1 = Vector_neq(l,r);
+				stack[++sp].b = b1;
+				NEXT;
+			CASE(BR)
+#ifdef VM_SUPERBLOCKS
+				if ( pc->a.target<=pc ) { // closes a loop
+					pc = pc->a.target;
+					WRITE_BACK_REGISTERS(vm);
+					sb_loop(vm);
+					LOAD_REGISTERS(vm);
+					DISPATCH;
+				}
+#endif
+				pc = pc->a.target;
+				DISPATCH;
+			CASE(BRF)
+				VALIDATE_STACK(sp);
+				if ( !stack[sp--].b ) {
+					pc = pc->a.target;
+					DISPATCH;
+				}
+				NEXT;
+			CASE(ICONST)
+				stack[++sp] = (element){.i = pc->a.i}; // whole slot so ICONST 0 also reads as 0.0
+				NEXT;
+			CASE(FCONST)
+				stack[++sp].f = pc->a.f;
+				NEXT;
+			CASE(SCONST)
+				stack[++sp].s = vm->strings[pc->a.i];
+				if ( !trace ) {
+					((Instr *)pc)->a.s = stack[sp].s;
+					QUICKEN(SCONST_QUICK);
+				}
+				NEXT;
+			CASE(SCONST_QUICK)
+				stack[++sp].s = pc->a.s;
+				NEXT;
+			CASE(ILOAD)
+				stack[++sp].i = stack[fp + pc->a.i].i;
+				NEXT;
+			CASE(FLOAD)
+				stack[++sp].f = stack[fp + pc->a.i].f;
+				NEXT;
+            CASE(VLOAD)
+                stack[++sp].vref = stack[fp + pc->a.i].vref;
+                NEXT;
+            CASE(SLOAD)
+                stack[++sp].s = stack[fp + pc->a.i].s;
+				NEXT;
+			CASE(STORE)
+				vm_force(vm, &stack[sp]);
+				stack[fp + pc->a.i] = stack[sp--]; // untyped store; it'll just copy all bits
+				NEXT;
+			CASE(VECTOR)
+				i = stack[sp--].i;
+				VALIDATE_STACK(sp-i+1);
+				double *data = (double*)malloc(i*sizeof(double));
+				for (int j = i-1; j >= 0;j--) { data[j] = stack[sp--].f; }
+				vptr = Vector_new(data,i);
+				stack[++sp].vref = vm_vector_ref(vptr);
+				NEXT;
+			CASE(VLOAD_INDEX)
+				vm_force(vm, &stack[sp-1]);
+				i = stack[sp--].i;
+				vptr = vm_vector(stack[sp--].vref);
+				vm->stack[++sp].f = ith(vptr, i-1);
+				NEXT;
+			CASE(STORE_INDEX)
+				vm_force(vm, &stack[sp-2]);
+				f = stack[sp--].f;
+				i = stack[sp--].i;
+				vptr = vm_vector(stack[sp--].vref);
+				set_ith(vptr, i-1, f);
+				NEXT;
+			CASE(SLOAD_INDEX)
+				i = stack[sp--].i;
+				c = stack[sp--].s;
+				if (i-1 >= c->length)
+				{
+					fprintf(stderr, "StringIndexOutOfRange: %d out of index : 1 to %d\n",i,(int)c->length);
+					NEXT;
+				}
+				stack[++sp].s = String_from_char(c->str[i-1]);
+				NEXT;
+			CASE(PUSH_DFLT_RETV)
+				i = *&vm->call_stack[vm->callsp].func->return_type;
+				sp = push_default_value(i, sp, stack);
+				NEXT;
+			CASE(POP)
+				if ( vm->num_lazy>0 ) vm_drop(vm, &stack[sp]);
+				sp--;
+				NEXT;
+			CASE(CALL)
+				func = pc->a.func;
+				if ( func==NULL ) no_such_function(vm, pc);
+				// a callee that isn't compiled now never will be without the JIT
+				if ( !trace && !vm->jit && func->native==NULL && func->regcode==NULL ) QUICKEN(CALL_QUICK);
+				pc++; // return to instruction following CALL
+				vm_force_n(vm, &stack[sp - func->nargs + 1], func->nargs);
+				WRITE_BACK_REGISTERS(vm);
+				if ( trace || !vm_call_compiled(vm, func) ) vm_call(vm, func);
+				LOAD_REGISTERS(vm);
+				DISPATCH;
+			CASE(CALL_QUICK)
+				func = pc->a.func;
+				vm_force_n(vm, &stack[sp - func->nargs + 1], func->nargs);
+				if ( vm->callsp+1>=MAX_CALL_STACK || sp + func->frame_size + func->max_stack>=MAX_OPND_STACK ) {
+					pc++;
+					WRITE_BACK_REGISTERS(vm);
+					vm_call(vm, func); // reports the overflow
+				}
+				// vm_call() without leaving the loop
+				frame = &vm->call_stack[++vm->callsp];
+				frame->func = func;
+				frame->retaddr = (addr32)(pc + 1 - vm->instrs);
+				frame->elided = 0;
+				frame->fp = fp = sp - func->nargs + 1;
+				memset(&stack[sp+1], 0, (func->frame_size - func->nargs) * sizeof(element));
+				sp = fp + func->frame_size - 1;
+				pc = &vm->instrs[func->entry];
+				DISPATCH;
+			CASE(TAIL_CALL)
+				func = pc->a.func;
+				vm_force_n(vm, &stack[sp - func->nargs + 1], func->nargs);
+				pc++;
+				WRITE_BACK_REGISTERS(vm);
+				if ( trace || !vm_call_compiled(vm, func) ) vm_tail_call(vm, func);
+				LOAD_REGISTERS(vm);
+				DISPATCH;
+			CASE(RET)
+				frame = &vm->call_stack[vm->callsp--];
+				pc = &vm->instrs[frame->retaddr];
+				// the result, if any, replaces the args
+				if ( frame->func->return_type!=VOID_TYPE ) {
+					vm_force(vm, &stack[sp]);
+					stack[frame->fp] = stack[sp];
+					sp = frame->fp;
+				}
+				else sp = frame->fp - 1;
+				fp = vm->callsp>=0 ? vm->call_stack[vm->callsp].fp : -1;
+				DISPATCH;
+			CASE(IPRINT)
+				VALIDATE_STACK(sp);
+				vm_print_int(vm, stack[sp--].i);
+				NEXT;
+			CASE(FPRINT)
+				VALIDATE_STACK(sp);
+				vm_print_float(vm, stack[sp--].f);
+				NEXT;
+			CASE(BPRINT)
+				VALIDATE_STACK(sp);
+				vm_print_int(vm, stack[sp--].b);
+				NEXT;
+			CASE(SPRINT)
+				VALIDATE_STACK(sp);
+				vm_print_string(vm, stack[sp--].s);
+				NEXT;
+			CASE(VPRINT)
+				VALIDATE_STACK(sp);
+				vm_force(vm, &stack[sp]);
+				vm_print_vector(vm, vm_vector(stack[sp--].vref));
+				NEXT;
+			CASE(VLEN)
+				vm_force(vm, &stack[sp]);
+				vptr = vm_vector(stack[sp--].vref);
+				i = Vector_len(vptr);
+				stack[++sp].i = i;
+				NEXT;
+			CASE(SLEN)
+				c = stack[sp--].s;
+				i = String_len(c);
+				stack[++sp].i = i;
+				NEXT;
+			CASE(GC_START)
+				vm->call_stack[vm->callsp].save_gc_roots = gc_num_roots();
+				NEXT;
+			CASE(GC_END)
+				gc_set_num_roots(vm->call_stack[vm->callsp].save_gc_roots);
+				NEXT;
+			CASE(SROOT)
+				gc_add_root((void **)&stack[sp].s);
+				NEXT;
+			CASE(VROOT)
+				vm_force(vm, &stack[sp]);
+				gc_add_root((void **)&stack[sp].vref);
+				NEXT;
+			CASE(COPY_VECTOR)
+				vm_force(vm, &stack[sp]);
+				if (stack[sp].vref != NULL) {
+					stack[sp].vref = vm_vector_ref(Vector_copy(stack[sp].vref->vptr));
+				}
+				else {
+					fprintf(stderr, "Vector reference cannot be found\n");
+				}
+				NEXT;
+			CASE(NOP) NEXT;
+			CASE(HALT) goto halt;
+
+			// superinstructions; operands are found in the records of the
+			// instructions they replace: pc[0], pc[1], ...
+			CASE(ICONST_I2F)
+				stack[++sp].f = pc->a.i;
+				pc += 2;
+				DISPATCH;
+			CASE(ILOAD_ICONST_IADD)
+				locals = &stack[fp];
+				stack[++sp].i = locals[pc[0].a.i].i + pc[1].a.i;
+				pc += 3;
+				DISPATCH;
+			CASE(ILOAD_ICONST_ISUB)
+				locals = &stack[fp];
+				stack[++sp].i = locals[pc[0].a.i].i - pc[1].a.i;
+				pc += 3;
+				DISPATCH;
+			CASE(ILOAD_ICONST_IEQ)
+				locals = &stack[fp];
+				stack[++sp].b = locals[pc[0].a.i].i == pc[1].a.i;
+				pc += 3;
+				DISPATCH;
+			CASE(ILOAD_ILOAD_IADD)
+				locals = &stack[fp];
+				stack[++sp].i = locals[pc[0].a.i].i + locals[pc[1].a.i].i;
+				pc += 3;
+				DISPATCH;
+			CASE(ILOAD_ILOAD_ISUB)
+				locals = &stack[fp];
+				stack[++sp].i = locals[pc[0].a.i].i - locals[pc[1].a.i].i;
+				pc += 3;
+				DISPATCH;
+			CASE(ILOAD_ILOAD_ILT_BRF)
+				locals = &stack[fp];
+				pc = locals[pc[0].a.i].i < locals[pc[1].a.i].i ? pc + 4 : pc[3].a.target;
+				DISPATCH;
+			CASE(ILOAD_ILOAD_ILE_BRF)
+				locals = &stack[fp];
+				pc = locals[pc[0].a.i].i <= locals[pc[1].a.i].i ? pc + 4 : pc[3].a.target;
+				DISPATCH;
+			CASE(ILOAD_ILOAD_IGT_BRF)
+				locals = &stack[fp];
+				pc = locals[pc[0].a.i].i > locals[pc[1].a.i].i ? pc + 4 : pc[3].a.target;
+				DISPATCH;
+			CASE(ILOAD_ILOAD_IGE_BRF)
+				locals = &stack[fp];
+				pc = locals[pc[0].a.i].i >= locals[pc[1].a.i].i ? pc + 4 : pc[3].a.target;
+				DISPATCH;
+			CASE(ILOAD_ICONST_IADD_STORE)
+				locals = &stack[fp];
+				locals[pc[3].a.i].i = locals[pc[0].a.i].i + pc[1].a.i;
+				pc += 4;
+				DISPATCH;
+			CASE(IEQ_BRF)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp--].i;
+				pc = x == y ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(INEQ_BRF)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp--].i;
+				pc = x != y ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(ILT_BRF)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp--].i;
+				pc = x < y ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(ILE_BRF)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp--].i;
+				pc = x <= y ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(IGT_BRF)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp--].i;
+				pc = x > y ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(IGE_BRF)
+				VALIDATE_STACK(sp-1);
+				y = stack[sp--].i;
+				x = stack[sp--].i;
+				pc = x >= y ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(FLT_BRF)
+				VALIDATE_STACK(sp-1);
+				g = stack[sp--].f;
+				f = stack[sp--].f;
+				pc = f < g ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(FGT_BRF)
+				VALIDATE_STACK(sp-1);
+				g = stack[sp--].f;
+				f = stack[sp--].f;
+				pc = f > g ? pc + 2 : pc[1].a.target;
+				DISPATCH;
+			CASE(STORE_ILOAD)
+				vm_force(vm, &stack[sp]);
+				locals = &stack[fp];
+				locals[pc[0].a.i] = stack[sp];
+				stack[sp].i = locals[pc[1].a.i].i;
+				pc += 2;
+				DISPATCH;
+#ifndef VM_THREADED_DISPATCH
+			default:
+				vm_flush(vm);
+				fprintf(stderr, "invalid opcode: %d at ip=%d\n", opcode, pc->offset);
+				exit(1);
+		}
+next:
+		pc++;
+	}
+#endif
+halt:
+	WRITE_BACK_REGISTERS(vm);
+}
+
+// back to the plain versions from dispatch.h
+#if defined(VM_PROFILED) && defined(VM_THREADED_DISPATCH)
+#undef DISPATCH
+#undef NEXT
+#define DISPATCH	goto *pc->handler
+#define NEXT		goto *(++pc)->handler
+#endif
@@ -0,0 +1,72 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wich.h>
+#include "vm.h"
+#include "wloader.h"
+
+/*
+Assemble a text object file into a binary one that vm_load() maps instead
+of parsing.
+
+	wasm2wbc file.wasm [file.wbc]
+
+The output defaults to the input file name with .wbc in place of .wasm.
+The module isn't linked so it may call functions other modules define.
+*/
+
+int main(int argc, char *argv[])
+{
+	if ( argc<2 ) {
+		fprintf(stderr, "usage: wasm2wbc file.wasm [file.wbc]\n");
+		return 1;
+	}
+	char out[2000];
+	if ( argc>2 ) snprintf(out, sizeof(out), "%s", argv[2]);
+	else {
+		char *dot = strrchr(argv[1], '.');
+		int n = dot!=NULL ? (int)(dot - argv[1]) : (int)strlen(argv[1]);
+		snprintf(out, sizeof(out), "%.*s.wbc", n, argv[1]);
+	}
+	FILE *f = fopen(argv[1], "r");
+	if ( f==NULL ) {
+		fprintf(stderr, "can't open %s\n", argv[1]);
+		return 1;
+	}
+	FILE *wbc = fopen(out, "w");
+	if ( wbc==NULL ) {
+		fprintf(stderr, "can't write %s\n", out);
+		return 1;
+	}
+	bool ok = vm_assemble(f, wbc);
+	fclose(wbc);
+	if ( !ok ) {
+		fprintf(stderr, "can't assemble %s into %s\n", argv[1], out);
+		remove(out);
+		return 1;
+	}
+	return 0;
+}
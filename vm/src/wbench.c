@@ -0,0 +1,114 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <wich.h>
+#include "vm.h"
+#include "wloader.h"
+#include "output.h"
+
+/*
+Compare the two loops that interpret verified code: the one that keeps the
+whole operand stack in memory and the one that caches its top in a register
+(wrun -k).
+
+	wbench [-n runs] file.wasm ...
+
+Runs each program runs times (default 200) on each loop, loading it afresh
+every time, and prints the average milliseconds per run, not counting the
+load, and how much faster the cached loop is. Programs that fail the
+verifier run on the checked loop either way and are marked as such. What
+the programs print, including errors, goes to /dev/null.
+*/
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// average ms per vm_exec of filename, or -1 if it doesn't load
+static double time_runs(char *filename, int runs, bool cache_tos, bool *verified)
+{
+	double total = 0;
+	for (int i = 0; i < runs; i++) {
+		FILE *f = fopen(filename, "r");
+		if ( f==NULL ) return -1;
+		VM *vm = vm_load(f);
+		if ( vm==NULL ) return -1;
+		vm->cache_tos = cache_tos;
+		*verified = vm->verified;
+		double start = now();
+		vm_exec(vm, false);
+		vm_flush(vm);
+		total += now() - start;
+		vm_free(vm);
+	}
+	return total * 1000 / runs;
+}
+
+int main(int argc, char *argv[])
+{
+	int runs = 200;
+	char *filenames[argc];
+	int nfiles = 0;
+	for (int i = 1; i < argc; i++) {
+		if ( strcmp(argv[i], "-n")==0 && i+1<argc ) runs = atoi(argv[++i]);
+		else filenames[nfiles++] = argv[i];
+	}
+	if ( nfiles==0 || runs<1 ) {
+		fprintf(stderr, "usage: wbench [-n runs] file.wasm ...\n");
+		return 1;
+	}
+	FILE *report = fdopen(dup(fileno(stdout)), "w");
+	freopen("/dev/null", "w", stdout);
+	freopen("/dev/null", "w", stderr);
+
+	double memory_total = 0, cached_total = 0;
+	fprintf(report, "%-32s %10s %10s %8s\n", "program", "memory ms", "cached ms", "speedup");
+	for (int i = 0; i < nfiles; i++) {
+		bool verified = false;
+		char *name = strrchr(filenames[i], '/')!=NULL ? strrchr(filenames[i], '/') + 1 : filenames[i];
+		double memory = time_runs(filenames[i], runs, false, &verified);
+		double cached = time_runs(filenames[i], runs, true, &verified);
+		if ( memory<0 || cached<0 ) {
+			fprintf(report, "%-32s %10s\n", name, "can't load");
+			continue;
+		}
+		memory_total += memory;
+		cached_total += cached;
+		fprintf(report, "%-32s %10.4f %10.4f %7.2fx%s\n", name, memory, cached, memory / cached,
+				verified ? "" : " (unverified)");
+	}
+	if ( cached_total>0 ) {
+		fprintf(report, "%-32s %10.4f %10.4f %7.2fx\n", "total", memory_total, cached_total,
+				memory_total / cached_total);
+	}
+	fclose(report);
+	return 0;
+}
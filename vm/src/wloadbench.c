@@ -0,0 +1,170 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wich.h>
+#include "vm.h"
+#include "wloader.h"
+#include "snapshot.h"
+
+/*
+Compare load times of the object file formats on a large generated program.
+
+	wloadbench [-n instrs] [-m modules] [-r runs]
+
+Writes a program of about instrs instructions (default 200000) spread over
+up to MAX_FUNCTIONS functions, which main calls one after the other. The
+functions are split across modules (default 1), written as
+/tmp/wloadbench-K.wasm; the first also holds main. Each module is assembled
+into /tmp/wloadbench-K.wbc and the linked program is snapshotted into
+/tmp/wloadbench.img. Then loads and links each format runs times and prints
+the average milliseconds per load.
+*/
+
+static const int FUNC_BLOCKS = 20;	// blocks of instructions below per function
+
+static char *module_file(int k, char *suffix)
+{
+	static char name[100];
+	snprintf(name, sizeof(name), "/tmp/wloadbench-%d.%s", k, suffix);
+	return name;
+}
+
+static void generate(int instrs, int nmodules)
+{
+	static char *block[] = {
+		"ICONST %d", "STORE 0", "ILOAD 0", "ICONST 3", "IMUL", "STORE 1",
+		"FCONST %d.25", "POP", "SCONST %d", "POP"
+	};
+	int per_block = sizeof(block) / sizeof(block[0]);
+	int per_func = FUNC_BLOCKS * per_block + 1;
+	int nfuncs = instrs / per_func;
+	if ( nfuncs<1 ) nfuncs = 1;
+	if ( nfuncs>MAX_FUNCTIONS-1 ) nfuncs = MAX_FUNCTIONS-1;
+	int nstrings = 1000;
+	int func_bytes = FUNC_BLOCKS * (5+3+3+5+1+3+9+1+3+1) + 1;
+
+	for (int k = 0; k < nmodules; k++) {
+		int lo = k * nfuncs / nmodules;
+		int hi = (k+1) * nfuncs / nmodules;
+		FILE *f = fopen(module_file(k, "wasm"), "w");
+		fprintf(f, "%d strings\n", nstrings);
+		for (int i = 0; i < nstrings; i++) {
+			char s[40];
+			snprintf(s, sizeof(s), "string number %d", i);
+			fprintf(f, "%d: %d/%s\n", i, (int)strlen(s), s);
+		}
+		if ( k==0 ) {
+			// main's CALLs come first; it declares the functions other modules define
+			int base = 3 * nfuncs + 1;
+			fprintf(f, "%d functions\n", nfuncs+1);
+			for (int i = 0; i < nfuncs; i++) {
+				fprintf(f, "%d: addr=%d args=0 locals=2 type=0 %d/f%d\n", i,
+						i<hi ? base + i*func_bytes : -1, snprintf(NULL, 0, "f%d", i), i);
+			}
+			fprintf(f, "%d: addr=0 args=0 locals=0 type=0 4/main\n", nfuncs);
+			fprintf(f, "%d instr, %d bytes\n", nfuncs + 1 + hi*per_func, base + hi*func_bytes);
+			for (int i = 0; i < nfuncs; i++) fprintf(f, "CALL %d\n", i);
+			fprintf(f, "HALT\n");
+		}
+		else {
+			fprintf(f, "%d functions\n", hi-lo);
+			for (int i = lo; i < hi; i++) {
+				fprintf(f, "%d: addr=%d args=0 locals=2 type=0 %d/f%d\n", i-lo,
+						(i-lo)*func_bytes, snprintf(NULL, 0, "f%d", i), i);
+			}
+			fprintf(f, "%d instr, %d bytes\n", (hi-lo)*per_func, (hi-lo)*func_bytes);
+		}
+		for (int i = lo; i < hi; i++) {
+			for (int b = 0; b < FUNC_BLOCKS; b++) {
+				for (int j = 0; j < per_block; j++) {
+					fprintf(f, block[j], (i*FUNC_BLOCKS + b) % nstrings);
+					fprintf(f, "\n");
+				}
+			}
+			fprintf(f, "RET\n");
+		}
+		fclose(f);
+	}
+}
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static VM *link_modules(int nmodules, char *suffix)
+{
+	FILE *files[nmodules];
+	for (int k = 0; k < nmodules; k++) files[k] = fopen(module_file(k, suffix), "r");
+	return vm_link(files, nmodules);
+}
+
+static double time_load(int nmodules, char *suffix, int runs)
+{
+	double start = now();
+	for (int i = 0; i < runs; i++) {
+		VM *vm = suffix!=NULL ? link_modules(nmodules, suffix) : vm_snapshot_load("/tmp/wloadbench.img");
+		vm_free(vm);
+	}
+	return (now() - start) * 1000 / runs;
+}
+
+int main(int argc, char *argv[])
+{
+	int instrs = 200000;
+	int nmodules = 1;
+	int runs = 10;
+	for (int i = 1; i < argc; i++) {
+		if ( strcmp(argv[i], "-n")==0 && i+1<argc ) instrs = atoi(argv[++i]);
+		else if ( strcmp(argv[i], "-m")==0 && i+1<argc ) nmodules = atoi(argv[++i]);
+		else if ( strcmp(argv[i], "-r")==0 && i+1<argc ) runs = atoi(argv[++i]);
+	}
+	if ( nmodules<1 ) nmodules = 1;
+	generate(instrs, nmodules);
+	for (int k = 0; k < nmodules; k++) {
+		FILE *in = fopen(module_file(k, "wasm"), "r");
+		FILE *out = fopen(module_file(k, "wbc"), "w");
+		vm_assemble(in, out);
+		fclose(out);
+	}
+	VM *vm = link_modules(nmodules, "wasm");
+	if ( vm==NULL ) return 1;
+	FILE *f = fopen("/tmp/wloadbench.img", "w");
+	vm_snapshot_write(vm, f);
+	fclose(f);
+	printf("%d instructions, %d functions, %d strings, %d modules\n",
+		   vm->num_instrs, vm->num_functions, vm->num_strings, nmodules);
+	vm_free(vm);
+
+	printf("%-8s %10s\n", "format", "ms/load");
+	printf("%-8s %10.3f\n", ".wasm", time_load(nmodules, "wasm", runs));
+	printf("%-8s %10.3f\n", ".wbc", time_load(nmodules, "wbc", runs));
+	printf("%-8s %10.3f\n", "image", time_load(nmodules, NULL, runs));
+	return 0;
+}
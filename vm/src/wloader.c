@@ -22,13 +22,51 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <wich.h>
 #include "vm.h"
 #include "wloader.h"
 
+// a function as an object file declares it
+typedef struct {
+	char *name;
+	addr32 address;		// into the module's code or EXTERN_FUNCTION
+	int nargs;
+	int nlocals;
+	int type;
+} Module_function;
+
+// an object file that has been read but not linked into a VM yet
+typedef struct {
+	int nstrings;
+	char **strings;
+	int nfuncs;
+	Module_function *funcs;
+	byte *code;			// code_size bytes followed by HALT
+	int code_size;
+	int *fmap;			// index of each of funcs in the VM it's linked into
+	bool mapped;		// strings, names and code point into a mapped .wbc file
+	void *map;			// that mapping until a VM takes it over
+	size_t map_size;
+} Module;
+
 static void vm_write16(byte *data, unsigned int n);
 static void vm_write32(byte *data, unsigned int n);
 static void vm_write64(byte *data, char *a);
+static unsigned int vm_read16(const byte *data);
+static unsigned int vm_read32(const byte *data);
+static bool read_module(FILE *f, Module *m);
+static bool read_text(FILE *f, Module *m);
+static bool read_binary(FILE *f, Module *m);
+static bool check_code(const Module *m);
+static bool write_module(Module *m, FILE *f);
+static void free_module(Module *m);
+static VM *link_modules(Module *modules, int n);
+
+static const char WBC_MAGIC[4] = {'W', 'B', 'C', '\0'};
+static const int WBC_VERSION = 1;
+static const int WBC_HEADER_SIZE = 32;
+
 /*
 Create a VM from a Wich object/asm file, .wasm; files look like:
 
@@ -44,48 +82,123 @@ Create a VM from a Wich object/asm file, .wasm; files look like:
 	ICONST 0
 	OR
     ...
+
+A function with addr=-1 is one the module calls but another module
+defines; see vm_link().
+
+Binary object files, .wbc, hold the same thing in a form that needs no
+parsing. Numbers are little-endian:
+
+	header      "WBC" 0, u16 version, u16 0, u32 nstrings, u32 nfuncs, u32 code_size,
+	            u32 strings, u32 functions, u32 code (section offsets in the file)
+	strings     per string: u32 length, chars, 0
+	functions   per function: u32 addr (0xFFFFFFFF if defined elsewhere), u16 args,
+	            u16 locals, u16 type, u16 name length, name chars, 0
+	code        code_size bytes of byte code followed by HALT
+
+vm_load() takes either format and closes f.
  */
 VM *vm_load(FILE *f)
 {
-    VM *vm = vm_alloc();
+	return vm_link(&f, 1);
+}
 
-    int nstrings;
+/* Load n modules, each in either object file format, into one VM and
+ * close the files. Every function must be defined by exactly one module
+ * and declared with the same args and type by any that call it. Functions
+ * are looked up by name in a hash table once per declaration and CALL
+ * operands are patched to index the VM's function table directly, so
+ * calls across modules cost what calls within one do. A single module
+ * that needs no patching runs where it lies, like vm_load() always did.
+ */
+VM *vm_link(FILE *files[], int n)
+{
+	Module *modules = calloc((size_t)n, sizeof(Module));
+	bool ok = true;
+	for (int i = 0; i < n; i++) {
+		ok = read_module(files[i], &modules[i]) && ok; // read all, so that all get closed
+	}
+	VM *vm = ok ? link_modules(modules, n) : NULL;
+	for (int i = 0; i < n; i++) free_module(&modules[i]);
+	free(modules);
+	return vm;
+}
+
+/* Assemble an object file into a binary one without linking it, so
+ * modules that call others can be assembled too. Closes in.
+ */
+bool vm_assemble(FILE *in, FILE *out)
+{
+	Module m;
+	if ( !read_module(in, &m) ) return false;
+	bool ok = write_module(&m, out);
+	free_module(&m);
+	return ok;
+}
+
+static bool read_module(FILE *f, Module *m)
+{
+	*m = (Module){0};
+	char magic[sizeof(WBC_MAGIC)];
+	if ( fread(magic, 1, sizeof(magic), f)==sizeof(magic) && memcmp(magic, WBC_MAGIC, sizeof(magic))==0 ) {
+		return read_binary(f, m) && check_code(m);
+	}
+	rewind(f);
+	return read_text(f, m);
+}
+
+static bool read_text(FILE *f, Module *m)
+{
+    // hash the instruction names once per file rather than scan them once per instruction
+    Symtab opcodes;
+    symtab_init(&opcodes, NUM_INSTRS);
+    for (int i = 0; i < NUM_INSTRS; i++) symtab_put(&opcodes, vm_instructions[i].name, i);
+
+    int nstrings = 0;
     fscanf(f, "%d strings\n", &nstrings);
-    vm->strings = (char **)calloc((size_t)nstrings, sizeof(char *));
+    m->strings = calloc((size_t)nstrings, sizeof(char *));
+    m->nstrings = nstrings;
     for (int i=0; i<nstrings; i++) {
         int index, name_size;
         fscanf(f, "%d: %d/", &index, &name_size);
         char *str = calloc((size_t)name_size+1, sizeof(char));
         fgets(str, name_size+1, f);
-        vm->strings[index] = str;
+        if ( index>=0 && index<nstrings && m->strings[index]==NULL ) m->strings[index] = str;
+        else free(str);
+    }
+    for (int i=0; i<nstrings; i++) {
+        if ( m->strings[i]==NULL ) m->strings[i] = strdup("");
     }
-    vm->num_strings = nstrings;
 
-    int nfuncs;
+    int nfuncs = 0;
     fscanf(f, "%d functions\n", &nfuncs);
-    for (int i=1; i<=nfuncs; i++) {
+    m->funcs = calloc((size_t)nfuncs, sizeof(Module_function));
+    m->nfuncs = nfuncs;
+    for (int i=0; i<nfuncs; i++) {
         int index, args, locals, type, name_size;
         addr32 addr;
         fscanf(f, "%d: addr=%d args=%d locals=%d type=%d %d/",
                 &index, &addr, &args, &locals, &type, &name_size);
-        char name[name_size+1];
+        char *name = calloc((size_t)name_size+1, sizeof(char));
         fgets(name, name_size+1, f);
-        def_function(vm, name, type, addr, args, locals);
+        m->funcs[i] = (Module_function){name, addr, args, locals, type};
     }
 
-    int ninstr, nbytes;
+    int ninstr = 0, nbytes = 0;
     element e;
     fscanf(f, "%d instr, %d bytes\n", &ninstr, &nbytes);
-    byte *code = calloc((size_t)nbytes, sizeof(byte));
+    byte *code = calloc((size_t)nbytes+1, sizeof(byte)); // ends with HALT
+    m->code = code;
+    m->code_size = nbytes;
     addr32 ip = 0;
+    bool ok = true;
     for (int i=1; i<=ninstr; i++) {
         char instr[80+1];
         fgets(instr, 80+1, f);
-        float fvalue;
-        int n = sscanf(instr, "\tFCONST %f", &fvalue);
+        double fvalue;
+        int n = sscanf(instr, "\tFCONST %lf", &fvalue);
         if ( n==1 ) {
-            VM_INSTRUCTION *I = vm_instr("FCONST");
-            code[ip] = I->opcode;
+            code[ip] = FCONST;
             ip++;
             e.f = fvalue;
             vm_write64(&code[ip], e.ba);
@@ -96,7 +209,13 @@ VM *vm_load(FILE *f)
         char name[80];
         int ivalue;
         n = sscanf(instr, "%s %d", name, &ivalue);
-        VM_INSTRUCTION *I = vm_instr(name);
+        int opcode = n>=1 ? symtab_get(&opcodes, name) : -1;
+        if ( opcode<0 ) {
+            fprintf(stderr, "unknown instruction %s", instr);
+            ok = false;
+            break;
+        }
+        VM_INSTRUCTION *I = &vm_instructions[opcode];
         code[ip] = I->opcode;
         ip++;
         if ( n==2 ) {
@@ -111,9 +230,294 @@ VM *vm_load(FILE *f)
         else if ( n==1 ) {
         }
     }
+    symtab_free(&opcodes);
     fclose(f);
-    vm_init(vm, code, nbytes);
-    return vm;
+    return ok;
+}
+
+/* Does a table entry of header bytes, a len byte name and its NUL end by end? */
+static bool entry_fits(const byte *s, size_t header, size_t len, const byte *end)
+{
+	size_t left = (size_t)(end - s);
+	return header<=left && len<left - header && s[header+len]=='\0';
+}
+
+/* Map the object file; strings, names and code stay where they lie in it.
+ * Lengths come from the file, so every entry is checked against the mapping.
+ */
+static bool read_binary(FILE *f, Module *m)
+{
+	struct stat st;
+	fstat(fileno(f), &st);
+	size_t size = (size_t)st.st_size;
+	byte *p = size>=(size_t)WBC_HEADER_SIZE ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(f), 0) : MAP_FAILED;
+	fclose(f);
+	if ( p==MAP_FAILED ) {
+		fprintf(stderr, "can't map object file\n");
+		return false;
+	}
+	m->mapped = true;
+	m->map = p;
+	m->map_size = size;
+	unsigned int version = vm_read16(&p[4]);
+	unsigned int nstrings = vm_read32(&p[8]);
+	unsigned int nfuncs = vm_read32(&p[12]);
+	unsigned int code_size = vm_read32(&p[16]);
+	unsigned int strings = vm_read32(&p[20]);
+	unsigned int functions = vm_read32(&p[24]);
+	unsigned int code = vm_read32(&p[28]);
+	if ( version!=WBC_VERSION || strings>size || functions>size || nstrings>size || nfuncs>size || (size_t)code+code_size>=size || p[code+code_size]!=HALT ) {
+		fprintf(stderr, "unsupported or damaged object file; version %d\n", version);
+		return false;
+	}
+
+	const byte *s = &p[strings], *end = &p[size];
+	m->strings = calloc((size_t)nstrings, sizeof(char *));
+	m->nstrings = nstrings;
+	for (unsigned int i = 0; i < nstrings; i++) {
+		unsigned int len = end - s>=4 ? vm_read32(s) : 0;
+		if ( !entry_fits(s, 4, len, end) ) {
+			fprintf(stderr, "damaged object file; string %d runs past the end\n", i);
+			return false;
+		}
+		m->strings[i] = (char *)&s[4];
+		s += 4 + len + 1;
+	}
+
+	s = &p[functions];
+	m->funcs = calloc((size_t)nfuncs, sizeof(Module_function));
+	m->nfuncs = nfuncs;
+	for (unsigned int i = 0; i < nfuncs; i++) {
+		unsigned int len = end - s>=12 ? vm_read16(&s[10]) : 0;
+		if ( !entry_fits(s, 12, len, end) ) {
+			fprintf(stderr, "damaged object file; function %d runs past the end\n", i);
+			return false;
+		}
+		m->funcs[i] = (Module_function){(char *)&s[12], vm_read32(s), vm_read16(&s[4]), vm_read16(&s[6]), vm_read16(&s[8])};
+		s += 12 + len + 1;
+	}
+
+	m->code = &p[code];
+	m->code_size = code_size;
+	return true;
+}
+
+/* Decoding runs before, and without, the verifier, so every opcode in an
+ * object file must be known, every operand must lie within the code and
+ * every function and string it names must be in the module. Text has only
+ * known opcodes and whole operands by construction.
+ */
+static bool check_code(const Module *m)
+{
+	const byte *code = m->code;
+	for (int ip = 0; ip < m->code_size; ip += 1 + vm_instructions[code[ip]].opnd_size) {
+		if ( code[ip]>=NUM_INSTRS ) {
+			fprintf(stderr, "damaged object file; invalid opcode %d at %d\n", code[ip], ip);
+			return false;
+		}
+		if ( ip + 1 + vm_instructions[code[ip]].opnd_size > m->code_size ) {
+			fprintf(stderr, "damaged object file; %s at %d runs past the end\n", vm_instructions[code[ip]].name, ip);
+			return false;
+		}
+		if ( code[ip]==CALL && vm_read16(&code[ip+1])>=(unsigned int)m->nfuncs ) {
+			fprintf(stderr, "damaged object file; no function %d at %d\n", vm_read16(&code[ip+1]), ip);
+			return false;
+		}
+		if ( code[ip]==SCONST && vm_read16(&code[ip+1])>=(unsigned int)m->nstrings ) {
+			fprintf(stderr, "damaged object file; no string %d at %d\n", vm_read16(&code[ip+1]), ip);
+			return false;
+		}
+	}
+	return true;
+}
+
+static void free_module(Module *m)
+{
+	if ( !m->mapped ) {
+		for (int i = 0; i < m->nstrings; i++) free(m->strings[i]);
+		for (int i = 0; i < m->nfuncs; i++) free(m->funcs[i].name);
+		free(m->code);
+	}
+	if ( m->map!=NULL ) munmap(m->map, m->map_size);
+	free(m->strings);
+	free(m->funcs);
+	free(m->fmap);
+}
+
+/* Point CALL operands at the VM's function table and SCONST operands
+ * at its constant pool. Branch offsets are relative and need nothing.
+ */
+static void relocate(byte *code, Module *m, int string_base)
+{
+	for (int ip = 0; ip < m->code_size; ip += 1 + vm_instructions[code[ip]].opnd_size) {
+		if ( code[ip]==CALL ) {
+			unsigned int i = vm_read16(&code[ip+1]);
+			if ( i<(unsigned int)m->nfuncs ) vm_write16(&code[ip+1], m->fmap[i]);
+		}
+		else if ( code[ip]==SCONST ) vm_write16(&code[ip+1], vm_read16(&code[ip+1]) + string_base);
+	}
+}
+
+/* Enter mf, from the module whose code starts at code_base, into the
+ * VM's function table, or match it against the function of that name
+ * already there. Returns the index or -1.
+ */
+static int link_function(VM *vm, Module_function *mf, int code_base)
+{
+	bool defined = mf->address!=EXTERN_FUNCTION;
+	addr32 address = defined ? code_base + mf->address : EXTERN_FUNCTION;
+	int k = vm_function_index(vm, mf->name);
+	if ( k<0 ) return def_function(vm, mf->name, mf->type, address, mf->nargs, mf->nlocals);
+
+	Function_metadata *f = &vm->functions[k];
+	if ( defined && f->address!=EXTERN_FUNCTION ) {
+		fprintf(stderr, "function %s is defined more than once\n", mf->name);
+		return -1;
+	}
+	if ( f->nargs!=mf->nargs || f->return_type!=mf->type ) {
+		fprintf(stderr, "function %s is declared with different args or type\n", mf->name);
+		return -1;
+	}
+	if ( defined ) {
+		f->address = address;
+		f->nlocals = mf->nlocals;
+	}
+	return k;
+}
+
+static VM *link_modules(Module *modules, int n)
+{
+	VM *vm = vm_alloc();
+	int nfuncs = 0;
+	for (int i = 0; i < n; i++) nfuncs += modules[i].nfuncs;
+	symtab_init(&vm->function_index, nfuncs);
+
+	bool ok = true;
+	bool in_place = n==1; // code needs no relocation
+	int code_size = 0;
+	for (int i = 0; i < n && ok; i++) {
+		Module *m = &modules[i];
+		for (int s = 0; s < m->nstrings && ok; s++) ok = def_string(vm, m->strings[s])>=0;
+		m->fmap = malloc((size_t)m->nfuncs * sizeof(int));
+		for (int j = 0; j < m->nfuncs && ok; j++) {
+			m->fmap[j] = link_function(vm, &m->funcs[j], code_size);
+			ok = m->fmap[j]>=0;
+			if ( m->fmap[j]!=j ) in_place = false;
+		}
+		code_size += m->code_size;
+	}
+	for (int i = 0; i < vm->num_functions && ok; i++) {
+		if ( vm->functions[i].address==EXTERN_FUNCTION ) {
+			fprintf(stderr, "function %s is not defined\n", vm->functions[i].name);
+			ok = false;
+		}
+	}
+	if ( !ok ) {
+		for (int i = 0; i < vm->num_functions; i++) free(vm->functions[i].name);
+		free(vm->functions);
+		symtab_free(&vm->function_index);
+		free(vm->strings);
+		free(vm);
+		return NULL;
+	}
+
+	if ( in_place ) {
+		Module *m = &modules[0];
+		vm->image = m->map; // vm owns the mapping or the code now
+		vm->image_size = m->map_size;
+		vm_init_code(vm, m->code, m->code_size);
+		m->map = NULL;
+		if ( !m->mapped ) m->code = NULL;
+		return vm;
+	}
+	byte *code = calloc((size_t)code_size+1, sizeof(byte)); // ends with HALT
+	int ip = 0;
+	int string_base = 0;
+	for (int i = 0; i < n; i++) {
+		Module *m = &modules[i];
+		memcpy(&code[ip], m->code, (size_t)m->code_size);
+		relocate(&code[ip], m, string_base);
+		ip += m->code_size;
+		string_base += m->nstrings;
+	}
+	vm_init_code(vm, code, code_size);
+	return vm;
+}
+
+/* Write the module vm was loaded from, or the modules it linked, as one
+ * binary object file.
+ */
+bool vm_write_binary(VM *vm, FILE *f)
+{
+	Module m = {
+		.nstrings = vm->num_strings,
+		.strings = malloc((size_t)vm->num_strings * sizeof(char *)),
+		.nfuncs = vm->num_functions,
+		.funcs = malloc((size_t)vm->num_functions * sizeof(Module_function)),
+		.code = vm->code,
+		.code_size = vm->code_size
+	};
+	for (int i = 0; i < vm->num_strings; i++) m.strings[i] = vm->strings[i]->str;
+	for (int i = 0; i < vm->num_functions; i++) {
+		Function_metadata *func = &vm->functions[i];
+		m.funcs[i] = (Module_function){func->name, func->address, func->nargs, func->nlocals, func->return_type};
+	}
+	bool ok = write_module(&m, f);
+	free(m.strings);
+	free(m.funcs);
+	return ok;
+}
+
+static bool write_module(Module *m, FILE *f)
+{
+	unsigned int strings = WBC_HEADER_SIZE;
+	unsigned int functions = strings;
+	for (int i = 0; i < m->nstrings; i++) functions += 4 + strlen(m->strings[i]) + 1;
+	unsigned int code = functions;
+	for (int i = 0; i < m->nfuncs; i++) code += 12 + strlen(m->funcs[i].name) + 1;
+
+	byte header[WBC_HEADER_SIZE];
+	memcpy(header, WBC_MAGIC, sizeof(WBC_MAGIC));
+	vm_write16(&header[4], WBC_VERSION);
+	vm_write16(&header[6], 0);
+	vm_write32(&header[8], m->nstrings);
+	vm_write32(&header[12], m->nfuncs);
+	vm_write32(&header[16], m->code_size);
+	vm_write32(&header[20], strings);
+	vm_write32(&header[24], functions);
+	vm_write32(&header[28], code);
+	fwrite(header, 1, sizeof(header), f);
+
+	byte n[12];
+	for (int i = 0; i < m->nstrings; i++) {
+		size_t len = strlen(m->strings[i]);
+		vm_write32(n, len);
+		fwrite(n, 1, 4, f);
+		fwrite(m->strings[i], 1, len + 1, f);
+	}
+	for (int i = 0; i < m->nfuncs; i++) {
+		Module_function *func = &m->funcs[i];
+		size_t len = strlen(func->name);
+		vm_write32(&n[0], func->address);
+		vm_write16(&n[4], func->nargs);
+		vm_write16(&n[6], func->nlocals);
+		vm_write16(&n[8], func->type);
+		vm_write16(&n[10], len);
+		fwrite(n, 1, sizeof(n), f);
+		fwrite(func->name, 1, len + 1, f);
+	}
+	fwrite(m->code, 1, (size_t)m->code_size + 1, f); // includes the trailing HALT
+	return !ferror(f);
+}
+
+static unsigned int vm_read32(const byte *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((unsigned int)data[3] << 24);
+}
+
+static unsigned int vm_read16(const byte *data)
+{
+	return data[0] | (data[1] << 8);
 }
 
 static void vm_write32(byte *data, unsigned int n)
@@ -153,12 +557,8 @@ VM_INSTRUCTION *vm_instr(char *name) {
 }
 
 Function_metadata *vm_function(VM *vm, char *name) {
-    for (int i = 0; i < vm->num_functions; ++i) {
-        if ( strcmp(name, vm->functions[i].name)==0 ) {
-            return &vm->functions[i];
-        }
-    }
-    return NULL;
+    int i = vm_function_index(vm, name);
+    return i>=0 ? &vm->functions[i] : NULL;
 }
 
 void save_string(char *filename, char *s) {
@@ -170,3 +570,10 @@ void save_string(char *filename, char *s) {
 	fputs(s, f);
 	fclose(f);
 }
+
+/* Load program text by way of a scratch file, as the tests do */
+VM *vm_load_string(char *code) {
+	save_string("/tmp/t.wasm", code);
+	FILE *f = fopen("/tmp/t.wasm", "r");
+	return f!=NULL ? vm_load(f) : NULL; // closes f
+}
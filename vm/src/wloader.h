@@ -27,7 +27,11 @@ SOFTWARE.
 #include "vm.h"
 
 extern VM *vm_load(FILE *f);
+extern VM *vm_link(FILE *files[], int n);
+extern bool vm_write_binary(VM *vm, FILE *f);
+extern bool vm_assemble(FILE *in, FILE *out);
 extern BYTECODE vm_opcode(char *name);
 extern VM_INSTRUCTION *vm_instr(char *name);
 extern Function_metadata *vm_function(VM *vm, char *name);
 extern void save_string(char *filename, char *s);
+extern VM *vm_load_string(char *code);
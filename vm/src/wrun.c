@@ -22,16 +22,221 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <wich.h>
 #include "vm.h"
 #include "wloader.h"
+#include "regvm.h"
+#include "jit.h"
+#include "superblock.h"
+#include "profiler.h"
+#include "opstats.h"
+#include "snapshot.h"
+#include "aot.h"
+
+/*
+	wrun [-r] [-j[threshold]] [-k] [-b[threshold]] [-s] [-t[option,...]] [-p[file]] [-c[file]] [-w[file] [-ifunc]] [-a[file]] [-lfile] file.wasm|file.wbc|image [module.wasm|module.wbc ...]
+
+Several object files are linked into one program whose main can call
+functions any of them defines; see vm_link().
+
+	-r	run functions on the register tier when they can be translated
+	-j	JIT compile functions called more than threshold times (default
+		JIT_THRESHOLD); -j0 compiles everything on first call
+	-k	interpret verified code with the loop that keeps the top of the
+		operand stack in a register
+	-b	record loops that branch back more than threshold times (default
+		HOT_LOOP_THRESHOLD) and run them as superblocks; takes precedence
+		over -k
+	-s	print run statistics to stderr at exit
+	-t	trace each instruction and the stack it leaves to stderr. Options:
+		func=name traces only instructions of function name, from=addr and
+		to=addr only those at code addresses from..to-1, heap shows strings
+		and vectors on the stack instead of their addresses
+	-p	sample the program PROFILE_HZ times per CPU second; write the call
+		stacks in folded format to file (default wich.folded) and a per
+		function and per instruction summary to stderr at exit
+	-c	count executions per opcode, per pair of opcodes and per BRF direction
+		plus cycles per opcode and write them as CSV to file (default
+		wich-opcodes.csv), adding to the counts already there so a corpus can
+		be run one program at a time. Everything runs on the interpreter; -r,
+		-j and -l are ignored. Needs a VM built with VM_OPCODE_STATS
+	-w	write a snapshot image of the loaded program to file (default
+		wich.img) instead of running it. A file that starts like an image
+		is run from the image rather than loaded as a .wasm
+	-i	with -w, run func, which takes no arguments, before writing the image
+	-a	compile the program ahead of time to C and from that to a shared
+		object file (default wich.so) instead of running it
+	-l	run with the functions compiled into shared object file by -a
+		from the same program
+ */
+// options is a comma separated list like "func=fib,to=40,heap"; modifies options
+static bool parse_trace_options(char *options, Trace_options *t)
+{
+    for (char *o = strtok(options, ","); o!=NULL; o = strtok(NULL, ",")) {
+        if ( strncmp(o, "func=", 5)==0 ) t->function = &o[5];
+        else if ( strncmp(o, "from=", 5)==0 ) t->from = atoi(&o[5]);
+        else if ( strncmp(o, "to=", 3)==0 ) t->to = atoi(&o[3]);
+        else if ( strcmp(o, "heap")==0 ) t->heap = true;
+        else return false;
+    }
+    return true;
+}
+
+// load an image or link the object files in filenames[0..n-1]
+static VM *load(char *filenames[], int n)
+{
+    if ( n==1 && vm_is_snapshot(filenames[0]) ) return vm_snapshot_load(filenames[0]);
+    FILE *files[n];
+    for (int i = 0; i < n; i++) {
+        files[i] = fopen(filenames[i], "r");
+        if ( files[i]==NULL ) {
+            fprintf(stderr, "can't open %s\n", filenames[i]);
+            while ( --i>=0 ) fclose(files[i]);
+            return NULL;
+        }
+    }
+    return vm_link(files, n);
+}
+
+static int write_image(char *filenames[], int n, char *image, char *init)
+{
+    VM *vm = load(filenames, n);
+    if ( vm==NULL ) return 1;
+    if ( init!=NULL ) {
+        Function_metadata *func = vm_function(vm, init);
+        if ( func==NULL || func->nargs!=0 ) {
+            fprintf(stderr, "wrun: no function %s without arguments\n", init);
+            return 1;
+        }
+        vm_snapshot_init(vm, func);
+    }
+    FILE *out = fopen(image, "w");
+    if ( out==NULL || !vm_snapshot_write(vm, out) ) {
+        fprintf(stderr, "can't write %s\n", image);
+        return 1;
+    }
+    fclose(out);
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
-    FILE *f = fopen(argv[1], "r");
-    if ( f!=NULL ) {
-        VM *vm = vm_load(f);
-        vm_exec(vm, false);
+    bool registers = false;
+    bool jit = false;
+    bool cache_tos = false;
+    bool superblocks = false;
+    bool stats = false;
+    bool trace = false;
+    Trace_options trace_options = {NULL, 0, 0, false};
+    int jit_threshold = JIT_THRESHOLD;
+    int hot_loop_threshold = HOT_LOOP_THRESHOLD;
+    char *profile = NULL;
+    char *counts = NULL;
+    char *image = NULL;
+    char *init = NULL;
+    char *aot = NULL;
+    char *natives = NULL;
+    char *filenames[argc];
+    int nfiles = 0;
+    for (int i = 1; i < argc; i++) {
+        if ( strcmp(argv[i], "-r")==0 ) registers = true;
+        else if ( strcmp(argv[i], "-k")==0 ) cache_tos = true;
+        else if ( strcmp(argv[i], "-s")==0 ) stats = true;
+        else if ( strncmp(argv[i], "-j", 2)==0 ) {
+            jit = true;
+            if ( argv[i][2]!='\0' ) jit_threshold = atoi(&argv[i][2]);
+        }
+        else if ( strncmp(argv[i], "-b", 2)==0 ) {
+            superblocks = true;
+            if ( argv[i][2]!='\0' ) hot_loop_threshold = atoi(&argv[i][2]);
+        }
+        else if ( strncmp(argv[i], "-t", 2)==0 ) {
+            trace = true;
+            if ( !parse_trace_options(&argv[i][2], &trace_options) ) {
+                fprintf(stderr, "wrun: bad trace option in %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if ( strncmp(argv[i], "-p", 2)==0 ) {
+            profile = argv[i][2]!='\0' ? &argv[i][2] : "wich.folded";
+        }
+        else if ( strncmp(argv[i], "-c", 2)==0 ) {
+            counts = argv[i][2]!='\0' ? &argv[i][2] : "wich-opcodes.csv";
+        }
+        else if ( strncmp(argv[i], "-w", 2)==0 ) {
+            image = argv[i][2]!='\0' ? &argv[i][2] : "wich.img";
+        }
+        else if ( strncmp(argv[i], "-i", 2)==0 && argv[i][2]!='\0' ) init = &argv[i][2];
+        else if ( strncmp(argv[i], "-a", 2)==0 ) {
+            aot = argv[i][2]!='\0' ? &argv[i][2] : "wich.so";
+        }
+        else if ( strncmp(argv[i], "-l", 2)==0 && argv[i][2]!='\0' ) natives = &argv[i][2];
+        else filenames[nfiles++] = argv[i];
+    }
+    if ( nfiles==0 ) {
+        fprintf(stderr, "usage: wrun [-r] [-j[threshold]] [-k] [-b[threshold]] [-s] [-t[option,...]] [-p[file]] [-c[file]] [-w[file] [-ifunc]] [-a[file]] [-lfile] file.wasm|file.wbc|image [module ...]\n");
+        return 1;
+    }
+#ifndef VM_OPCODE_STATS
+    if ( counts!=NULL ) {
+        fprintf(stderr, "wrun: -c needs a VM built with VM_OPCODE_STATS\n");
+        return 1;
+    }
+#endif
+    if ( image!=NULL ) return write_image(filenames, nfiles, image, init);
+    VM *vm = load(filenames, nfiles);
+    if ( vm==NULL ) return 1;
+    if ( aot!=NULL ) return aot_compile(vm, aot) ? 0 : 1;
+    Opcode_stats *opcodes = NULL;
+    if ( counts!=NULL ) {
+        opcodes = vm_stats_alloc();
+        FILE *old = fopen(counts, "r");
+        if ( old!=NULL ) {
+            bool ok = vm_stats_merge_csv(opcodes, old);
+            fclose(old);
+            if ( !ok ) {
+                fprintf(stderr, "wrun: %s isn't an opcode count file\n", counts);
+                return 1;
+            }
+        }
+        opcodes->runs++;
+        vm->stats = opcodes;
+        registers = jit = false;
+        natives = NULL;
+    }
+    if ( natives!=NULL && !aot_load(vm, natives) ) return 1;
+    if ( registers ) reg_translate(vm);
+    vm->jit = jit;
+    vm->cache_tos = cache_tos;
+    vm->superblocks = superblocks;
+    vm->hot_loop_threshold = hot_loop_threshold;
+    vm->jit_threshold = jit_threshold;
+    if ( profile!=NULL ) vm_profile_start(vm, PROFILE_HZ);
+    vm->trace = trace_options;
+    vm_exec(vm, trace);
+    if ( profile!=NULL ) {
+        vm_profile_stop(vm);
+        FILE *out = fopen(profile, "w");
+        if ( out!=NULL ) {
+            vm_profile_write_folded(vm, out);
+            fclose(out);
+        }
+        else fprintf(stderr, "can't write %s\n", profile);
+        vm_profile_write_summary(vm, stderr);
+    }
+    if ( counts!=NULL ) {
+        FILE *out = fopen(counts, "w");
+        if ( out!=NULL ) {
+            vm_stats_write_csv(opcodes, out);
+            fclose(out);
+        }
+        else fprintf(stderr, "can't write %s\n", counts);
+    }
+    if ( stats ) fprintf(stderr, "quickened %d instructions\n", vm->quickened);
+    if ( stats && vm->hot_loops!=NULL ) {
+        fprintf(stderr, "compiled %d superblocks, %ld side exits\n", vm->hot_loops->compiled, vm->hot_loops->side_exits);
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,101 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <wich.h>
+#include "vm.h"
+#include "wloader.h"
+
+/*
+Measure how interpreter throughput scales with the number of threads.
+
+	wscale [-t max_threads] [-n runs] file.wasm
+
+For 1, 2, 4, ... max_threads threads, each thread loads and runs the program
+runs times in a VM of its own, which has its own heap. Program output goes to
+/dev/null; per-thread-count throughput goes to stderr. Since VMs share no
+mutable state, runs/sec should grow with threads up to the number of cores.
+Output still takes stdout's lock so pick programs that compute more than they
+print.
+*/
+
+static char *filename;
+static int runs = 20;
+
+static void *run(void *arg)
+{
+	for (int i = 0; i < runs; i++) {
+		FILE *f = fopen(filename, "r");
+		VM *vm = vm_load(f);
+		vm_exec(vm, false);
+		vm_free(vm);
+	}
+	return NULL;
+}
+
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+	int max_threads = 8;
+	for (int i = 1; i < argc; i++) {
+		if ( strcmp(argv[i], "-t")==0 && i+1<argc ) max_threads = atoi(argv[++i]);
+		else if ( strcmp(argv[i], "-n")==0 && i+1<argc ) runs = atoi(argv[++i]);
+		else filename = argv[i];
+	}
+	if ( filename==NULL ) {
+		fprintf(stderr, "usage: wscale [-t max_threads] [-n runs] file.wasm\n");
+		return 1;
+	}
+	FILE *f = fopen(filename, "r");
+	if ( f==NULL ) {
+		fprintf(stderr, "can't open %s\n", filename);
+		return 1;
+	}
+	fclose(f);
+	freopen("/dev/null", "w", stdout);
+
+	pthread_t *threads = calloc((size_t)max_threads, sizeof(pthread_t));
+	double base = 0;
+	fprintf(stderr, "%7s %10s %10s %8s\n", "threads", "seconds", "runs/sec", "speedup");
+	for (int n = 1; n <= max_threads; n *= 2) {
+		double start = now();
+		for (int i = 0; i < n; i++) pthread_create(&threads[i], NULL, run, NULL);
+		for (int i = 0; i < n; i++) pthread_join(threads[i], NULL);
+		double elapsed = now() - start;
+		double rate = n * runs / elapsed;
+		if ( n==1 ) base = rate;
+		fprintf(stderr, "%7d %10.3f %10.1f %7.2fx\n", n, elapsed, rate, rate / base);
+	}
+	free(threads);
+	return 0;
+}
@@ -0,0 +1,180 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <wich.h>
+#include "vm.h"
+#include "wloader.h"
+#include "superinstructions.h"
+
+/*
+Propose superinstructions for the VM from opcode sequence frequencies.
+
+	wsuper [-n count] file.wasm|dir ...
+
+Counts every sequence of 2..MAX_SUPER_LENGTH instructions over all .wasm
+files given (directories are scanned for .wasm files) and prints the most
+frequent ones, marking those already covered by vm_superinstructions[].
+Sequences that could be fused but aren't yet are printed as table entries
+ready to paste into superinstructions.c.
+*/
+
+typedef struct {
+	BYTECODE ops[4];
+	int length;
+	long count;
+} Sequence;
+
+static Sequence *seqs = NULL;
+static int num_seqs = 0;
+static int max_seqs = 0;
+
+static void count(BYTECODE *ops, int length)
+{
+	for (int i = 0; i < num_seqs; i++) {
+		if ( seqs[i].length==length && memcmp(seqs[i].ops, ops, length*sizeof(BYTECODE))==0 ) {
+			seqs[i].count++;
+			return;
+		}
+	}
+	if ( num_seqs==max_seqs ) {
+		max_seqs = max_seqs==0 ? 1000 : max_seqs*2;
+		seqs = realloc(seqs, max_seqs*sizeof(Sequence));
+	}
+	Sequence *s = &seqs[num_seqs++];
+	memcpy(s->ops, ops, length*sizeof(BYTECODE));
+	s->length = length;
+	s->count = 1;
+}
+
+/* Only straight-line sequences can be fused; a branch may end one. */
+static bool fusable(BYTECODE *ops, int length)
+{
+	for (int i = 0; i < length; i++) {
+		switch ( ops[i] ) {
+			case CALL: case RET: case HALT:
+				return false;
+			case BR: case BRF:
+				if ( i<length-1 ) return false;
+				break;
+			default:
+				break;
+		}
+	}
+	return true;
+}
+
+static bool covered(BYTECODE *ops, int length)
+{
+	for (int s = 0; s < NUM_SUPERINSTRS; s++) {
+		VM_SUPERINSTRUCTION *S = &vm_superinstructions[s];
+		if ( S->length==length && memcmp(S->pattern, ops, length*sizeof(BYTECODE))==0 ) return true;
+	}
+	return false;
+}
+
+static void count_file(char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	if ( f==NULL ) {
+		fprintf(stderr, "can't open %s\n", filename);
+		return;
+	}
+	VM *vm = vm_load(f);
+	for (int i = 0; i < vm->num_instrs; i++) {
+		BYTECODE ops[4];
+		for (int n = 0; n < MAX_SUPER_LENGTH && i+n < vm->num_instrs; n++) {
+			ops[n] = (BYTECODE)vm->instrs[i+n].opcode;
+			if ( n>0 ) count(ops, n+1);
+		}
+	}
+}
+
+static void count_dir(char *dirname)
+{
+	DIR *dir = opendir(dirname);
+	struct dirent *dp;
+	while ( (dp = readdir(dir))!=NULL ) {
+		if ( strstr(dp->d_name, ".wasm")!=NULL ) {
+			char filename[2000];
+			snprintf(filename, sizeof(filename), "%s/%s", dirname, dp->d_name);
+			count_file(filename);
+		}
+	}
+	closedir(dir);
+}
+
+static int by_count(const void *a, const void *b)
+{
+	long d = ((Sequence *)b)->count - ((Sequence *)a)->count;
+	return d<0 ? -1 : d>0;
+}
+
+int main(int argc, char *argv[])
+{
+	int top = 30;
+	for (int i = 1; i < argc; i++) {
+		if ( strcmp(argv[i], "-n")==0 && i+1<argc ) {
+			top = atoi(argv[++i]);
+			continue;
+		}
+		DIR *dir = opendir(argv[i]);
+		if ( dir!=NULL ) {
+			closedir(dir);
+			count_dir(argv[i]);
+		}
+		else {
+			count_file(argv[i]);
+		}
+	}
+
+	qsort(seqs, (size_t)num_seqs, sizeof(Sequence), by_count);
+
+	printf("%8s  %-40s %s\n", "count", "sequence", "fused");
+	for (int i = 0; i < num_seqs && i < top; i++) {
+		char name[200] = "";
+		for (int j = 0; j < seqs[i].length; j++) {
+			if ( j>0 ) strcat(name, " ");
+			strcat(name, vm_instructions[seqs[i].ops[j]].name);
+		}
+		printf("%8ld  %-40s %s\n", seqs[i].count, name,
+			   covered(seqs[i].ops, seqs[i].length) ? "yes" : fusable(seqs[i].ops, seqs[i].length) ? "" : "-");
+	}
+
+	printf("\nproposed:\n");
+	for (int i = 0; i < num_seqs && i < top; i++) {
+		if ( covered(seqs[i].ops, seqs[i].length) || !fusable(seqs[i].ops, seqs[i].length) ) continue;
+		char name[200] = "";
+		char pattern[200] = "";
+		for (int j = 0; j < seqs[i].length; j++) {
+			if ( j>0 ) { strcat(name, "_"); strcat(pattern, ", "); }
+			strcat(name, vm_instructions[seqs[i].ops[j]].name);
+			strcat(pattern, vm_instructions[seqs[i].ops[j]].name);
+		}
+		printf("\t\t{\"%s\", %s, %d, {%s}},\n", name, name, seqs[i].length, pattern);
+	}
+	return 0;
+}
@@ -0,0 +1,117 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef SAMPLES_H_
+#define SAMPLES_H_
+
+/* Differential testing of an execution tier against the interpreter, for
+ * the tests of the tiers: every sample in $WICHRUNTIME/vm/test/samples runs
+ * on the plain interpreter loop and again on a VM the tier has set up, and
+ * stdout must be the same. Include after cunit.h and wloader.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include "vm.h"
+
+static char samplesdir[2000];
+
+// point samplesdir into $WICHRUNTIME; false if that isn't set
+static bool find_samples() {
+	char *wichruntime = getenv("WICHRUNTIME");
+	if ( wichruntime==NULL ) {
+		fprintf(stderr, "environment variable WICHRUNTIME not set to root of runtime area\n");
+		return false;
+	}
+	strcpy(samplesdir, wichruntime);
+	strcat(samplesdir, "/vm/test/samples");
+	return true;
+}
+
+// run filename capturing stdout in output, on the VM as setup leaves it if not NULL; returns the VM
+static VM *run_captured(char *filename, void (*setup)(VM *vm), char *output) {
+	FILE *f = fopen(filename, "r");
+	VM *vm = vm_load(f); // closes f
+	if ( setup!=NULL ) setup(vm);
+
+	fflush(stdout);
+	int saved = dup(1);
+	int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	dup2(fd, 1);
+	close(fd);
+	vm_exec(vm, false);
+	fflush(stdout);
+	dup2(saved, 1);
+	close(saved);
+	return vm;
+}
+
+static char *read_file(char *filename) {
+	FILE *f = fopen(filename, "r");
+	fseek(f, 0, SEEK_END);
+	long n = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *buf = calloc((size_t)n+1, sizeof(char));
+	fread(buf, sizeof(char), (size_t)n, f);
+	fclose(f);
+	return buf;
+}
+
+/* Run every sample on the interpreter and on the VM as setup leaves it,
+ * then hand that VM to check, if not NULL, and compare stdout.
+ */
+static void samples_match(void (*setup)(VM *vm), void (*check)(VM *vm)) {
+	char samplesfile[2000];
+	int nsamples = 0;
+	DIR *dir = opendir(samplesdir);
+	assert_addr_not_equal(dir, NULL);
+	struct dirent *dp;
+	while ( (dp = readdir(dir))!=NULL ) {
+		if ( strstr(dp->d_name, ".wasm")==NULL ) continue;
+		strcpy(samplesfile, samplesdir);
+		strcat(samplesfile, "/");
+		strcat(samplesfile, dp->d_name);
+
+		vm_free(run_captured(samplesfile, NULL, "/tmp/wich_interp.txt"));
+		VM *vm = run_captured(samplesfile, setup, "/tmp/wich_tier.txt");
+		if ( check!=NULL ) check(vm);
+		vm_free(vm);
+		char *expected = read_file("/tmp/wich_interp.txt");
+		char *found = read_file("/tmp/wich_tier.txt");
+		printf("%s\n", dp->d_name);
+		assert_str_equal(found, expected);
+		free(expected);
+		free(found);
+		nsamples++;
+	}
+	closedir(dir);
+	assert_true(nsamples>0);
+}
+
+#endif
@@ -0,0 +1,65 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <wich.h>
+#include "vm.h"
+#include "aot.h"
+
+#include <cunit.h>
+#include <wloader.h>
+#include "samples.h"
+
+/* Differential test: run every sample on the interpreter and again
+ * compiled ahead of time to a shared object; stdout must be the same.
+ */
+
+static void setup()		{ }
+static void teardown()	{ }
+
+static void compile_ahead_of_time(VM *vm) {
+	static int nobjects = 0;
+	char sofile[2000];
+	sprintf(sofile, "/tmp/wich_aot_%d.so", nobjects++); // a loaded object stays loaded
+	assert_true(aot_compile(vm, sofile));
+	assert_true(aot_load(vm, sofile));
+}
+
+static void main_compiled(VM *vm) {
+	assert_addr_not_equal(vm_function(vm, "main")->native, NULL);
+}
+
+void samples_match_interpreter() {
+	samples_match(compile_ahead_of_time, main_compiled);
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+	if ( !find_samples() ) return -1;
+
+	test(samples_match_interpreter);
+	return 0;
+}
@@ -0,0 +1,240 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <wich.h>
+#include "vm.h"
+
+#include <cunit.h>
+#include <wloader.h>
+
+static void setup()		{ }
+static void teardown()	{ }
+
+// call an int function on the stack interpreter, bypassing main
+static int call_int(VM *vm, char *name, int arg) {
+	vm->stack[++vm->sp].i = arg;
+	vm_invoke(vm, vm_function(vm, name));
+	return vm->stack[vm->sp--].i;
+}
+
+/*
+ * func down(n:int):int { if (n==0) { return 0 } return down(n-1)+1 }
+ * print(down(100000))
+ */
+static char *down_code =
+	"0 strings\n"
+	"2 functions\n"
+	"0: addr=0 args=1 locals=0 type=1 4/down\n"
+	"1: addr=43 args=0 locals=0 type=0 4/main\n"
+	"25 instr, 55 bytes\n"
+	"GC_START\n"
+	"ILOAD 0\n"
+	"ICONST 0\n"
+	"IEQ\n"
+	"BRF 10\n"
+	"ICONST 0\n"
+	"GC_END\n"
+	"RET\n"
+	"ILOAD 0\n"
+	"ICONST 1\n"
+	"ISUB\n"
+	"CALL 0\n"
+	"ICONST 1\n"
+	"IADD\n"
+	"GC_END\n"
+	"RET\n"
+	"PUSH_DFLT_RETV\n"
+	"RET\n"
+	"GC_END\n"
+	"GC_START\n"
+	"ICONST 100000\n"
+	"CALL 0\n"
+	"IPRINT\n"
+	"GC_END\n"
+	"HALT\n";
+
+void result_replaces_args() {
+	VM *vm = vm_load_string(down_code);
+	vm->stack[++vm->sp].i = 99; // caller's pending operand stays put
+	assert_equal(call_int(vm, "down", 3), 3);
+	assert_equal(vm->sp, 0);
+	assert_equal(vm->stack[0].i, 99);
+	assert_equal(vm->callsp, -1);
+}
+
+void deep_recursion() {
+	VM *vm = vm_load_string(down_code);
+	assert_equal(call_int(vm, "down", 100000), 100000);
+	assert_equal(vm->sp, -1);
+	vm_exec(vm, false);
+}
+
+/*
+ * f(a,b) has 12 locals, more than the old fixed-size frames held;
+ * local 13 = a-b, returns local 13 + local 12 + b
+ */
+static char *many_locals_code =
+	"0 strings\n"
+	"2 functions\n"
+	"0: addr=0 args=2 locals=12 type=1 1/f\n"
+	"1: addr=27 args=0 locals=0 type=0 4/main\n"
+	"22 instr, 44 bytes\n"
+	"GC_START\n"
+	"ILOAD 0\n"
+	"ILOAD 1\n"
+	"ISUB\n"
+	"STORE 13\n"
+	"ILOAD 13\n"
+	"ILOAD 12\n"
+	"IADD\n"
+	"ILOAD 1\n"
+	"IADD\n"
+	"GC_END\n"
+	"RET\n"
+	"PUSH_DFLT_RETV\n"
+	"RET\n"
+	"GC_END\n"
+	"GC_START\n"
+	"ICONST 7\n"
+	"ICONST 5\n"
+	"CALL 0\n"
+	"IPRINT\n"
+	"GC_END\n"
+	"HALT\n";
+
+void many_locals() {
+	VM *vm = vm_load_string(many_locals_code);
+	assert_true(vm->verified);
+	Function_metadata *f = vm_function(vm, "f");
+	assert_equal(f->frame_size, 14);
+	vm->stack[++vm->sp].i = 7;
+	vm->stack[++vm->sp].i = 5;
+	vm_invoke(vm, f);
+	assert_equal(vm->sp, 0);
+	assert_equal(vm->stack[0].i, 7);
+}
+
+/*
+ * func count(n:int, acc:int):int { if (n==0) { return acc } return count(n-1, acc+1) }
+ * print(count(3, 0))
+ */
+static char *count_code =
+	"0 strings\n"
+	"2 functions\n"
+	"0: addr=0 args=2 locals=0 type=1 5/count\n"
+	"1: addr=44 args=0 locals=0 type=0 4/main\n"
+	"27 instr, 61 bytes\n"
+	"GC_START\n"
+	"ILOAD 0\n"
+	"ICONST 0\n"
+	"IEQ\n"
+	"BRF 8\n"
+	"ILOAD 1\n"
+	"GC_END\n"
+	"RET\n"
+	"ILOAD 0\n"
+	"ICONST 1\n"
+	"ISUB\n"
+	"ILOAD 1\n"
+	"ICONST 1\n"
+	"IADD\n"
+	"CALL 0\n"
+	"GC_END\n"
+	"RET\n"
+	"PUSH_DFLT_RETV\n"
+	"RET\n"
+	"GC_END\n"
+	"GC_START\n"
+	"ICONST 3\n"
+	"ICONST 0\n"
+	"CALL 0\n"
+	"IPRINT\n"
+	"GC_END\n"
+	"HALT\n";
+
+void tail_calls_marked() {
+	VM *vm = vm_load_string(count_code);
+	int tail = 0, calls = 0;
+	for (int i = 0; i < vm->num_instrs; i++) {
+		if ( vm->instrs[i].opcode==CALL ) calls++;
+		if ( vm->instrs[i].super==TAIL_CALL ) tail++;
+	}
+	assert_equal(calls, 2);
+	assert_equal(tail, 1); // main's CALL is followed by IPRINT
+}
+
+void tail_recursion_in_constant_space() {
+	VM *vm = vm_load_string(count_code);
+	// deeper than the call stack could hold if every call pushed a frame
+	vm->stack[++vm->sp].i = 2 * MAX_CALL_STACK;
+	vm->stack[++vm->sp].i = 0;
+	vm_invoke(vm, vm_function(vm, "count"));
+	assert_equal(vm->sp, 0);
+	assert_equal(vm->stack[0].i, 2 * MAX_CALL_STACK);
+	assert_equal(vm->callsp, -1);
+	vm->sp--;
+	vm_exec(vm, true); // trace shows the elided frames
+}
+
+void calls_quickened() {
+	VM *vm = vm_load_string(down_code);
+	vm_exec(vm, false);
+	assert_equal(vm->quickened, 2); // down's CALL and main's
+	vm_exec(vm, false); // now runs the quick forms from the start
+	assert_equal(vm->quickened, 2);
+}
+
+void strings_quickened() {
+	VM *vm = vm_load_string(
+		"1 strings\n"
+		"0: 5/hello\n"
+		"1 functions\n"
+		"0: addr=0 args=0 locals=0 type=0 4/main\n"
+		"3 instr, 5 bytes\n"
+		"SCONST 0\n"
+		"SPRINT\n"
+		"HALT\n");
+	vm_exec(vm, false);
+	assert_equal(vm->quickened, 1);
+	assert_equal(vm->instrs[0].super, SCONST_QUICK);
+	assert_addr_equal(vm->instrs[0].a.s, vm->strings[0]);
+	vm_exec(vm, false);
+	assert_equal(vm->quickened, 1);
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+
+	test(result_replaces_args);
+	test(deep_recursion);
+	test(many_locals);
+	test(tail_calls_marked);
+	test(tail_recursion_in_constant_space);
+	test(calls_quickened);
+	test(strings_quickened);
+	return 0;
+}
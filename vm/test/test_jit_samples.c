@@ -0,0 +1,148 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <wich.h>
+#include "vm.h"
+
+#include <cunit.h>
+#include <wloader.h>
+#include "samples.h"
+
+/* Differential test: run every sample on the interpreter and again with
+ * every function JIT compiled on its first call; stdout must be the same.
+ */
+
+static void setup()		{ }
+static void teardown()	{ }
+
+static void jit_everything(VM *vm) {
+	vm->jit = true;
+	vm->jit_threshold = 0;
+}
+
+static void main_compiled(VM *vm) {
+#if defined(__x86_64__)
+	assert_addr_not_equal(vm_function(vm, "main")->native, NULL);
+#endif
+}
+
+void samples_match_interpreter() {
+	samples_match(jit_everything, main_compiled);
+}
+
+/*
+ * func sum(n:int):int { if ( n==0 ) { return 0 } return n + sum(n-1) }
+ * print(sum(100000))
+ */
+static char *sum_code =
+	"0 strings\n"
+	"2 functions\n"
+	"0: addr=0 args=1 locals=0 type=1 3/sum\n"
+	"1: addr=40 args=0 locals=0 type=0 4/main\n"
+	"24 instr, 52 bytes\n"
+	"GC_START\n"
+	"ILOAD 0\n"
+	"ICONST 0\n"
+	"IEQ\n"
+	"BRF 10\n"
+	"ICONST 0\n"
+	"GC_END\n"
+	"RET\n"
+	"ILOAD 0\n"
+	"ILOAD 0\n"
+	"ICONST 1\n"
+	"ISUB\n"
+	"CALL 0\n"
+	"IADD\n"
+	"GC_END\n"
+	"RET\n"
+	"PUSH_DFLT_RETV\n"
+	"RET\n"
+	"GC_START\n"
+	"ICONST 100000\n"
+	"CALL 0\n"
+	"IPRINT\n"
+	"GC_END\n"
+	"HALT\n";
+
+/*
+ * func loop(n:int, acc:int):int { if ( n==0 ) { return acc } return loop(n-1, acc+n) }
+ * print(loop(100000, 0))
+ */
+static char *loop_code =
+	"0 strings\n"
+	"2 functions\n"
+	"0: addr=0 args=2 locals=0 type=1 4/loop\n"
+	"1: addr=41 args=0 locals=0 type=0 4/main\n"
+	"26 instr, 58 bytes\n"
+	"GC_START\n"
+	"ILOAD 0\n"
+	"ICONST 0\n"
+	"IEQ\n"
+	"BRF 8\n"
+	"ILOAD 1\n"
+	"GC_END\n"
+	"RET\n"
+	"ILOAD 0\n"
+	"ICONST 1\n"
+	"ISUB\n"
+	"ILOAD 1\n"
+	"ILOAD 0\n"
+	"IADD\n"
+	"CALL 0\n"
+	"GC_END\n"
+	"RET\n"
+	"PUSH_DFLT_RETV\n"
+	"RET\n"
+	"GC_START\n"
+	"ICONST 100000\n"
+	"ICONST 0\n"
+	"CALL 0\n"
+	"IPRINT\n"
+	"GC_END\n"
+	"HALT\n";
+
+// compiled calls nest on the C stack only so deep; tail calls not at all
+void deep_recursion_matches_interpreter() {
+	char *programs[] = {sum_code, loop_code};
+	for (int k = 0; k < 2; k++) {
+		save_string("/tmp/t.wasm", programs[k]);
+		vm_free(run_captured("/tmp/t.wasm", jit_everything, "/tmp/wich_jit.txt"));
+		char *found = read_file("/tmp/wich_jit.txt");
+		assert_str_equal(found, "705082704\n");
+		free(found);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+	if ( !find_samples() ) return -1;
+
+	test(samples_match_interpreter);
+	test(deep_recursion_matches_interpreter);
+	return 0;
+}
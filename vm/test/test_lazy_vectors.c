@@ -0,0 +1,333 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <wich.h>
+#include "vm.h"
+
+#include <cunit.h>
+#include <wloader.h>
+
+static void setup()		{ }
+static void teardown()	{ }
+
+static Vector_ref *vec3(double x, double y, double z) {
+	double data[] = {x, y, z};
+	return vm_vector_ref(PVector_new(data, 3));
+}
+
+static void assert_vec3(Vector_ref *v, double x, double y, double z) {
+	assert_equal(v->vptr.vector->length, 3);
+	assert_float_equal(ith(v->vptr, 0), x);
+	assert_float_equal(ith(v->vptr, 1), y);
+	assert_float_equal(ith(v->vptr, 2), z);
+}
+
+/*
+ * var a = [1,2,3]  var b = [4,5,6]  var c = [7,8,9]  var d = [.5,.5,.5]
+ * var e = a + b * c - d
+ * var g = a * 2 + .5
+ */
+static char *fused_code =
+	"0 strings\n"
+	"1 functions\n"
+	"0: addr=0 args=0 locals=6 type=0 4/main\n"
+	"41 instr, 187 bytes\n"
+	"GC_START\n"
+	"FCONST 1.0\n"
+	"FCONST 2.0\n"
+	"FCONST 3.0\n"
+	"ICONST 3\n"
+	"VECTOR\n"
+	"STORE 0\n"
+	"FCONST 4.0\n"
+	"FCONST 5.0\n"
+	"FCONST 6.0\n"
+	"ICONST 3\n"
+	"VECTOR\n"
+	"STORE 1\n"
+	"FCONST 7.0\n"
+	"FCONST 8.0\n"
+	"FCONST 9.0\n"
+	"ICONST 3\n"
+	"VECTOR\n"
+	"STORE 2\n"
+	"FCONST 0.5\n"
+	"FCONST 0.5\n"
+	"FCONST 0.5\n"
+	"ICONST 3\n"
+	"VECTOR\n"
+	"STORE 3\n"
+	"VLOAD 0\n"
+	"VLOAD 1\n"
+	"VLOAD 2\n"
+	"VMUL\n"
+	"VADD\n"
+	"VLOAD 3\n"
+	"VSUB\n"
+	"STORE 4\n"
+	"VLOAD 0\n"
+	"ICONST 2\n"
+	"VMULI\n"
+	"FCONST 0.5\n"
+	"VADDF\n"
+	"STORE 5\n"
+	"GC_END\n"
+	"HALT\n";
+
+void stored_results_match_eager() {
+	VM *vm = vm_load_string(fused_code);
+	vm_exec(vm, false);
+	element *locals = &vm->stack[vm->fp]; // main's frame stays put at HALT; don't allocate, it's all garbage now
+	assert_false(vm_is_lazy(vm, locals[4].vref));
+	assert_false(vm_is_lazy(vm, locals[5].vref));
+	assert_vec3(locals[4].vref, 28.5, 41.5, 56.5);
+	assert_vec3(locals[5].vref, 2.5, 4.5, 6.5);
+	assert_equal(vm->num_lazy, 0);
+}
+
+/*
+ * func f(v:[]):float { return v[2] }
+ * var a = [1,2,3]
+ * var x = f(a + a)
+ */
+static char *call_code =
+	"0 strings\n"
+	"2 functions\n"
+	"0: addr=0 args=1 locals=0 type=2 1/f\n"
+	"1: addr=12 args=0 locals=2 type=0 4/main\n"
+	"20 instr, 64 bytes\n"
+	"GC_START\n"
+	"VLOAD 0\n"
+	"ICONST 2\n"
+	"VLOAD_INDEX\n"
+	"GC_END\n"
+	"RET\n"
+	"GC_START\n"
+	"FCONST 1.0\n"
+	"FCONST 2.0\n"
+	"FCONST 3.0\n"
+	"ICONST 3\n"
+	"VECTOR\n"
+	"STORE 0\n"
+	"VLOAD 0\n"
+	"VLOAD 0\n"
+	"VADD\n"
+	"CALL 0\n"
+	"STORE 1\n"
+	"GC_END\n"
+	"HALT\n";
+
+void args_computed_at_call() {
+	VM *vm = vm_load_string(call_code);
+	vm_exec(vm, false);
+	assert_float_equal(vm->stack[vm->fp + 1].f, 4.0);
+	assert_equal(vm->num_lazy, 0);
+}
+
+/*
+ * var n = 7  var a = [1,2,3]
+ * var e = a + a
+ * n = n
+ *
+ * STORE 1 and ILOAD 2 fuse into STORE_ILOAD.
+ */
+static char *store_iload_code =
+	"0 strings\n"
+	"1 functions\n"
+	"0: addr=0 args=0 locals=3 type=0 4/main\n"
+	"17 instr, 63 bytes\n"
+	"GC_START\n"
+	"ICONST 7\n"
+	"STORE 2\n"
+	"FCONST 1.0\n"
+	"FCONST 2.0\n"
+	"FCONST 3.0\n"
+	"ICONST 3\n"
+	"VECTOR\n"
+	"STORE 0\n"
+	"VLOAD 0\n"
+	"VLOAD 0\n"
+	"VADD\n"
+	"STORE 1\n"
+	"ILOAD 2\n"
+	"STORE 2\n"
+	"GC_END\n"
+	"HALT\n";
+
+void fused_store_forces() {
+	for (int cache_tos = 0; cache_tos <= 1; cache_tos++) {
+		VM *vm = vm_load_string(store_iload_code);
+		assert_true(vm->verified);
+		vm->cache_tos = cache_tos;
+		vm_exec(vm, false);
+		element *locals = &vm->stack[vm->fp];
+		assert_false(vm_is_lazy(vm, locals[1].vref));
+		assert_vec3(locals[1].vref, 2, 4, 6);
+		assert_equal(locals[2].i, 7);
+		assert_equal(vm->num_lazy, 0);
+	}
+}
+
+void deferred_until_forced() {
+	VM *vm = vm_load_string(fused_code);
+	element *stack = vm->stack;
+	stack[0].vref = vec3(1, 2, 3);
+	stack[1].vref = vec3(4, 5, 6);
+	vm_vector_op(vm, &stack[0], &stack[1], VEXPR_MUL);
+	vm_vector_scalar_op(vm, &stack[0], VEXPR_SUB_SCALAR, 1);
+	assert_true(vm_is_lazy(vm, stack[0].vref));
+	assert_equal(vm->num_lazy, 1);
+	vm_force(vm, &stack[0]);
+	assert_false(vm_is_lazy(vm, stack[0].vref));
+	assert_equal(vm->num_lazy, 0);
+	assert_vec3(stack[0].vref, 3, 9, 17);
+}
+
+void long_chains_split() {
+	VM *vm = vm_load_string(fused_code);
+	element *stack = vm->stack;
+	Vector_ref *b = vec3(1, 2, 3);
+	stack[0].vref = vec3(0, 0, 0);
+	for (int k = 0; k < 3 * MAX_VECTOR_EXPR_OPS; k++) {
+		stack[1].vref = b;
+		vm_vector_op(vm, &stack[0], &stack[1], VEXPR_ADD);
+		assert_true(vm->num_lazy <= 1); // full expressions are computed and a new one started
+	}
+	vm_force(vm, &stack[0]);
+	assert_vec3(stack[0].vref, 48, 96, 144);
+}
+
+void pool_exhaustion_goes_eager() {
+	VM *vm = vm_load_string(fused_code);
+	element *stack = vm->stack;
+	int n = MAX_LAZY_VECTORS + 4;
+	for (int k = 0; k < n; k++) {
+		stack[k].vref = vec3(k, k, k);
+		vm_vector_scalar_op(vm, &stack[k], VEXPR_MUL_SCALAR, 2);
+		assert_equal(vm_is_lazy(vm, stack[k].vref), k < MAX_LAZY_VECTORS);
+	}
+	vm_force_n(vm, stack, n);
+	assert_equal(vm->num_lazy, 0);
+	for (int k = 0; k < n; k++) assert_vec3(stack[k].vref, 2*k, 2*k, 2*k);
+}
+
+void long_vectors() {
+	VM *vm = vm_load_string(fused_code);
+	element *stack = vm->stack;
+	int n = 1000; // several evaluation blocks and a partial one
+	double a[n], b[n];
+	for (int k = 0; k < n; k++) { a[k] = k; b[k] = n - k; }
+	stack[0].vref = vm_vector_ref(PVector_new(a, n));
+	stack[1].vref = vm_vector_ref(PVector_new(b, n));
+	set_ith(stack[1].vref->vptr, 999, 7); // versioned element
+	PVector_ptr eager = Vector_div_scalar(Vector_mul(stack[0].vref->vptr, stack[1].vref->vptr), 4);
+	vm_vector_op(vm, &stack[0], &stack[1], VEXPR_MUL);
+	vm_vector_scalar_op(vm, &stack[0], VEXPR_DIV_SCALAR, 4);
+	vm_force(vm, &stack[0]);
+	assert_true(Vector_eq(stack[0].vref->vptr, eager));
+}
+
+void errors_match_eager() {
+	VM *vm = vm_load_string(fused_code);
+	element *stack = vm->stack;
+	double two[] = {1, 2};
+	stack[0].vref = vec3(1, 2, 3);
+	stack[1].vref = vm_vector_ref(PVector_new(two, 2));
+	vm_vector_op(vm, &stack[0], &stack[1], VEXPR_ADD); // different lengths
+	assert_addr_equal(stack[0].vref, NULL);
+	assert_equal(vm->num_lazy, 0);
+
+	stack[0].vref = vec3(1, 2, 3);
+	stack[1].vref = vec3(1, 0, 1);
+	vm_vector_op(vm, &stack[0], &stack[1], VEXPR_DIV);
+	vm_force(vm, &stack[0]);
+	assert_addr_equal(stack[0].vref, NULL);
+	assert_equal(vm->num_lazy, 0);
+}
+
+/*
+ * [9] is garbage by the time vm_exec collects; [1,2,3] is still rooted by
+ * VROOT as main never gets to GC_END so it moves down over [9].
+ */
+static char *rooted_code =
+	"0 strings\n"
+	"1 functions\n"
+	"0: addr=0 args=0 locals=1 type=0 4/main\n"
+	"13 instr, 54 bytes\n"
+	"GC_START\n"
+	"FCONST 9.0\n"
+	"ICONST 1\n"
+	"VECTOR\n"
+	"POP\n"
+	"FCONST 1.0\n"
+	"FCONST 2.0\n"
+	"FCONST 3.0\n"
+	"ICONST 3\n"
+	"VECTOR\n"
+	"STORE 0\n"
+	"VROOT\n"
+	"HALT\n";
+
+void rooted_vectors_survive_collection() {
+	VM *vm = vm_load_string(rooted_code);
+	vm_exec(vm, false);
+	element *locals = &vm->stack[vm->fp];
+	assert_addr_equal(locals[0].vref->vptr.vector, get_heap_info().start_of_heap);
+	assert_vec3(locals[0].vref, 1, 2, 3);
+}
+
+void pending_leaves_survive_collection() {
+	VM *vm = vm_load_string(fused_code);
+	element *stack = vm->stack;
+	vec3(0, 0, 0); // garbage, so the collection moves the leaves down over it
+	stack[0].vref = vec3(1, 2, 3);
+	stack[1].vref = vec3(4, 5, 6);
+	vm_vector_op(vm, &stack[0], &stack[1], VEXPR_ADD);
+	assert_true(vm_is_lazy(vm, stack[0].vref));
+	gc(); // only the pending expression points at the leaves now
+	vec3(-1, -1, -1); // reuse whatever the collection freed
+	vec3(-2, -2, -2);
+	vm_force(vm, &stack[0]);
+	assert_vec3(stack[0].vref, 5, 7, 9);
+	assert_equal(vm->num_lazy, 0);
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+
+	test(stored_results_match_eager);
+	test(args_computed_at_call);
+	test(fused_store_forces);
+	test(deferred_until_forced);
+	test(long_chains_split);
+	test(pool_exhaustion_goes_eager);
+	test(long_vectors);
+	test(errors_match_eager);
+	test(rooted_vectors_survive_collection);
+	test(pending_leaves_survive_collection);
+	return 0;
+}
@@ -0,0 +1,178 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <wich.h>
+#include "vm.h"
+
+#include <cunit.h>
+#include <wloader.h>
+
+static void setup()		{ }
+static void teardown()	{ }
+
+static VM *link2(char *a, char *b) {
+	FILE *files[] = {fopen(a, "r"), fopen(b, "r")};
+	return vm_link(files, 2); // closes files
+}
+
+/*
+ * func sq(x:int) : int { return x*x }
+ * func name() : string { return "lib" }
+ */
+static char *lib =
+	"1 strings\n"
+	"0: 3/lib\n"
+	"2 functions\n"
+	"0: addr=0 args=1 locals=0 type=1 2/sq\n"
+	"1: addr=8 args=0 locals=0 type=4 4/name\n"
+	"6 instr, 12 bytes\n"
+	"ILOAD 0\n"
+	"ILOAD 0\n"
+	"IMUL\n"
+	"RET\n"
+	"SCONST 0\n"
+	"RET\n";
+
+/*
+ * var n = sq(7)
+ * var s = name()
+ * "main"
+ */
+static char *app =
+	"1 strings\n"
+	"0: 4/main\n"
+	"3 functions\n"
+	"0: addr=0 args=0 locals=2 type=0 4/main\n"
+	"1: addr=-1 args=1 locals=0 type=1 2/sq\n"
+	"2: addr=-1 args=0 locals=0 type=4 4/name\n"
+	"8 instr, 22 bytes\n"
+	"ICONST 7\n"
+	"CALL 1\n"
+	"STORE 0\n"
+	"CALL 2\n"
+	"STORE 1\n"
+	"SCONST 0\n"
+	"POP\n"
+	"HALT\n";
+
+static void check_linked(VM *vm) {
+	assert_addr_not_equal(vm, NULL);
+	assert_equal(vm->num_functions, 3);
+	assert_equal(vm->num_strings, 2);
+	Function_metadata *main = vm_function(vm, "main");
+	Function_metadata *sq = vm_function(vm, "sq");
+	assert_addr_equal(vm->instrs[main->entry+1].a.func, sq);
+	assert_true(vm->verified);
+	vm_exec(vm, false);
+	assert_equal(vm->stack[vm->fp].i, 49);
+	assert_str_equal(vm->stack[vm->fp+1].s->str, "lib");
+	assert_str_equal(vm_sconst(vm, &vm->instrs[main->entry+5])->str, "main");
+	vm_free(vm);
+}
+
+void call_across_modules() {
+	save_string("/tmp/app.wasm", app);
+	save_string("/tmp/lib.wasm", lib);
+	VM *vm = link2("/tmp/app.wasm", "/tmp/lib.wasm");
+	assert_equal(vm_function(vm, "sq")->address, 22); // lib's code follows app's
+	assert_equal(vm_function(vm, "name")->address, 30);
+	check_linked(vm);
+}
+
+void module_order_does_not_matter() {
+	save_string("/tmp/app.wasm", app);
+	save_string("/tmp/lib.wasm", lib);
+	VM *vm = link2("/tmp/lib.wasm", "/tmp/app.wasm");
+	assert_equal(vm_function_index(vm, "sq"), 0); // app's CALL 1 must now say CALL 0
+	assert_equal(vm_function(vm, "main")->address, 12);
+	check_linked(vm);
+}
+
+void links_binary_modules() {
+	save_string("/tmp/app.wasm", app);
+	save_string("/tmp/lib.wasm", lib);
+	FILE *out = fopen("/tmp/lib.wbc", "w");
+	assert_true(vm_assemble(fopen("/tmp/lib.wasm", "r"), out));
+	fclose(out);
+	check_linked(link2("/tmp/app.wasm", "/tmp/lib.wbc"));
+}
+
+void undefined_function() {
+	save_string("/tmp/app.wasm", app);
+	assert_addr_equal(vm_load(fopen("/tmp/app.wasm", "r")), NULL);
+}
+
+void function_defined_twice() {
+	save_string("/tmp/lib.wasm", lib);
+	assert_addr_equal(link2("/tmp/lib.wasm", "/tmp/lib.wasm"), NULL);
+}
+
+void declarations_must_match() {
+	save_string("/tmp/app.wasm",
+		"0 strings\n"
+		"1 functions\n"
+		"0: addr=-1 args=2 locals=0 type=1 2/sq\n"
+		"0 instr, 0 bytes\n");
+	save_string("/tmp/lib.wasm", lib);
+	assert_addr_equal(link2("/tmp/app.wasm", "/tmp/lib.wasm"), NULL);
+}
+
+// more functions than the function table used to have room for
+void tables_grow() {
+	int n = 5000;
+	FILE *f = fopen("/tmp/t.wasm", "w");
+	fprintf(f, "0 strings\n%d functions\n", n+1);
+	fprintf(f, "0: addr=0 args=0 locals=1 type=0 4/main\n");
+	for (int i = 0; i < n; i++) fprintf(f, "%d: addr=%d args=0 locals=0 type=1 %d/f%d\n", i+1, 7+6*i, snprintf(NULL, 0, "f%d", i), i);
+	fprintf(f, "%d instr, %d bytes\n", 3+2*n, 7+6*n);
+	fprintf(f, "CALL %d\nSTORE 0\nHALT\n", n);
+	for (int i = 0; i < n; i++) fprintf(f, "ICONST %d\nRET\n", i);
+	fclose(f);
+	VM *vm = vm_load(fopen("/tmp/t.wasm", "r"));
+	assert_equal(vm->num_functions, n+1);
+	Function_metadata *last = vm_function(vm, "f4999");
+	assert_addr_equal(last, &vm->functions[n]);
+	assert_equal((int)vm->functions[1].end, vm->functions[2].entry);
+	assert_equal((int)last->end, vm->num_instrs);
+	vm_exec(vm, false);
+	assert_equal(vm->stack[vm->fp].i, n-1);
+	vm_free(vm);
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+
+	test(call_across_modules);
+	test(module_order_does_not_matter);
+	test(links_binary_modules);
+	test(undefined_function);
+	test(function_defined_twice);
+	test(declarations_must_match);
+	test(tables_grow);
+	return 0;
+}
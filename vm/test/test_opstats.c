@@ -0,0 +1,134 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <wich.h>
+#include "vm.h"
+#include "opstats.h"
+
+#include <cunit.h>
+#include <wloader.h>
+
+static void setup()		{ }
+static void teardown()	{ }
+
+static Opcode_stats *reread(Opcode_stats *stats, int times) {
+	FILE *f = fopen("/tmp/t.csv", "w");
+	vm_stats_write_csv(stats, f);
+	fclose(f);
+	Opcode_stats *merged = vm_stats_alloc();
+	for (int k = 0; k < times; k++) {
+		f = fopen("/tmp/t.csv", "r");
+		assert_true(vm_stats_merge_csv(merged, f));
+		fclose(f);
+	}
+	return merged;
+}
+
+void csv_merges_counts() {
+	Opcode_stats *stats = vm_stats_alloc();
+	stats->runs = 1;
+	stats->count[ILOAD] = 7;
+	stats->cycles[ILOAD] = 70;
+	stats->count[TAIL_CALL] = 2;
+	stats->pairs[ILOAD][IADD] = 3;
+	stats->pairs[TAIL_CALL][ILOAD] = 1;
+	stats->brf_taken = 4;
+	stats->brf_not_taken = 5;
+
+	Opcode_stats *merged = reread(stats, 2);
+	assert_equal(merged->runs, 2);
+	assert_equal(merged->count[ILOAD], 14);
+	assert_equal(merged->cycles[ILOAD], 140);
+	assert_equal(merged->count[TAIL_CALL], 4);
+	assert_equal(merged->count[IADD], 0);
+	assert_equal(merged->pairs[ILOAD][IADD], 6);
+	assert_equal(merged->pairs[TAIL_CALL][ILOAD], 2);
+	assert_equal(merged->brf_taken, 8);
+	assert_equal(merged->brf_not_taken, 10);
+}
+
+void csv_rejects_other_files() {
+	Opcode_stats *stats = vm_stats_alloc();
+	save_string("/tmp/t.csv", "0 strings\n1 functions\n");
+	FILE *f = fopen("/tmp/t.csv", "r");
+	assert_false(vm_stats_merge_csv(stats, f));
+	fclose(f);
+}
+
+#ifdef VM_OPCODE_STATS
+/*
+ * var i = 0  while ( i<10 ) { i = i + 1 }
+ */
+static char *loop_code =
+	"0 strings\n"
+	"1 functions\n"
+	"0: addr=0 args=0 locals=1 type=0 4/main\n"
+	"14 instr, 40 bytes\n"
+	"ICONST 0\n"
+	"STORE 0\n"
+	"ILOAD 0\n"
+	"ICONST 10\n"
+	"ILT\n"
+	"BRF 18\n"
+	"ILOAD 0\n"
+	"ICONST 1\n"
+	"IADD\n"
+	"STORE 0\n"
+	"BR -24\n"
+	"ILOAD 0\n"
+	"IPRINT\n"
+	"HALT\n";
+
+void counts_unfused_instructions() {
+	VM *vm = vm_load_string(loop_code);
+	vm->stats = vm_stats_alloc();
+	vm_exec(vm, false);
+	Opcode_stats *stats = vm->stats;
+	assert_equal(stats->count[ILT], 11);
+	assert_equal(stats->count[BRF], 11);
+	assert_equal(stats->count[IADD], 10);
+	assert_equal(stats->count[HALT], 1);
+	assert_equal(stats->pairs[ILT][BRF], 11);
+	assert_equal(stats->pairs[BR][ILOAD], 10);
+	assert_equal(stats->pairs[ILOAD][ICONST], 21);
+	assert_equal(stats->brf_not_taken, 10);
+	assert_equal(stats->brf_taken, 1);
+	assert_equal(vm->quickened, 0);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+
+	test(csv_merges_counts);
+	test(csv_rejects_other_files);
+#ifdef VM_OPCODE_STATS
+	test(counts_unfused_instructions);
+#endif
+	return 0;
+}
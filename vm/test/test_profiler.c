@@ -0,0 +1,115 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <wich.h>
+#include "vm.h"
+#include "profiler.h"
+
+#include <cunit.h>
+#include <wloader.h>
+
+static void setup()		{ }
+static void teardown()	{ }
+
+static char *contents(char *filename) {
+	static char buf[4096];
+	FILE *f = fopen(filename, "r");
+	size_t n = fread(buf, 1, sizeof(buf)-1, f);
+	buf[n] = '\0';
+	fclose(f);
+	return buf;
+}
+
+/*
+ * func spin(n:int) : int { var i = 0  while ( i<n ) { i = i + 1 }  return i }
+ * var x = spin(20000000)
+ */
+static char *spin_code =
+	"0 strings\n"
+	"2 functions\n"
+	"0: addr=12 args=1 locals=1 type=1 4/spin\n"
+	"1: addr=0 args=0 locals=1 type=0 4/main\n"
+	"17 instr, 49 bytes\n"
+	"ICONST 20000000\n"
+	"CALL 0\n"
+	"STORE 0\n"
+	"HALT\n"
+	"ICONST 0\n"
+	"STORE 1\n"
+	"ILOAD 1\n"
+	"ILOAD 0\n"
+	"ILT\n"
+	"BRF 18\n"
+	"ILOAD 1\n"
+	"ICONST 1\n"
+	"IADD\n"
+	"STORE 1\n"
+	"BR -22\n"
+	"ILOAD 1\n"
+	"RET\n";
+
+void samples_land_in_running_function() {
+	VM *vm = vm_load_string(spin_code);
+	assert_true(vm_profile_start(vm, PROFILE_HZ));
+	assert_false(vm_profile_start(vm, PROFILE_HZ)); // one at a time
+	vm_exec(vm, false);
+	vm_profile_stop(vm);
+	assert_false(vm->profiling);
+	assert_equal(vm->stack[vm->fp].i, 20000000);
+	assert_true(vm_profile_samples()>0);
+
+	FILE *f = fopen("/tmp/t.folded", "w");
+	vm_profile_write_folded(vm, f);
+	fclose(f);
+	assert_true(strstr(contents("/tmp/t.folded"), "main;spin ")!=NULL);
+
+	f = fopen("/tmp/t.summary", "w");
+	vm_profile_write_summary(vm, f);
+	fclose(f);
+	char *summary = contents("/tmp/t.summary");
+	assert_true(strstr(summary, "spin")!=NULL);
+	char *hot = strstr(summary, "hottest instructions:\n");
+	assert_true(hot!=NULL);
+	assert_true(strstr(hot, "spin")!=NULL); // all the time is in its loop
+}
+
+void off_unless_started() {
+	VM *vm = vm_load_string(spin_code);
+	vm_exec(vm, false);
+	assert_false(vm->profiling);
+	assert_addr_equal((void *)vm->profile_pc, NULL); // the usual loops never publish pc
+	assert_equal(vm->stack[vm->fp].i, 20000000);
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+
+	test(samples_land_in_running_function);
+	test(off_unless_started);
+	return 0;
+}
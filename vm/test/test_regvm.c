@@ -0,0 +1,309 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <wich.h>
+#include "vm.h"
+#include "regvm.h"
+
+#include <cunit.h>
+#include <wloader.h>
+
+static void setup()		{ }
+static void teardown()	{ }
+
+// call a translated int function directly, bypassing main
+static int call_int(VM *vm, char *name, int arg) {
+	Function_metadata *func = vm_function(vm, name);
+	vm->stack[++vm->sp].i = arg;
+	vm_regcall(vm, func);
+	return vm->stack[vm->sp--].i;
+}
+
+/*
+ * func sum(n:int):int { var s=0 var i=1 while (i<=n) { s=s+i i=i+1 } return s }
+ * print(sum(100))
+ */
+static char *sum_code =
+	"0 strings\n"
+	"2 functions\n"
+	"0: addr=0 args=1 locals=2 type=1 3/sum\n"
+	"1: addr=60 args=0 locals=0 type=0 4/main\n"
+	"30 instr, 72 bytes\n"
+	"GC_START\n"
+	"ICONST 0\n"
+	"STORE 1\n"
+	"ICONST 1\n"
+	"STORE 2\n"
+	"ILOAD 2\n"
+	"ILOAD 0\n"
+	"ILE\n"
+	"BRF 28\n"
+	"ILOAD 1\n"
+	"ILOAD 2\n"
+	"IADD\n"
+	"STORE 1\n"
+	"ILOAD 2\n"
+	"ICONST 1\n"
+	"IADD\n"
+	"STORE 2\n"
+	"BR -32\n"
+	"ILOAD 1\n"
+	"GC_END\n"
+	"RET\n"
+	"PUSH_DFLT_RETV\n"
+	"RET\n"
+	"GC_END\n"
+	"GC_START\n"
+	"ICONST 100\n"
+	"CALL 0\n"
+	"IPRINT\n"
+	"GC_END\n"
+	"HALT\n";
+
+void sum_loop() {
+	VM *vm = vm_load_string(sum_code);
+	assert_equal(reg_translate(vm), 2);
+	assert_equal(call_int(vm, "sum", 100), 5050);
+	assert_equal(vm->sp, -1);
+	vm_exec(vm, false);
+}
+
+void sum_loop_fewer_instrs() {
+	VM *vm = vm_load_string(sum_code);
+	RFunction *rf = reg_translate_function(vm, vm_function(vm, "sum"));
+	assert_addr_not_equal(rf, NULL);
+	// ICONST, ICONST, ILE_BRF, IADD, IADDK, BR, RET
+	assert_equal(rf->ninstrs, 7);
+	assert_equal(rf->nregs, 3 + 2 + 1);
+}
+
+/*
+ * func fib(x:int):int { if (2 > x) { return x } return fib(x-1) + fib(x-2) }
+ * print(fib(10))
+ */
+void fib() {
+	char *code =
+		"0 strings\n"
+		"2 functions\n"
+		"0: addr=0 args=1 locals=0 type=1 3/fib\n"
+		"1: addr=48 args=0 locals=0 type=0 4/main\n"
+		"28 instr, 60 bytes\n"
+		"GC_START\n"
+		"ICONST 2\n"
+		"ILOAD 0\n"
+		"IGT\n"
+		"BRF 8\n"
+		"ILOAD 0\n"
+		"GC_END\n"
+		"RET\n"
+		"ILOAD 0\n"
+		"ICONST 1\n"
+		"ISUB\n"
+		"CALL 0\n"
+		"ILOAD 0\n"
+		"ICONST 2\n"
+		"ISUB\n"
+		"CALL 0\n"
+		"IADD\n"
+		"GC_END\n"
+		"RET\n"
+		"PUSH_DFLT_RETV\n"
+		"RET\n"
+		"GC_END\n"
+		"GC_START\n"
+		"ICONST 10\n"
+		"CALL 0\n"
+		"IPRINT\n"
+		"GC_END\n"
+		"HALT\n";
+	VM *vm = vm_load_string(code);
+	assert_equal(reg_translate(vm), 2);
+	assert_equal(call_int(vm, "fib", 10), 55);
+	assert_equal(vm->callsp, -1);
+	vm_exec(vm, false);
+}
+
+/*
+ * len() uses strings so stays on the stack interpreter as does main; f is
+ * translated and calls len. f also stores to a local while its old value is
+ * still on the operand stack.
+ */
+void mixed_tiers() {
+	char *code =
+		"1 strings\n"
+		"0: 5/hello\n"
+		"3 functions\n"
+		"0: addr=0 args=0 locals=0 type=1 3/len\n"
+		"1: addr=11 args=1 locals=0 type=1 1/f\n"
+		"2: addr=36 args=0 locals=1 type=0 4/main\n"
+		"32 instr, 58 bytes\n"
+		"GC_START\n"
+		"SCONST 0\n"
+		"SROOT\n"
+		"SLEN\n"
+		"GC_END\n"
+		"RET\n"
+		"PUSH_DFLT_RETV\n"
+		"RET\n"
+		"GC_END\n"
+		"GC_START\n"
+		"ILOAD 0\n"
+		"ICONST 5\n"
+		"STORE 0\n"
+		"ILOAD 0\n"
+		"IADD\n"
+		"CALL 0\n"
+		"IADD\n"
+		"GC_END\n"
+		"RET\n"
+		"PUSH_DFLT_RETV\n"
+		"RET\n"
+		"GC_END\n"
+		"GC_START\n"
+		"SCONST 0\n"
+		"SPRINT\n"
+		"ICONST 1\n"
+		"CALL 1\n"
+		"STORE 0\n"
+		"ILOAD 0\n"
+		"IPRINT\n"
+		"GC_END\n"
+		"HALT\n";
+	VM *vm = vm_load_string(code);
+	assert_equal(reg_translate(vm), 1);
+	assert_addr_equal(vm_function(vm, "len")->regcode, NULL);
+	assert_addr_equal(vm_function(vm, "main")->regcode, NULL);
+	assert_equal(call_int(vm, "f", 1), 11);
+	assert_equal(vm->sp, -1);
+	vm_exec(vm, false);
+}
+
+/*
+ * func sum(n:int):int { if ( n==0 ) { return 0 } return n + sum(n-1) }
+ * print(sum(100000))
+ */
+void deep_recursion() {
+	char *code =
+		"0 strings\n"
+		"2 functions\n"
+		"0: addr=0 args=1 locals=0 type=1 3/sum\n"
+		"1: addr=40 args=0 locals=0 type=0 4/main\n"
+		"24 instr, 52 bytes\n"
+		"GC_START\n"
+		"ILOAD 0\n"
+		"ICONST 0\n"
+		"IEQ\n"
+		"BRF 10\n"
+		"ICONST 0\n"
+		"GC_END\n"
+		"RET\n"
+		"ILOAD 0\n"
+		"ILOAD 0\n"
+		"ICONST 1\n"
+		"ISUB\n"
+		"CALL 0\n"
+		"IADD\n"
+		"GC_END\n"
+		"RET\n"
+		"PUSH_DFLT_RETV\n"
+		"RET\n"
+		"GC_START\n"
+		"ICONST 100000\n"
+		"CALL 0\n"
+		"IPRINT\n"
+		"GC_END\n"
+		"HALT\n";
+	VM *vm = vm_load_string(code);
+	assert_equal(reg_translate(vm), 2);
+	// past MAX_NATIVE_DEPTH the stack interpreter takes over
+	assert_equal(call_int(vm, "sum", 100000), 705082704);
+	assert_equal(vm->callsp, -1);
+	assert_equal(vm->native_depth, 0);
+}
+
+/*
+ * func loop(n:int, acc:int):int { if ( n==0 ) { return acc } return loop(n-1, acc+n) }
+ * print(loop(100000, 0))
+ */
+void tail_calls_reuse_registers() {
+	char *code =
+		"0 strings\n"
+		"2 functions\n"
+		"0: addr=0 args=2 locals=0 type=1 4/loop\n"
+		"1: addr=41 args=0 locals=0 type=0 4/main\n"
+		"26 instr, 58 bytes\n"
+		"GC_START\n"
+		"ILOAD 0\n"
+		"ICONST 0\n"
+		"IEQ\n"
+		"BRF 8\n"
+		"ILOAD 1\n"
+		"GC_END\n"
+		"RET\n"
+		"ILOAD 0\n"
+		"ICONST 1\n"
+		"ISUB\n"
+		"ILOAD 1\n"
+		"ILOAD 0\n"
+		"IADD\n"
+		"CALL 0\n"
+		"GC_END\n"
+		"RET\n"
+		"PUSH_DFLT_RETV\n"
+		"RET\n"
+		"GC_START\n"
+		"ICONST 100000\n"
+		"ICONST 0\n"
+		"CALL 0\n"
+		"IPRINT\n"
+		"GC_END\n"
+		"HALT\n";
+	VM *vm = vm_load_string(code);
+	assert_equal(reg_translate(vm), 2);
+	RFunction *rf = vm_function(vm, "loop")->regcode;
+	bool tail_call = false;
+	for (int j = 0; j < rf->ninstrs; j++) tail_call |= rf->code[j].opcode==R_TAIL_CALL;
+	assert_true(tail_call);
+	vm->stack[++vm->sp].i = 100000;
+	vm->stack[++vm->sp].i = 0;
+	vm_regcall(vm, rf->func);
+	assert_equal(vm->stack[vm->sp--].i, 705082704);
+	assert_equal(vm->sp, -1);
+	assert_equal(vm->callsp, -1);
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+
+	test(sum_loop);
+	test(sum_loop_fewer_instrs);
+	test(fib);
+	test(mixed_tiers);
+	test(deep_recursion);
+	test(tail_calls_reuse_registers);
+	return 0;
+}
@@ -0,0 +1,144 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <wich.h>
+#include "vm.h"
+#include "snapshot.h"
+
+#include <cunit.h>
+#include <wloader.h>
+
+static void setup()		{ }
+static void teardown()	{ }
+
+static void write_image(VM *vm, char *filename) {
+	FILE *f = fopen(filename, "w");
+	assert_true(vm_snapshot_write(vm, f));
+	fclose(f);
+}
+
+/*
+ * func greet() : string { return "hello" }
+ * func sum(n:int) : int { var i = 0  var s = 0  while ( i<n ) { s = s + i  i = i + 1 }  return s }
+ * var x = sum(100)
+ * var y = len(greet())
+ */
+static char *code =
+	"1 strings\n"
+	"0: 5/hello\n"
+	"3 functions\n"
+	"0: addr=19 args=0 locals=0 type=4 5/greet\n"
+	"1: addr=23 args=1 locals=2 type=1 3/sum\n"
+	"2: addr=0 args=0 locals=2 type=0 4/main\n"
+	"28 instr, 78 bytes\n"
+	"ICONST 100\n"
+	"CALL 1\n"
+	"STORE 0\n"
+	"CALL 0\n"
+	"SLEN\n"
+	"STORE 1\n"
+	"HALT\n"
+	"SCONST 0\n"
+	"RET\n"
+	"ICONST 0\n"
+	"STORE 1\n"
+	"ICONST 0\n"
+	"STORE 2\n"
+	"ILOAD 1\n"
+	"ILOAD 0\n"
+	"ILT\n"
+	"BRF 28\n"
+	"ILOAD 2\n"
+	"ILOAD 1\n"
+	"IADD\n"
+	"STORE 2\n"
+	"ILOAD 1\n"
+	"ICONST 1\n"
+	"IADD\n"
+	"STORE 1\n"
+	"BR -32\n"
+	"ILOAD 2\n"
+	"RET\n";
+
+void image_runs_like_source() {
+	VM *vm = vm_load_string(code);
+	write_image(vm, "/tmp/t.img");
+	int num_instrs = vm->num_instrs;
+	bool verified = vm->verified;
+	vm_free(vm);
+
+	assert_true(vm_is_snapshot("/tmp/t.img"));
+	vm = vm_snapshot_load("/tmp/t.img");
+	assert_addr_not_equal(vm, NULL);
+	assert_equal(vm->num_instrs, num_instrs);
+	assert_equal(vm->verified, verified);
+	assert_equal(vm->num_functions, 3);
+	assert_str_equal(vm->functions[1].name, "sum");
+	assert_equal(vm->num_strings, 1);
+	assert_str_equal(vm->strings[0]->str, "hello");
+	vm_exec(vm, false);
+	assert_equal(vm->stack[vm->fp].i, 4950);
+	assert_equal(vm->stack[vm->fp+1].i, 5);
+	vm_free(vm);
+}
+
+void image_keeps_what_init_quickened() {
+	VM *vm = vm_load_string(code);
+	Function_metadata *greet = vm_function(vm, "greet");
+	vm_snapshot_init(vm, greet);
+	assert_equal(vm->sp, -1);
+	assert_equal(vm->instrs[greet->entry].super, SCONST_QUICK);
+	int quickened = vm->quickened;
+	write_image(vm, "/tmp/t.img");
+	vm_free(vm);
+
+	vm = vm_snapshot_load("/tmp/t.img");
+	assert_equal(vm->quickened, quickened);
+	greet = vm_function(vm, "greet");
+	assert_equal(vm->instrs[greet->entry].super, SCONST_QUICK);
+	assert_addr_equal(vm->instrs[greet->entry].a.s, vm->strings[0]);
+	vm_exec(vm, false);
+	assert_equal(vm->stack[vm->fp].i, 4950);
+	assert_equal(vm->stack[vm->fp+1].i, 5);
+	vm_free(vm);
+}
+
+void wasm_isnt_an_image() {
+	save_string("/tmp/t.wasm", code);
+	assert_false(vm_is_snapshot("/tmp/t.wasm"));
+	assert_false(vm_is_snapshot("/tmp/no-such-file"));
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+
+	test(image_runs_like_source);
+	test(image_keeps_what_init_quickened);
+	test(wasm_isnt_an_image);
+	return 0;
+}
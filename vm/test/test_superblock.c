@@ -0,0 +1,205 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <wich.h>
+#include "vm.h"
+#include "superblock.h"
+
+#include <cunit.h>
+#include <wloader.h>
+#include "samples.h"
+
+static void setup()		{ }
+static void teardown()	{ }
+
+static void superblocks_at_once(VM *vm) {
+	vm->superblocks = true;
+	vm->hot_loop_threshold = 0;
+}
+
+static VM *run_code(char *code, char *output) {
+	save_string("/tmp/t.wasm", code);
+	return run_captured("/tmp/t.wasm", superblocks_at_once, output);
+}
+
+static Superblock *first_superblock(VM *vm) {
+	for (int i = 0; i <= vm->num_instrs; i++) {
+		if ( vm->hot_loops->blocks[i]!=NULL ) return vm->hot_loops->blocks[i];
+	}
+	return NULL;
+}
+
+/*
+ * var s=0 var i=1 while (i<=100) { s=s+i i=i+1 } print(s)
+ */
+void sum_loop() {
+	char *code =
+		"0 strings\n"
+		"1 functions\n"
+		"0: addr=0 args=0 locals=2 type=0 4/main\n"
+		"22 instr, 60 bytes\n"
+		"GC_START\n"
+		"ICONST 0\n"
+		"STORE 0\n"
+		"ICONST 1\n"
+		"STORE 1\n"
+		"ILOAD 1\n"
+		"ICONST 100\n"
+		"ILE\n"
+		"BRF 28\n"
+		"ILOAD 0\n"
+		"ILOAD 1\n"
+		"IADD\n"
+		"STORE 0\n"
+		"ILOAD 1\n"
+		"ICONST 1\n"
+		"IADD\n"
+		"STORE 1\n"
+		"BR -34\n"
+		"ILOAD 0\n"
+		"IPRINT\n"
+		"GC_END\n"
+		"HALT\n";
+	VM *vm = run_code(code, "/tmp/wich_sb.txt");
+	char *output = read_file("/tmp/wich_sb.txt");
+	assert_str_equal(output, "5050\n");
+	free(output);
+	assert_equal(vm->hot_loops->compiled, 1);
+	assert_equal(vm->hot_loops->side_exits, 1); // leaving the loop
+	Superblock *sb = first_superblock(vm);
+	assert_addr_not_equal(sb, NULL);
+	// ILEK_GUARD, IADD, IADDK, LOOP; s and i stay in registers
+	assert_equal(sb->ninstrs, 4);
+	assert_equal(sb->nloads, 2);
+	assert_equal(sb->nstores, 2);
+	vm_free(vm);
+}
+
+/*
+ * var n=0 var i=1 var b=true while (i<=10) { if (b) { n=n+1 } b=!b i=i+1 } print(n)
+ *
+ * The if goes the other way every time, so every other iteration leaves the
+ * superblock through the guard on b.
+ */
+void alternating_branch() {
+	char *code =
+		"0 strings\n"
+		"1 functions\n"
+		"0: addr=0 args=0 locals=3 type=0 4/main\n"
+		"29 instr, 83 bytes\n"
+		"GC_START\n"
+		"ICONST 0\n"
+		"STORE 0\n"
+		"ICONST 1\n"
+		"STORE 1\n"
+		"ICONST 1\n"
+		"STORE 2\n"
+		"ILOAD 1\n"
+		"ICONST 10\n"
+		"ILE\n"
+		"BRF 43\n"
+		"ILOAD 2\n"
+		"BRF 15\n"
+		"ILOAD 0\n"
+		"ICONST 1\n"
+		"IADD\n"
+		"STORE 0\n"
+		"ILOAD 2\n"
+		"NOT\n"
+		"STORE 2\n"
+		"ILOAD 1\n"
+		"ICONST 1\n"
+		"IADD\n"
+		"STORE 1\n"
+		"BR -49\n"
+		"ILOAD 0\n"
+		"IPRINT\n"
+		"GC_END\n"
+		"HALT\n";
+	VM *vm = run_code(code, "/tmp/wich_sb.txt");
+	char *output = read_file("/tmp/wich_sb.txt");
+	assert_str_equal(output, "5\n");
+	free(output);
+	assert_equal(vm->hot_loops->compiled, 1);
+	assert_true(vm->hot_loops->side_exits>=5);
+	vm_free(vm);
+}
+
+/*
+ * var i=0 while (i<3) { print("hi") i=i+1 }
+ *
+ * Strings are left to the interpreter, so the loop is never recorded.
+ */
+void loop_with_strings_not_recorded() {
+	char *code =
+		"1 strings\n"
+		"0: 2/hi\n"
+		"1 functions\n"
+		"0: addr=0 args=0 locals=1 type=0 4/main\n"
+		"16 instr, 42 bytes\n"
+		"GC_START\n"
+		"ICONST 0\n"
+		"STORE 0\n"
+		"ILOAD 0\n"
+		"ICONST 3\n"
+		"ILT\n"
+		"BRF 22\n"
+		"SCONST 0\n"
+		"SPRINT\n"
+		"ILOAD 0\n"
+		"ICONST 1\n"
+		"IADD\n"
+		"STORE 0\n"
+		"BR -28\n"
+		"GC_END\n"
+		"HALT\n";
+	VM *vm = run_code(code, "/tmp/wich_sb.txt");
+	char *output = read_file("/tmp/wich_sb.txt");
+	assert_str_equal(output, "hi\nhi\nhi\n");
+	free(output);
+	assert_equal(vm->hot_loops->compiled, 0);
+	vm_free(vm);
+}
+
+/* Differential test: every sample on the interpreter and again with every
+ * loop turned into a superblock the first time it branches back; stdout
+ * must be the same.
+ */
+void samples_match_interpreter() {
+	samples_match(superblocks_at_once, NULL);
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+	if ( !find_samples() ) return -1;
+
+	test(sum_loop);
+	test(alternating_branch);
+	test(loop_with_strings_not_recorded);
+	test(samples_match_interpreter);
+	return 0;
+}
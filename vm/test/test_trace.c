@@ -0,0 +1,140 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <wich.h>
+#include "vm.h"
+
+#include <cunit.h>
+#include <wloader.h>
+
+static void setup()		{ }
+static void teardown()	{ }
+
+// run vm with stderr going to a file and return what it printed there
+static char *trace(VM *vm, bool on) {
+	static char buf[8192];
+	fflush(stderr);
+	int saved = dup(2);
+	freopen("/tmp/t.trace", "w", stderr);
+	vm_exec(vm, on);
+	fflush(stderr);
+	dup2(saved, 2);
+	close(saved);
+	FILE *f = fopen("/tmp/t.trace", "r");
+	size_t n = fread(buf, 1, sizeof(buf)-1, f);
+	buf[n] = '\0';
+	fclose(f);
+	return buf;
+}
+
+static int lines(char *s) {
+	int n = 0;
+	for (; *s; s++) if ( *s=='\n' ) n++;
+	return n;
+}
+
+/*
+ * func f() { var s = "cat" + "dog"  print(s) }
+ * f()
+ */
+static char *code =
+	"2 strings\n"
+	"0: 3/cat\n"
+	"1: 3/dog\n"
+	"2 functions\n"
+	"0: addr=0 args=0 locals=1 type=0 1/f\n"
+	"1: addr=18 args=0 locals=0 type=0 4/main\n"
+	"11 instr, 24 bytes\n"
+	"GC_START\n"
+	"SCONST 0\n"
+	"SCONST 1\n"
+	"SADD\n"
+	"STORE 0\n"
+	"SROOT\n"
+	"SLOAD 0\n"
+	"SPRINT\n"
+	"GC_END\n"
+	"RET\n"
+	"CALL 0\n"
+	"HALT\n";
+
+void trace_everything() {
+	VM *vm = vm_load_string(code);
+	char *t = trace(vm, true);
+	assert_equal(lines(t), 12); // every instruction plus the final HALT
+	assert_true(strstr(t, "0018:  CALL")!=NULL);
+	assert_true(strstr(t, "0001:  SCONST")!=NULL);
+	assert_equal(vm->quickened, 0); // the diagnostic loop runs instructions as they are
+}
+
+void trace_one_function() {
+	VM *vm = vm_load_string(code);
+	vm->trace.function = "f";
+	char *t = trace(vm, true);
+	assert_equal(lines(t), 10);
+	assert_true(strstr(t, "CALL")==NULL);
+	assert_true(strstr(t, "0017:  RET")!=NULL);
+	assert_true(strstr(t, "HALT")==NULL);
+}
+
+void trace_address_range() {
+	VM *vm = vm_load_string(code);
+	vm->trace.from = 1;
+	vm->trace.to = 8;
+	char *t = trace(vm, true);
+	assert_equal(lines(t), 3);
+	assert_true(strncmp(t, "0001:  SCONST", 13)==0);
+	assert_true(strstr(t, "0007:  SADD")!=NULL);
+}
+
+void trace_heap_objects() {
+	VM *vm = vm_load_string(code);
+	vm->trace.heap = true;
+	char *t = trace(vm, true);
+	assert_true(strstr(t, "opnds=[ \"cat\" \"dog\" ]")!=NULL);
+	assert_true(strstr(t, "f=[ \"catdog\" ]")!=NULL);
+}
+
+void untraced_loop_prints_nothing() {
+	VM *vm = vm_load_string(code);
+	char *t = trace(vm, false);
+	assert_str_equal(t, "");
+	assert_equal(vm->quickened, 3); // two SCONSTs and the CALL
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+
+	test(trace_everything);
+	test(trace_one_function);
+	test(trace_address_range);
+	test(trace_heap_objects);
+	test(untraced_loop_prints_nothing);
+	return 0;
+}
@@ -0,0 +1,192 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <dirent.h>
+#include <wich.h>
+#include "vm.h"
+#include "verifier.h"
+
+#include <cunit.h>
+#include <wloader.h>
+
+static char samplesdir[2000];
+
+static void setup()		{ }
+static void teardown()	{ }
+
+// a one-function program around body
+static VM *load_main(char *body, int ninstrs, int nbytes) {
+	char code[1000];
+	sprintf(code,
+			"0 strings\n"
+			"1 functions\n"
+			"0: addr=0 args=0 locals=1 type=0 4/main\n"
+			"%d instr, %d bytes\n"
+			"%s", ninstrs, nbytes, body);
+	return vm_load_string(code);
+}
+
+/*
+ * func sum(n:int):int { var s=0 var i=1 while (i<=n) { s=s+i i=i+1 } return s }
+ * print(sum(100))
+ */
+static char *sum_code =
+	"0 strings\n"
+	"2 functions\n"
+	"0: addr=0 args=1 locals=2 type=1 3/sum\n"
+	"1: addr=60 args=0 locals=0 type=0 4/main\n"
+	"30 instr, 72 bytes\n"
+	"GC_START\n"
+	"ICONST 0\n"
+	"STORE 1\n"
+	"ICONST 1\n"
+	"STORE 2\n"
+	"ILOAD 2\n"
+	"ILOAD 0\n"
+	"ILE\n"
+	"BRF 28\n"
+	"ILOAD 1\n"
+	"ILOAD 2\n"
+	"IADD\n"
+	"STORE 1\n"
+	"ILOAD 2\n"
+	"ICONST 1\n"
+	"IADD\n"
+	"STORE 2\n"
+	"BR -32\n"
+	"ILOAD 1\n"
+	"GC_END\n"
+	"RET\n"
+	"PUSH_DFLT_RETV\n"
+	"RET\n"
+	"GC_END\n"
+	"GC_START\n"
+	"ICONST 100\n"
+	"CALL 0\n"
+	"IPRINT\n"
+	"GC_END\n"
+	"HALT\n";
+
+void sum_loop_verifies() {
+	VM *vm = vm_load_string(sum_code);
+	assert_true(vm->verified);
+	assert_equal(vm_function(vm, "sum")->max_stack, 2);
+	assert_equal(vm_function(vm, "main")->max_stack, 1);
+	vm_exec(vm, false);
+}
+
+void vector_of_constant_size() {
+	VM *vm = load_main(
+		"FCONST 1.0\n"
+		"FCONST 2.0\n"
+		"ICONST 2\n"
+		"VECTOR\n"
+		"VPRINT\n"
+		"HALT\n", 6, 26);
+	assert_true(vm->verified);
+	assert_equal(vm->functions[0].max_stack, 3);
+}
+
+void stack_underflow() {
+	VM *vm = load_main("ICONST 1\nIADD\nIPRINT\nHALT\n", 4, 8);
+	assert_false(vm->verified);
+}
+
+void local_out_of_range() {
+	VM *vm = load_main("ICONST 1\nSTORE 3\nHALT\n", 3, 9);
+	assert_false(vm->verified);
+}
+
+void float_op_on_ints() {
+	VM *vm = load_main("ICONST 1\nICONST 2\nFADD\nFPRINT\nHALT\n", 5, 13);
+	assert_false(vm->verified);
+}
+
+void branch_out_of_function() {
+	VM *vm = load_main("BR 100\nHALT\n", 2, 4);
+	assert_false(vm->verified);
+}
+
+void bad_call_index() {
+	VM *vm = load_main("CALL 5\nHALT\n", 2, 4);
+	assert_false(vm->verified);
+}
+
+void different_depths_at_join() {
+	// ICONST 1; BRF over an ICONST leaves 0 or 1 values at the join
+	VM *vm = load_main("ICONST 1\nBRF 8\nICONST 7\nHALT\n", 4, 14);
+	assert_false(vm->verified);
+}
+
+/* All samples verify except two whose code generator stores to the local
+ * just past nargs+nlocals; those run on the checked interpreter loop.
+ */
+void samples_verify() {
+	char samplesfile[2000];
+	int nsamples = 0;
+	DIR *dir = opendir(samplesdir);
+	assert_addr_not_equal(dir, NULL);
+	struct dirent *dp;
+	while ( (dp = readdir(dir))!=NULL ) {
+		if ( strstr(dp->d_name, ".wasm")==NULL ) continue;
+		strcpy(samplesfile, samplesdir);
+		strcat(samplesfile, "/");
+		strcat(samplesfile, dp->d_name);
+		printf("%s\n", dp->d_name);
+		FILE *f = fopen(samplesfile, "r");
+		VM *vm = vm_load(f); // closes f
+		bool bad = strcmp(dp->d_name, "bubble_sort.wasm")==0 || strcmp(dp->d_name, "quick_sort.wasm")==0;
+		assert_equal(vm_verify(vm, !bad), !bad);
+		nsamples++;
+	}
+	closedir(dir);
+	assert_true(nsamples>0);
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+
+	char *wichruntime = getenv("WICHRUNTIME");
+	if ( wichruntime==NULL ) {
+		fprintf(stderr, "environment variable WICHRUNTIME not set to root of runtime area\n");
+		return -1;
+	}
+	strcpy(samplesdir, wichruntime);
+	strcat(samplesdir, "/vm/test/samples");
+
+	test(sum_loop_verifies);
+	test(vector_of_constant_size);
+	test(stack_underflow);
+	test(local_out_of_range);
+	test(float_op_on_ints);
+	test(branch_out_of_function);
+	test(bad_call_index);
+	test(different_depths_at_join);
+	test(samples_verify);
+	return 0;
+}
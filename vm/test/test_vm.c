@@ -24,6 +24,9 @@ SOFTWARE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
 #include <wich.h>
 #include "vm.h"
 
@@ -34,10 +37,7 @@ static void setup()		{ }
 static void teardown()	{ }
 
 static void run(char *code) {
-	save_string("/tmp/t.wasm", code);
-	FILE *f = fopen("/tmp/t.wasm", "r");
-	VM *vm = vm_load(f);
-	fclose(f);
+	VM *vm = vm_load_string(code);
 	vm_exec(vm,false);
 }
 
@@ -598,6 +598,78 @@ void test_div_error() {
     run(code);
 }
 
+// run code in a child with stdout in output; returns its exit status
+static int run_to_exit(char *code, bool cache_tos, bool jit, char *output) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if ( pid==0 ) {
+        int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        dup2(fd, 1);
+        close(fd);
+        VM *vm = vm_load_string(code);
+        vm->cache_tos = cache_tos;
+        vm->jit = jit;
+        vm->jit_threshold = 0;
+        vm_exec(vm, false);
+        exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/*
+ * print(1)  print(7 / 0)  print(2)
+ * print(1)  print(7.0 / 0.0)  print(2)
+ *
+ * Output before the division is flushed and nothing after it runs.
+ */
+void division_by_zero_stops() {
+    char *codes[] = {
+        "0 strings\n"
+        "1 functions\n"
+        "0: addr=0 args=0 locals=0 type=0 4/main\n"
+        "11 instr, 27 bytes\n"
+        "GC_START\n"
+        "ICONST 1\n"
+        "IPRINT\n"
+        "ICONST 7\n"
+        "ICONST 0\n"
+        "IDIV\n"
+        "IPRINT\n"
+        "ICONST 2\n"
+        "IPRINT\n"
+        "GC_END\n"
+        "HALT\n",
+        "0 strings\n"
+        "1 functions\n"
+        "0: addr=0 args=0 locals=0 type=0 4/main\n"
+        "11 instr, 35 bytes\n"
+        "GC_START\n"
+        "ICONST 1\n"
+        "IPRINT\n"
+        "FCONST 7.0\n"
+        "FCONST 0.0\n"
+        "FDIV\n"
+        "FPRINT\n"
+        "ICONST 2\n"
+        "IPRINT\n"
+        "GC_END\n"
+        "HALT\n"
+    };
+    char output[100];
+    for (int k = 0; k < 2; k++) {
+        for (int tier = 0; tier < 3; tier++) {
+            assert_equal(run_to_exit(codes[k], tier==1, tier==2, "/tmp/wich_div.txt"), 1);
+            FILE *f = fopen("/tmp/wich_div.txt", "r");
+            size_t n = fread(output, 1, sizeof(output) - 1, f);
+            fclose(f);
+            output[n] = '\0';
+            assert_str_equal(output, "1\n");
+        }
+    }
+}
+
 /*var x = [1,2,3]
  * x[4] = 4
  * print(x)
@@ -775,6 +847,62 @@ void test_while() {
     run(code);
 }
 
+/*
+ * func lt(s:string, t:string):boolean { return s < t }
+ * func len(s:string):int { return len(s) }
+ * func isabc(s:string):boolean { return s == "abc" }
+ */
+void string_ops_allocate_nothing() {
+    char *code =
+        "1 strings\n"
+        "0: 3/abc\n"
+        "4 functions\n"
+        "0: addr=0 args=2 locals=0 type=3 2/lt\n"
+        "1: addr=10 args=1 locals=0 type=1 3/len\n"
+        "2: addr=17 args=1 locals=0 type=3 5/isabc\n"
+        "3: addr=27 args=0 locals=0 type=0 4/main\n"
+        "18 instr, 28 bytes\n"
+        "GC_START\n"
+        "SLOAD 0\n"
+        "SLOAD 1\n"
+        "SLT\n"
+        "GC_END\n"
+        "RET\n"
+        "GC_START\n"
+        "SLOAD 0\n"
+        "SLEN\n"
+        "GC_END\n"
+        "RET\n"
+        "GC_START\n"
+        "SLOAD 0\n"
+        "SCONST 0\n"
+        "SEQ\n"
+        "GC_END\n"
+        "RET\n"
+        "HALT\n";
+    VM *vm = vm_load_string(code);
+    String *abc = String_new("abc"), *abcd = String_new("abcd");
+    int busy = get_heap_info().busy;
+
+    vm->stack[++vm->sp].s = abc;
+    vm->stack[++vm->sp].s = abcd;
+    vm_invoke(vm, vm_function(vm, "lt"));
+    assert_true(vm->stack[vm->sp--].b);
+    vm->stack[++vm->sp].s = abcd;
+    vm->stack[++vm->sp].s = abc;
+    vm_invoke(vm, vm_function(vm, "lt"));
+    assert_false(vm->stack[vm->sp--].b);
+    vm->stack[++vm->sp].s = abcd;
+    vm_invoke(vm, vm_function(vm, "len"));
+    assert_equal(vm->stack[vm->sp--].i, 4);
+    vm->stack[++vm->sp].s = abc;
+    vm_invoke(vm, vm_function(vm, "isabc"));
+    assert_true(vm->stack[vm->sp--].b);
+    assert_false(ptr_is_in_heap((heap_object *)vm->strings[0])); // literals live outside the heap
+
+    assert_equal(get_heap_info().busy, busy);
+}
+
 int main(int argc, char *argv[]) {
     cunit_setup = setup;
     cunit_teardown = teardown;
@@ -798,10 +926,12 @@ int main(int argc, char *argv[]) {
     test(test_len2);
     test(test_float_div);
     test(test_div_error);
+    test(division_by_zero_stops);
     test(test_index_out_of_range);
     test(test_need_default_return);
     test(test_bubblesort);
     test(test_while);
+    test(string_ops_allocate_nothing);
     return 0;
 }
 
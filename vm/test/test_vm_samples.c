@@ -31,23 +31,28 @@ SOFTWARE.
 
 #include <cunit.h>
 #include <wloader.h>
+#include "samples.h"
 
 static void setup()		{ }
 static void teardown()	{ }
 
+static void cache_top_of_stack(VM *vm) {
+	vm->cache_tos = true;
+}
+
+/* Differential test: every sample on the plain loop and again on the loop
+ * that caches the top of the stack; stdout must be the same.
+ */
+void cache_tos_matches_plain_loop() {
+	samples_match(cache_top_of_stack, NULL);
+}
+
 int main(int argc, char *argv[]) {
 	cunit_setup = setup;
 	cunit_teardown = teardown;
-	char samplesdir[2000];
 	char samplesfile[2000];
 
-	char* wichruntime = getenv("WICHRUNTIME"); // set in intellij "test_vm_samples" environment variable config area
-	if ( wichruntime==NULL ) {
-		fprintf(stderr, "environment variable WICHRUNTIME not set to root of runtime area\n");
-		return -1;
-	}
-	strcpy(samplesdir, wichruntime);
-	strcat(samplesdir, "/vm/test/samples");
+	if ( !find_samples() ) return -1; // set in intellij "test_vm_samples" environment variable config area
 
 	struct dirent *dp;
 	DIR *dir = opendir(samplesdir);
@@ -61,9 +66,9 @@ int main(int argc, char *argv[]) {
 				strcat(samplesfile, "/");
 				strcat(samplesfile, filename);
 				FILE *f = fopen(samplesfile, "r");
-				VM *vm = vm_load(f);
+				VM *vm = vm_load(f); // closes f
 				vm_exec(vm, false);
-				fclose(f);
+				vm_free(vm);
 			}
 			dp = readdir(dir);
 		}
@@ -72,5 +77,7 @@ int main(int argc, char *argv[]) {
 	else {
 		fprintf(stderr, "can't find samples dir\n");
 	}
+
+	test(cache_tos_matches_plain_loop);
 	return 0;
 }
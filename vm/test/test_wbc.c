@@ -0,0 +1,181 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <wich.h>
+#include "vm.h"
+
+#include <cunit.h>
+#include <wloader.h>
+
+static void setup()		{ }
+static void teardown()	{ }
+
+static VM *load(char *filename) {
+	FILE *f = fopen(filename, "r");
+	return vm_load(f); // closes f
+}
+
+static void write_wbc(char *code, char *filename) {
+	save_string("/tmp/t.wasm", code);
+	VM *vm = load("/tmp/t.wasm");
+	FILE *f = fopen(filename, "w");
+	assert_true(vm_write_binary(vm, f));
+	fclose(f);
+	vm_free(vm);
+}
+
+/*
+ * func twice(x:int) : int { return x*2 }
+ * var f = 0.1
+ * var n = len("hello")
+ * var y = twice(7)
+ */
+static char *code =
+	"1 strings\n"
+	"0: 5/hello\n"
+	"2 functions\n"
+	"0: addr=31 args=1 locals=0 type=1 5/twice\n"
+	"1: addr=0 args=0 locals=3 type=0 4/main\n"
+	"13 instr, 41 bytes\n"
+	"FCONST 0.1\n"
+	"STORE 0\n"
+	"SCONST 0\n"
+	"SLEN\n"
+	"STORE 1\n"
+	"ICONST 7\n"
+	"CALL 0\n"
+	"STORE 2\n"
+	"HALT\n"
+	"ILOAD 0\n"
+	"ICONST 2\n"
+	"IMUL\n"
+	"RET\n";
+
+void binary_loads_like_text() {
+	write_wbc(code, "/tmp/t.wbc");
+	VM *text = load("/tmp/t.wasm");
+	VM *vm = load("/tmp/t.wbc");
+	assert_addr_not_equal(vm, NULL);
+	assert_equal(vm->code_size, text->code_size);
+	assert_equal(memcmp(vm->code, text->code, (size_t)text->code_size+1), 0);
+	assert_true(vm->code >= (byte *)vm->image && vm->code < (byte *)vm->image + vm->image_size); // not copied
+	assert_equal(vm->num_instrs, text->num_instrs);
+	assert_equal(vm->verified, text->verified);
+	assert_equal(vm->num_functions, 2);
+	assert_str_equal(vm->functions[0].name, "twice");
+	assert_equal(vm->functions[0].address, 31);
+	assert_equal(vm->functions[0].nargs, 1);
+	assert_equal(vm->functions[0].return_type, INT_TYPE);
+	assert_equal(vm->functions[1].nlocals, 3);
+	assert_equal(vm->num_strings, 1);
+	assert_str_equal(vm->strings[0]->str, "hello");
+	vm_free(text);
+
+	vm_exec(vm, false);
+	assert_equal(vm->stack[vm->fp+1].i, 5);
+	assert_equal(vm->stack[vm->fp+2].i, 14);
+	vm_free(vm);
+}
+
+void fconst_keeps_double_precision() {
+	write_wbc(code, "/tmp/t.wbc");
+	VM *vm = load("/tmp/t.wbc");
+	assert_true(vm->instrs[0].a.f==0.1);
+	vm_exec(vm, false);
+	assert_true(vm->stack[vm->fp].f==0.1);
+	vm_free(vm);
+}
+
+void rejects_other_versions() {
+	write_wbc(code, "/tmp/t.wbc");
+	FILE *f = fopen("/tmp/t.wbc", "r+");
+	fseek(f, 4, SEEK_SET);
+	fputc(99, f);
+	fclose(f);
+	assert_addr_equal(load("/tmp/t.wbc"), NULL);
+}
+
+// the object file is little-endian
+static unsigned int read_le(FILE *f, long offset, int n) {
+	unsigned int v = 0;
+	fseek(f, offset, SEEK_SET);
+	for (int k = 0; k < n; k++) v |= (unsigned int)fgetc(f) << 8*k;
+	return v;
+}
+
+static void write_le(FILE *f, long offset, unsigned int v, int n) {
+	fseek(f, offset, SEEK_SET);
+	for (int k = 0; k < n; k++) fputc((int)(v >> 8*k) & 0xFF, f);
+}
+
+void rejects_lengths_past_the_end() {
+	write_wbc(code, "/tmp/t.wbc");
+	FILE *f = fopen("/tmp/t.wbc", "r+");
+	write_le(f, read_le(f, 20, 4), 0x7FFFFFF0, 4); // "hello"
+	fclose(f);
+	assert_addr_equal(load("/tmp/t.wbc"), NULL);
+
+	write_wbc(code, "/tmp/t.wbc");
+	f = fopen("/tmp/t.wbc", "r+");
+	write_le(f, read_le(f, 24, 4) + 10, 0xFFFF, 2); // "twice"
+	fclose(f);
+	assert_addr_equal(load("/tmp/t.wbc"), NULL);
+}
+
+// code starts at the offset in header bytes 28..31; see the layout of code above
+static void damage_code(long offset, unsigned int v, int n) {
+	write_wbc(code, "/tmp/t.wbc");
+	FILE *f = fopen("/tmp/t.wbc", "r+");
+	write_le(f, read_le(f, 28, 4) + offset, v, n);
+	fclose(f);
+}
+
+void rejects_invalid_code() {
+	damage_code(0, 0xFF, 1); // FCONST
+	assert_addr_equal(load("/tmp/t.wbc"), NULL);
+
+	damage_code(25, 2, 2); // CALL 0
+	assert_addr_equal(load("/tmp/t.wbc"), NULL);
+
+	damage_code(13, 1, 2); // SCONST 0
+	assert_addr_equal(load("/tmp/t.wbc"), NULL);
+
+	damage_code(40, ICONST, 1); // RET, so ICONST's operand runs past the end
+	assert_addr_equal(load("/tmp/t.wbc"), NULL);
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+
+	test(binary_loads_like_text);
+	test(fconst_keeps_double_precision);
+	test(rejects_other_versions);
+	test(rejects_lengths_past_the_end);
+	test(rejects_invalid_code);
+	return 0;
+}
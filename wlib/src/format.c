@@ -0,0 +1,140 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include "wich.h"
+#include "persistent_vector.h"
+#include "format.h"
+
+// digits of u right after buf; returns how many
+static int format_u64(char *buf, uint64_t u)
+{
+	char digits[20];
+	int n = 0;
+	do {
+		digits[n++] = (char)('0' + u % 10);
+		u /= 10;
+	} while ( u>0 );
+	for (int i = 0; i < n; i++) buf[i] = digits[n-1-i];
+	return n;
+}
+
+int format_int(char *buf, int value)
+{
+	int len = 0;
+	if ( value<0 ) buf[len++] = '-';
+	len += format_u64(&buf[len], value<0 ? 0 - (uint64_t)(int64_t)value : (uint64_t)value);
+	buf[len] = '\0';
+	return len;
+}
+
+/* |value| is mant/2^shift for a 53-bit mant, so value*10^decimals rounds
+ * to (mant*10^decimals)/2^shift rounded half to even, which stays in 64
+ * bits. That is what printf prints, digit for digit. Bigger values,
+ * infinity and NaN go to printf.
+ */
+int format_fixed(char *buf, double value, int decimals)
+{
+	static const uint64_t scales[] = {1, 10, 100, 1000};
+	if ( decimals<0 || decimals>FORMAT_MAX_DECIMALS || !isfinite(value) || fabs(value)>=0x1p53 ) {
+		return snprintf(buf, FORMAT_FLOAT_SIZE, "%.*f", decimals, value);
+	}
+	int e;
+	double m = frexp(fabs(value), &e);	// |value| = m * 2^e with 0.5 <= m < 1, or m = 0
+	uint64_t mant = (uint64_t)ldexp(m, 53);
+	int shift = 53 - e;
+	uint64_t scaled = mant * scales[decimals];
+	uint64_t q = 0;
+	if ( shift==0 ) q = scaled;
+	else if ( shift<64 ) {
+		q = scaled >> shift;
+		uint64_t rem = scaled & ((UINT64_C(1) << shift) - 1);
+		uint64_t half = UINT64_C(1) << (shift - 1);
+		if ( rem>half || (rem==half && (q & 1)) ) q++;
+	}
+	// else scaled < 2^63 <= 2^(shift-1) so value*10^decimals rounds to 0
+
+	int len = 0;
+	if ( signbit(value) ) buf[len++] = '-';
+	len += format_u64(&buf[len], q / scales[decimals]);
+	if ( decimals>0 ) {
+		buf[len++] = '.';
+		uint64_t frac = q % scales[decimals];
+		for (int i = decimals-1; i >= 0; i--) {
+			buf[len+i] = (char)('0' + frac % 10);
+			frac /= 10;
+		}
+		len += decimals;
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+// make room for n more chars in *s, which holds len of capacity *max
+static char *reserve(char *s, size_t len, size_t *max, size_t n)
+{
+	if ( len + n <= *max ) return s;
+	while ( len + n > *max ) *max *= 2;
+	return realloc(s, *max);
+}
+
+char *format_vector(PVector_ptr a, size_t *length)
+{
+	size_t n = a.vector->length;
+	size_t max = 8 * n + FORMAT_FLOAT_SIZE; // "1.00, " per element is typical
+	char *s = malloc(max);
+	size_t len = 0;
+	s[len++] = '[';
+	for (size_t i = 0; i < n; i++) {
+		s = reserve(s, len, &max, FORMAT_FLOAT_SIZE + 3);
+		if ( i>0 ) {
+			s[len++] = ',';
+			s[len++] = ' ';
+		}
+		len += format_fixed(&s[len], ith(a, (int)i), 2);
+	}
+	s = reserve(s, len, &max, 2);
+	s[len++] = ']';
+	s[len] = '\0';
+	if ( length!=NULL ) *length = len;
+	return s;
+}
+
+char *format_vector_ints(PVector_ptr a, size_t *length)
+{
+	size_t n = a.vector->length;
+	size_t max = 2 * n + FORMAT_INT_SIZE;
+	char *s = malloc(max);
+	size_t len = 0;
+	for (size_t i = 0; i < n; i++) {
+		s = reserve(s, len, &max, FORMAT_INT_SIZE);
+		len += format_int(&s[len], (int)ith(a, (int)i));
+	}
+	s[len] = '\0';
+	if ( length!=NULL ) *length = len;
+	return s;
+}
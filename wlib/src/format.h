@@ -0,0 +1,53 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef RUNTIME_FORMAT_H
+#define RUNTIME_FORMAT_H
+
+#include <stddef.h>
+
+/* Number and vector formatting for print and the string conversions,
+ * without going through printf's format parsing. format_int() is "%d"
+ * and format_fixed() is "%.*f" for up to FORMAT_MAX_DECIMALS decimals,
+ * rounded exactly like printf rounds. Both write a NUL-terminated string
+ * to buf and return its length; buf needs FORMAT_INT_SIZE or
+ * FORMAT_FLOAT_SIZE chars.
+ *
+ * format_vector() renders a vector as print_vector() shows it, e.g.
+ * "[1.00, 2.00]", and format_vector_ints() concatenates its elements as
+ * ints like String_from_vector(). They return a malloc'd string, which the
+ * caller frees, and its length in time linear in the length of the vector.
+ *
+ * Include after wich.h.
+ */
+
+static const int FORMAT_INT_SIZE = 12;		// "-2147483648"
+static const int FORMAT_MAX_DECIMALS = 3;
+static const int FORMAT_FLOAT_SIZE = 320;	// -DBL_MAX with FORMAT_MAX_DECIMALS decimals
+
+int format_int(char *buf, int value);
+int format_fixed(char *buf, double value, int decimals);
+char *format_vector(PVector_ptr a, size_t *length);
+char *format_vector_ints(PVector_ptr a, size_t *length);
+
+#endif
@@ -28,6 +28,7 @@ SOFTWARE.
 
 #include "wich.h"
 #include "persistent_vector.h"
+#include "format.h"
 
 /*
  * Per "Making Data Structures Persistent"
@@ -140,21 +141,14 @@ void set_ith(PVector_ptr vptr, int i, double value) {
 }
 
 char *PVector_as_string(PVector_ptr a) {
-	char *s = calloc(a.vector->length*20, sizeof(char));
-	char buf[50];
-	strcat(s, "[");
-	for (int i=0; i<a.vector->length; i++) {
-		if ( i>0 ) strcat(s, ", ");
-		sprintf(buf, "%1.2f", ith(a, i));
-		strcat(s, buf);
-	}
-	strcat(s, "]");
-	return s;
+	return format_vector(a, NULL);
 }
 
 void print_pvector(PVector_ptr a) {
-	char *vs = PVector_as_string(a);
-	printf("%s\n", vs);
+	size_t n;
+	char *vs = format_vector(a, &n);
+	vs[n] = '\n'; // replaces the NUL
+	fwrite(vs, 1, n+1, stdout);
 	free(vs);
 }
 
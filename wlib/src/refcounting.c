@@ -22,18 +22,19 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 #include <stdlib.h>
+#include <limits.h>
 
 #include "wich.h"
 #include "persistent_vector.h"
 #include "refcounting.h"
 
-// WARNING: refcounting is not synchronized so concurrency is not supported
+// WARNING: refcounting is not synchronized so threads can't share objects
 //          but we must still destroy mutex's created by persistent vector lib
-//          during free.
+//          during free. Each thread has its own roots.
 
 static const int MAX_ROOTS = 1024;
-static int sp = -1; // grow upwards; inc then set for push.
-static heap_object **roots[MAX_ROOTS];
+static __thread int sp = -1; // grow upwards; inc then set for push.
+static __thread heap_object **roots[MAX_ROOTS];
 
 PVector *PVector_alloc(size_t length) {
 	PVector *p = (PVector *)calloc(1, sizeof(PVector) + length * sizeof(PVectorFatNode));
@@ -59,6 +60,12 @@ String *String_alloc(size_t length) {
 	return p;
 }
 
+String *String_alloc_immortal(size_t length) {
+	String *p = String_alloc(length);
+	p->metadata.refs = INT_MAX / 2; // no sequence of DEREFs brings this to 0
+	return p;
+}
+
 void free_object(heap_object *o) {
 	if ( o->type==REFCOUNT_STRING_TYPE ) {
 #ifdef DEBUG
@@ -0,0 +1,119 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <wich.h>
+#include "vector_expr.h"
+
+static const int VEXPR_BLOCK = 128; // elements computed per pass over the ops; keeps temps in L1
+
+void Vector_expr_init(Vector_expr *e, PVector_ptr v)
+{
+	e->length = v.vector->length;
+	e->n = 1;
+	e->depth = 1;
+	e->ops[0].op = VEXPR_LEAF;
+	e->ops[0].leaf = v;
+}
+
+/* l = l op r; false if the vectors differ in length or the result won't fit.
+ * Either way l is untouched, so the caller can fall back on eager evaluation.
+ */
+bool Vector_expr_binary(Vector_expr *l, const Vector_expr *r, VEXPR_OP op)
+{
+	if ( l->length!=r->length || l->n + r->n + 1 > MAX_VECTOR_EXPR_OPS ) return false;
+	for (int k = 0; k < r->n; k++) l->ops[l->n++] = r->ops[k];
+	l->ops[l->n].op = op;
+	l->ops[l->n++].leaf = NIL_VECTOR;
+	if ( r->depth+1 > l->depth ) l->depth = r->depth+1; // r is evaluated on top of l
+	return true;
+}
+
+bool Vector_expr_scalar(Vector_expr *e, VEXPR_OP op, double s)
+{
+	if ( e->n + 1 > MAX_VECTOR_EXPR_OPS ) return false;
+	e->ops[e->n].op = op;
+	e->ops[e->n].leaf = NIL_VECTOR;
+	e->ops[e->n].scalar = s;
+	e->n++;
+	return true;
+}
+
+static inline double leaf_elem(PVector_ptr a, size_t i) {
+	PVectorFatNode *node = &a.vector->nodes[i];
+	return node->head==NULL ? node->data : ith(a, (int)i);
+}
+
+/* Compute e into a new vector, a block of elements at a time: each op is a
+ * tight loop over VEXPR_BLOCK doubles and intermediate values never leave
+ * the temps, so there is one allocation and one pass over every leaf. That
+ * allocation may collect, so whoever holds e must keep its leaves rooted.
+ */
+PVector_ptr Vector_expr_eval(Vector_expr *e)
+{
+	size_t n = e->length;
+	PVector *v = PVector_alloc(n);
+	v->version_count = 0;
+	PVector_ptr c = {0, v};
+
+	double temps[e->depth][VEXPR_BLOCK];
+	for (size_t base = 0; base < n; base += VEXPR_BLOCK) {
+		size_t m = n - base < VEXPR_BLOCK ? n - base : VEXPR_BLOCK;
+		double *t = NULL; // top of the evaluation stack
+		int top = -1;
+		for (int k = 0; k < e->n; k++) {
+			Vector_expr_op *op = &e->ops[k];
+			double *r = t, s;
+			if ( op->op>=VEXPR_ADD && op->op<=VEXPR_DIV ) t = temps[--top];
+			switch ( op->op ) {
+				case VEXPR_LEAF :
+					t = temps[++top];
+					for (size_t j = 0; j < m; j++) t[j] = leaf_elem(op->leaf, base + j);
+					break;
+				case VEXPR_ADD : for (size_t j = 0; j < m; j++) t[j] += r[j]; break;
+				case VEXPR_SUB : for (size_t j = 0; j < m; j++) t[j] -= r[j]; break;
+				case VEXPR_MUL : for (size_t j = 0; j < m; j++) t[j] *= r[j]; break;
+				case VEXPR_DIV :
+					for (size_t j = 0; j < m; j++) {
+						if ( r[j]==0 ) {
+							fprintf(stderr, "ZeroDivisionError: Divisor cann't be 0\n");
+							return NIL_VECTOR;
+						}
+						t[j] /= r[j];
+					}
+					break;
+				case VEXPR_ADD_SCALAR : s = op->scalar; for (size_t j = 0; j < m; j++) t[j] += s; break;
+				case VEXPR_SUB_SCALAR : s = op->scalar; for (size_t j = 0; j < m; j++) t[j] -= s; break;
+				case VEXPR_MUL_SCALAR : s = op->scalar; for (size_t j = 0; j < m; j++) t[j] *= s; break;
+				case VEXPR_DIV_SCALAR : s = op->scalar; for (size_t j = 0; j < m; j++) t[j] /= s; break;
+			}
+		}
+		for (size_t j = 0; j < m; j++) {
+			v->nodes[base + j].data = t[j];
+			v->nodes[base + j].head = NULL;
+		}
+	}
+	return c;
+}
@@ -0,0 +1,59 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#ifndef RUNTIME_VECTOR_EXPR_H
+#define RUNTIME_VECTOR_EXPR_H
+
+/* A deferred vector expression such as a + b * c - d. Rather than allocating
+ * a PVector for every operator, build the expression in postfix form and
+ * compute all of it in one fused loop by Vector_expr_eval() once someone
+ * needs the elements. Results match Vector_add() and friends exactly.
+ */
+
+static const int MAX_VECTOR_EXPR_OPS = 16;	// leaves, scalars and operators per expression
+
+typedef enum {
+	VEXPR_LEAF,			// push elements of a vector
+	VEXPR_ADD, VEXPR_SUB, VEXPR_MUL, VEXPR_DIV,
+	VEXPR_ADD_SCALAR, VEXPR_SUB_SCALAR, VEXPR_MUL_SCALAR, VEXPR_DIV_SCALAR
+} VEXPR_OP;
+
+typedef struct {
+	VEXPR_OP op;
+	PVector_ptr leaf;	// VEXPR_LEAF
+	double scalar;		// VEXPR_*_SCALAR
+} Vector_expr_op;
+
+typedef struct {
+	size_t length;		// of every leaf and of the result
+	int n;				// ops in use
+	int depth;			// evaluation stack depth needed
+	Vector_expr_op ops[MAX_VECTOR_EXPR_OPS];
+} Vector_expr;
+
+void Vector_expr_init(Vector_expr *e, PVector_ptr v);
+bool Vector_expr_binary(Vector_expr *l, const Vector_expr *r, VEXPR_OP op);
+bool Vector_expr_scalar(Vector_expr *e, VEXPR_OP op, double s);
+PVector_ptr Vector_expr_eval(Vector_expr *e);
+
+#endif
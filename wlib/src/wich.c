@@ -27,6 +27,7 @@ SOFTWARE.
 #include <stdbool.h>
 #include <wich.h>
 #include "persistent_vector.h"
+#include "format.h"
 #include <assert.h>
 
 #ifndef REFCOUNTING
@@ -49,6 +50,9 @@ String *String_alloc(size_t length) {
 	p->length = length;
 	return p;
 }
+String *String_alloc_immortal(size_t length) {
+	return String_alloc(length); // nothing is ever freed anyway
+}
 #endif
 
 static void inline vector_operation_error() {
@@ -180,6 +184,98 @@ PVector_ptr Vector_div(PVector_ptr a, PVector_ptr b)
 	return c;
 }
 
+/* Vector-scalar kernels for the VADDI/VADDF... family. Unlike Vector_add(a,
+ * Vector_from_int(s, n)) they allocate only the result and make one pass over a,
+ * reading the unversioned default value directly when the node has no history.
+ */
+static inline double vector_elem(PVector_ptr a, int i) {
+	PVectorFatNode *node = &a.vector->nodes[i];
+	return node->head==NULL ? node->data : ith(a, i);
+}
+
+static inline PVector_ptr vector_result(size_t n) {
+	PVector *v = PVector_alloc(n);
+	v->version_count = 0;
+	return (PVector_ptr){0, v};
+}
+
+PVector_ptr Vector_add_scalar(PVector_ptr a, double s)
+{
+	REF((heap_object *)a.vector);
+	if ( a.vector==NULL ) {
+		null_pointer_error("Addition operator cannot be applied to NULL Vectors\n");
+		return NIL_VECTOR;
+	}
+	int i;
+	size_t n = a.vector->length;
+	PVector_ptr c = vector_result(n);
+	for (i=0; i<n; i++) {
+		c.vector->nodes[i].data = vector_elem(a, i) + s;
+		c.vector->nodes[i].head = NULL;
+	}
+	DEREF((heap_object *)a.vector);
+	return c;
+}
+
+PVector_ptr Vector_sub_scalar(PVector_ptr a, double s)
+{
+	REF((heap_object *)a.vector);
+	if ( a.vector==NULL ) {
+		null_pointer_error("Subtraction operator cannot be applied to NULL Vectors\n");
+		return NIL_VECTOR;
+	}
+	int i;
+	size_t n = a.vector->length;
+	PVector_ptr c = vector_result(n);
+	for (i=0; i<n; i++) {
+		c.vector->nodes[i].data = vector_elem(a, i) - s;
+		c.vector->nodes[i].head = NULL;
+	}
+	DEREF((heap_object *)a.vector);
+	return c;
+}
+
+PVector_ptr Vector_mul_scalar(PVector_ptr a, double s)
+{
+	REF((heap_object *)a.vector);
+	if ( a.vector==NULL ) {
+		null_pointer_error("Multiplication operator cannot be applied to NULL Vectors\n");
+		return NIL_VECTOR;
+	}
+	int i;
+	size_t n = a.vector->length;
+	PVector_ptr c = vector_result(n);
+	for (i=0; i<n; i++) {
+		c.vector->nodes[i].data = vector_elem(a, i) * s;
+		c.vector->nodes[i].head = NULL;
+	}
+	DEREF((heap_object *)a.vector);
+	return c;
+}
+
+PVector_ptr Vector_div_scalar(PVector_ptr a, double s)
+{
+	REF((heap_object *)a.vector);
+	if ( a.vector==NULL ) {
+		null_pointer_error("Division operator cannot be applied to NULL Vectors\n");
+		return NIL_VECTOR;
+	}
+	if ( s==0 ) {
+		fprintf(stderr, "ZeroDivisionError: Divisor cann't be 0\n");
+		DEREF((heap_object *)a.vector);
+		return NIL_VECTOR;
+	}
+	int i;
+	size_t n = a.vector->length;
+	PVector_ptr c = vector_result(n);
+	for (i=0; i<n; i++) {
+		c.vector->nodes[i].data = vector_elem(a, i) / s;
+		c.vector->nodes[i].head = NULL;
+	}
+	DEREF((heap_object *)a.vector);
+	return c;
+}
+
 bool Vector_eq(PVector_ptr a, PVector_ptr b) {
 	REF((heap_object *)a.vector);
 	REF((heap_object *)b.vector);
@@ -230,6 +326,14 @@ String *String_new(char *orig)
 	return s;
 }
 
+// a copy of s that is never collected
+String *String_immortal(char *orig)
+{
+	String *s = String_alloc_immortal(strlen(orig));
+	strcpy(s->str, orig);
+	return s;
+}
+
 String *String_from_char(char c)
 {
 	char buf[2] = {c, '\0'};
@@ -241,25 +345,21 @@ String *String_from_vector(PVector_ptr v) {
 		null_pointer_error("NULL Vector object cannot be converted to string\n");
 		return NIL_STRING;
 	}
-	char s[v.vector->length*20];
-	s[0] = '\0';
-	for (int i=0; i<v.vector->length; i++) {
-		char buf[50];
-		sprintf(buf, "%d", (int)ith(v, i));
-		strcat(s, buf);
-	}
-	return String_new(s);
+	char *s = format_vector_ints(v, NULL);
+	String *result = String_new(s);
+	free(s);
+	return result;
 }
 
 String *String_from_int(int value) {
-	char buf[50];
-	sprintf(buf,"%d",value);
+	char buf[FORMAT_INT_SIZE];
+	format_int(buf, value);
 	return String_new(buf);
 }
 
 String *String_from_float(double value) {
-	char buf[50];
-	sprintf(buf,"%1.2f",value);
+	char buf[FORMAT_FLOAT_SIZE];
+	format_fixed(buf, value, 2);
 	return String_new(buf);
 }
 
@@ -278,7 +378,8 @@ void print_string(String *a)
 		return;
 	}
 	REF((heap_object *)a);
-	printf("%s\n", a->str);
+	fwrite(a->str, 1, a->length, stdout);
+	putchar('\n');
 	DEREF((heap_object *)a);
 }
 
@@ -292,19 +393,31 @@ String *String_add(String *s, String *t)
 	if ( t == NULL ) return s;
 	REF((heap_object *)s);
 	REF((heap_object *)t);
-	size_t n = strlen(s->str) + strlen(t->str);
+	size_t n = s->length + t->length;
 	String *u = String_alloc(n);
-	strcpy(u->str, s->str);
-	strcat(u->str, t->str);
+	memcpy(u->str, s->str, s->length);
+	memcpy(u->str + s->length, t->str, t->length + 1); // with the '\0'
 	DEREF((heap_object *)s);
 	DEREF((heap_object *)t);
 	return u;
 }
 
+/* Like strcmp() but uses the lengths we already have rather than scanning
+ * for '\0'; a prefix sorts before the longer string.
+ */
+int String_cmp(String *s, String *t) {
+	assert(s);
+	assert(t);
+	size_t n = s->length < t->length ? s->length : t->length;
+	int c = memcmp(s->str, t->str, n);
+	if ( c!=0 ) return c;
+	return (s->length > t->length) - (s->length < t->length);
+}
+
 bool String_eq(String *s, String *t) {
 	assert(s);
 	assert(t);
-	return strncmp(s->str, t->str, s->length > t->length ? s->length : t->length) == 0;
+	return s->length == t->length && memcmp(s->str, t->str, s->length) == 0;
 }
 
 bool String_neq(String *s, String *t) {
@@ -312,27 +425,19 @@ bool String_neq(String *s, String *t) {
 }
 
 bool String_gt(String *s, String *t) {
-	assert(s);
-	assert(t);
-	return strncmp(s->str, t->str, s->length > t->length ? s->length : t->length) > 0;
+	return String_cmp(s, t) > 0;
 }
 
 bool String_ge(String *s, String *t) {
-	assert(s);
-	assert(t);
-	return strncmp(s->str, t->str, s->length > t->length ? s->length : t->length) >= 0;
+	return String_cmp(s, t) >= 0;
 }
 
 bool String_lt(String *s, String *t) {
-	assert(s);
-	assert(t);
-	return strncmp(s->str, t->str, s->length > t->length ? s->length : t->length) < 0;
-
+	return String_cmp(s, t) < 0;
 }
+
 bool String_le(String *s, String *t) {
-	assert(s);
-	assert(t);
-	return strncmp(s->str, t->str, s->length > t->length ? s->length : t->length) <= 0;
+	return String_cmp(s, t) <= 0;
 }
 
 void print_alloc_strategy() {
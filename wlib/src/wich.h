@@ -61,6 +61,7 @@ static const PVector_ptr NIL_VECTOR = {-1,NULL};
 static String* NIL_STRING = NULL;
 
 String *String_new(char *s);
+String *String_immortal(char *s);
 String *String_from_char(char c);
 String *String_add(String *s, String *t);
 String *String_copy(String *s);
@@ -68,6 +69,7 @@ String *String_from_vector(PVector_ptr vector);
 String *String_from_int(int value);
 String *String_from_float(double value);
 
+int String_cmp(String *s, String *t);
 bool String_eq(String *s, String *t);
 bool String_neq(String *s, String *t);
 bool String_gt(String *s, String *t);
@@ -89,6 +91,10 @@ PVector_ptr Vector_add(PVector_ptr a, PVector_ptr b);
 PVector_ptr Vector_sub(PVector_ptr a, PVector_ptr b);
 PVector_ptr Vector_mul(PVector_ptr a, PVector_ptr b);
 PVector_ptr Vector_div(PVector_ptr a, PVector_ptr b);
+PVector_ptr Vector_add_scalar(PVector_ptr a, double s);
+PVector_ptr Vector_sub_scalar(PVector_ptr a, double s);
+PVector_ptr Vector_mul_scalar(PVector_ptr a, double s);
+PVector_ptr Vector_div_scalar(PVector_ptr a, double s);
 
 bool Vector_eq(PVector_ptr a, PVector_ptr b);
 bool Vector_neq(PVector_ptr a, PVector_ptr b);
@@ -99,6 +105,7 @@ void print_vector(PVector_ptr a);
 PVector *PVector_alloc(size_t length);
 PVectorFatNodeElem *PVectorFatNodeElem_alloc();
 String *String_alloc(size_t length);
+String *String_alloc_immortal(size_t length); // never collected; for literals
 void print_alloc_strategy();
 
 static void
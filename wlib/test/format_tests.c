@@ -0,0 +1,117 @@
+/*
+The MIT License (MIT)
+
+Copyright (c) 2015 Terence Parr, Hanzhou Shi, Shuai Yuan, Yuanyuan Zhang
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <cunit.h>
+#include <wich.h>
+#include <format.h>
+
+static void setup() {
+}
+
+static void teardown() {
+}
+
+static void check_int(int value) {
+	char expected[50], found[FORMAT_INT_SIZE];
+	snprintf(expected, sizeof(expected), "%d", value);
+	int n = format_int(found, value);
+	assert_str_equal(found, expected);
+	assert_equal(n, (int)strlen(expected));
+}
+
+static void check_fixed(double value, int decimals) {
+	char expected[FORMAT_FLOAT_SIZE], found[FORMAT_FLOAT_SIZE];
+	snprintf(expected, sizeof(expected), "%.*f", decimals, value);
+	int n = format_fixed(found, value, decimals);
+	if ( strcmp(found, expected)!=0 ) fprintf(stderr, "%a with %d decimals: %s\n", value, decimals, found);
+	assert_str_equal(found, expected);
+	assert_equal(n, (int)strlen(expected));
+}
+
+void test_ints() {
+	int values[] = {0, 1, -1, 9, 10, 99, 100, -100, 123456789, INT_MAX, INT_MIN, INT_MIN+1};
+	for (int i = 0; i < (int)(sizeof(values)/sizeof(values[0])); i++) check_int(values[i]);
+	srand(42);
+	for (int i = 0; i < 100000; i++) check_int(rand() - RAND_MAX/2);
+}
+
+void test_fixed_rounds_like_printf() {
+	// ties go to even when they are exact in binary and the nearer side otherwise
+	double values[] = {0.0, -0.0, 0.125, 0.375, -0.125, 2.675, 1.005, 0.005, 0.015, 0.5, 1.5, 2.5,
+					   99.995, 999.9999, -0.001, 1e-300, 0x1p-1074, 3.14159, 1e15 + 0.125, 0x1p53 - 1,
+					   0x1p53, 1e20, -1e300, INFINITY, -INFINITY, NAN};
+	for (int i = 0; i < (int)(sizeof(values)/sizeof(values[0])); i++) {
+		for (int d = 0; d <= FORMAT_MAX_DECIMALS; d++) check_fixed(values[i], d);
+	}
+	srand(42);
+	for (int i = 0; i < 100000; i++) {
+		double x = (rand() - RAND_MAX/2) / 1000.0;		// near and on ties
+		double y = ldexp(rand(), rand() % 80 - 60);		// all kinds of exponents
+		check_fixed(x, i % (FORMAT_MAX_DECIMALS+1));
+		check_fixed(y, 2);
+	}
+}
+
+void test_vectors() {
+	PVector_ptr v = PVector_new((double[]){1, -2.5, 3.14159}, 3);
+	size_t n;
+	char *s = format_vector(v, &n);
+	assert_str_equal(s, "[1.00, -2.50, 3.14]");
+	assert_equal(n, strlen(s));
+	free(s);
+	s = format_vector_ints(v, &n);
+	assert_str_equal(s, "1-23");
+	free(s);
+
+	PVector_ptr empty = PVector_new(NULL, 0);
+	s = format_vector(empty, NULL);
+	assert_str_equal(s, "[]");
+	free(s);
+
+	int len = 100000; // quadratic formatting would take a while
+	double *data = malloc(len * sizeof(double));
+	for (int i = 0; i < len; i++) data[i] = i;
+	PVector_ptr big = PVector_new(data, (size_t)len);
+	s = format_vector(big, &n);
+	assert_equal(n, strlen(s));
+	assert_true(strncmp(s, "[0.00, 1.00, 2.00, ", 19)==0);
+	assert_str_equal(&s[n-9], "99999.00]");
+	free(s);
+	free(data);
+}
+
+int main(int argc, char *argv[]) {
+	cunit_setup = setup;
+	cunit_teardown = teardown;
+
+	test(test_ints);
+	test(test_fixed_rounds_like_printf);
+	test(test_vectors);
+
+	return 0;
+}
@@ -89,12 +89,42 @@ void test_strings() {
 	assert_equal(true, String_eq(s7,s8));
 }
 
+void test_vector_scalar_ops() {
+	double data[] = {1, 2, 3, 4};
+	PVector_ptr a = PVector_new(data, 4);
+	PVector_ptr b = PVector_copy(a);       // b's first element lives in a version list
+	set_ith(b, 0, 10);
+
+	PVector_ptr c = Vector_add_scalar(b, 2);
+	assert_equal(4, c.vector->length);
+	assert_float_equal(12.0, ith(c, 0));
+	assert_float_equal(4.0, ith(c, 1));
+	assert_float_equal(6.0, ith(c, 3));
+
+	c = Vector_sub_scalar(a, 1.5);
+	assert_float_equal(-0.5, ith(c, 0));
+	assert_float_equal(2.5, ith(c, 3));
+
+	c = Vector_mul_scalar(b, 3);
+	assert_float_equal(30.0, ith(c, 0));
+	assert_float_equal(9.0, ith(c, 2));
+
+	c = Vector_div_scalar(a, 2);
+	assert_float_equal(0.5, ith(c, 0));
+	assert_float_equal(2.0, ith(c, 3));
+
+	// kernels must not disturb their operand
+	assert_float_equal(1.0, ith(a, 0));
+	assert_float_equal(10.0, ith(b, 0));
+}
+
 
 int main(int argc, char *argv[]) {
 	cunit_setup = setup;
 	cunit_teardown = teardown;
 
 	test(test_strings);
+	test(test_vector_scalar_ops);
 
 	return 0;
 }
\ No newline at end of file